@@ -80,11 +80,15 @@ extern uint16_t srp_random16(void);
 static dso_state_t *dso_connections;
 static dso_state_t *dso_connections_needing_cleanup; // DSO connections that have been shut down but aren't yet freed.
 
+// Serial numbers are handed out sequentially, so the low bits spread the live connections evenly across buckets.
+#define DSO_SERIAL_BUCKETS 256
+static dso_state_t *dso_connections_by_serial[DSO_SERIAL_BUCKETS];
+
 dso_state_t *dso_find_by_serial(uint32_t serial)
 {
     dso_state_t *dsop;
 
-    for (dsop = dso_connections; dsop; dsop = dsop->next) {
+    for (dsop = dso_connections_by_serial[serial % DSO_SERIAL_BUCKETS]; dsop; dsop = dsop->serial_next) {
         if (dsop->serial == serial) {
             return dsop;
         }
@@ -92,6 +96,19 @@ dso_state_t *dso_find_by_serial(uint32_t serial)
     return NULL;
 }
 
+static void dso_serial_index_remove(dso_state_t *dso)
+{
+    dso_state_t **dsop = &dso_connections_by_serial[dso->serial % DSO_SERIAL_BUCKETS];
+
+    while (*dsop != NULL && *dsop != dso) {
+        dsop = &(*dsop)->serial_next;
+    }
+    if (*dsop != NULL) {
+        *dsop = dso->serial_next;
+    }
+    dso->serial_next = NULL;
+}
+
 // This function is called either when an error has occurred requiring the a DSO connection be
 // canceled, or else when a connection to a DSO endpoint has been cleanly closed and is ready to be
 // canceled for that reason.
@@ -114,6 +131,8 @@ void dso_state_cancel(dso_state_t *dso)
         }
     }
 
+    dso_serial_index_remove(dso);
+
     // When the dso_state_t is canceled, its context may also need to be canceled/released/freed, so we give context a
     // callback to do the cleaning work with dso_life_cycle_cancel state.
     if (dso->context_callback != NULL) {
@@ -124,6 +143,8 @@ void dso_state_cancel(dso_state_t *dso)
     dso_connections_needing_cleanup = dso;
 }
 
+static void dso_activity_index_free(dso_state_t *dso);
+
 int32_t dso_idle(void *context, int32_t now, int32_t next_timer_event)
 {
     dso_state_t *dso, *dnext;
@@ -139,6 +160,8 @@ int32_t dso_idle(void *context, int32_t now, int32_t next_timer_event)
             }
             mdns_free(ap);
         }
+        dso->activities = NULL;
+        dso_activity_index_free(dso);
         if (dso->transport != NULL && dso->transport_finalize != NULL) {
             dso->transport_finalize(dso->transport);
             dso->transport = NULL;
@@ -255,6 +278,8 @@ dso_state_t *dso_state_create(bool is_server, int max_outstanding_queries, const
 
     dso->next = dso_connections;
     dso_connections = dso;
+    dso->serial_next = dso_connections_by_serial[dso->serial % DSO_SERIAL_BUCKETS];
+    dso_connections_by_serial[dso->serial % DSO_SERIAL_BUCKETS] = dso;
 
     LogMsg("[DSO%u] New dso_state_t created - dso: %p, remote name: %s, context: %p",
            dso->serial, dso, remote_name, context);
@@ -389,6 +414,114 @@ void dso_finish_tlv(dso_message_t *state)
     state->building_tlv = false;
 }
 
+// Activities are indexed two ways, by (type, name) and by (type, context), so that the per-message lookups done
+// for each DNS Push SUBSCRIBE, UNSUBSCRIBE and RECONFIRM don't have to walk every subscription on the session.
+// The indexes are allocated with the first activity and freed with the last; if allocation fails, lookups fall
+// back to walking dso->activities. Both bucket chains keep the newest activity first, like dso->activities does.
+#define DSO_ACTIVITY_MIN_BUCKETS 16
+
+static uint32_t dso_activity_name_hash(const char *const activity_type, const char *const name)
+{
+    uint32_t hash = 2166136261u ^ (uint32_t)((uintptr_t)activity_type >> 4);
+    const uint8_t *p;
+
+    // FNV-1a
+    for (p = (const uint8_t *)name; *p != 0; p++) {
+        hash = (hash ^ *p) * 16777619u;
+    }
+    return hash;
+}
+
+static uint32_t dso_activity_context_hash(const char *const activity_type, const void *const context)
+{
+    const uintptr_t bits = (uintptr_t)context ^ ((uintptr_t)activity_type << 1);
+    return (uint32_t)((bits >> 4) ^ (bits >> 16)) * 2654435761u;
+}
+
+static void dso_activity_index_free(dso_state_t *dso)
+{
+    mdns_free(dso->activities_by_name);
+    mdns_free(dso->activities_by_context);
+    dso->activity_buckets = 0;
+    dso->num_activities = 0;
+}
+
+static void dso_activity_index_insert(dso_state_t *dso, dso_activity_t *activity)
+{
+    uint32_t bucket;
+
+    if (activity->name != NULL) {
+        bucket = dso_activity_name_hash(activity->activity_type, activity->name) % dso->activity_buckets;
+        activity->name_next = dso->activities_by_name[bucket];
+        dso->activities_by_name[bucket] = activity;
+    }
+    bucket = dso_activity_context_hash(activity->activity_type, activity->context) % dso->activity_buckets;
+    activity->context_next = dso->activities_by_context[bucket];
+    dso->activities_by_context[bucket] = activity;
+}
+
+// Rebuilds both indexes with the given number of buckets; leaves the index missing if memory is short.
+static void dso_activity_index_rebuild(dso_state_t *dso, uint32_t buckets)
+{
+    dso_activity_t **by_name = mDNSPlatformMemAllocateClear((uint32_t)(buckets * sizeof(*by_name)));
+    dso_activity_t **by_context = mDNSPlatformMemAllocateClear((uint32_t)(buckets * sizeof(*by_context)));
+    dso_activity_t *activity, *reversed = NULL;
+    const uint32_t num_activities = dso->num_activities;
+
+    dso_activity_index_free(dso);
+    dso->num_activities = num_activities;
+    if (by_name == NULL || by_context == NULL) {
+        mdns_free(by_name);
+        mdns_free(by_context);
+        return;
+    }
+    dso->activities_by_name = by_name;
+    dso->activities_by_context = by_context;
+    dso->activity_buckets = buckets;
+
+    // Insert oldest first so that the newest activity ends up at the front of each chain. The name_next links are
+    // borrowed to hold the reversed list; dso_activity_index_insert overwrites them as it goes.
+    for (activity = dso->activities; activity != NULL; activity = activity->next) {
+        activity->name_next = reversed;
+        reversed = activity;
+    }
+    while (reversed != NULL) {
+        activity = reversed;
+        reversed = activity->name_next;
+        activity->name_next = NULL;
+        dso_activity_index_insert(dso, activity);
+    }
+}
+
+// Returns false if the activity isn't in the indexes (and therefore isn't one of dso's activities).
+static bool dso_activity_index_remove(dso_state_t *dso, dso_activity_t *activity)
+{
+    dso_activity_t **app;
+
+    app = &dso->activities_by_context[dso_activity_context_hash(activity->activity_type, activity->context) %
+                                      dso->activity_buckets];
+    while (*app != NULL && *app != activity) {
+        app = &(*app)->context_next;
+    }
+    if (*app == NULL) {
+        return false;
+    }
+    *app = activity->context_next;
+
+    if (activity->name != NULL) {
+        app = &dso->activities_by_name[dso_activity_name_hash(activity->activity_type, activity->name) %
+                                       dso->activity_buckets];
+        while (*app != NULL && *app != activity) {
+            app = &(*app)->name_next;
+        }
+        if (*app != NULL) {
+            *app = activity->name_next;
+        }
+    }
+    activity->name_next = activity->context_next = NULL;
+    return true;
+}
+
 dso_activity_t *NULLABLE dso_find_activity(dso_state_t *const NONNULL dso, const char *const NULLABLE name,
                                   const char *const NONNULL activity_type, void *const NULLABLE context)
 {
@@ -402,6 +535,32 @@ dso_activity_t *NULLABLE dso_find_activity(dso_state_t *const NONNULL dso, const
         goto exit;
     }
 
+    if (dso->activity_buckets != 0) {
+        if (name != NULL) {
+            activity = dso->activities_by_name[dso_activity_name_hash(activity_type, name) % dso->activity_buckets];
+            for (; activity != NULL; activity = activity->name_next) {
+                if (activity->activity_type == activity_type && strcmp(name, activity->name) == 0) {
+                    break;
+                }
+            }
+            // If the name matches, the corresponding context should also match if the context is not NULL.
+            if (activity != NULL && context != NULL && activity->context != context) {
+                FAULT("[DSO%u] The activity specified by the name does not have the expected context - "
+                    "name: " PRI_S_SRP ", activity_type: " PUB_S_SRP ", context: %p.", dso->serial, name, activity_type,
+                    context);
+            }
+        } else {
+            activity = dso->activities_by_context[dso_activity_context_hash(activity_type, context) %
+                                                  dso->activity_buckets];
+            for (; activity != NULL; activity = activity->context_next) {
+                if (activity->activity_type == activity_type && activity->context == context) {
+                    break;
+                }
+            }
+        }
+        goto exit;
+    }
+
     for (activity = dso->activities; activity != NULL; activity = activity->next) {
         if (activity->activity_type != activity_type) {
             continue;
@@ -481,24 +640,75 @@ dso_activity_t *dso_add_activity(dso_state_t *dso, const char *name, const char
 
     // Retain this activity on the list.
     activity->next = dso->activities;
+    activity->prev = NULL;
+    if (dso->activities != NULL) {
+        dso->activities->prev = activity;
+    }
     dso->activities = activity;
+    dso->num_activities++;
+
+    // Keep the indexes at no more than two activities per bucket on average.
+    if (dso->activity_buckets == 0 || dso->num_activities > dso->activity_buckets * 2) {
+        dso_activity_index_rebuild(dso, dso->activity_buckets == 0 ? DSO_ACTIVITY_MIN_BUCKETS
+                                                                   : dso->activity_buckets * 2);
+    } else {
+        dso_activity_index_insert(dso, activity);
+    }
 
     return activity;
 }
 
+// Activities are indexed by context, so an activity that changes hands has to be moved to its new context's bucket
+// rather than having its context overwritten in place.
+void dso_set_activity_context(dso_state_t *dso, dso_activity_t *activity, void *context)
+{
+    INFO("[DSO%u] Changing the context of a DSO activity - activity name: " PRI_S_SRP ", activity type: " PUB_S_SRP
+        ", old context: %p, new context: %p.", dso->serial, activity->name, activity->activity_type,
+        activity->context, context);
+
+    if (dso->activity_buckets != 0) {
+        if (!dso_activity_index_remove(dso, activity)) {
+            FAULT("[DSO%u] Trying to change the context of an activity that is not in the list - "
+                "activity name: " PRI_S_SRP ", activity type: " PUB_S_SRP ", activity context: %p.",
+                dso->serial, activity->name, activity->activity_type, activity->context);
+            return;
+        }
+        activity->context = context;
+        dso_activity_index_insert(dso, activity);
+    } else {
+        activity->context = context;
+    }
+}
+
 void dso_drop_activity(dso_state_t *dso, dso_activity_t *activity)
 {
     dso_activity_t **app = &dso->activities;
     bool matched = false;
 
-    // Remove this activity from the list.
-    while (*app) {
-        if (*app == activity) {
-            *app = activity->next;
-            matched = true;
-            break;
-        } else {
-            app = &((*app)->next);
+    // Remove this activity from the list. The context index holds every activity, so when it's there it tells us
+    // whether the activity is on the list without walking it.
+    if (dso->activity_buckets != 0) {
+        matched = dso_activity_index_remove(dso, activity);
+        if (matched) {
+            *(activity->prev != NULL ? &activity->prev->next : app) = activity->next;
+        }
+    } else {
+        while (*app) {
+            if (*app == activity) {
+                *app = activity->next;
+                matched = true;
+                break;
+            } else {
+                app = &((*app)->next);
+            }
+        }
+    }
+    if (matched) {
+        if (activity->next != NULL) {
+            activity->next->prev = activity->prev;
+        }
+        if (--dso->num_activities == 0) {
+            dso_activity_index_free(dso);
         }
     }
 
@@ -143,6 +143,9 @@ typedef struct dso_message {
 typedef struct dso_activity dso_activity_t;
 struct dso_activity {
     dso_activity_t *next;
+    dso_activity_t *prev;       // Previous activity on dso->activities, so that dropping one doesn't walk the list
+    dso_activity_t *name_next;  // Next activity in the same dso->activities_by_name bucket
+    dso_activity_t *context_next; // Next activity in the same dso->activities_by_context bucket
     void (*finalize)(dso_activity_t *activity);
     const char *activity_type;  // Name of the activity type, must be the same pointer for all activities of a type.
     void *context;              // Activity implementation's context (if any).
@@ -175,6 +178,7 @@ typedef void (*dso_life_cycle_context_callback_t)(const dso_life_cycle_t life_cy
 // DNS Stateless Operations state
 struct dso_state {
     dso_state_t *next;
+    dso_state_t *serial_next;        // Next DSO state in the same bucket of the serial number index
     void *context;                   // The context of the next layer up (e.g., a Discovery Proxy)
     // The callback gets called when dso_state_t is created, canceled or freed.
     dso_life_cycle_context_callback_t context_callback;
@@ -195,6 +199,10 @@ struct dso_state {
     event_time_t keepalive_due;      // When the next keepalive is due (to be received or sent)
     event_time_t inactivity_due;     // When next activity has to happen for connection to remain active
     dso_activity_t *activities;      // Outstanding DSO activities.
+    dso_activity_t **activities_by_name;    // Activities indexed by (type, name); allocated while there are activities
+    dso_activity_t **activities_by_context; // Activities indexed by (type, context)
+    uint32_t activity_buckets;       // Number of buckets in each of the two activity indexes
+    uint32_t num_activities;
 
     dso_tlv_t primary;               // Primary TLV for current message
     dso_tlv_t additl[MAX_ADDITLS];   // Additional TLVs
@@ -225,6 +233,7 @@ void dso_finish_tlv(dso_message_t *state);
 dso_activity_t *dso_find_activity(dso_state_t *dso, const char *name, const char *activity_type, void *context);
 dso_activity_t *dso_add_activity(dso_state_t *dso, const char *name, const char *activity_type,
                                             void *context, void (*finalize)(dso_activity_t *));
+void dso_set_activity_context(dso_state_t *dso, dso_activity_t *activity, void *context);
 void dso_drop_activity(dso_state_t *dso, dso_activity_t *activity);
 void dso_ignore_response(dso_state_t *dso, void *context);
 bool dso_make_message(dso_message_t *state, uint8_t *outbuf, size_t outbuf_size, dso_state_t *dso,
@@ -168,8 +168,10 @@ struct dns_edns0 {
     uint8_t data[0];
 };
 
+typedef struct dns_arena_block dns_arena_block_t;
 typedef struct dns_message dns_message_t;
 struct dns_message {
+    dns_arena_block_t *NULLABLE arena; // Holds the message and everything it points to; see fromwire.c
     int ref_count;
     unsigned qdcount, ancount, nscount, arcount;
     dns_rr_t *NULLABLE questions;
@@ -456,6 +458,7 @@ bool dns_rr_parse_(dns_rr_t *NONNULL rrset, const uint8_t *NONNULL buf, unsigned
 void dns_name_free(dns_label_t *NONNULL name);
 void dns_rrdata_free(dns_rr_t *NONNULL rr);
 void dns_message_free(dns_message_t *NONNULL message);
+dns_name_t *NULLABLE dns_message_name_copy(dns_message_t *NONNULL message, dns_name_t *NONNULL original);
 #define dns_wire_parse(ret, message, len, dump_to_stderr) \
     dns_wire_parse_(ret, message, len, dump_to_stderr, __FILE__, __LINE__)
 bool dns_wire_parse_(dns_message_t *NONNULL *NULLABLE ret, dns_wire_t *NONNULL message, unsigned len,
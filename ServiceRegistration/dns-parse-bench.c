@@ -0,0 +1,255 @@
+/* dns-parse-bench.c
+ *
+ * Copyright (c) 2021 Apple Inc. All rights reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ * Measures dns_wire_parse() and dns_message_free() on SRP updates. The updates are laid out the way srp-client
+ * generates them: the zone, a host description with A, AAAA and KEY records, one to five service instances with
+ * PTR, SRV and TXT records, an EDNS0 update lease and a SIG(0). The KEY and signature bytes are filler, since
+ * the parser doesn't validate them, so no signing key is needed.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+
+#include "srp.h"
+#include "dns-msg.h"
+
+#define INCREMENT(x) (x) = htons(ntohs(x) + 1)
+
+static double
+now_microseconds(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (double)ts.tv_sec * 1e6 + (double)ts.tv_nsec / 1e3;
+}
+
+// Adds an RR whose name is a pointer to a name already in the message, and which has raw rdata.
+static void
+bench_raw_rr_to_wire(dns_towire_state_t *towire, dns_name_pointer_t *name, uint16_t rrtype,
+                     const void *data, size_t length)
+{
+    dns_pointer_to_wire(NULL, towire, name);
+    dns_u16_to_wire(towire, rrtype);
+    dns_u16_to_wire(towire, dns_qclass_in);
+    dns_ttl_to_wire(towire, 3600);
+    dns_rdlength_begin(towire);
+    dns_rdata_raw_data_to_wire(towire, data, length);
+    dns_rdlength_end(towire);
+    INCREMENT(towire->message->nscount);
+}
+
+// Returns the length of the update, or 0 if it didn't fit.
+static unsigned
+bench_generate_update(dns_wire_t *message, int index)
+{
+    static const char *service_types[] = { "_ipp._tcp", "_hap._udp", "_matter._tcp", "_airplay._tcp", "_raop._tcp" };
+    dns_towire_state_t towire;
+    dns_name_pointer_t p_zone_name, p_host_name, p_service_name, p_service_instance_name;
+    uint8_t key[68], signature[64], address[16];
+    char hostname[32], instance[DNS_MAX_LABEL_SIZE];
+    int num_services = 1 + index % 5, i;
+
+    memset(&towire, 0, sizeof(towire));
+    memset(message, 0, sizeof(*message));
+    towire.p = &message->data[0];
+    towire.lim = &message->data[DNS_DATA_SIZE];
+    towire.message = message;
+    message->id = htons((uint16_t)index);
+    dns_qr_set(message, dns_qr_query);
+    dns_opcode_set(message, dns_opcode_update);
+
+    dns_full_name_to_wire(&p_zone_name, &towire, "default.service.arpa");
+    dns_u16_to_wire(&towire, dns_rrtype_soa);
+    dns_u16_to_wire(&towire, dns_qclass_in);
+    INCREMENT(message->qdcount);
+
+    // Host description
+    snprintf(hostname, sizeof(hostname), "accessory-%04x%04x", rand() & 0xffff, rand() & 0xffff);
+    dns_name_to_wire(&p_host_name, &towire, hostname);
+    dns_pointer_to_wire(&p_host_name, &towire, &p_zone_name);
+    dns_u16_to_wire(&towire, dns_rrtype_any);
+    dns_u16_to_wire(&towire, dns_qclass_any);
+    dns_ttl_to_wire(&towire, 0);
+    dns_u16_to_wire(&towire, 0);
+    INCREMENT(message->nscount);
+    for (i = 0; i < (int)sizeof(address); i++) {
+        address[i] = (uint8_t)rand();
+    }
+    bench_raw_rr_to_wire(&towire, &p_host_name, dns_rrtype_a, address, 4);
+    bench_raw_rr_to_wire(&towire, &p_host_name, dns_rrtype_aaaa, address, 16);
+    key[0] = 0x02; key[1] = 0x01; key[2] = 3; key[3] = 13; // flags, protocol, ECDSAP256SHA256
+    for (i = 4; i < (int)sizeof(key); i++) {
+        key[i] = (uint8_t)rand();
+    }
+    bench_raw_rr_to_wire(&towire, &p_host_name, dns_rrtype_key, key, sizeof(key));
+
+    // Service instances
+    for (i = 0; i < num_services; i++) {
+        dns_name_to_wire(&p_service_name, &towire, service_types[(index + i) % 5]);
+        dns_pointer_to_wire(&p_service_name, &towire, &p_zone_name);
+        dns_u16_to_wire(&towire, dns_rrtype_ptr);
+        dns_u16_to_wire(&towire, dns_qclass_in);
+        dns_ttl_to_wire(&towire, 3600);
+        dns_rdlength_begin(&towire);
+        snprintf(instance, sizeof(instance), "Accessory %d on %s", i, hostname);
+        dns_name_to_wire(&p_service_instance_name, &towire, instance);
+        dns_pointer_to_wire(&p_service_instance_name, &towire, &p_service_name);
+        dns_rdlength_end(&towire);
+        INCREMENT(message->nscount);
+
+        dns_pointer_to_wire(NULL, &towire, &p_service_instance_name);
+        dns_u16_to_wire(&towire, dns_rrtype_any);
+        dns_u16_to_wire(&towire, dns_qclass_any);
+        dns_ttl_to_wire(&towire, 0);
+        dns_u16_to_wire(&towire, 0);
+        INCREMENT(message->nscount);
+
+        dns_pointer_to_wire(NULL, &towire, &p_service_instance_name);
+        dns_u16_to_wire(&towire, dns_rrtype_srv);
+        dns_u16_to_wire(&towire, dns_qclass_in);
+        dns_ttl_to_wire(&towire, 3600);
+        dns_rdlength_begin(&towire);
+        dns_u16_to_wire(&towire, 0);
+        dns_u16_to_wire(&towire, 0);
+        dns_u16_to_wire(&towire, (uint16_t)(5000 + i));
+        dns_pointer_to_wire(NULL, &towire, &p_host_name);
+        dns_rdlength_end(&towire);
+        INCREMENT(message->nscount);
+
+        dns_pointer_to_wire(NULL, &towire, &p_service_instance_name);
+        dns_u16_to_wire(&towire, dns_rrtype_txt);
+        dns_u16_to_wire(&towire, dns_qclass_in);
+        dns_ttl_to_wire(&towire, 3600);
+        dns_rdlength_begin(&towire);
+        dns_rdata_txt_to_wire(&towire, "txtvers=1");
+        dns_rdata_txt_to_wire(&towire, "sf=1");
+        dns_rdata_txt_to_wire(&towire, "id=8C:29:37:2A:11:6E");
+        dns_rdlength_end(&towire);
+        INCREMENT(message->nscount);
+    }
+
+    dns_edns0_header_to_wire(&towire, DNS_MAX_UDP_PAYLOAD, 0, 0, 1);
+    dns_rdlength_begin(&towire);
+    dns_u16_to_wire(&towire, dns_opt_update_lease);
+    dns_edns0_option_begin(&towire);
+    dns_u32_to_wire(&towire, 7200);
+    dns_u32_to_wire(&towire, 604800);
+    dns_edns0_option_end(&towire);
+    dns_rdlength_end(&towire);
+    INCREMENT(message->arcount);
+
+    // SIG(0), laid out as dns_sig0_signature_to_wire() does it.
+    dns_u8_to_wire(&towire, 0); // root label
+    dns_u16_to_wire(&towire, dns_rrtype_sig);
+    dns_u16_to_wire(&towire, dns_qclass_any);
+    dns_ttl_to_wire(&towire, 0);
+    dns_rdlength_begin(&towire);
+    dns_u16_to_wire(&towire, 0);  // type covered
+    dns_u8_to_wire(&towire, 13);  // algorithm
+    dns_u8_to_wire(&towire, 0);   // labels
+    dns_ttl_to_wire(&towire, 0);  // original TTL
+    dns_u32_to_wire(&towire, (uint32_t)time(NULL) + 300);
+    dns_u32_to_wire(&towire, (uint32_t)time(NULL) - 300);
+    dns_u16_to_wire(&towire, (uint16_t)rand());
+    dns_pointer_to_wire(NULL, &towire, &p_host_name);
+    for (i = 0; i < (int)sizeof(signature); i++) {
+        signature[i] = (uint8_t)rand();
+    }
+    dns_rdata_raw_data_to_wire(&towire, signature, sizeof(signature));
+    dns_rdlength_end(&towire);
+    INCREMENT(message->arcount);
+
+    if (towire.error) {
+        return 0;
+    }
+    return (unsigned)(towire.p - (uint8_t *)message);
+}
+
+int
+main(int argc, char **argv)
+{
+    dns_wire_t *messages;
+    unsigned *lengths;
+    int count = 70, iterations = 1000, i, j, opt;
+    double total_length = 0, start, elapsed;
+
+    while ((opt = getopt(argc, argv, "n:i:")) != -1) {
+        switch (opt) {
+        case 'n':
+            count = atoi(optarg);
+            break;
+        case 'i':
+            iterations = atoi(optarg);
+            break;
+        default:
+            fprintf(stderr, "Usage: %s [-n updates] [-i iterations]\n", argv[0]);
+            return 2;
+        }
+    }
+    if (count <= 0 || iterations <= 0) {
+        fprintf(stderr, "Usage: %s [-n updates] [-i iterations]\n", argv[0]);
+        return 2;
+    }
+
+    messages = calloc((size_t)count, sizeof(*messages));
+    lengths = calloc((size_t)count, sizeof(*lengths));
+    if (messages == NULL || lengths == NULL) {
+        fprintf(stderr, "%s: out of memory\n", argv[0]);
+        return 1;
+    }
+    srand(1);
+    for (i = 0; i < count; i++) {
+        lengths[i] = bench_generate_update(&messages[i], i);
+        if (lengths[i] == 0) {
+            fprintf(stderr, "%s: update %d doesn't fit in a message\n", argv[0], i);
+            return 1;
+        }
+        total_length += lengths[i];
+    }
+
+    start = now_microseconds();
+    for (j = 0; j < iterations; j++) {
+        for (i = 0; i < count; i++) {
+            dns_message_t *parsed;
+            if (!dns_wire_parse(&parsed, &messages[i], lengths[i], false)) {
+                fprintf(stderr, "%s: update %d didn't parse\n", argv[0], i);
+                return 1;
+            }
+            dns_message_free(parsed);
+        }
+    }
+    elapsed = now_microseconds() - start;
+
+    printf("%d updates, %.0f bytes on average: %.2f us per parse and free\n", count, total_length / count,
+           elapsed / ((double)count * iterations));
+    free(messages);
+    free(lengths);
+    return 0;
+}
+
+// Local Variables:
+// mode: C
+// tab-width: 4
+// c-file-style: "bsd"
+// c-basic-offset: 4
+// fill-column: 108
+// indent-tabs-mode: nil
+// End:
@@ -147,6 +147,9 @@ struct served_domain {
 // idle state.
 
 typedef struct dnssd_query dnssd_query_t;
+typedef struct dp_cache_answer dp_cache_answer_t;
+typedef struct dp_cache_entry dp_cache_entry_t;
+typedef struct dp_push_subscription dp_push_subscription_t;
 typedef struct dp_tracker {
     int ref_count;
     comm_t *connection;
@@ -178,6 +181,46 @@ struct dnssd_query {
     dns_wire_t *response;
     size_t data_size;               // Size of the data payload of the response.
     int interface_index;            // Which interface the query should use.
+    dp_cache_entry_t *cache_entry;  // If this query is waiting on the answer cache, the cache entry it's waiting on.
+    dnssd_query_t *cache_next;      // Other queries waiting on the same cache entry.
+    dp_push_subscription_t *subscription; // For a DNS Push subscription, the shared question it subscribes to.
+    dnssd_query_t *push_next;       // Other subscribers to the same shared question.
+};
+
+// Answers to DNS queries are cached by (name, type, class, served domain). Each cache entry keeps a single long-lived
+// DNSServiceQueryRecord running on behalf of all the queries that use it, so its answers follow what mDNSResponder
+// sees, and a repeat query can be answered from memory instead of waiting on a fresh mDNS query.
+struct dp_cache_answer {
+    dp_cache_answer_t *next;
+    uint32_t ttl;                   // The TTL mDNSResponder last gave for the answer.
+    uint16_t rrtype, rrclass;
+    uint16_t rdlen;
+    uint8_t rdata[];
+};
+
+struct dp_cache_entry {
+    dp_cache_entry_t *next;         // Next entry in the same hash bucket.
+    char *name;                     // The name we are looking up, as in dnssd_query_t.
+    served_domain_t *served_domain; // The served domain in which we are looking it up, if any.
+    uint16_t type, qclass;
+    uint32_t hash;
+    dnssd_txn_t *txn;               // The shared query that keeps the answers up to date.
+    wakeup_t *idle_wakeup;          // Drops the entry once nobody has used it for a while.
+    int64_t last_used;
+    dp_cache_answer_t *answers;
+    dnssd_query_t *waiting;         // Queries that arrived before we had a complete set of answers.
+    bool complete;                  // True once we have had a complete set of answers.
+};
+
+// DNS Push subscriptions to the same (name, type, class, served domain) share a single query to mDNSResponder. Each
+// change is encoded once, in the subscription's own dnssd_query_t, and the same message is sent to every subscriber.
+struct dp_push_subscription {
+    dp_push_subscription_t *next;   // Next subscription in the same hash bucket.
+    uint32_t hash;
+    bool indexed;                   // True while new subscribers can find the subscription in the index.
+    dnssd_query_t *shared;          // Holds the question and the query to mDNSResponder, and encodes updates.
+    dnssd_query_t *subscribers;     // The subscribers' queries, one per DSO activity, linked through push_next.
+    dp_cache_answer_t *answers;     // The answers so far, for catching up new subscribers.
 };
 
 // Structure that is used to setup the mDNS discovery for dnssd-proxy.
@@ -259,6 +302,12 @@ bool tls_fail = false; // Command line argument, for testing.
 
 // Forward references
 
+static void
+dp_cache_query_detach(dnssd_query_t *const NONNULL query);
+
+static void
+dp_push_subscription_detach(dnssd_query_t *const NONNULL query);
+
 static served_domain_t *NULLABLE
 new_served_domain(interface_t *const NULLABLE interface, const char * NONNULL domain);
 
@@ -321,6 +370,12 @@ dnssd_query_finalize(void *context)
         ioloop_dnssd_txn_release(query->txn);
         query->txn = NULL;
     }
+    if (query->cache_entry != NULL) {
+        dp_cache_query_detach(query);
+    }
+    if (query->subscription != NULL) {
+        dp_push_subscription_detach(query);
+    }
     if (query->question != NULL) {
         ioloop_message_release(query->question);
     }
@@ -390,6 +445,12 @@ dnssd_query_cancel(dnssd_query_t *query)
         ioloop_dnssd_txn_release(query->txn);
         query->txn = NULL;
     }
+    if (query->cache_entry != NULL) {
+        dp_cache_query_detach(query);
+    }
+    if (query->subscription != NULL) {
+        dp_push_subscription_detach(query);
+    }
     if (query->wakeup != NULL) {
         ioloop_wakeup_release(query->wakeup);
         query->wakeup = NULL;
@@ -1869,6 +1930,8 @@ dns_query_callback(DNSServiceRef UNUSED sdRef, DNSServiceFlags flags, uint32_t U
                     query->towire.error = false;
                     goto re_add;
                 } else {
+                    // Otherwise dp_query_send_dns_response would send this as a truncated NOERROR response.
+                    query->towire.truncated = false;
                     dns_rcode_set(query->response, dns_rcode_servfail);
                     dp_query_send_dns_response(query);
                     return;
@@ -1910,6 +1973,354 @@ dns_query_callback(DNSServiceRef UNUSED sdRef, DNSServiceFlags flags, uint32_t U
     }
 }
 
+static void
+dp_query_wakeup(void *context);
+
+#define DP_CACHE_HASH_SIZE    256
+#define DP_CACHE_MAX_ENTRIES  512                    // Once we have this many entries, new names bypass the cache.
+#define DP_CACHE_IDLE_TIME    (IOLOOP_SECOND * 60)   // An entry that nobody has used for this long is dropped.
+
+static dp_cache_entry_t *dp_cache[DP_CACHE_HASH_SIZE];
+static int dp_cache_num_entries;
+static unsigned long dp_cache_hits, dp_cache_misses;
+
+// Names are compared case-insensitively, so the hash is too.
+static uint32_t
+dp_question_hash(const char *name, const served_domain_t *served_domain, uint16_t type, uint16_t qclass)
+{
+    uint32_t hash = (uint32_t)(uintptr_t)served_domain;
+    for (const char *s = name; *s != '\0'; s++) {
+        hash = hash * 31 + (uint8_t)(isascii(*s) ? tolower(*s) : *s);
+    }
+    return (hash * 31 + type) * 31 + qclass;
+}
+
+static dp_cache_entry_t *
+dp_cache_find(dnssd_query_t *query, uint32_t hash)
+{
+    dp_cache_entry_t *entry;
+
+    for (entry = dp_cache[hash % DP_CACHE_HASH_SIZE]; entry != NULL; entry = entry->next) {
+        if (entry->hash == hash && entry->type == query->type && entry->qclass == query->qclass &&
+            entry->served_domain == query->served_domain && !strcasecmp(entry->name, query->name))
+        {
+            return entry;
+        }
+    }
+    return NULL;
+}
+
+// Add, refresh or remove an answer in a list of answers to the named question, as told by a
+// DNSServiceQueryRecord callback. A remove with no rdata removes the whole RRset. Returns false if we couldn't
+// remember an answer we were given.
+static bool
+dp_cache_answer_update(dp_cache_answer_t **answers, const char *name, DNSServiceFlags flags, uint16_t rrtype,
+                       uint16_t rrclass, uint16_t rdlen, const void *rdata, uint32_t ttl)
+{
+    dp_cache_answer_t **ap, *answer;
+
+    if (!(flags & kDNSServiceFlagsAdd) && rdlen == 0) {
+        for (ap = answers; *ap != NULL; ) {
+            answer = *ap;
+            if (answer->rrtype == rrtype && answer->rrclass == rrclass) {
+                *ap = answer->next;
+                free(answer);
+            } else {
+                ap = &answer->next;
+            }
+        }
+        return true;
+    }
+    for (ap = answers; *ap != NULL; ap = &(*ap)->next) {
+        answer = *ap;
+        if (answer->rrtype == rrtype && answer->rrclass == rrclass && answer->rdlen == rdlen &&
+            (rdlen == 0 || !memcmp(answer->rdata, rdata, rdlen)))
+        {
+            break;
+        }
+    }
+    if (!(flags & kDNSServiceFlagsAdd)) {
+        if (*ap != NULL) {
+            answer = *ap;
+            *ap = answer->next;
+            free(answer);
+        }
+        return true;
+    }
+    if (*ap == NULL) {
+        answer = calloc(1, (sizeof *answer) + rdlen);
+        if (answer == NULL) {
+            ERROR("no memory to remember answer for " PRI_S_SRP, name);
+            return false;
+        }
+        answer->rrtype = rrtype;
+        answer->rrclass = rrclass;
+        answer->rdlen = rdlen;
+        if (rdlen != 0) {
+            memcpy(answer->rdata, rdata, rdlen);
+        }
+        *ap = answer;
+    } else {
+        answer = *ap;
+    }
+    answer->ttl = ttl;
+    return true;
+}
+
+// Answer the query with the answers the entry has, and send the response. An answer stays in the entry until
+// mDNSResponder removes it: when mDNSResponder refreshes a record it only resets the record's TTL, without telling
+// us, so the TTL from the add can't be used to decide when the answer has gone stale.
+static void
+dp_cache_respond(dp_cache_entry_t *entry, dnssd_query_t *query)
+{
+    dp_cache_answer_t *answer;
+    bool record_added;
+
+    VALIDATE_TRACKER_CONNECTION_NON_NULL();
+
+    for (answer = entry->answers; answer != NULL; answer = answer->next) {
+    re_add:
+        record_added = dp_query_add_data_to_response(query, query->name, answer->rrtype, answer->rrclass,
+                                                     answer->rdlen, answer->rdata,
+                                                     answer->ttl > 10 ? 10 : (int32_t)answer->ttl,
+                                                     true); // dnssd-hybrid 5.5.1
+        if (query->towire.truncated) {
+            if (query->tracker->connection->tcp_stream) {
+                if (embiggen(query)) {
+                    query->towire.truncated = false;
+                    query->towire.error = false;
+                    goto re_add;
+                }
+                // TCP responses can't be truncated, so if there's no room for the rest of the answers, fail.
+                query->towire.truncated = false;
+                dns_rcode_set(query->response, dns_rcode_servfail);
+            }
+            break;
+        }
+        query->response->ancount = htons(ntohs(query->response->ancount) + (record_added ? 1 : 0));
+    }
+    dp_query_send_dns_response(query);
+}
+
+static void
+dp_cache_answer_waiting(dp_cache_entry_t *entry)
+{
+    dnssd_query_t *query;
+
+    while ((query = entry->waiting) != NULL) {
+        entry->waiting = query->cache_next;
+        query->cache_next = NULL;
+        query->cache_entry = NULL;
+        dp_cache_respond(entry, query);
+    }
+}
+
+static void
+dp_cache_query_detach(dnssd_query_t *const NONNULL query)
+{
+    dnssd_query_t **qp;
+
+    for (qp = &query->cache_entry->waiting; *qp != NULL; qp = &(*qp)->cache_next) {
+        if (*qp == query) {
+            *qp = query->cache_next;
+            break;
+        }
+    }
+    query->cache_next = NULL;
+    query->cache_entry = NULL;
+}
+
+// Take the entry out of the cache, answer anything still waiting on it with what we have, and free it.
+static void
+dp_cache_entry_remove(dp_cache_entry_t *entry)
+{
+    dp_cache_entry_t **ep;
+    dp_cache_answer_t *answer;
+
+    for (ep = &dp_cache[entry->hash % DP_CACHE_HASH_SIZE]; *ep != NULL; ep = &(*ep)->next) {
+        if (*ep == entry) {
+            *ep = entry->next;
+            dp_cache_num_entries--;
+            break;
+        }
+    }
+    if (entry->txn != NULL) {
+        ioloop_dnssd_txn_cancel(entry->txn);
+        ioloop_dnssd_txn_release(entry->txn);
+        entry->txn = NULL;
+    }
+    dp_cache_answer_waiting(entry);
+    if (entry->idle_wakeup != NULL) {
+        ioloop_wakeup_release(entry->idle_wakeup);
+    }
+    while ((answer = entry->answers) != NULL) {
+        entry->answers = answer->next;
+        free(answer);
+    }
+    free(entry->name);
+    free(entry);
+}
+
+static void
+dp_cache_entry_idle(void *context)
+{
+    dp_cache_entry_t *entry = context;
+    int64_t idle = ioloop_timenow() - entry->last_used;
+
+    if (idle < DP_CACHE_IDLE_TIME) {
+        ioloop_add_wake_event(entry->idle_wakeup, entry, dp_cache_entry_idle, NULL,
+                              (int32_t)(DP_CACHE_IDLE_TIME - idle));
+        return;
+    }
+    INFO("dropping idle cache entry for " PRI_S_SRP " type %d class %d", entry->name, entry->type, entry->qclass);
+    dp_cache_entry_remove(entry);
+}
+
+#if SRP_FEATURE_DYNAMIC_CONFIGURATION
+// Drop every entry that refers to the served domain, which is about to go away.
+static void
+dp_cache_flush_served_domain(served_domain_t *served_domain)
+{
+    dp_cache_entry_t *entry, *next;
+
+    for (int i = 0; i < DP_CACHE_HASH_SIZE; i++) {
+        for (entry = dp_cache[i]; entry != NULL; entry = next) {
+            next = entry->next;
+            if (entry->served_domain == served_domain) {
+                dp_cache_entry_remove(entry);
+            }
+        }
+    }
+}
+#endif // SRP_FEATURE_DYNAMIC_CONFIGURATION
+
+// This is the callback for the shared query that keeps a cache entry up to date.
+static void
+dp_cache_query_callback(DNSServiceRef UNUSED sdRef, DNSServiceFlags flags, uint32_t UNUSED interfaceIndex,
+                        DNSServiceErrorType errorCode, const char *fullname, uint16_t rrtype, uint16_t rrclass,
+                        uint16_t rdlen, const void *rdata, uint32_t ttl, void *context)
+{
+    dp_cache_entry_t *entry = context;
+
+    INFO("CACHE " PRI_S_SRP " %d %d %x %d", fullname, rrtype, rrclass, rdlen, errorCode);
+
+    if (errorCode == kDNSServiceErr_NoError) {
+        if (!dp_cache_answer_update(&entry->answers, entry->name, flags, rrtype, rrclass, rdlen, rdata, ttl)) {
+            dp_cache_entry_remove(entry);
+            return;
+        }
+        // When we get a CNAME response, we may not get the record it points to with the MoreComing
+        // flag set, so don't treat the answers as complete yet.
+        if ((flags & kDNSServiceFlagsMoreComing) || (entry->type != dns_rrtype_cname && rrtype == dns_rrtype_cname)) {
+            return;
+        }
+    } else if (errorCode == kDNSServiceErr_NoSuchRecord) {
+        // There's nothing to remember about a negative answer, except that the answers we have are all there is.
+        if (flags & kDNSServiceFlagsMoreComing) {
+            return;
+        }
+    } else {
+        ERROR("unexpected error code %d for " PRI_S_SRP, errorCode, entry->name);
+        dp_cache_entry_remove(entry);
+        return;
+    }
+    entry->complete = true;
+    dp_cache_answer_waiting(entry);
+}
+
+static void
+dp_cache_close_callback(void *context, int status)
+{
+    dp_cache_entry_t *entry = context;
+
+    ERROR("DNSServiceProcessResult on cached " PRI_S_SRP " returned %d", entry->name, status);
+    dp_cache_entry_remove(entry);
+}
+
+// Answer the query from the cache, or, if we don't have a complete set of answers yet, make it wait for one. np is
+// the name to ask mDNSResponder about. Returns false if the cache can't be used for this query; otherwise *rcode
+// says whether it worked. Either way, a true return means the query may already have been answered and released.
+static bool
+dp_cache_query_start(dnssd_query_t *query, const char *np, bool local, int *rcode)
+{
+    uint32_t hash = dp_question_hash(query->name, query->served_domain, query->type, query->qclass);
+    dp_cache_entry_t *entry = dp_cache_find(query, hash);
+    DNSServiceRef sdref;
+
+    if (entry == NULL) {
+        if (dp_cache_num_entries >= DP_CACHE_MAX_ENTRIES) {
+            INFO("cache is full, not caching " PRI_S_SRP, np);
+            return false;
+        }
+        entry = calloc(1, sizeof *entry);
+        if (entry == NULL) {
+            ERROR("no memory for cache entry for " PRI_S_SRP, np);
+            return false;
+        }
+        entry->name = strdup(query->name);
+        entry->idle_wakeup = ioloop_wakeup_create();
+        if (entry->name == NULL || entry->idle_wakeup == NULL) {
+            ERROR("no memory for cache entry for " PRI_S_SRP, np);
+            goto fail;
+        }
+        entry->served_domain = query->served_domain;
+        entry->type = query->type;
+        entry->qclass = query->qclass;
+        entry->hash = hash;
+
+        int err = DNSServiceQueryRecord(&sdref, query->serviceFlags, query->interface_index, np, query->type,
+                                        query->qclass, dp_cache_query_callback, entry);
+        if (err != kDNSServiceErr_NoError) {
+            ERROR("DNSServiceQueryRecord failed for '" PRI_S_SRP "': %d", np, err);
+            goto fail;
+        }
+        entry->txn = ioloop_dnssd_txn_add(sdref, entry, NULL, dp_cache_close_callback);
+        if (entry->txn == NULL) {
+            goto fail;
+        }
+        INFO("shared DNSServiceQueryRecord started for '" PRI_S_SRP "'", np);
+
+        entry->next = dp_cache[hash % DP_CACHE_HASH_SIZE];
+        dp_cache[hash % DP_CACHE_HASH_SIZE] = entry;
+        dp_cache_num_entries++;
+        ioloop_add_wake_event(entry->idle_wakeup, entry, dp_cache_entry_idle, NULL, DP_CACHE_IDLE_TIME);
+    }
+    entry->last_used = ioloop_timenow();
+    *rcode = dns_rcode_noerror;
+
+    if (entry->complete) {
+        dp_cache_hits++;
+        INFO("cache hit for " PRI_S_SRP " (%lu hits, %lu misses)", np, dp_cache_hits, dp_cache_misses);
+        dp_cache_respond(entry, query);
+        return true;
+    }
+    dp_cache_misses++;
+
+    // As in dp_query_start, don't wait more than six seconds for a local answer.
+    if (local) {
+        if (query->wakeup == NULL) {
+            query->wakeup = ioloop_wakeup_create();
+            if (query->wakeup == NULL) {
+                *rcode = dns_rcode_servfail;
+                return true;
+            }
+        }
+        ioloop_add_wake_event(query->wakeup, query, dp_query_wakeup, NULL, IOLOOP_SECOND * 6);
+    }
+    query->cache_entry = entry;
+    query->cache_next = entry->waiting;
+    entry->waiting = query;
+    return true;
+
+fail:
+    if (entry->idle_wakeup != NULL) {
+        ioloop_wakeup_release(entry->idle_wakeup);
+    }
+    free(entry->name);
+    free(entry);
+    return false;
+}
+
 static void
 dp_query_wakeup(void *context)
 {
@@ -1917,6 +2328,15 @@ dp_query_wakeup(void *context)
     char name[DNS_MAX_NAME_SIZE + 1];
     size_t namelen = strlen(query->name);
 
+    // A query waiting on the cache has waited long enough: whatever the cache has is as complete as it will get,
+    // so answer this query and any others waiting on the same entry.
+    if (query->cache_entry != NULL) {
+        dp_cache_entry_t *entry = query->cache_entry;
+        entry->complete = true;
+        dp_cache_answer_waiting(entry);
+        return;
+    }
+
     // Should never happen.
     if (namelen + (query->served_domain
                    ? (query->served_domain->interface != NULL
@@ -1935,45 +2355,56 @@ dp_query_wakeup(void *context)
     dp_query_send_dns_response(query);
 }
 
+// Work out the name to ask mDNSResponder about. If a query has a served domain, query->name is the subdomain of the
+// served domain that is being queried, so the name is built in buf; otherwise query->name is the whole name.
+// Returns NULL if the name doesn't fit.
+static const char *
+dp_query_mdns_name(dnssd_query_t *query, char *buf, size_t bufsize)
+{
+    size_t len;
+
+    if (query->served_domain == NULL) {
+        return query->name;
+    }
+    len = strlen(query->name);
+    if (query->served_domain->interface != NULL) {
+        if (len + sizeof local_suffix > bufsize) {
+            ERROR("question name %s is too long for .local.", query->name);
+            return NULL;
+        }
+        memcpy(buf, query->name, len);
+        memcpy(&buf[len], local_suffix, sizeof local_suffix);
+    } else {
+        size_t dlen = strlen(query->served_domain->domain_ld) + 1;
+        if (len + dlen > bufsize) {
+            ERROR("question name %s is too long for %s.", query->name, query->served_domain->domain);
+            return NULL;
+        }
+        memcpy(buf, query->name, len);
+        memcpy(&buf[len], query->served_domain->domain_ld, dlen);
+    }
+    return buf;
+}
+
 static bool
 dp_query_start(dnssd_query_t *query, int *rcode, bool dns64, DNSServiceQueryRecordReply callback)
 {
     char name[DNS_MAX_NAME_SIZE + 1];
-    char *np;
+    const char *np;
     bool local = false;
-    size_t len;
     DNSServiceRef sdref;
 
-    // If a query has a served domain, query->name is the subdomain of the served domain that is
-    // being queried; otherwise query->name is the whole name.
     if (query->served_domain != NULL) {
         if (dnssd_hardwired_response(query, callback)) {
             *rcode = dns_rcode_noerror;
             return true;
         }
-        len = strlen(query->name);
-        if (query->served_domain->interface != NULL) {
-            if (len + sizeof local_suffix > sizeof name) {
-                *rcode = dns_rcode_servfail;
-                ERROR("question name %s is too long for .local.", name);
-                return false;
-            }
-            memcpy(name, query->name, len);
-            memcpy(&name[len], local_suffix, sizeof local_suffix);
-        } else {
-            size_t dlen = strlen(query->served_domain->domain_ld) + 1;
-            if (len + dlen > sizeof name) {
-                *rcode = dns_rcode_servfail;
-                ERROR("question name %s is too long for %s.", name, query->served_domain->domain);
-                return false;
-            }
-            memcpy(name, query->name, len);
-            memcpy(&name[len], query->served_domain->domain_ld, dlen);
-        }
-        np = name;
         local = true;
-    } else {
-        np = query->name;
+    }
+    np = dp_query_mdns_name(query, name, sizeof name);
+    if (np == NULL) {
+        *rcode = dns_rcode_servfail;
+        return false;
     }
 
     // If we get an SOA query for record that's under a zone cut we're authoritative for, which
@@ -1987,6 +2418,19 @@ dp_query_start(dnssd_query_t *query, int *rcode, bool dns64, DNSServiceQueryReco
         return true;
     }
 
+    // Answer regular DNS queries from the cache when we can. Push subscriptions need every change as it happens,
+    // and NAT64 synthesis depends on how the answers arrive, so those still get a query of their own.
+    if (query->dso == NULL && !dns64
+#if SRP_FEATURE_NAT64
+        && !srp_nat64_enabled
+#endif
+        ) {
+        if (dp_cache_query_start(query, np, local, rcode)) {
+            // The query may already have been answered and released, so we can't touch it here.
+            return *rcode == dns_rcode_noerror;
+        }
+    }
+
     // Issue a DNSServiceQueryRecord call
 #if SRP_FEATURE_NAT64
     const DNSServiceQueryAttr *attr = NULL;
@@ -2112,16 +2556,161 @@ exit:
     return query;
 }
 
+#define DP_PUSH_HASH_SIZE 256
+
+static dp_push_subscription_t *dp_push_subscriptions[DP_PUSH_HASH_SIZE];
+
+// Add a record to the DNS Push update being built in query. Returns false if the update is full, in which case the
+// caller should send it and try again.
+static bool
+dp_push_add_record(dnssd_query_t *query, const char *fullname, uint16_t rrtype, uint16_t rrclass, uint16_t rdlen,
+                   const void *rdata, uint32_t ttl)
+{
+    uint8_t *start;
+
+    dns_push_start(query);
+    start = query->towire.p;
+    dp_query_add_data_to_response(query, fullname, rrtype, rrclass, rdlen, rdata, ttl, true);
+    if (query->towire.truncated) {
+        query->towire.truncated = false;
+        query->towire.error = 0;
+        // If the record doesn't fit even in an empty update, sending the update won't help.
+        if (query->p_dso_length != NULL && start == query->p_dso_length + 2) {
+            ERROR("no room for " PRI_S_SRP " rrtype %d rdlen %d in an empty DNS Push update", fullname, rrtype, rdlen);
+            return true;
+        }
+        return false;
+    }
+    return true;
+}
+
+// Send the update that's been built in the subscription's shared query to every subscriber.
+static void
+dp_push_subscription_send(dp_push_subscription_t *subscription)
+{
+    dnssd_query_t *shared = subscription->shared, *query;
+    struct iovec iov;
+    int count = 0;
+
+    if (shared->p_dso_length == NULL) {
+        return;
+    }
+    int16_t dso_length = shared->towire.p - shared->p_dso_length - 2;
+    iov.iov_len = (shared->towire.p - (uint8_t *)shared->response);
+    iov.iov_base = shared->response;
+
+    shared->towire.p = shared->p_dso_length;
+    dns_u16_to_wire(&shared->towire, dso_length);
+    for (query = subscription->subscribers; query != NULL; query = query->push_next) {
+        if (query->tracker != NULL && query->tracker->connection != NULL) {
+            ioloop_send_message(query->tracker->connection, NULL, &iov, 1);
+            count++;
+        }
+    }
+    INFO(PRI_S_SRP " (len %zd) sent to %d subscribers", shared->name, iov.iov_len, count);
+    dp_query_towire_reset(shared);
+}
+
+// Send a new subscriber the answers the subscription already has, since it won't hear about them otherwise. Every
+// answer mDNSResponder hasn't removed is still live, whatever its TTL said when it was added.
+static void
+dp_push_subscription_catch_up(dnssd_query_t *query)
+{
+    dp_push_subscription_t *subscription = query->subscription;
+    dp_cache_answer_t *answer;
+
+    VALIDATE_TRACKER_CONNECTION_NON_NULL();
+
+    if (subscription == NULL || subscription->answers == NULL) {
+        return;
+    }
+    for (answer = subscription->answers; answer != NULL; answer = answer->next) {
+        if (!dp_push_add_record(query, query->name, answer->rrtype, answer->rrclass, answer->rdlen, answer->rdata,
+                                answer->ttl))
+        {
+            dp_push_response(query);
+            dp_push_add_record(query, query->name, answer->rrtype, answer->rrclass, answer->rdlen, answer->rdata,
+                               answer->ttl);
+        }
+    }
+    dp_push_response(query);
+}
+
+static void
+dp_push_subscription_unindex(dp_push_subscription_t *subscription)
+{
+    dp_push_subscription_t **sp;
+
+    if (!subscription->indexed) {
+        return;
+    }
+    for (sp = &dp_push_subscriptions[subscription->hash % DP_PUSH_HASH_SIZE]; *sp != NULL; sp = &(*sp)->next) {
+        if (*sp == subscription) {
+            *sp = subscription->next;
+            break;
+        }
+    }
+    subscription->indexed = false;
+}
+
+static void
+dp_push_subscription_free(dp_push_subscription_t *subscription)
+{
+    dp_cache_answer_t *answer;
+
+    dp_push_subscription_unindex(subscription);
+    // Finalizing the shared query cancels the query to mDNSResponder.
+    RELEASE_HERE(subscription->shared, dnssd_query_finalize);
+    while ((answer = subscription->answers) != NULL) {
+        subscription->answers = answer->next;
+        free(answer);
+    }
+    free(subscription);
+}
+
+// Called when a subscriber's query is canceled or finalized. When the last subscriber goes, so does the subscription.
+static void
+dp_push_subscription_detach(dnssd_query_t *const NONNULL query)
+{
+    dp_push_subscription_t *subscription = query->subscription;
+    dnssd_query_t **qp;
+
+    for (qp = &subscription->subscribers; *qp != NULL; qp = &(*qp)->push_next) {
+        if (*qp == query) {
+            *qp = query->push_next;
+            break;
+        }
+    }
+    query->subscription = NULL;
+    query->push_next = NULL;
+    if (subscription->subscribers == NULL) {
+        INFO("last subscriber to " PRI_S_SRP " type %d class %d is gone", subscription->shared->name,
+             subscription->shared->type, subscription->shared->qclass);
+        dp_push_subscription_free(subscription);
+    }
+}
+
+// Cancel every subscriber. The subscription goes away when the last one is detached.
+static void
+dp_push_subscription_cancel(dp_push_subscription_t *subscription)
+{
+    dnssd_query_t *query, *next;
+
+    dp_push_subscription_unindex(subscription);
+    for (query = subscription->subscribers; query != NULL; query = next) {
+        next = query->push_next;
+        dnssd_query_cancel(query);
+    }
+}
+
 // This is the callback for DNS push query results, as opposed to push updates.
 static void
 dns_push_query_callback(DNSServiceRef UNUSED sdRef, DNSServiceFlags flags, uint32_t UNUSED interfaceIndex,
                         DNSServiceErrorType errorCode,const char *fullname, uint16_t rrtype, uint16_t rrclass,
                         uint16_t rdlen, const void *rdata, uint32_t ttl, void *context)
 {
-    dnssd_query_t *query = context;
-    uint8_t *revert = query->towire.p;
-
-    VALIDATE_TRACKER_CONNECTION_NON_NULL();
+    dp_push_subscription_t *subscription = context;
+    dnssd_query_t *shared = subscription->shared;
 
     // From DNSSD-Hybrid, for mDNS queries:
     // If we have cached answers, respond immediately, because we probably have all the answers.
@@ -2137,12 +2726,16 @@ dns_push_query_callback(DNSServiceRef UNUSED sdRef, DNSServiceFlags flags, uint3
 
     // query_state_waiting means that we're answering a regular DNS question
     if (errorCode == kDNSServiceErr_NoError) {
-        dns_push_start(query);
-
         const void *rdata_to_send;
         uint32_t ttl_to_send;
+
+        // Remember the answer, so that new subscribers can be caught up. If we can't, stop letting new subscribers
+        // share this question; they'll get a question of their own.
+        if (!dp_cache_answer_update(&subscription->answers, shared->name, flags, rrtype, rrclass, rdlen, rdata, ttl)) {
+            dp_push_subscription_unindex(subscription);
+        }
+
         // If kDNSServiceFlagsAdd is set, it's an add, otherwise a delete.
-    re_add:
         if (flags & kDNSServiceFlagsAdd) {
             rdata_to_send = rdata;
             ttl_to_send = ttl;
@@ -2171,29 +2764,143 @@ dns_push_query_callback(DNSServiceRef UNUSED sdRef, DNSServiceFlags flags, uint3
                  fullname, dns_rrtype_to_string(rrtype), dns_qclass_to_string(rrclass), rdlen, ttl_to_send);
         }
 
-        // Do the update.
-        dp_query_add_data_to_response(query, fullname, rrtype, rrclass, rdlen, rdata_to_send, ttl_to_send, true);
-
-        if (query->towire.truncated) {
-            query->towire.truncated = false;
-            query->towire.p = revert;
-            query->towire.error = 0;
-            dp_push_response(query);
-            dns_push_start(query);
-            goto re_add;
+        // Do the update, once for all subscribers.
+        if (!dp_push_add_record(shared, fullname, rrtype, rrclass, rdlen, rdata_to_send, ttl_to_send)) {
+            dp_push_subscription_send(subscription);
+            dp_push_add_record(shared, fullname, rrtype, rrclass, rdlen, rdata_to_send, ttl_to_send);
         }
 
         // If there isn't more coming, send a DNS Push notification now.
-        // XXX If enough comes to fill the response, send the message.
         if (!(flags & kDNSServiceFlagsMoreComing)) {
-            dp_push_response(query);
+            dp_push_subscription_send(subscription);
         }
     } else {
         ERROR("dns_push_query_callback: unexpected error code %d", errorCode);
-        dnssd_query_cancel(query);
+        dp_push_subscription_cancel(subscription);
     }
 }
 
+static void
+dp_push_subscription_close_callback(void *context, int status)
+{
+    dp_push_subscription_t *subscription = context;
+
+    ERROR("DNSServiceProcessResult on shared subscription to " PRI_S_SRP " returned %d",
+          subscription->shared->name, status);
+    dp_push_subscription_cancel(subscription);
+}
+
+static dp_push_subscription_t *
+dp_push_subscription_create(dnssd_query_t *query, uint32_t hash, int *rcode)
+{
+    char name[DNS_MAX_NAME_SIZE + 1];
+    const char *np;
+    DNSServiceRef sdref;
+    dnssd_query_t *shared = NULL;
+    dp_push_subscription_t *subscription = calloc(1, sizeof *subscription);
+
+    *rcode = dns_rcode_servfail;
+    require_action_quiet(subscription != NULL, fail,
+                         ERROR("Unable to allocate memory for subscription on " PRI_S_SRP, query->name));
+
+    // The shared query isn't on any connection; it's only used to ask the question and encode the answers.
+    shared = calloc(1, sizeof *shared);
+    require_action_quiet(shared != NULL, fail,
+                         ERROR("Unable to allocate memory for shared query on " PRI_S_SRP, query->name));
+    RETAIN_HERE(shared); // The subscription holds a reference to the shared query.
+    subscription->shared = shared;
+    shared->name = strdup(query->name);
+    shared->response = malloc(sizeof *shared->response);
+    require_action_quiet(shared->name != NULL && shared->response != NULL, fail,
+                         ERROR("Unable to allocate memory for shared query on " PRI_S_SRP, query->name));
+    shared->data_size = DNS_DATA_SIZE;
+    shared->served_domain = query->served_domain;
+    shared->serviceFlags = query->serviceFlags;
+    shared->interface_index = query->interface_index;
+    shared->type = query->type;
+    shared->qclass = query->qclass;
+    dp_query_towire_reset(shared);
+
+    np = dp_query_mdns_name(shared, name, sizeof name);
+    require_quiet(np != NULL, fail);
+    int err = DNSServiceQueryRecord(&sdref, shared->serviceFlags, shared->interface_index, np, shared->type,
+                                    shared->qclass, dns_push_query_callback, subscription);
+    require_action_quiet(err == kDNSServiceErr_NoError, fail,
+                         ERROR("DNSServiceQueryRecord failed for '" PRI_S_SRP "': %d", np, err));
+    shared->txn = ioloop_dnssd_txn_add(sdref, subscription, NULL, dp_push_subscription_close_callback);
+    require_quiet(shared->txn != NULL, fail);
+    INFO("DNSServiceQueryRecord started for '" PRI_S_SRP "', shared by its subscribers", np);
+
+    subscription->hash = hash;
+    subscription->next = dp_push_subscriptions[hash % DP_PUSH_HASH_SIZE];
+    dp_push_subscriptions[hash % DP_PUSH_HASH_SIZE] = subscription;
+    subscription->indexed = true;
+    *rcode = dns_rcode_noerror;
+    return subscription;
+
+fail:
+    if (subscription != NULL) {
+        if (shared != NULL) {
+            RELEASE_HERE(shared, dnssd_query_finalize);
+        }
+        free(subscription);
+    }
+    return NULL;
+}
+
+// Start a DNS Push subscription, sharing the question with any other subscribers to it.
+static bool
+dp_push_subscription_start(dnssd_query_t *query, int *rcode)
+{
+    uint32_t hash = dp_question_hash(query->name, query->served_domain, query->type, query->qclass);
+    dp_push_subscription_t *subscription;
+
+    if (query->served_domain != NULL && dnssd_hardwired_response(query, dns_push_query_callback)) {
+        *rcode = dns_rcode_noerror;
+        return true;
+    }
+
+    for (subscription = dp_push_subscriptions[hash % DP_PUSH_HASH_SIZE]; subscription != NULL;
+         subscription = subscription->next)
+    {
+        dnssd_query_t *shared = subscription->shared;
+        if (subscription->hash == hash && shared->type == query->type && shared->qclass == query->qclass &&
+            shared->served_domain == query->served_domain && !strcasecmp(shared->name, query->name))
+        {
+            break;
+        }
+    }
+    if (subscription == NULL) {
+        subscription = dp_push_subscription_create(query, hash, rcode);
+        if (subscription == NULL) {
+            return false;
+        }
+    }
+    query->subscription = subscription;
+    query->push_next = subscription->subscribers;
+    subscription->subscribers = query;
+    *rcode = dns_rcode_noerror;
+    return true;
+}
+
+#if SRP_FEATURE_DYNAMIC_CONFIGURATION
+// Drop every subscription that refers to the served domain, which is about to go away.
+static void
+dp_push_subscriptions_flush_served_domain(served_domain_t *served_domain)
+{
+    dp_push_subscription_t *subscription, *next;
+
+    for (int i = 0; i < DP_PUSH_HASH_SIZE; i++) {
+        for (subscription = dp_push_subscriptions[i]; subscription != NULL; subscription = next) {
+            next = subscription->next;
+            if (subscription->shared->served_domain == served_domain) {
+                dp_push_subscription_cancel(subscription);
+            }
+        }
+    }
+}
+#endif // SRP_FEATURE_DYNAMIC_CONFIGURATION
+
 static void
 dns_push_subscribe(dp_tracker_t *tracker, const dns_wire_t *header, dso_state_t *dso, dns_rr_t *question,
                    const char *activity_name, const char * UNUSED opcode_name)
@@ -2210,13 +2917,14 @@ dns_push_subscribe(dp_tracker_t *tracker, const dns_wire_t *header, dso_state_t
                                                 dns_push_cancel);
     RETAIN_HERE(query); // The activity holds a reference to the query.
     query->activity = activity;
-    if (!dp_query_start(query, &rcode, false, dns_push_query_callback)) {
+    if (!dp_push_subscription_start(query, &rcode)) {
         dso_simple_response(tracker->connection, NULL, header, rcode);
         dnssd_query_cancel(query);
         RELEASE_HERE(query, dnssd_query_finalize);
         return;
     }
     dso_simple_response(tracker->connection, NULL, header, dns_rcode_noerror);
+    dp_push_subscription_catch_up(query);
 }
 
 static void
@@ -2451,6 +3159,9 @@ dp_dns_query(dp_tracker_t *tracker, message_t *message, dns_rr_t *question)
         dso_simple_response(tracker->connection, message, &message->wire, rcode);
         return;
     }
+    // The tracker holds the only reference to the query. Track it before starting it, because a query that's
+    // answered immediately, from the cache or from a hardwired response, is canceled before dp_query_start returns.
+    dp_query_track(tracker, query);
     dns_rcode_set(query->response, dns_rcode_noerror);
 
     // For DNS queries, we need to return the question.
@@ -2467,6 +3178,7 @@ dp_dns_query(dp_tracker_t *tracker, message_t *message, dns_rr_t *question)
     TOWIRE_CHECK("CLASS", &query->towire, dns_u16_to_wire(&query->towire, question->qclass));  // CLASS
     if (failnote != NULL) {
         ERROR("dp_dns_query: failure encoding question: %s", failnote);
+        rcode = dns_rcode_servfail;
         goto fail;
     }
 
@@ -2482,13 +3194,10 @@ dp_dns_query(dp_tracker_t *tracker, message_t *message, dns_rr_t *question)
         dns64 = nat64_is_active();
     }
 #endif
-    if (dp_query_start(query, &rcode, dns64, dns_query_callback)) {
-        dp_query_track(tracker, query);
-    } else {
+    if (!dp_query_start(query, &rcode, dns64, dns_query_callback)) {
     fail:
         dso_simple_response(tracker->connection, message, &message->wire, rcode);
-        RELEASE_HERE(query, dnssd_query_finalize);
-        return;
+        dnssd_query_cancel(query);
     }
 }
 
@@ -2541,7 +3250,14 @@ dnssd_proxy_dns_evaluate(comm_t *comm, message_t *message, dp_tracker_t *tracker
         }
 
         if (!tracker->dso) {
+            // This connection may turn out to be an incoming SRP replication session, so the DSO state has to be
+            // able to track as many outstanding queries as a replication peer can send.
+#if SRP_FEATURE_REPLICATION
+            tracker->dso = dso_state_create(true, SRPL_DSO_MAX_OUTSTANDING_QUERIES, comm->name, dns_push_callback,
+                                            tracker, NULL, comm);
+#else
             tracker->dso = dso_state_create(true, 2, comm->name, dns_push_callback, tracker, NULL, comm);
+#endif
             if (!tracker->dso) {
                 ERROR("Unable to create a dso context for %s", comm->name);
                 dso_simple_response(comm, message, &message->wire, dns_rcode_servfail);
@@ -2666,6 +3382,10 @@ delete_served_domain(served_domain_t *const served_domain)
 {
     INFO("served domain removed - domain name: " PRI_S_SRP, served_domain->domain);
 
+    // Cached answers, push subscriptions and the queries that use them refer to the served domain.
+    dp_cache_flush_served_domain(served_domain);
+    dp_push_subscriptions_flush_served_domain(served_domain);
+
     // free struct interface *NULLABLE interface
     if (served_domain->interface != NULL) {
         interface_addr_t *current = served_domain->interface->addresses;
@@ -36,8 +36,94 @@
 #include "srp.h"
 #include "dns-msg.h"
 
-bool
-dns_opt_parse(dns_edns0_t *NONNULL *NULLABLE ret, dns_rr_t *rr)
+// A parsed message, along with every RR, label, rdata buffer and EDNS0 option it points to, is carved out of
+// a small chain of arena blocks hanging off the message. The first block is sized from the wire message so that
+// most messages fit in it; if it runs out, further blocks are added. dns_message_free releases the whole chain at
+// once rather than walking the message. When the parse functions are called outside of dns_wire_parse, there is
+// no arena, and each piece is allocated separately, as before, so that the caller can free it with dns_name_free
+// or dns_rrdata_free.
+#define DNS_ARENA_ALIGN       8
+#define DNS_ARENA_BLOCK_SIZE  2048
+#define DNS_ARENA_WIRE_FACTOR 6
+#define DNS_ARENA_ROUND(len)  (((len) + DNS_ARENA_ALIGN - 1) & ~((size_t)DNS_ARENA_ALIGN - 1))
+
+struct dns_arena_block {
+    dns_arena_block_t *NULLABLE next;
+    size_t size, used;
+};
+
+static dns_arena_block_t *NULLABLE
+dns_arena_block_create(dns_arena_block_t *NULLABLE next, size_t size, const char *file, int line)
+{
+    dns_arena_block_t *block;
+    size_t block_size = DNS_ARENA_ROUND(sizeof(*block)) + size;
+#ifdef MALLOC_DEBUG_LOGGING
+    block = debug_malloc(block_size, file, line);
+#else
+    (void)file; (void)line;
+    block = malloc(block_size);
+#endif
+    if (block == NULL) {
+        return NULL;
+    }
+    block->next = next;
+    block->size = size;
+    block->used = 0;
+    return block;
+}
+
+// Returns zeroed memory. If arena is NULL, the memory is allocated on its own and must be freed by the caller.
+static void *NULLABLE
+dns_arena_alloc(dns_arena_block_t *NULLABLE *NULLABLE arena, size_t len, const char *file, int line)
+{
+    dns_arena_block_t *block;
+    uint8_t *rv;
+
+    if (arena == NULL) {
+#ifdef MALLOC_DEBUG_LOGGING
+        return debug_calloc(1, len, file, line);
+#else
+        return calloc(1, len);
+#endif
+    }
+    len = DNS_ARENA_ROUND(len);
+    block = *arena;
+    if (block == NULL || block->size - block->used < len) {
+        block = dns_arena_block_create(block, len > DNS_ARENA_BLOCK_SIZE ? len : DNS_ARENA_BLOCK_SIZE, file, line);
+        if (block == NULL) {
+            return NULL;
+        }
+        *arena = block;
+    }
+    rv = (uint8_t *)block + DNS_ARENA_ROUND(sizeof(*block)) + block->used;
+    block->used += len;
+    memset(rv, 0, len);
+    return rv;
+}
+
+dns_name_t *NULLABLE
+dns_message_name_copy(dns_message_t *NONNULL message, dns_name_t *NONNULL original)
+{
+    dns_name_t *ret = NULL, **cur = &ret;
+    dns_name_t *next;
+
+    for (next = original; next; next = next->next) {
+        *cur = dns_arena_alloc(&message->arena, 1 + next->len + (sizeof (dns_name_t)) - DNS_MAX_LABEL_SIZE,
+                               __FILE__, __LINE__);
+        if (*cur == NULL) {
+            return NULL;
+        }
+        if (next->len) {
+            memcpy((*cur)->data, next->data, next->len + 1);
+        }
+        (*cur)->len = next->len;
+        cur = &((*cur)->next);
+    }
+    return ret;
+}
+
+static bool
+dns_opt_parse_in(dns_arena_block_t *NULLABLE *NULLABLE arena, dns_edns0_t *NONNULL *NULLABLE ret, dns_rr_t *rr)
 {
     dns_edns0_t *edns0, **p_edns0 = ret;
     unsigned offset = 0;
@@ -65,7 +151,7 @@ dns_opt_parse(dns_edns0_t *NONNULL *NULLABLE ret, dns_rr_t *rr)
             return false;
         }
 
-        edns0 = calloc(1, tlv_len + sizeof(*edns0));
+        edns0 = dns_arena_alloc(arena, tlv_len + sizeof(*edns0), __FILE__, __LINE__);
         if (edns0 == NULL) {
             return false;
         }
@@ -80,8 +166,15 @@ dns_opt_parse(dns_edns0_t *NONNULL *NULLABLE ret, dns_rr_t *rr)
     return true;
 }
 
-dns_label_t * NULLABLE
-dns_label_parse_(const uint8_t *buf, unsigned mlen, unsigned *NONNULL offp, const char *file, int line)
+bool
+dns_opt_parse(dns_edns0_t *NONNULL *NULLABLE ret, dns_rr_t *rr)
+{
+    return dns_opt_parse_in(NULL, ret, rr);
+}
+
+static dns_label_t * NULLABLE
+dns_label_parse_in(dns_arena_block_t *NULLABLE *NULLABLE arena,
+                   const uint8_t *buf, unsigned mlen, unsigned *NONNULL offp, const char *file, int line)
 {
     uint8_t llen = buf[*offp];
     dns_label_t *rv;
@@ -92,12 +185,7 @@ dns_label_parse_(const uint8_t *buf, unsigned mlen, unsigned *NONNULL offp, cons
         return NULL;
     }
 
-#ifdef MALLOC_DEBUG_LOGGING
-    rv = debug_calloc(1, (sizeof(*rv) - DNS_MAX_LABEL_SIZE) + llen + 1, file, line);
-#else
-    (void)file; (void)line;
-    rv = calloc(1, (sizeof(*rv) - DNS_MAX_LABEL_SIZE) + llen + 1);
-#endif
+    rv = dns_arena_alloc(arena, (sizeof(*rv) - DNS_MAX_LABEL_SIZE) + llen + 1, file, line);
     if (rv == NULL) {
         DEBUG("memory allocation for %u byte label (%.*s) failed.\n",
               *offp + llen + 1, *offp + llen + 1, &buf[*offp + 1]);
@@ -111,9 +199,15 @@ dns_label_parse_(const uint8_t *buf, unsigned mlen, unsigned *NONNULL offp, cons
     return rv;
 }
 
+dns_label_t * NULLABLE
+dns_label_parse_(const uint8_t *buf, unsigned mlen, unsigned *NONNULL offp, const char *file, int line)
+{
+    return dns_label_parse_in(NULL, buf, mlen, offp, file, line);
+}
+
 static bool
-dns_name_parse_in(dns_label_t *NONNULL *NULLABLE ret, const uint8_t *buf, unsigned len,
-                   unsigned *NONNULL offp, unsigned base, const char *file, int line)
+dns_name_parse_in(dns_arena_block_t *NULLABLE *NULLABLE arena, dns_label_t *NONNULL *NULLABLE ret,
+                  const uint8_t *buf, unsigned len, unsigned *NONNULL offp, unsigned base, const char *file, int line)
 {
     dns_label_t *rv;
 
@@ -153,7 +247,7 @@ dns_name_parse_in(dns_label_t *NONNULL *NULLABLE ret, const uint8_t *buf, unsign
                   pointer, buf[pointer]);
             return false;
         }
-        return dns_name_parse_in(ret, buf, len, &pointer, pointer, file, line);
+        return dns_name_parse_in(arena, ret, buf, len, &pointer, pointer, file, line);
     }
     // We don't support binary labels, which are historical, and at this time there are no other valid
     // DNS label types.
@@ -162,7 +256,7 @@ dns_name_parse_in(dns_label_t *NONNULL *NULLABLE ret, const uint8_t *buf, unsign
         return false;
     }
 
-    rv = dns_label_parse_(buf, len, offp, file, line);
+    rv = dns_label_parse_in(arena, buf, len, offp, file, line);
     if (rv == NULL) {
         return false;
     }
@@ -172,19 +266,22 @@ dns_name_parse_in(dns_label_t *NONNULL *NULLABLE ret, const uint8_t *buf, unsign
     if (rv->len == 0) {
         return true;
     }
-    return dns_name_parse_in(&rv->next, buf, len, offp, base, file, line);
+    return dns_name_parse_in(arena, &rv->next, buf, len, offp, base, file, line);
 }
 
-bool
-dns_name_parse_(dns_label_t *NONNULL *NULLABLE ret, const uint8_t *buf,
-                unsigned len, unsigned *NONNULL offp, unsigned base, const char *file, int line)
+static bool
+dns_name_parse_arena(dns_arena_block_t *NULLABLE *NULLABLE arena, dns_label_t *NONNULL *NULLABLE ret,
+                     const uint8_t *buf, unsigned len, unsigned *NONNULL offp, unsigned base, const char *file, int line)
 {
     dns_label_t *rv = NULL, *next;
 
-    if (!dns_name_parse_in(&rv, buf, len, offp, base, file, line)) {
-        for (; rv != NULL; rv = next) {
-            next = rv->next;
-            free(rv);
+    if (!dns_name_parse_in(arena, &rv, buf, len, offp, base, file, line)) {
+        // Labels allocated from an arena go away with the arena.
+        if (arena == NULL) {
+            for (; rv != NULL; rv = next) {
+                next = rv->next;
+                free(rv);
+            }
         }
         return false;
     }
@@ -192,6 +289,13 @@ dns_name_parse_(dns_label_t *NONNULL *NULLABLE ret, const uint8_t *buf,
     return true;
 }
 
+bool
+dns_name_parse_(dns_label_t *NONNULL *NULLABLE ret, const uint8_t *buf,
+                unsigned len, unsigned *NONNULL offp, unsigned base, const char *file, int line)
+{
+    return dns_name_parse_arena(NULL, ret, buf, len, offp, base, file, line);
+}
+
 bool
 dns_u8_parse(const uint8_t *buf, unsigned len, unsigned *NONNULL offp, uint8_t *NONNULL ret)
 {
@@ -386,9 +490,10 @@ dns_rrdata_dump(dns_rr_t *rr, bool dump_to_stderr)
     }
 }
 
-bool
-dns_rdata_parse_data_(dns_rr_t *NONNULL rr, const uint8_t *buf, unsigned *NONNULL offp, unsigned target, uint16_t rdlen,
-                      unsigned rrstart, const char *file, int line)
+static bool
+dns_rdata_parse_data_in(dns_arena_block_t *NULLABLE *NULLABLE arena, dns_rr_t *NONNULL rr, const uint8_t *buf,
+                        unsigned *NONNULL offp, unsigned target, uint16_t rdlen, unsigned rrstart,
+                        const char *file, int line)
 {
     if (target < *offp) {
         DEBUG("target %u < *offp %u", target, *offp);
@@ -402,11 +507,7 @@ dns_rdata_parse_data_(dns_rr_t *NONNULL rr, const uint8_t *buf, unsigned *NONNUL
             return false;
         }
         rr->data.key.len = (unsigned)(target - *offp);
-#ifdef MALLOC_DEBUG_LOGGING
-        rr->data.key.key = debug_malloc(rr->data.key.len, file, line);
-#else
-        rr->data.key.key = malloc(rr->data.key.len);
-#endif
+        rr->data.key.key = dns_arena_alloc(arena, rr->data.key.len, file, line);
         if (!rr->data.key.key) {
             return false;
         }
@@ -423,17 +524,13 @@ dns_rdata_parse_data_(dns_rr_t *NONNULL rr, const uint8_t *buf, unsigned *NONNUL
             !dns_u32_parse(buf, target, offp, &rr->data.sig.expiry) ||
             !dns_u32_parse(buf, target, offp, &rr->data.sig.inception) ||
             !dns_u16_parse(buf, target, offp, &rr->data.sig.key_tag) ||
-            !dns_name_parse_(&rr->data.sig.signer, buf, target, offp, *offp, file, line)) {
+            !dns_name_parse_arena(arena, &rr->data.sig.signer, buf, target, offp, *offp, file, line)) {
             return false;
         }
         // The signature is what's left of the RRDATA.  It covers the message up to the signature, so we
         // remember where it starts so as to know what memory to cover to validate it.
         rr->data.sig.len = target - *offp;
-#ifdef MALLOC_DEBUG_LOGGING
-        rr->data.sig.signature = debug_malloc(rr->data.sig.len, file, line);
-#else
-        rr->data.sig.signature = malloc(rr->data.sig.len);
-#endif
+        rr->data.sig.signature = dns_arena_alloc(arena, rr->data.sig.len, file, line);
         if (!rr->data.sig.signature) {
             return false;
         }
@@ -453,7 +550,7 @@ dns_rdata_parse_data_(dns_rr_t *NONNULL rr, const uint8_t *buf, unsigned *NONNUL
     case dns_rrtype_ns:
     case dns_rrtype_ptr:
     case dns_rrtype_cname:
-        if (!dns_name_parse_(&rr->data.ptr.name, buf, target, offp, *offp, file, line)) {
+        if (!dns_name_parse_arena(arena, &rr->data.ptr.name, buf, target, offp, *offp, file, line)) {
             return false;
         }
         break;
@@ -486,11 +583,7 @@ dns_rdata_parse_data_(dns_rr_t *NONNULL rr, const uint8_t *buf, unsigned *NONNUL
             ERROR("TXT record length %u is longer than 255", left);
         }
         rr->data.txt.len = (uint8_t)left;
-#ifdef MALLOC_DEBUG_LOGGING
-        rr->data.txt.data = debug_malloc(rr->data.txt.len, file, line);
-#else
-        rr->data.txt.data = malloc(rr->data.txt.len);
-#endif
+        rr->data.txt.data = dns_arena_alloc(arena, rr->data.txt.len, file, line);
         if (rr->data.txt.data == NULL) {
             DEBUG("dns_rdata_parse: no memory for TXT RR");
             return false;
@@ -502,11 +595,7 @@ dns_rdata_parse_data_(dns_rr_t *NONNULL rr, const uint8_t *buf, unsigned *NONNUL
 
     default:
         if (rdlen > 0) {
-#ifdef MALLOC_DEBUG_LOGGING
-            rr->data.unparsed.data = debug_malloc(rdlen, file, line);
-#else
-            rr->data.unparsed.data = malloc(rdlen);
-#endif
+            rr->data.unparsed.data = dns_arena_alloc(arena, rdlen, file, line);
             if (rr->data.unparsed.data == NULL) {
                 return false;
             }
@@ -523,8 +612,15 @@ dns_rdata_parse_data_(dns_rr_t *NONNULL rr, const uint8_t *buf, unsigned *NONNUL
     return true;
 }
 
+bool
+dns_rdata_parse_data_(dns_rr_t *NONNULL rr, const uint8_t *buf, unsigned *NONNULL offp, unsigned target, uint16_t rdlen,
+                      unsigned rrstart, const char *file, int line)
+{
+    return dns_rdata_parse_data_in(NULL, rr, buf, offp, target, rdlen, rrstart, file, line);
+}
+
 static bool
-dns_rdata_parse_(dns_rr_t *NONNULL rr,
+dns_rdata_parse_(dns_arena_block_t *NULLABLE *NULLABLE arena, dns_rr_t *NONNULL rr,
                  const uint8_t *buf, unsigned len, unsigned *NONNULL offp, unsigned rrstart, const char *file, int line)
 {
     uint16_t rdlen;
@@ -537,17 +633,17 @@ dns_rdata_parse_(dns_rr_t *NONNULL rr,
     if (target > len) {
         return false;
     }
-    return dns_rdata_parse_data_(rr, buf, offp, target, rdlen, rrstart, file, line);
+    return dns_rdata_parse_data_in(arena, rr, buf, offp, target, rdlen, rrstart, file, line);
 }
 
-bool
-dns_rr_parse_(dns_rr_t *NONNULL rr, const uint8_t *buf, unsigned len, unsigned *NONNULL offp, bool rrdata_expected,
-              bool dump_stderr, const char *file, int line)
+static bool
+dns_rr_parse_in(dns_arena_block_t *NULLABLE *NULLABLE arena, dns_rr_t *NONNULL rr, const uint8_t *buf, unsigned len,
+                unsigned *NONNULL offp, bool rrdata_expected, bool dump_stderr, const char *file, int line)
 {
     unsigned rrstart = *offp; // Needed to mark the start of the SIG RR for SIG(0).
 
     memset(rr, 0, sizeof(*rr));
-    if (!dns_name_parse_(&rr->name, buf, len, offp, *offp, file, line)) {
+    if (!dns_name_parse_arena(arena, &rr->name, buf, len, offp, *offp, file, line)) {
         return false;
     }
 
@@ -563,7 +659,7 @@ dns_rr_parse_(dns_rr_t *NONNULL rr, const uint8_t *buf, unsigned len, unsigned *
         if (!dns_u32_parse(buf, len, offp, &rr->ttl)) {
             return false;
         }
-        if (!dns_rdata_parse_(rr, buf, len, offp, rrstart, file, line)) {
+        if (!dns_rdata_parse_(arena, rr, buf, len, offp, rrstart, file, line)) {
             return false;
         }
     }
@@ -582,6 +678,13 @@ dns_rr_parse_(dns_rr_t *NONNULL rr, const uint8_t *buf, unsigned len, unsigned *
     return true;
 }
 
+bool
+dns_rr_parse_(dns_rr_t *NONNULL rr, const uint8_t *buf, unsigned len, unsigned *NONNULL offp, bool rrdata_expected,
+              bool dump_stderr, const char *file, int line)
+{
+    return dns_rr_parse_in(NULL, rr, buf, len, offp, rrdata_expected, dump_stderr, file, line);
+}
+
 void
 dns_rrdata_free(dns_rr_t *rr)
 {
@@ -630,29 +733,13 @@ dns_rrdata_free(dns_rr_t *rr)
 void
 dns_message_free(dns_message_t *message)
 {
-    dns_edns0_t *edns0, *next;
-
-#define FREE(count, sets)                               \
-    if (message->sets) {                                \
-        for (unsigned i = 0; i < message->count; i++) { \
-            dns_rr_t *set = &message->sets[i];          \
-            if (set->name) {                            \
-                dns_name_free(set->name);               \
-            }                                           \
-            dns_rrdata_free(set);                       \
-        }                                               \
-        free(message->sets);                            \
-    }
-    FREE(qdcount, questions);
-    FREE(ancount, answers);
-    FREE(nscount, authority);
-    FREE(arcount, additional);
-#undef FREE
-    for (edns0 = message->edns0; edns0 != NULL; edns0 = next) {
-        next = edns0->next;
-        free(edns0);
-    }
-    free(message);
+    dns_arena_block_t *block, *next;
+
+    // The message itself lives in the arena, so don't touch it once the first block is gone.
+    for (block = message->arena; block != NULL; block = next) {
+        next = block->next;
+        free(block);
+    }
 }
 
 bool
@@ -661,19 +748,29 @@ dns_wire_parse_(dns_message_t *NONNULL *NULLABLE ret, dns_wire_t *message, unsig
 {
     unsigned offset = 0;
     unsigned data_len = len - DNS_HEADER_SIZE;
+    unsigned num_records = 0;
+    dns_arena_block_t *arena;
     dns_message_t *rv;
 
     if (len < DNS_HEADER_SIZE) {
         return false;
     }
-#ifdef MALLOC_DEBUG_LOGGING
-    rv = debug_calloc(1, sizeof(*rv), file, line);
-#else
-    rv = calloc(1, sizeof(*rv));
-#endif
-    if (rv == NULL) {
+
+    // Size the first arena block so that the message, its RR arrays, and the labels and rdata, which take up
+    // several times as much space in memory as they do on the wire, usually fit in it.
+#define COUNT(count) num_records += ntohs(message->count) > 50 ? 0 : ntohs(message->count)
+    COUNT(qdcount);
+    COUNT(ancount);
+    COUNT(nscount);
+    COUNT(arcount);
+#undef COUNT
+    arena = dns_arena_block_create(NULL, DNS_ARENA_ROUND(sizeof(*rv)) + num_records * sizeof(dns_rr_t) +
+                                   DNS_ARENA_WIRE_FACTOR * data_len, file, line);
+    if (arena == NULL) {
         return false;
     }
+    rv = dns_arena_alloc(&arena, sizeof(*rv), file, line);
+    rv->arena = arena;
 
 #define PARSE(count, sets, name, rrdata_expected)                                   \
     rv->count = ntohs(message->count);                                              \
@@ -685,7 +782,8 @@ dns_wire_parse_(dns_message_t *NONNULL *NULLABLE ret, dns_wire_t *message, unsig
     DEBUG("Section %s, %d records", name, rv->count);                               \
                                                                                     \
     if (rv->count != 0) {                                                           \
-        rv->sets = calloc(rv->count, sizeof(*rv->sets));                            \
+        rv->sets = dns_arena_alloc(&rv->arena, rv->count * sizeof(*rv->sets),       \
+                                   file, line);                                     \
         if (rv->sets == NULL) {                                                     \
             dns_message_free(rv);                                                   \
             return false;                                                           \
@@ -693,8 +791,9 @@ dns_wire_parse_(dns_message_t *NONNULL *NULLABLE ret, dns_wire_t *message, unsig
     }                                                                               \
                                                                                     \
     for (unsigned i = 0; i < rv->count; i++) {                                      \
-        if (!dns_rr_parse_(&rv->sets[i], message->data, data_len, &offset,          \
-                           rrdata_expected, dump_to_stderr, file, line)) {          \
+        if (!dns_rr_parse_in(&rv->arena, &rv->sets[i], message->data, data_len,     \
+                             &offset, rrdata_expected, dump_to_stderr, file, line)) \
+        {                                                                           \
             dns_message_free(rv);                                                   \
             ERROR(name " %d RR parse failed.\n", i);                                \
             return false;                                                           \
@@ -709,7 +808,7 @@ dns_wire_parse_(dns_message_t *NONNULL *NULLABLE ret, dns_wire_t *message, unsig
     for (unsigned i = 0; i < rv->arcount; i++) {
         // Parse EDNS(0)
         if (rv->additional[i].type == dns_rrtype_opt) {
-            if (!dns_opt_parse(&rv->edns0, &rv->additional[i])) {
+            if (!dns_opt_parse_in(&rv->arena, &rv->edns0, &rv->additional[i])) {
                 dns_message_free(rv);
                 return false;
             }
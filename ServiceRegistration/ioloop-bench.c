@@ -0,0 +1,160 @@
+/* ioloop-bench.c
+ *
+ * Copyright (c) 2021 Apple Inc. All rights reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ * Measures the cost of scheduling, rescheduling, cancelling and firing a large number of concurrent ioloop wakeups.
+ * All of the wakeups are added, half of them are rescheduled, a quarter are cancelled, and then ioloop_events() is
+ * run until the rest have fired. The times reported are CPU time, so the time spent waiting for wakeups to come due
+ * doesn't count. Each wakeup is also checked to have fired no earlier than its deadline, in deadline order.
+ * ioloop_add_wake_event() logs every wakeup it schedules, and that logging is included in the times reported.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <netinet/in.h>
+
+#include "srp.h"
+#include "dns-msg.h"
+#include "ioloop.h"
+
+// Provided by the POSIX ioloop.c, which doesn't export it through ioloop.h because macos-ioloop.c has no equivalent.
+int ioloop_events(int64_t timeout_when);
+
+typedef struct bench_wakeup bench_wakeup_t;
+struct bench_wakeup {
+    wakeup_t *wakeup;
+    int64_t deadline;
+    bool cancelled;
+    bool fired;
+};
+
+static int num_fired;
+static int64_t last_deadline;
+static bool out_of_order;
+
+static double
+cpu_microseconds(void)
+{
+    return (double)clock() * 1e6 / CLOCKS_PER_SEC;
+}
+
+static void
+bench_wakeup_callback(void *context)
+{
+    bench_wakeup_t *bw = context;
+
+    if (bw->fired || bw->cancelled || bw->deadline < last_deadline || ioloop_timenow() < bw->deadline) {
+        out_of_order = true;
+    }
+    last_deadline = bw->deadline;
+    bw->fired = true;
+    num_fired++;
+}
+
+static void
+bench_schedule(bench_wakeup_t *bw, int window)
+{
+    ioloop_add_wake_event(bw->wakeup, bw, bench_wakeup_callback, NULL, rand() % window);
+    // Read back the time the ioloop chose rather than working it out again, since the clock may have ticked since.
+    bw->deadline = bw->wakeup->wakeup_time;
+}
+
+int
+main(int argc, char **argv)
+{
+    bench_wakeup_t *wakeups;
+    int count = 50000, window = 1000, expected = 0, i, opt;
+    double start, added, rescheduled, fired;
+
+    while ((opt = getopt(argc, argv, "n:w:")) != -1) {
+        switch (opt) {
+        case 'n':
+            count = atoi(optarg);
+            break;
+        case 'w':
+            window = atoi(optarg);
+            break;
+        default:
+            fprintf(stderr, "Usage: %s [-n wakeups] [-w deadline window in milliseconds]\n", argv[0]);
+            return 2;
+        }
+    }
+    if (count <= 0 || window <= 0 || !ioloop_init()) {
+        fprintf(stderr, "%s: bad arguments or ioloop_init failed\n", argv[0]);
+        return 2;
+    }
+
+    wakeups = calloc((size_t)count, sizeof(*wakeups));
+    if (wakeups == NULL) {
+        fprintf(stderr, "%s: out of memory\n", argv[0]);
+        return 1;
+    }
+    for (i = 0; i < count; i++) {
+        wakeups[i].wakeup = ioloop_wakeup_create();
+        if (wakeups[i].wakeup == NULL) {
+            fprintf(stderr, "%s: out of memory\n", argv[0]);
+            return 1;
+        }
+    }
+
+    start = cpu_microseconds();
+    for (i = 0; i < count; i++) {
+        bench_schedule(&wakeups[i], window);
+    }
+    added = cpu_microseconds();
+    for (i = 0; i < count; i += 2) {
+        bench_schedule(&wakeups[i], window);
+    }
+    for (i = 1; i < count; i += 4) {
+        ioloop_cancel_wake_event(wakeups[i].wakeup);
+        wakeups[i].cancelled = true;
+    }
+    rescheduled = cpu_microseconds();
+    for (i = 0; i < count; i++) {
+        if (!wakeups[i].cancelled) {
+            expected++;
+        }
+    }
+
+    // A timeout of zero would wait forever once the last wakeup has fired, since there's no I/O to wake us.
+    while (num_fired < expected) {
+        ioloop_events(ioloop_timenow() + window);
+    }
+    fired = cpu_microseconds() - rescheduled;
+
+    printf("%d wakeups: add %.2f us each, reschedule half and cancel a quarter %.1f ms, fire %.2f us each\n",
+           count, (added - start) / count, (rescheduled - added) / 1000, fired / expected);
+    for (i = 0; i < count; i++) {
+        ioloop_wakeup_release(wakeups[i].wakeup);
+    }
+    free(wakeups);
+    if (out_of_order) {
+        fprintf(stderr, "%s: wakeups fired out of deadline order or early\n", argv[0]);
+        return 1;
+    }
+    return 0;
+}
+
+// Local Variables:
+// mode: C
+// tab-width: 4
+// c-file-style: "bsd"
+// c-basic-offset: 4
+// fill-column: 108
+// indent-tabs-mode: nil
+// End:
@@ -57,7 +57,6 @@ typedef struct async_event {
 } async_event_t;
 
 io_t *ios;
-wakeup_t *wakeups;
 subproc_t *subprocesses;
 async_event_t *async_events;
 int64_t ioloop_now;
@@ -205,24 +204,106 @@ drop_writer(io_t *io)
 #endif // USE_EPOLL
 }
 
+// Scheduled wakeups are kept in a binary min-heap ordered by wakeup time, so that adding, rescheduling and
+// cancelling a wakeup are O(log n), and finding the next one due is O(1).
+static wakeup_t **wakeup_heap;
+static size_t num_wakeups, wakeup_heap_size;
+static uint64_t wakeup_serial;
+
+static bool
+wakeup_before(wakeup_t *a, wakeup_t *b)
+{
+    // Wakeups due at the same time fire in the order in which they were scheduled.
+    if (a->wakeup_time != b->wakeup_time) {
+        return a->wakeup_time < b->wakeup_time;
+    }
+    return a->serial < b->serial;
+}
+
 static void
-add_remove_wakeup(wakeup_t *wakeup, bool remove)
+wakeup_heap_set(size_t index, wakeup_t *wakeup)
 {
-    wakeup_t **p_wakeups;
+    wakeup_heap[index] = wakeup;
+    wakeup->heap_index = index + 1;
+}
 
-    // Add the new reader to the end of the list if it's not on the list.
-    for (p_wakeups = &wakeups; *p_wakeups != NULL && *p_wakeups != wakeup; p_wakeups = &((*p_wakeups)->next))
-        ;
-    if (remove) {
-        if (*p_wakeups != NULL) {
-            *p_wakeups = wakeup->next;
-            wakeup->next = NULL;
+static void
+wakeup_heap_sift_up(size_t index)
+{
+    wakeup_t *wakeup = wakeup_heap[index];
+
+    while (index > 0) {
+        size_t parent = (index - 1) / 2;
+        if (!wakeup_before(wakeup, wakeup_heap[parent])) {
+            break;
         }
-    } else {
-        if (*p_wakeups == NULL) {
-            *p_wakeups = wakeup;
-            wakeup->next = NULL;
+        wakeup_heap_set(index, wakeup_heap[parent]);
+        index = parent;
+    }
+    wakeup_heap_set(index, wakeup);
+}
+
+static void
+wakeup_heap_sift_down(size_t index)
+{
+    wakeup_t *wakeup = wakeup_heap[index];
+
+    while (index * 2 + 1 < num_wakeups) {
+        size_t child = index * 2 + 1;
+        if (child + 1 < num_wakeups && wakeup_before(wakeup_heap[child + 1], wakeup_heap[child])) {
+            child++;
         }
+        if (!wakeup_before(wakeup_heap[child], wakeup)) {
+            break;
+        }
+        wakeup_heap_set(index, wakeup_heap[child]);
+        index = child;
+    }
+    wakeup_heap_set(index, wakeup);
+}
+
+static bool
+wakeup_schedule(wakeup_t *wakeup, int64_t wakeup_time)
+{
+    // If the wakeup isn't already on the heap, add it at the end; either way, move it to where its new time belongs.
+    if (wakeup->heap_index == 0) {
+        if (num_wakeups == wakeup_heap_size) {
+            size_t new_size = wakeup_heap_size == 0 ? 64 : wakeup_heap_size * 2;
+            wakeup_t **new_heap = realloc(wakeup_heap, new_size * sizeof(*new_heap));
+            if (new_heap == NULL) {
+                ERROR("no memory for %zu wakeups", new_size);
+                return false;
+            }
+            wakeup_heap = new_heap;
+            wakeup_heap_size = new_size;
+        }
+        wakeup_heap_set(num_wakeups++, wakeup);
+    }
+    wakeup->wakeup_time = wakeup_time;
+    wakeup->serial = ++wakeup_serial;
+    wakeup_heap_sift_up(wakeup->heap_index - 1);
+    wakeup_heap_sift_down(wakeup->heap_index - 1);
+    return true;
+}
+
+static void
+wakeup_unschedule(wakeup_t *wakeup)
+{
+    size_t index = wakeup->heap_index;
+    wakeup_t *last;
+
+    if (index == 0) {
+        return;
+    }
+    index--;
+    wakeup->heap_index = 0;
+    last = wakeup_heap[--num_wakeups];
+
+    // Move the last wakeup on the heap into the vacated slot and restore the heap property around it.
+    if (last != wakeup) {
+        wakeup_heap_set(index, last);
+        wakeup_heap_sift_up(index);
+        wakeup_heap_sift_down(last->heap_index - 1);
     }
 }
 
@@ -230,7 +311,7 @@ static void
 wakeup_finalize(void *context)
 {
     wakeup_t *wakeup = context;
-    add_remove_wakeup(wakeup, true);
+    wakeup_unschedule(wakeup);
     if (wakeup->finalize != NULL) {
         wakeup->finalize(wakeup->context);
     }
@@ -273,8 +354,9 @@ ioloop_add_wake_event(wakeup_t *wakeup, void *context, wakeup_callback_t callbac
         return false;
     }
     INFO("%p %p %d", wakeup, context, milliseconds);
-    add_remove_wakeup(wakeup, false);
-    wakeup->wakeup_time = ioloop_timenow() + milliseconds;
+    if (!wakeup_schedule(wakeup, ioloop_timenow() + milliseconds)) {
+        return false;
+    }
     wakeup->finalize = finalize;
     wakeup->wakeup = callback;
     wakeup->context = context;
@@ -284,7 +366,7 @@ ioloop_add_wake_event(wakeup_t *wakeup, void *context, wakeup_callback_t callbac
 void
 ioloop_cancel_wake_event(wakeup_t *wakeup)
 {
-    add_remove_wakeup(wakeup, true);
+    wakeup_unschedule(wakeup);
     wakeup->wakeup_time = 0;
 }
 
@@ -316,7 +398,8 @@ int
 ioloop_events(int64_t timeout_when)
 {
     io_t *io, **iop;
-    wakeup_t *wakeup, **p_wakeup;
+    wakeup_t *wakeup;
+    uint64_t serial_limit;
     int nev = 0, rv;
     int64_t now = ioloop_timenow();
     int64_t next_event;
@@ -341,41 +424,18 @@ ioloop_events(int64_t timeout_when)
     struct timespec ts;
 #endif
 
-start_over:
-    p_wakeup = &wakeups;
-
-    // A timeout of zero means don't time out.
-    if (timeout_when == 0) {
-        next_event = INT64_MAX;
-    } else {
-        next_event = timeout_when;
-    }
-
-    // Cycle through the list of timeouts.
-    while (*p_wakeup) {
-        wakeup = *p_wakeup;
-        if (wakeup->wakeup_time != 0) {
-            if (wakeup->wakeup_time <= ioloop_now) {
-                *p_wakeup = wakeup->next;
-                wakeup->wakeup_time = 0;
-                wakeup->wakeup(wakeup->context);
-                ++nev;
-
-                // In case either wakeup has been freed, or a new wakeup has been added, we need to start
-                // at the beginning again. This wakeup will never still be on the list unless it's been
-                // re-added with a later time, so this should always have the effect that every wakeup that's
-                // ready gets its callback called, and when all wakeups that are ready have been called,
-                // there are no wakeups that are ready remaining on the list, so our loop exits.
-                goto start_over;
-            } else {
-                p_wakeup = &wakeup->next;
-            }
-            if (wakeup->wakeup_time < next_event && wakeup->wakeup_time != 0) {
-                next_event = wakeup->wakeup_time;
-            }
-        } else {
-            *p_wakeup = wakeup->next;
+    // Call every wakeup that's due. Only wakeups that were scheduled before we got here are called, so a callback that
+    // schedules a wakeup that's already due can't keep us in this loop forever; it'll be called on the next pass.
+    serial_limit = wakeup_serial;
+    while (num_wakeups > 0) {
+        wakeup = wakeup_heap[0];
+        if (wakeup->wakeup_time > ioloop_now || wakeup->serial > serial_limit) {
+            break;
         }
+        wakeup_unschedule(wakeup);
+        wakeup->wakeup_time = 0;
+        wakeup->wakeup(wakeup->context);
+        ++nev;
     }
 
     // Deliver and consume any asynchronous events
@@ -406,11 +466,25 @@ start_over:
         iop = &io->next;
     }
 
+    // A timeout of zero means don't time out.
+    if (timeout_when == 0) {
+        next_event = INT64_MAX;
+    } else {
+        next_event = timeout_when;
+    }
+    if (num_wakeups > 0 && wakeup_heap[0]->wakeup_time < next_event) {
+        next_event = wakeup_heap[0]->wakeup_time;
+    }
+
     INFO("now: %" PRIu64 " next_event %" PRIu64, ioloop_now, next_event);
 
     // If we were given a timeout in the future, or told to wait indefinitely, wait until the next event.
     if (timeout_when == 0 || timeout_when > ioloop_now) {
         timeout = next_event - ioloop_now;
+        // A wakeup that was scheduled during this pass may already be due.
+        if (timeout < 0) {
+            timeout = 0;
+        }
         // Don't choose a time so far in the future that it might overflow some math in the kernel.
         if (timeout > IOLOOP_DAY * 100) {
             timeout = IOLOOP_DAY * 100;
@@ -142,7 +142,6 @@ struct io {
 
 struct wakeup {
     int ref_count;
-    wakeup_t *NULLABLE next;
     void *NULLABLE context;
     wakeup_callback_t NULLABLE wakeup;
     finalize_callback_t NULLABLE finalize;
@@ -150,6 +149,8 @@ struct wakeup {
     dispatch_source_t NULLABLE dispatch_source;
 #else
     int64_t wakeup_time;
+    uint64_t serial;   // Order in which the wakeup was scheduled, used to break ties on wakeup_time.
+    size_t heap_index; // One more than the wakeup's position in the timer heap, or zero if not scheduled.
 #endif
 };
 
@@ -25,6 +25,7 @@
 #include <unistd.h>
 #include <pwd.h>
 #include <errno.h>
+#include <ctype.h>
 #include <sys/socket.h>
 #include <netinet/in.h>
 #include <arpa/inet.h>
@@ -63,6 +64,12 @@ struct {
 adv_host_t *hosts;
 int advertise_interface = kDNSServiceInterfaceIndexAny;
 
+// Hash indexes on host name and service instance name, so that looking for a matching host or a conflicting
+// instance doesn't mean walking every host.
+#define SRP_NAME_INDEX_SIZE 1024
+static adv_host_t *host_index[SRP_NAME_INDEX_SIZE];
+static instance_index_entry_t *instance_index[SRP_NAME_INDEX_SIZE];
+
 static const char local_suffix_ld[] = ".local";
 static const char *local_suffix = &local_suffix_ld[1];
 uint32_t max_lease_time = 3600 * 27; // One day plus 20%
@@ -89,6 +96,142 @@ static void prepare_update(adv_host_t *host);
 static void lease_callback(void *context);
 static void host_finalize(adv_host_t *host);
 
+//======================================================================================================================
+// MARK: - Name indexes
+
+// Names are compared case-insensitively, so the hash is too.
+static uint32_t
+srp_name_hash(const char *name)
+{
+    uint32_t hash = 0;
+    const char *s;
+
+    for (s = name; *s != '\0'; s++) {
+        hash = hash * 31 + (uint8_t)(isascii(*s) ? tolower(*s) : *s);
+    }
+    return hash;
+}
+
+static void
+host_index_add(adv_host_t *host)
+{
+    adv_host_t **p_host = &host_index[srp_name_hash(host->name) % SRP_NAME_INDEX_SIZE];
+
+    host->index_next = *p_host;
+    *p_host = host;
+}
+
+static void
+host_index_remove(adv_host_t *host)
+{
+    adv_host_t **p_host;
+
+    for (p_host = &host_index[srp_name_hash(host->name) % SRP_NAME_INDEX_SIZE]; *p_host != NULL;
+         p_host = &(*p_host)->index_next)
+    {
+        if (*p_host == host) {
+            *p_host = host->index_next;
+            host->index_next = NULL;
+            return;
+        }
+    }
+}
+
+// Find the host on the hosts list with the given presentation-format name, if any.
+static adv_host_t *
+host_index_find(const char *name)
+{
+    adv_host_t *host;
+
+    for (host = host_index[srp_name_hash(name) % SRP_NAME_INDEX_SIZE]; host != NULL; host = host->index_next) {
+        if (!strcasecmp(name, host->name)) {
+            return host;
+        }
+    }
+    return NULL;
+}
+
+// The instance index is keyed on the instance name label in presentation format, which is what
+// extract_instance_name produces for adv_instance_t->instance_name.
+static void
+instance_index_key(char *key, size_t key_max, service_instance_t *instance)
+{
+    dns_name_print_to_limit(instance->name, instance->name != NULL ? instance->name->next : NULL, key, key_max);
+}
+
+static void
+instance_index_add(instance_index_entry_t *entry, const char *instance_name, adv_host_t *host)
+{
+    instance_index_entry_t **p_entry;
+
+    entry->hash = srp_name_hash(instance_name);
+    entry->host = host;
+    p_entry = &instance_index[entry->hash % SRP_NAME_INDEX_SIZE];
+    entry->next = *p_entry;
+    *p_entry = entry;
+}
+
+static void
+instance_index_remove(instance_index_entry_t *entry)
+{
+    instance_index_entry_t **p_entry;
+
+    if (entry->host == NULL) {
+        return;
+    }
+    for (p_entry = &instance_index[entry->hash % SRP_NAME_INDEX_SIZE]; *p_entry != NULL; p_entry = &(*p_entry)->next) {
+        if (*p_entry == entry) {
+            *p_entry = entry->next;
+            break;
+        }
+    }
+    entry->next = NULL;
+    entry->host = NULL;
+}
+
+// Index the service instances of a client update that is going onto host->clients.
+static bool
+client_update_index_add(client_update_t *client, service_instance_t *instances, adv_host_t *host)
+{
+    char key[DNS_MAX_LABEL_SIZE_ESCAPED + 1];
+    service_instance_t *instance;
+    int i, num = 0;
+
+    for (instance = instances; instance != NULL; instance = instance->next) {
+        num++;
+    }
+    if (num == 0) {
+        return true;
+    }
+    client->index_entries = calloc(num, sizeof(*client->index_entries));
+    if (client->index_entries == NULL) {
+        return false;
+    }
+    client->num_index_entries = num;
+    for (i = 0, instance = instances; instance != NULL; i++, instance = instance->next) {
+        instance_index_key(key, sizeof key, instance);
+        client->index_entries[i].client_instance = instance;
+        instance_index_add(&client->index_entries[i], key, host);
+    }
+    return true;
+}
+
+// Take a client update's instances out of the index once it's no longer on host->clients.
+static void
+client_update_index_remove(client_update_t *client)
+{
+    int i;
+
+    if (client->index_entries != NULL) {
+        for (i = 0; i < client->num_index_entries; i++) {
+            instance_index_remove(&client->index_entries[i]);
+        }
+        free(client->index_entries);
+        client->index_entries = NULL;
+        client->num_index_entries = 0;
+    }
+}
+
 //======================================================================================================================
 // MARK: - Functions
 
@@ -101,6 +244,7 @@ adv_address_finalize(adv_address_t *address)
 static void
 adv_instance_finalize(adv_instance_t *instance)
 {
+    instance_index_remove(&instance->index_entry);
     if (instance->conn != NULL) {
         service_connection_cancel_and_release(instance->conn);
     }
@@ -364,6 +508,7 @@ service_disconnected(adv_host_t *host)
 static void
 client_finalize(client_update_t *client)
 {
+    client_update_index_remove(client);
     srp_update_free_parts(client->instances, NULL, client->services, client->host);
     if (client->parsed_message != NULL) {
         dns_message_free(client->parsed_message);
@@ -651,7 +796,10 @@ srp_hosts_to_array(adv_host_t **host_array, int max)
 adv_host_t *
 srp_adv_host_copy_(dns_name_t *name, const char *file, int line)
 {
-    for (adv_host_t *host = hosts; host; host = host->next) {
+    char pres_name[DNS_MAX_NAME_SIZE_ESCAPED + 1];
+
+    dns_name_print(name, pres_name, sizeof pres_name);
+    for (adv_host_t *host = host_index[srp_name_hash(pres_name) % SRP_NAME_INDEX_SIZE]; host; host = host->index_next) {
         if (srp_adv_host_valid(host) && dns_names_equal_text(name, host->name)) {
             RETAIN(host);
             return host;
@@ -700,6 +848,7 @@ lease_callback(void *context)
 
     // De-link the host.
     *p_hosts = host->next;
+    host_index_remove(host);
 
     // Get rid of any transactions attached to the host, any timer events, and any other associated data.
     host_remove(host);
@@ -1528,6 +1677,8 @@ adv_instance_create(service_instance_t *raw, adv_host_t *host, adv_update_t *upd
         RELEASE_HERE(instance, adv_instance_finalize);
         return NULL;
     }
+    instance->index_entry.instance = instance;
+    instance_index_add(&instance->index_entry, instance->instance_name, host);
 
     // Allocate the text record buffer
     if (raw->txt != NULL) {
@@ -1965,6 +2116,7 @@ prepare_update(adv_host_t *host)
     RETAIN_HERE(update->host);
     update->client = client_update;
     host->clients = client_update->next;
+    client_update_index_remove(client_update);
     update->num_remove_addresses = num_remove_addrs;
     update->remove_addresses = remove_addrs;
     update->num_add_addresses = num_add_addrs;
@@ -2040,6 +2192,67 @@ compare_instance(adv_instance_t *instance,
     return missed;
 }
 
+// True if instance is one of its host's registered instances, or is being added by one of the host's updates.
+// Instances that an update is only replacing or removing don't count.
+static bool
+adv_instance_is_current(adv_instance_t *instance)
+{
+    adv_host_t *host = instance->host;
+    adv_update_t *update;
+    int i;
+
+    if (host->instances != NULL) {
+        for (i = 0; i < host->instances->num; i++) {
+            if (host->instances->vec[i] == instance) {
+                return true;
+            }
+        }
+    }
+    for (update = host->updates; update; update = update->next) {
+        if (update->add_instances != NULL) {
+            for (i = 0; i < update->add_instances->num; i++) {
+                if (update->add_instances->vec[i] == instance) {
+                    return true;
+                }
+            }
+        }
+    }
+    return false;
+}
+
+// Look up a new service instance in the instance index. This finds it whether it's registered, being added by an
+// update that has been baked, or in a client update that _hasn't_ been baked, so that we catch a duplicate update
+// that arrives while a previous update is in progress.
+static instance_outcome_t
+instance_index_lookup(service_instance_t *new_instance, dns_host_description_t *new_host,
+                      char *instance_name, char *service_type, adv_host_t **p_host)
+{
+    char key[DNS_MAX_LABEL_SIZE_ESCAPED + 1];
+    instance_index_entry_t *entry;
+    instance_outcome_t outcome;
+
+    instance_index_key(key, sizeof key, new_instance);
+    for (entry = instance_index[srp_name_hash(key) % SRP_NAME_INDEX_SIZE]; entry != NULL; entry = entry->next) {
+        outcome = missed;
+        if (entry->instance != NULL) {
+            if (adv_instance_is_current(entry->instance)) {
+                outcome = compare_instance(entry->instance, new_host, entry->host, instance_name, service_type);
+            }
+        } else if (dns_names_equal(entry->client_instance->name, new_instance->name)) {
+            if (!dns_names_equal_text(new_host->name, entry->host->name)) {
+                outcome = conflict;
+            } else {
+                outcome = match;
+            }
+        }
+        if (outcome != missed) {
+            *p_host = entry->host;
+            return outcome;
+        }
+    }
+    return missed;
+}
+
 bool
 srp_update_start(comm_t *connection, void *context, dns_message_t *parsed_message, message_t *raw_message,
                  dns_host_description_t *new_host, service_instance_t *instances, service_t *services,
@@ -2048,7 +2261,7 @@ srp_update_start(comm_t *connection, void *context, dns_message_t *parsed_messag
 {
     adv_host_t *host, **p_hosts = NULL;
     char pres_name[DNS_MAX_NAME_SIZE_ESCAPED + 1];
-    service_instance_t *new_instance, *client_instance;
+    service_instance_t *new_instance;
     instance_outcome_t outcome = missed;
     adv_update_t *update;
     client_update_t *client_update, **p_client_update;
@@ -2093,54 +2306,23 @@ srp_update_start(comm_t *connection, void *context, dns_message_t *parsed_messag
     }
 
     // Look for matching service instance names.   A service instance name that matches, but has a different
-    // hostname, means that there is a conflict.   We have to look through all the entries; the presence of
-    // a matching hostname doesn't mean we are done UNLESS there's a matching service instance name pointing
-    // to that hostname.
-    for (host = hosts; host; host = host->next) {
-        // We need to look for matches both in the registered instances for this registration, and also in
-        // the list of new instances, in case we get a duplicate update while a previous update is in progress.
-        for (new_instance = instances; new_instance; new_instance = new_instance->next) {
-            extract_instance_name(instance_name, sizeof instance_name, service_type, sizeof service_type, new_instance);
-
-            // First check for a match or conflict in the host itself.
-            for (int i = 0; i < host->instances->num; i++) {
-                outcome = compare_instance(host->instances->vec[i], new_host, host,
-                                           instance_name, service_type);
-                if (outcome != missed) {
-                    goto found_something;
-                }
-            }
+    // hostname, means that there is a conflict.   A conflict on any instance wins over a match on another.
+    for (new_instance = instances; new_instance; new_instance = new_instance->next) {
+        adv_host_t *instance_host = NULL;
+        instance_outcome_t instance_outcome;
 
-            // Then look for the same thing in any subsequent updates that have been baked.
-            for (update = host->updates; update; update = update->next) {
-                if (update->add_instances != NULL) {
-                    for (int i = 0; i < update->add_instances->num; i++) {
-                        outcome = compare_instance(update->add_instances->vec[i], new_host, host,
-                                                   instance_name, service_type);
-                        if (outcome != missed) {
-                            goto found_something;
-                        }
-                    }
-                }
-            }
-
-            // Finally, look for it in any updates that _haven't_ been baked.
-            for (client_update = host->clients; client_update; client_update = client_update->next) {
-                for (client_instance = client_update->instances; client_instance;
-                     client_instance = client_instance->next) {
-                    if (dns_names_equal(client_instance->name, new_instance->name)) {
-                        if (!dns_names_equal_text(new_host->name, host->name)) {
-                            outcome = conflict;
-                        } else {
-                            outcome = match;
-                        }
-                        goto found_something;
-                    }
-                }
-            }
+        extract_instance_name(instance_name, sizeof instance_name, service_type, sizeof service_type, new_instance);
+        instance_outcome = instance_index_lookup(new_instance, new_host, instance_name, service_type, &instance_host);
+        if (instance_outcome == conflict) {
+            outcome = conflict;
+            host = instance_host;
+            break;
+        }
+        if (instance_outcome == match && outcome == missed) {
+            outcome = match;
+            host = instance_host;
         }
     }
-found_something:
     if (outcome == conflict) {
         ERROR("srp_update_start: service instance name " PRI_S_SRP "/" PRI_S_SRP " already pointing to host "
               PRI_S_SRP ", not host " PRI_S_SRP, instance_name, service_type, host->name, new_host_name);
@@ -2151,35 +2333,30 @@ found_something:
     // If we fall off the end looking for a matching service instance, there isn't a matching
     // service instance, but there may be a matching host, so look for that.
     if (outcome == missed) {
-        // Search for the new hostname in the list of hosts, which is sorted.
-        for (p_hosts = &hosts; *p_hosts; p_hosts = &host->next) {
-            host = *p_hosts;
-            int comparison = strcasecmp(new_host_name, host->name);
-            if (comparison == 0) {
-                // If we get an update for a host that was removed, and it's not also a remove,
-                // remove the host entry that's marking the remove. If this is a remove, just flag
-                // it as a miss.
-                if (host->removed) {
-                    outcome = missed;
-                    if (remove) {
-                        break;
+        host = host_index_find(new_host_name);
+        if (host != NULL) {
+            // If we get an update for a host that was removed, and it's not also a remove,
+            // remove the host entry that's marking the remove. If this is a remove, just flag
+            // it as a miss.
+            if (host->removed) {
+                if (!remove) {
+                    for (p_hosts = &hosts; *p_hosts != NULL && *p_hosts != host; p_hosts = &(*p_hosts)->next)
+                        ;
+                    if (*p_hosts != NULL) {
+                        *p_hosts = host->next;
                     }
-                    *p_hosts = host->next;
+                    host_index_remove(host);
                     host_invalidate(host);
                     host_finalize(host);
-                    break;
-                }
-                if (key_id == host->key_id && dns_keys_rdata_equal(new_host->key, &host->key)) {
-                    outcome = match;
-                    break;
                 }
+            } else if (key_id == host->key_id && dns_keys_rdata_equal(new_host->key, &host->key)) {
+                outcome = match;
+            } else {
                 ERROR("srp_update_start: update for host " PRI_S_SRP " has key id %" PRIx32
                       " which doesn't match host key id %" PRIx32 ".",
                       host->name, key_id, host->key_id);
                 advertise_finished(NULL, context, connection, raw_message, dns_rcode_yxdomain, NULL);
                 goto cleanup;
-            } else if (comparison < 0) {
-                break;
             }
         }
     } else {
@@ -2255,12 +2432,13 @@ found_something:
         host->key.data.key.key = &host->key_rdata[4];
         host->key_id = key_id;
 
-        // Insert this in the list where it would have sorted.  The if test is because the optimizer doesn't notice that
-        // p_hosts can never be null here--it will always be pointing to the end of the list of hosts if we get here.
-        if (p_hosts != NULL) {
-            host->next = *p_hosts;
-            *p_hosts = host;
-        }
+        // Insert this in the list where it would have sorted.
+        for (p_hosts = &hosts; *p_hosts != NULL && strcasecmp(new_host_name, (*p_hosts)->name) > 0;
+             p_hosts = &(*p_hosts)->next)
+            ;
+        host->next = *p_hosts;
+        *p_hosts = host;
+        host_index_add(host);
         p_hosts = NULL;
     }
 
@@ -2305,6 +2483,12 @@ found_something:
         advertise_finished(NULL, context, connection, raw_message, dns_rcode_servfail, NULL);
         goto cleanup;
     }
+    if (!client_update_index_add(client_update, instances, host)) {
+        ERROR("srp_update_start: no memory for instance index entries.");
+        advertise_finished(NULL, context, connection, raw_message, dns_rcode_servfail, NULL);
+        free(client_update);
+        goto cleanup;
+    }
 
     if (outcome == missed) {
         INFO("New host " PRI_S_SRP ", key id %" PRIx32 , host->name, host->key_id);
@@ -2404,6 +2588,7 @@ srp_mdns_flush(void)
             host->clients = NULL;
         }
         host_next = host->next;
+        host_index_remove(host);
         host_remove(host);
     }
     hosts = NULL;
@@ -2413,7 +2598,7 @@ static void
 usage(void)
 {
     ERROR("srp-mdns-proxy [--max-lease-time <seconds>] [--min-lease-time <seconds>] [--log-stderr]");
-    ERROR("               [--enable-replication | --disable-replication]");
+    ERROR("               [--enable-replication | --disable-replication] [--replication-window <messages>]");
 #if SRP_FEATURE_NAT64
     ERROR("               [--enable-nat64 | --disable-nat64]");
 #endif
@@ -2457,6 +2642,16 @@ main(int argc, char **argv)
             srp_replication_enabled = true;
         } else if (!strcmp(argv[i], "--disable-replication")) {
             srp_replication_enabled = false;
+        } else if (!strcmp(argv[i], "--replication-window")) {
+            if (i + 1 == argc) {
+                usage();
+            }
+            srpl_sync_window = (int)strtol(argv[i + 1], &end, 10);
+            if (end == argv[i + 1] || end[0] != 0 ||
+                srpl_sync_window < 1 || srpl_sync_window > SRPL_SYNC_WINDOW_MAX) {
+                usage();
+            }
+            i++;
 #if SRP_FEATURE_NAT64
         } else if (!strcmp(argv[i], "--enable-nat64")) {
             srp_nat64_enabled = true;
@@ -31,6 +31,17 @@ typedef struct adv_instance_vec adv_instance_vec_t;
 typedef struct adv_host_vec adv_host_vec_t;
 typedef struct adv_address_vec adv_address_vec_t;
 typedef struct srpl_connection srpl_connection_t;
+typedef struct instance_index_entry instance_index_entry_t;
+
+// An entry in the index of service instance names, which is keyed on the instance name label. Each entry is either
+// an adv_instance_t or a service instance in a client update that hasn't been prepared yet.
+struct instance_index_entry {
+    instance_index_entry_t *NULLABLE next;          // Next entry in the same bucket
+    adv_host_t *NULLABLE host;                      // Host the instance belongs to; NULL if not in the index
+    adv_instance_t *NULLABLE instance;              // Prepared or registered instance, or
+    service_instance_t *NULLABLE client_instance;   // instance in an unprepared client update
+    uint32_t hash;                                  // Hash of the instance name label
+};
 
 struct adv_instance {
     int ref_count;
@@ -42,6 +53,7 @@ struct adv_instance {
     int port;                      // Port on which service can be found.
     char *NULLABLE txt_data;       // Contents of txt record
     uint16_t txt_length;           // length of txt record contents
+    instance_index_entry_t index_entry; // Entry for this instance in the instance name index
 };
 
 // An address registration
@@ -60,6 +72,7 @@ struct adv_host {
     wakeup_t *NONNULL lease_wakeup;        // Wakeup at least expiry time
     service_connection_t *NULLABLE conn;   // Connection handler to mDNSResponder that shares DNSServiceRef with others.
     adv_host_t *NULLABLE next;             // Hosts are maintained in a linked list.
+    adv_host_t *NULLABLE index_next;       // Next host in the same bucket of the host name index
     adv_update_t *NULLABLE updates;        // Updates to this host, if any
     client_update_t *NULLABLE clients;     // Updates that clients have sent for which replies have not yet been sent.
     char *NONNULL name;                    // Name of host (without domain)
@@ -172,6 +185,8 @@ struct client_update {
     uint32_t host_lease, key_lease;           // Lease intervals for host entry and key entry.
     uint32_t serial_number;                   // Serial number sent by client, if one was sent
     bool serial_sent;                         // True if serial number was sent.
+    instance_index_entry_t *NULLABLE index_entries; // Instance index entries, while the update is on host->clients
+    int num_index_entries;
 
 };
 
@@ -93,7 +93,7 @@ add_host_addr(host_addr_t **dest, dns_rr_t *rr)
 }
 
 static bool
-replace_zone_name(dns_name_t **nzp_in, dns_name_t *uzp, dns_name_t *replacement_zone)
+replace_zone_name(dns_message_t *message, dns_name_t **nzp_in, dns_name_t *uzp, dns_name_t *replacement_zone)
 {
     dns_name_t **nzp = nzp_in;
     while (*nzp != NULL && *nzp != uzp) {
@@ -104,11 +104,9 @@ replace_zone_name(dns_name_t **nzp_in, dns_name_t *uzp, dns_name_t *replacement_
         return false;
     }
 
-    // Free the suffix we're replacing
-    dns_name_free(*nzp);
-
-    // Replace it.
-    *nzp = dns_name_copy(replacement_zone);
+    // Replace the suffix. The old one belongs to the message's arena, so it's freed with the message, and so is
+    // the replacement.
+    *nzp = dns_message_name_copy(message, replacement_zone);
     if (*nzp == NULL) {
         ERROR("replace_zone_name: no memory for replacement zone");
         return false;
@@ -627,13 +625,13 @@ srp_evaluate(comm_t *connection, void *context, dns_message_t *message, message_
         // zone for which the delete is a subdomain, so we can just replace it without
         // finding it again.
         for (dp = deletes; dp; dp = dp->next) {
-            replace_zone_name(&dp->name, dp->zone, replacement_zone);
+            replace_zone_name(message, &dp->name, dp->zone, replacement_zone);
         }
 
         // All services have PTR records, which point to names.   Both the service name and the
         // PTR name have to be fixed up.
         for (sp = services; sp; sp = sp->next) {
-            replace_zone_name(&sp->rr->name, sp->zone, replacement_zone);
+            replace_zone_name(message, &sp->rr->name, sp->zone, replacement_zone);
             uzp = dns_name_subdomain_of(sp->rr->data.ptr.name, update_zone);
             // We already validated that the PTR record points to something in the zone, so this
             // if condition should always be false.
@@ -641,7 +639,7 @@ srp_evaluate(comm_t *connection, void *context, dns_message_t *message, message_
                 ERROR("service PTR record zone match fail!!");
                 goto out;
             }
-            replace_zone_name(&sp->rr->data.ptr.name, uzp, replacement_zone);
+            replace_zone_name(message, &sp->rr->data.ptr.name, uzp, replacement_zone);
         }
 
         // All service instances have SRV records, which point to names.  The service instance
@@ -655,7 +653,7 @@ srp_evaluate(comm_t *connection, void *context, dns_message_t *message, message_
                 ERROR("service instance SRV record zone match fail!!");
                 goto out;
             }
-            replace_zone_name(&sip->srv->data.srv.name, uzp, replacement_zone);
+            replace_zone_name(message, &sip->srv->data.srv.name, uzp, replacement_zone);
         }
 
         // We shouldn't need to replace the hostname zone because it's actually pointing to
@@ -58,6 +58,7 @@ static char *current_thread_domain;
 static srpl_domain_t *srpl_domains;
 static unclaimed_connection_t *unclaimed_connections;
 static uint64_t server_id;
+int srpl_sync_window = 1;
 
 #define srpl_event_content_type_set(event, content_type) \
     srpl_event_content_type_set_(event, content_type, __FILE__, __LINE__)
@@ -428,6 +429,7 @@ srpl_connection_candidates_free(srpl_connection_t *srpl_connection)
     srpl_connection->candidates = NULL;
 out:
     srpl_connection->num_candidates = srpl_connection->current_candidate = 0;
+    srpl_connection->candidate_response_index = srpl_connection->hosts_in_flight = 0;
     return;
 }
 
@@ -443,6 +445,34 @@ srpl_srp_client_update_queue_free(srpl_connection_t *srpl_connection)
     }
 }
 
+static void
+srpl_wanted_candidates_free(srpl_connection_t *srpl_connection)
+{
+    while (srpl_connection->wanted_candidates != NULL) {
+        srpl_candidate_t *candidate = srpl_connection->wanted_candidates;
+        srpl_connection->wanted_candidates = candidate->next;
+        srpl_candidate_free(candidate);
+    }
+}
+
+static void
+srpl_deferred_message_free(srpl_deferred_message_t *deferred)
+{
+    srpl_event_content_type_set(&deferred->event, srpl_event_content_type_none);
+    ioloop_message_release(deferred->message);
+    free(deferred);
+}
+
+static void
+srpl_deferred_messages_free(srpl_connection_t *srpl_connection)
+{
+    while (srpl_connection->deferred_messages != NULL) {
+        srpl_deferred_message_t *deferred = srpl_connection->deferred_messages;
+        srpl_connection->deferred_messages = deferred->next;
+        srpl_deferred_message_free(deferred);
+    }
+}
+
 static void
 srpl_connection_candidate_set(srpl_connection_t *srpl_connection, srpl_candidate_t *candidate)
 {
@@ -463,6 +493,8 @@ srpl_connection_attachments_free(srpl_connection_t *srpl_connection)
     }
     srpl_connection_candidates_free(srpl_connection);
     srpl_srp_client_update_queue_free(srpl_connection);
+    srpl_wanted_candidates_free(srpl_connection);
+    srpl_deferred_messages_free(srpl_connection);
 }
 
 static void
@@ -734,7 +766,11 @@ srpl_dso_message_setup(dso_state_t *dso, dso_message_t *state, dns_towire_state_
         return false;
     }
 
-    dso_make_message(state, buffer, buffer_size, dso, false, response, response ? message->wire.id : 0, rcode, context);
+    if (!dso_make_message(state, buffer, buffer_size, dso, false, response, response ? message->wire.id : 0, rcode,
+                          context)) {
+        ERROR("no room for another outstanding query on " PRI_S_SRP, dso->remote_name);
+        return false;
+    }
     memset(towire, 0, sizeof(*towire));
     towire->p = &buffer[DNS_HEADER_SIZE];
     towire->lim = towire->p + (buffer_size - DNS_HEADER_SIZE);
@@ -1140,6 +1176,48 @@ srpl_send_candidates_response(srpl_connection_t *srpl_connection, dso_state_t *d
     }
 }
 
+// During database sync the sender may have several candidate and host messages outstanding. We only work on one host
+// at a time, so anything that arrives while we are applying a host is queued, and replayed in order when we get back
+// to send_candidates_wait. Returns true if the event was consumed.
+static bool
+srpl_sync_message_defer(srpl_connection_t *srpl_connection, message_t *message, srpl_event_t *event)
+{
+    switch(srpl_connection->state) {
+    case srpl_state_candidate_host_contention_wait:
+    case srpl_state_candidate_host_apply:
+    case srpl_state_candidate_host_apply_wait:
+        break;
+    default:
+        // If earlier messages are still queued, this one has to go behind them.
+        if (srpl_connection->deferred_messages == NULL) {
+            return false;
+        }
+        break;
+    }
+
+    srpl_deferred_message_t *deferred = calloc(1, sizeof(*deferred));
+    if (deferred == NULL) {
+        ERROR(PRI_S_SRP ": no memory to defer " PUB_S_SRP " event", srpl_connection->name, event->name);
+        srpl_disconnect(srpl_connection);
+        return true;
+    }
+    // Steal the event contents so that the caller's cleanup doesn't free them.
+    deferred->event = *event;
+    memset(&event->content, 0, sizeof(event->content));
+    event->content_type = srpl_event_content_type_none;
+    deferred->message = message;
+    ioloop_message_retain(deferred->message);
+
+    srpl_deferred_message_t **dp = &srpl_connection->deferred_messages;
+    while (*dp != NULL) {
+        dp = &(*dp)->next;
+    }
+    *dp = deferred;
+    INFO(PRI_S_SRP ": deferred " PUB_S_SRP " event in state " PUB_S_SRP,
+         srpl_connection->name, event->name, srpl_connection->state_name);
+    return true;
+}
+
 static bool
 srpl_candidate_message_parse_in(int index, const uint8_t *buffer, unsigned *offp, uint16_t length, void *context)
 {
@@ -1173,9 +1251,11 @@ srpl_candidate_message(srpl_connection_t *srpl_connection, message_t *message, d
         goto fail;
     }
 
-    srpl_connection_message_set(srpl_connection, message);
     event.content.candidate->update_time = time(NULL) - event.content.candidate->update_offset;
-    srpl_event_deliver(srpl_connection, &event);
+    if (!srpl_sync_message_defer(srpl_connection, message, &event)) {
+        srpl_connection_message_set(srpl_connection, message);
+        srpl_event_deliver(srpl_connection, &event);
+    }
     srpl_event_content_type_set(&event, srpl_event_content_type_none);
     return;
 
@@ -1286,8 +1366,10 @@ srpl_host_message(srpl_connection_t *srpl_connection, message_t *message, dso_st
         event.content.host_update.update_time =
             time(NULL) - event.content.host_update.update_offset;
         event.content.host_update.message->received_time = event.content.host_update.update_time;
-        srpl_connection_message_set(srpl_connection, message);
-        srpl_event_deliver(srpl_connection, &event);
+        if (!srpl_sync_message_defer(srpl_connection, message, &event)) {
+            srpl_connection_message_set(srpl_connection, message);
+            srpl_event_deliver(srpl_connection, &event);
+        }
         srpl_event_content_type_set(&event, srpl_event_content_type_none);
     }
     return;
@@ -1660,7 +1742,8 @@ srpl_connected(comm_t *connection, void *context)
     srpl_connection_t *srpl_connection = context;
 
     INFO(PRI_S_SRP " connected", connection->name);
-    connection->dso = dso_state_create(false, 1, connection->name, srpl_instance_dso_event_callback,
+    connection->dso = dso_state_create(false, SRPL_DSO_MAX_OUTSTANDING_QUERIES, connection->name,
+                                       srpl_instance_dso_event_callback,
                                        srpl_connection, NULL, connection);
     if (connection->dso == NULL) {
         ERROR(PRI_S_SRP " can't create dso state object.", srpl_connection->name);
@@ -2671,11 +2754,28 @@ srpl_send_candidates_send_action(srpl_connection_t *srpl_connection, srpl_event_
     return srpl_state_send_candidates_wait;
 }
 
-// Used by srpl_send_candidates_wait_action and srpl_host_wait_action
+// Find the candidate we asked for that matches an incoming host message, and take it off the wanted list.
+static srpl_candidate_t *
+srpl_wanted_candidate_claim(srpl_connection_t *srpl_connection, dns_name_t *hostname)
+{
+    for (srpl_candidate_t **cp = &srpl_connection->wanted_candidates; *cp != NULL; cp = &(*cp)->next) {
+        srpl_candidate_t *candidate = *cp;
+        if (dns_names_equal(candidate->name, hostname)) {
+            *cp = candidate->next;
+            candidate->next = NULL;
+            return candidate;
+        }
+    }
+    return NULL;
+}
+
+// Used by srpl_send_candidates_wait_action, both for live events and for events deferred while applying a host.
 static srpl_state_t
 srpl_send_candidates_wait_event_process(srpl_connection_t *srpl_connection, srpl_event_t *event)
 {
     if (event->event_type == srpl_event_send_candidates_response_received) {
+        // Any candidates whose hosts never arrived went away on the remote before it could send them.
+        srpl_wanted_candidates_free(srpl_connection);
         if (srpl_connection->is_server) {
             srpl_connection->database_synchronized = true;
             return srpl_state_ready;
@@ -2686,11 +2786,38 @@ srpl_send_candidates_wait_event_process(srpl_connection_t *srpl_connection, srpl
         srpl_connection_candidate_set(srpl_connection, event->content.candidate);
         event->content.candidate = NULL; // steal!
         return srpl_state_candidate_check;
+    } else if (event->event_type == srpl_event_host_message_received) {
+        srpl_candidate_t *candidate = srpl_wanted_candidate_claim(srpl_connection,
+                                                                  event->content.host_update.hostname);
+        if (candidate == NULL) {
+            // We didn't ask for this host. Answer anyway so that the sender doesn't stall waiting for a response.
+            INFO(PRI_S_SRP ": host message for a host we didn't ask for.", srpl_connection->name);
+            srpl_host_response_send(srpl_connection, dns_rcode_refused);
+            return srpl_state_invalid;
+        }
+        srpl_connection_candidate_set(srpl_connection, candidate);
+        // Copy the update information, retain what's refcounted, and free what's not on the event.
+        srpl_host_update_steal_parts(&srpl_connection->stashed_host, &event->content.host_update);
+        return srpl_state_candidate_host_prepare;
     } else {
         UNEXPECTED_EVENT(srpl_connection, event);
     }
 }
 
+// Deliver the oldest message that arrived while we were busy applying a host.
+static srpl_state_t
+srpl_deferred_message_replay(srpl_connection_t *srpl_connection)
+{
+    srpl_deferred_message_t *deferred = srpl_connection->deferred_messages;
+    srpl_connection->deferred_messages = deferred->next;
+
+    INFO(PRI_S_SRP ": replaying deferred " PUB_S_SRP " event", srpl_connection->name, deferred->event.name);
+    srpl_connection_message_set(srpl_connection, deferred->message);
+    srpl_state_t next_state = srpl_send_candidates_wait_event_process(srpl_connection, &deferred->event);
+    srpl_deferred_message_free(deferred);
+    return next_state;
+}
+
 // We reach this state after having sent a "send candidates" message, so we can in principle get either a
 // "candidate" message or a "send candidates" response here, leading either to send_candidates check or one
 // of two states depending on whether this connection is an incoming or outgoing connection. Outgoing
@@ -2699,6 +2826,10 @@ srpl_send_candidates_wait_event_process(srpl_connection_t *srpl_connection, srpl
 // message last, so when they get the "send candidates" reply, the database sync is done and it's time to
 // just deal with ongoing updates. In this case we go to the check_for_srp_client_updates state, which
 // looks to see if any updates came in from SRP clients while we were syncing the databases.
+//
+// We also come back here after answering each candidate and after applying each host we asked for. The remote may
+// send several candidates before we've answered the first, so host messages can arrive here interleaved with
+// candidates; we match them to the candidates we asked for by name.
 static srpl_state_t
 srpl_send_candidates_wait_action(srpl_connection_t *srpl_connection, srpl_event_t *event)
 {
@@ -2706,6 +2837,13 @@ srpl_send_candidates_wait_action(srpl_connection_t *srpl_connection, srpl_event_
     STATE_ANNOUNCE(srpl_connection, event);
 
     if (event == NULL) {
+        // Pick up anything that arrived while we were applying the previous host.
+        while (srpl_connection->deferred_messages != NULL) {
+            srpl_state_t next_state = srpl_deferred_message_replay(srpl_connection);
+            if (next_state != srpl_state_invalid) {
+                return next_state;
+            }
+        }
         return srpl_state_invalid; // Wait for events.
     }
     return srpl_send_candidates_wait_event_process(srpl_connection, event);
@@ -2751,9 +2889,17 @@ srpl_candidate_check_action(srpl_connection_t *srpl_connection, srpl_event_t *ev
         srp_adv_host_release(host);
     }
     switch(disposition) {
-    case srpl_candidate_yes:
+    case srpl_candidate_yes: {
         srpl_candidate_response_send(srpl_connection, kDSOType_SRPLCandidateYes);
-        return srpl_state_candidate_host_wait;
+        // Remember the candidate until its host arrives; the remote may send more candidates first.
+        srpl_candidate_t **cp = &srpl_connection->wanted_candidates;
+        while (*cp != NULL) {
+            cp = &(*cp)->next;
+        }
+        *cp = srpl_connection->candidate;
+        srpl_connection->candidate = NULL;
+        return srpl_state_send_candidates_wait;
+    }
     case srpl_candidate_no:
         srpl_candidate_response_send(srpl_connection, kDSOType_SRPLCandidateNo);
         return srpl_state_send_candidates_wait;
@@ -2764,27 +2910,6 @@ srpl_candidate_check_action(srpl_connection_t *srpl_connection, srpl_event_t *ev
     return srpl_state_invalid;
 }
 
-// In candidate_host_send_wait, we take no action and wait for events. We're hoping for a "host" message, leading to
-// candidate_host_prepare. We could also receive a "candidate" message, leading to candidate_received, or a "send
-// candidates" reply, leading to candidate_reply_received.
-
-static srpl_state_t
-srpl_candidate_host_wait_action(srpl_connection_t *srpl_connection, srpl_event_t *event)
-{
-    REQUIRE_SRPL_INSTANCE(srpl_connection);
-    STATE_ANNOUNCE(srpl_connection, event);
-
-    if (event == NULL) {
-        return srpl_state_invalid; // Wait for events.
-    } else if (event->event_type == srpl_event_host_message_received) {
-        // Copy the update information, retain what's refcounted, and free what's not on the event.
-        srpl_host_update_steal_parts(&srpl_connection->stashed_host, &event->content.host_update);
-        return srpl_state_candidate_host_prepare;
-    } else {
-        return srpl_send_candidates_wait_event_process(srpl_connection, event);
-    }
-}
-
 // Here we want to see if we can do an immediate update; if so, we go to candidate_host_re_evaluate; otherwise
 // we go to candidate_host_contention_wait
 static srpl_state_t
@@ -3060,10 +3185,14 @@ srpl_send_candidates_received_action(srpl_connection_t *srpl_connection, srpl_ev
     }
     srpl_connection->num_candidates = num_candidates;
     srpl_connection->current_candidate = -1;
+    srpl_connection->candidate_response_index = 0;
+    srpl_connection->hosts_in_flight = 0;
     return srpl_state_send_candidates_remaining_check;
 }
 
-// See if there are candidates remaining; if not, send "send candidates" response.
+// See if there are candidates remaining; if not, send "send candidates" response. We keep up to srpl_sync_window
+// candidate and host messages outstanding at a time, so if the window is full we wait for a response instead. Since the
+// remote answers candidate messages in order, the responses tell us which candidate they're for.
 static srpl_state_t
 srpl_candidates_remaining_check_action(srpl_connection_t *srpl_connection, srpl_event_t *event)
 {
@@ -3071,11 +3200,19 @@ srpl_candidates_remaining_check_action(srpl_connection_t *srpl_connection, srpl_
     REQUIRE_SRPL_INSTANCE(srpl_connection);
     STATE_ANNOUNCE_NO_EVENTS(srpl_connection);
 
+    int in_flight = (srpl_connection->current_candidate + 1 - srpl_connection->candidate_response_index +
+                     srpl_connection->hosts_in_flight);
+
     // Get the next candidate out of the candidate list
     // Return "no candidates left" or "next candidate"
     if (srpl_connection->current_candidate + 1 < srpl_connection->num_candidates) {
-        srpl_connection->current_candidate++;
-        return srpl_state_next_candidate_send;
+        if (in_flight < srpl_sync_window) {
+            srpl_connection->current_candidate++;
+            return srpl_state_next_candidate_send;
+        }
+        return srpl_state_next_candidate_send_wait;
+    } else if (in_flight > 0) {
+        return srpl_state_next_candidate_send_wait;
     } else {
         return srpl_state_send_candidates_response_send;
     }
@@ -3089,11 +3226,13 @@ srpl_next_candidate_send_action(srpl_connection_t *srpl_connection, srpl_event_t
     REQUIRE_SRPL_INSTANCE(srpl_connection);
     STATE_ANNOUNCE_NO_EVENTS(srpl_connection);
 
-    srpl_candidate_message_send(srpl_connection, srpl_connection->candidates[srpl_connection->current_candidate]);
-    return srpl_state_next_candidate_send_wait;
+    if (!srpl_candidate_message_send(srpl_connection, srpl_connection->candidates[srpl_connection->current_candidate])) {
+        return srpl_state_disconnect;
+    }
+    return srpl_state_send_candidates_remaining_check;
 }
 
-// Wait for a "candidate" response.
+// Wait for a "candidate" response or a "host" response.
 static srpl_state_t
 srpl_next_candidate_send_wait_action(srpl_connection_t *srpl_connection, srpl_event_t *event)
 {
@@ -3103,6 +3242,10 @@ srpl_next_candidate_send_wait_action(srpl_connection_t *srpl_connection, srpl_ev
     if (event == NULL) {
         return srpl_state_invalid; // Wait for events.
     } else if (event->event_type == srpl_event_candidate_response_received) {
+        if (srpl_connection->candidate_response_index > srpl_connection->current_candidate) {
+            UNEXPECTED_EVENT(srpl_connection, event);
+        }
+        srpl_connection->candidate_response_index++;
         switch (event->content.disposition) {
         case srpl_candidate_yes:
             return srpl_state_candidate_host_send;
@@ -3111,12 +3254,20 @@ srpl_next_candidate_send_wait_action(srpl_connection_t *srpl_connection, srpl_ev
             return srpl_state_send_candidates_remaining_check;
         }
         return srpl_state_invalid;
+    } else if (event->event_type == srpl_event_host_response_received) {
+        if (srpl_connection->hosts_in_flight == 0) {
+            UNEXPECTED_EVENT(srpl_connection, event);
+        }
+        srpl_connection->hosts_in_flight--;
+        // The only failure case we care about is a conflict, and we don't have a way to handle that, so just
+        // continue without checking the status.
+        return srpl_state_send_candidates_remaining_check;
     } else {
         UNEXPECTED_EVENT(srpl_connection, event);
     }
 }
 
-// Send the host for the candidate.
+// Send the host for the candidate the remote just asked for.
 static srpl_state_t
 srpl_candidate_host_send_action(srpl_connection_t *srpl_connection, srpl_event_t *event)
 {
@@ -3126,30 +3277,15 @@ srpl_candidate_host_send_action(srpl_connection_t *srpl_connection, srpl_event_t
 
     // It's possible that the host that we put on the candidates list has become invalid. If so, just go back and send
     // the next candidate (or finish).
-    adv_host_t *host = srpl_connection->candidates[srpl_connection->current_candidate];
+    adv_host_t *host = srpl_connection->candidates[srpl_connection->candidate_response_index - 1];
     if (!srp_adv_host_valid(host) || host->message == NULL) {
         return srpl_state_send_candidates_remaining_check;
     }
-    srpl_host_message_send(srpl_connection, host);
-    return srpl_state_candidate_host_response_wait;
-}
-
-// Wait for a "host" response.
-static srpl_state_t
-srpl_candidate_host_response_wait_action(srpl_connection_t *srpl_connection, srpl_event_t *event)
-{
-    REQUIRE_SRPL_INSTANCE(srpl_connection);
-    STATE_ANNOUNCE(srpl_connection, event);
-
-    if (event == NULL) {
-        return srpl_state_invalid; // Wait for events.
-    } else if (event->event_type == srpl_event_host_response_received) {
-        // The only failure case we care about is a conflict, and we don't have a way to handle that, so just
-        // continue without checking the status.
-        return srpl_state_send_candidates_remaining_check;
-    } else {
-        UNEXPECTED_EVENT(srpl_connection, event);
+    if (!srpl_host_message_send(srpl_connection, host)) {
+        return srpl_state_disconnect;
     }
+    srpl_connection->hosts_in_flight++;
+    return srpl_state_send_candidates_remaining_check;
 }
 
 // At this point we're done sending candidates, so we send a "send candidates" response.
@@ -3523,13 +3659,12 @@ static srpl_connection_state_t srpl_connection_states[] = {
     { STATE_NAME_DECL(send_candidates_send),                 srpl_send_candidates_send_action },
     { STATE_NAME_DECL(send_candidates_wait),                 srpl_send_candidates_wait_action },
 
-    // Got a "candidate" message, need to check it and send the right reply.
+    // Got a "candidate" message, need to check it and send the right reply. If we want the host, the candidate goes
+    // on the wanted list and we go back to send_candidates_wait for the host message. It's possible that the host
+    // went away in the interim, in which case the remote will never send it.
     { STATE_NAME_DECL(candidate_check),                      srpl_candidate_check_action },
 
-    // At this point we've send a candidate reply, so we're waiting for a host message. It's possible that the host
-    // went away in the interim, in which case we will get a "candidate" message or a "send candidate" reply.
-
-    { STATE_NAME_DECL(candidate_host_wait),                  srpl_candidate_host_wait_action },
+    // We got a host message for a candidate we asked for.
     { STATE_NAME_DECL(candidate_host_prepare),               srpl_candidate_host_prepare_action },
     { STATE_NAME_DECL(candidate_host_contention_wait),       srpl_candidate_host_contention_wait_action },
     { STATE_NAME_DECL(candidate_host_re_evaluate),           srpl_candidate_host_re_evaluate_action },
@@ -3544,12 +3679,10 @@ static srpl_connection_state_t srpl_connection_states[] = {
     { STATE_NAME_DECL(send_candidates_remaining_check),      srpl_candidates_remaining_check_action },
     // Send a "candidate" message for the next candidate
     { STATE_NAME_DECL(next_candidate_send),                  srpl_next_candidate_send_action },
-    // Wait for a response to the "candidate" message
+    // Wait for a response to a "candidate" or "host" message
     { STATE_NAME_DECL(next_candidate_send_wait),             srpl_next_candidate_send_wait_action },
     // The candidate requested, so send its host info
     { STATE_NAME_DECL(candidate_host_send),                  srpl_candidate_host_send_action },
-    // We're waiting for the remote to acknowledge the host update
-    { STATE_NAME_DECL(candidate_host_response_wait),         srpl_candidate_host_response_wait_action },
 
     // When we've run out of candidates to send, we send the candidates response.
     { STATE_NAME_DECL(send_candidates_response_send),        srpl_send_candidates_response_send_action },
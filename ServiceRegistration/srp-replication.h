@@ -72,8 +72,7 @@ enum srpl_state {
     // Waiting for candidate to arrive
     srpl_state_candidate_check,
 
-    // Waiting for a host to arrive after requesting it
-    srpl_state_candidate_host_wait,
+    // Got a host we asked for; applying it
     srpl_state_candidate_host_prepare,
     srpl_state_candidate_host_contention_wait,
     srpl_state_candidate_host_re_evaluate,
@@ -86,7 +85,6 @@ enum srpl_state {
     srpl_state_next_candidate_send,
     srpl_state_next_candidate_send_wait,
     srpl_state_candidate_host_send,
-    srpl_state_candidate_host_response_wait,
 
     // When we're done sending candidates
     srpl_state_send_candidates_response_send,
@@ -140,6 +138,7 @@ typedef struct srpl_srp_client_queue_entry srpl_srp_client_queue_entry_t;
 typedef struct srpl_srp_client_update_result srpl_srp_client_update_result_t;
 typedef struct srpl_host_update srpl_host_update_t;
 typedef struct srpl_advertise_finished_result srpl_advertise_finished_result_t;
+typedef struct srpl_deferred_message srpl_deferred_message_t;
 
 typedef void (*address_change_callback_t)(void *NULLABLE context, addr_t *NULLABLE address, bool added, int err);
 typedef void (*address_query_cancel_callback_t)(void *NULLABLE context);
@@ -163,6 +162,7 @@ struct address_query {
 };
 
 struct srpl_candidate {
+    srpl_candidate_t *NULLABLE next; // On srpl_connection->wanted_candidates
     dns_label_t *NULLABLE name;
     uint32_t key_id;                 // key id from adv_host_t
     uint32_t update_offset;          // Offset in seconds before the time candidate message was sent that update was received.
@@ -229,6 +229,13 @@ struct srpl_srp_client_queue_entry {
     bool sent;
 };
 
+// A candidate or host message that arrived while we were still applying an earlier host during database sync.
+struct srpl_deferred_message {
+    srpl_deferred_message_t *NULLABLE next;
+    message_t *NONNULL message;
+    srpl_event_t event;
+};
+
 struct srpl_connection {
     int ref_count;
     uint64_t remote_server_id;
@@ -244,8 +251,12 @@ struct srpl_connection {
     adv_host_t *NULLABLE *NULLABLE candidates;
     srpl_host_update_t stashed_host;
     srpl_srp_client_queue_entry_t *NULLABLE client_update_queue;
+    srpl_candidate_t *NULLABLE wanted_candidates;       // Candidates we said yes to whose host hasn't arrived yet
+    srpl_deferred_message_t *NULLABLE deferred_messages; // Messages received while applying a host, in arrival order
     int num_candidates;
-    int current_candidate;
+    int current_candidate;      // Last candidate sent
+    int candidate_response_index; // Next candidate we expect a response for
+    int hosts_in_flight;        // Host messages sent that haven't been acknowledged
     int retry_delay; // How long to send when we send a retry_delay message
     srpl_state_t state, next_state;
     bool is_server;
@@ -310,6 +321,17 @@ struct unclaimed_connection {
 
 #define SRPL_UPDATE_JITTER_WINDOW 10
 
+// Maximum number of candidate and host messages we will have outstanding during database sync. A window of one is the
+// original lockstep exchange; anything larger requires that the peer queue candidates that arrive while it is busy.
+#define SRPL_SYNC_WINDOW_MAX 64
+
+// Number of outstanding queries an SRPL DSO state has to be able to track: a full sync window, plus the session and
+// "send candidates" queries.
+#define SRPL_DSO_MAX_OUTSTANDING_QUERIES (SRPL_SYNC_WINDOW_MAX + 2)
+
+// Exported variables...
+extern int srpl_sync_window;
+
 // Exported functions...
 void srpl_startup(void);
 void srpl_dso_server_message(comm_t *NONNULL connection, message_t *NULLABLE message, dso_state_t *NONNULL dso);
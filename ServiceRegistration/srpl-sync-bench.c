@@ -0,0 +1,789 @@
+/* srpl-sync-bench.c
+ *
+ * Copyright (c) 2021 Apple Inc. All rights reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ * Measures how long an SRP replication database sync takes with different values of srpl_sync_window. Two peers run
+ * in this process, on one ioloop, connected over a loopback TCP connection with a DSO session on each end. The peer
+ * that accepts the connection has the hosts; the peer that connects sends "send candidates" and asks for every
+ * candidate it's offered. The messages are laid out as srp-replication.c lays them out, and the sending peer keeps
+ * at most the window's worth of candidate and host messages outstanding, the way
+ * srpl_candidates_remaining_check_action() does. The receiving peer parses each host message with dns_wire_parse()
+ * before it answers, in place of applying the update. The time reported is from sending "send candidates" to
+ * receiving its response.
+ *
+ * Both peers share one thread, so over loopback nothing ever waits on the network and the window has little to
+ * overlap. The -l option holds each of the receiving peer's responses for the given number of milliseconds, in order,
+ * to stand in for the round trip between two border routers.
+ *
+ * srp-replication.c itself keeps its domains, instances and host database in file-scope state, and needs
+ * mDNSResponder to apply updates, so two copies of it can't share a process; this exercises the same exchange over
+ * the same transport instead.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include <dns_sd.h>
+
+#include "srp.h"
+#include "dns-msg.h"
+#include "ioloop.h"
+#include "srp-gw.h"
+#include "srp-proxy.h"
+#include "srp-mdns-proxy.h"
+#define DNSMessageHeader dns_wire_t
+#include "dso.h"
+#include "srp-replication.h"
+
+// Provided by the POSIX ioloop.c, which doesn't export it through ioloop.h because macos-ioloop.c has no equivalent.
+int ioloop_events(int64_t timeout_when);
+
+#define INCREMENT(x) (x) = htons(ntohs(x) + 1)
+
+typedef struct bench_host bench_host_t;
+struct bench_host {
+    char name[DNS_MAX_NAME_SIZE + 1];
+    message_t *message;
+};
+
+typedef struct bench_response bench_response_t;
+struct bench_response {
+    bench_response_t *next;
+    int64_t due;
+    size_t length;
+    uint8_t data[];
+};
+
+typedef struct bench_sync bench_sync_t;
+struct bench_sync {
+    bench_host_t *hosts;
+    int num_hosts;
+    int window;
+    int latency;                        // Milliseconds to hold each response from the receiving peer
+
+    // The peer that has the hosts
+    comm_t *listener;
+    comm_t *sender;
+    dso_state_t *sender_dso;
+    message_t *send_candidates;         // The "send candidates" message we're answering
+    int current_candidate;              // Index of the last candidate sent
+    int candidate_response_index;       // Number of candidate responses received
+    int hosts_in_flight;
+
+    // The peer that asks for them
+    comm_t *receiver;
+    dso_state_t *receiver_dso;
+    int hosts_received;
+    bench_response_t *responses;        // Responses being held, oldest first
+    bench_response_t **responses_tail;
+    wakeup_t *response_wakeup;
+    double start, elapsed;
+
+    bool done, failed;
+};
+
+static double
+now_microseconds(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (double)ts.tv_sec * 1e6 + (double)ts.tv_nsec / 1e3;
+}
+
+// Generates the SRP update a host with one service would send: a host description with AAAA and KEY records, a
+// service instance with PTR, SRV and TXT records, an update lease and a SIG(0). As with dns-parse-bench, the key and
+// signature are filler, since nothing here checks them.
+static message_t *
+bench_generate_update(const char *hostname, int index)
+{
+    static const char *service_types[] = { "_ipp._tcp", "_hap._udp", "_matter._tcp", "_airplay._tcp", "_raop._tcp" };
+    dns_towire_state_t towire;
+    dns_name_pointer_t p_zone_name, p_host_name, p_service_name, p_service_instance_name;
+    uint8_t key[68], signature[64], address[16];
+    char instance[DNS_MAX_LABEL_SIZE];
+    message_t *message;
+    dns_wire_t wire;
+    int i;
+
+    memset(&towire, 0, sizeof(towire));
+    memset(&wire, 0, sizeof(wire));
+    towire.p = &wire.data[0];
+    towire.lim = &wire.data[DNS_DATA_SIZE];
+    towire.message = &wire;
+    wire.id = htons((uint16_t)index);
+    dns_qr_set(&wire, dns_qr_query);
+    dns_opcode_set(&wire, dns_opcode_update);
+
+    dns_full_name_to_wire(&p_zone_name, &towire, "default.service.arpa");
+    dns_u16_to_wire(&towire, dns_rrtype_soa);
+    dns_u16_to_wire(&towire, dns_qclass_in);
+    INCREMENT(wire.qdcount);
+
+    // Host description
+    dns_name_to_wire(&p_host_name, &towire, hostname);
+    dns_pointer_to_wire(&p_host_name, &towire, &p_zone_name);
+    dns_u16_to_wire(&towire, dns_rrtype_any);
+    dns_u16_to_wire(&towire, dns_qclass_any);
+    dns_ttl_to_wire(&towire, 0);
+    dns_u16_to_wire(&towire, 0);
+    INCREMENT(wire.nscount);
+
+    for (i = 0; i < (int)sizeof(address); i++) {
+        address[i] = (uint8_t)rand();
+    }
+    dns_pointer_to_wire(NULL, &towire, &p_host_name);
+    dns_u16_to_wire(&towire, dns_rrtype_aaaa);
+    dns_u16_to_wire(&towire, dns_qclass_in);
+    dns_ttl_to_wire(&towire, 3600);
+    dns_rdlength_begin(&towire);
+    dns_rdata_raw_data_to_wire(&towire, address, sizeof(address));
+    dns_rdlength_end(&towire);
+    INCREMENT(wire.nscount);
+
+    key[0] = 0x02; key[1] = 0x01; key[2] = 3; key[3] = 13; // flags, protocol, ECDSAP256SHA256
+    for (i = 4; i < (int)sizeof(key); i++) {
+        key[i] = (uint8_t)rand();
+    }
+    dns_pointer_to_wire(NULL, &towire, &p_host_name);
+    dns_u16_to_wire(&towire, dns_rrtype_key);
+    dns_u16_to_wire(&towire, dns_qclass_in);
+    dns_ttl_to_wire(&towire, 3600);
+    dns_rdlength_begin(&towire);
+    dns_rdata_raw_data_to_wire(&towire, key, sizeof(key));
+    dns_rdlength_end(&towire);
+    INCREMENT(wire.nscount);
+
+    // Service instance
+    dns_name_to_wire(&p_service_name, &towire, service_types[index % 5]);
+    dns_pointer_to_wire(&p_service_name, &towire, &p_zone_name);
+    dns_u16_to_wire(&towire, dns_rrtype_ptr);
+    dns_u16_to_wire(&towire, dns_qclass_in);
+    dns_ttl_to_wire(&towire, 3600);
+    dns_rdlength_begin(&towire);
+    snprintf(instance, sizeof(instance), "Accessory on %s", hostname);
+    dns_name_to_wire(&p_service_instance_name, &towire, instance);
+    dns_pointer_to_wire(&p_service_instance_name, &towire, &p_service_name);
+    dns_rdlength_end(&towire);
+    INCREMENT(wire.nscount);
+
+    dns_pointer_to_wire(NULL, &towire, &p_service_instance_name);
+    dns_u16_to_wire(&towire, dns_rrtype_any);
+    dns_u16_to_wire(&towire, dns_qclass_any);
+    dns_ttl_to_wire(&towire, 0);
+    dns_u16_to_wire(&towire, 0);
+    INCREMENT(wire.nscount);
+
+    dns_pointer_to_wire(NULL, &towire, &p_service_instance_name);
+    dns_u16_to_wire(&towire, dns_rrtype_srv);
+    dns_u16_to_wire(&towire, dns_qclass_in);
+    dns_ttl_to_wire(&towire, 3600);
+    dns_rdlength_begin(&towire);
+    dns_u16_to_wire(&towire, 0);
+    dns_u16_to_wire(&towire, 0);
+    dns_u16_to_wire(&towire, 5000);
+    dns_pointer_to_wire(NULL, &towire, &p_host_name);
+    dns_rdlength_end(&towire);
+    INCREMENT(wire.nscount);
+
+    dns_pointer_to_wire(NULL, &towire, &p_service_instance_name);
+    dns_u16_to_wire(&towire, dns_rrtype_txt);
+    dns_u16_to_wire(&towire, dns_qclass_in);
+    dns_ttl_to_wire(&towire, 3600);
+    dns_rdlength_begin(&towire);
+    dns_rdata_txt_to_wire(&towire, "txtvers=1");
+    dns_rdata_txt_to_wire(&towire, "id=8C:29:37:2A:11:6E");
+    dns_rdlength_end(&towire);
+    INCREMENT(wire.nscount);
+
+    dns_edns0_header_to_wire(&towire, DNS_MAX_UDP_PAYLOAD, 0, 0, 1);
+    dns_rdlength_begin(&towire);
+    dns_u16_to_wire(&towire, dns_opt_update_lease);
+    dns_edns0_option_begin(&towire);
+    dns_u32_to_wire(&towire, 7200);
+    dns_u32_to_wire(&towire, 604800);
+    dns_edns0_option_end(&towire);
+    dns_rdlength_end(&towire);
+    INCREMENT(wire.arcount);
+
+    // SIG(0), laid out as dns_sig0_signature_to_wire() does it.
+    dns_u8_to_wire(&towire, 0); // root label
+    dns_u16_to_wire(&towire, dns_rrtype_sig);
+    dns_u16_to_wire(&towire, dns_qclass_any);
+    dns_ttl_to_wire(&towire, 0);
+    dns_rdlength_begin(&towire);
+    dns_u16_to_wire(&towire, 0);  // type covered
+    dns_u8_to_wire(&towire, 13);  // algorithm
+    dns_u8_to_wire(&towire, 0);   // labels
+    dns_ttl_to_wire(&towire, 0);  // original TTL
+    dns_u32_to_wire(&towire, (uint32_t)time(NULL) + 300);
+    dns_u32_to_wire(&towire, (uint32_t)time(NULL) - 300);
+    dns_u16_to_wire(&towire, (uint16_t)rand());
+    dns_pointer_to_wire(NULL, &towire, &p_host_name);
+    for (i = 0; i < (int)sizeof(signature); i++) {
+        signature[i] = (uint8_t)rand();
+    }
+    dns_rdata_raw_data_to_wire(&towire, signature, sizeof(signature));
+    dns_rdlength_end(&towire);
+    INCREMENT(wire.arcount);
+
+    if (towire.error) {
+        return NULL;
+    }
+    message = ioloop_message_create(towire.p - (uint8_t *)&wire);
+    if (message == NULL) {
+        return NULL;
+    }
+    memcpy(&message->wire, &wire, message->length);
+    return message;
+}
+
+static void
+bench_fail(bench_sync_t *sync, const char *why)
+{
+    fprintf(stderr, "srpl-sync-bench: %s\n", why);
+    sync->failed = true;
+    sync->done = true;
+}
+
+static bool
+bench_dso_message_setup(dso_state_t *dso, dso_message_t *state, dns_towire_state_t *towire, uint8_t *buffer,
+                        size_t buffer_size, message_t *message, bool response, int rcode, void *context)
+{
+    if (!dso_make_message(state, buffer, buffer_size, dso, false, response, response ? message->wire.id : 0, rcode,
+                          context)) {
+        return false;
+    }
+    memset(towire, 0, sizeof(*towire));
+    towire->p = &buffer[DNS_HEADER_SIZE];
+    towire->lim = towire->p + (buffer_size - DNS_HEADER_SIZE);
+    towire->message = (dns_wire_t *)buffer;
+    return true;
+}
+
+#define BENCH_SIMPLE_MESSAGE_LENGTH (SRPL_SESSION_MESSAGE_LENGTH + DSO_TLV_HEADER_SIZE)
+
+// Builds a message whose primary TLV is empty and which has at most one empty additional TLV, which covers the session
+// and "send candidates" messages and responses, the candidate response and the host response. Returns the length of
+// the message, or 0 if it couldn't be built.
+static size_t
+bench_simple_build(uint8_t *dsobuf, dso_state_t *dso, message_t *responding_to, int rcode, void *context,
+                   uint16_t primary, uint16_t additional, bool server_id)
+{
+    dns_towire_state_t towire;
+    dso_message_t message;
+
+    if (!bench_dso_message_setup(dso, &message, &towire, dsobuf, BENCH_SIMPLE_MESSAGE_LENGTH, responding_to,
+                                 responding_to != NULL, rcode, context)) {
+        return 0;
+    }
+    dns_u16_to_wire(&towire, primary);
+    dns_rdlength_begin(&towire);
+    if (server_id) {
+        dns_u64_to_wire(&towire, 0x0123456789abcdefULL);
+    }
+    dns_rdlength_end(&towire);
+    if (additional != 0) {
+        dns_u16_to_wire(&towire, additional);
+        dns_rdlength_begin(&towire);
+        dns_rdlength_end(&towire);
+    }
+    if (towire.error) {
+        return 0;
+    }
+    return towire.p - dsobuf;
+}
+
+static bool
+bench_simple_send(comm_t *connection, dso_state_t *dso, message_t *responding_to, int rcode, void *context,
+                  uint16_t primary, uint16_t additional, bool server_id)
+{
+    uint8_t dsobuf[BENCH_SIMPLE_MESSAGE_LENGTH];
+    struct iovec iov;
+
+    iov.iov_len = bench_simple_build(dsobuf, dso, responding_to, rcode, context, primary, additional, server_id);
+    if (iov.iov_len == 0) {
+        return false;
+    }
+    iov.iov_base = dsobuf;
+    return ioloop_send_message(connection, responding_to, &iov, 1);
+}
+
+static void bench_responses_send(void *context);
+
+static void
+bench_responses_schedule(bench_sync_t *sync)
+{
+    int64_t delay = sync->responses->due - ioloop_timenow();
+    ioloop_add_wake_event(sync->response_wakeup, sync, bench_responses_send, NULL, delay > 0 ? (int32_t)delay : 0);
+}
+
+// Sends the held responses that have come due, in the order they were made.
+static void
+bench_responses_send(void *context)
+{
+    bench_sync_t *sync = context;
+    int64_t now = ioloop_timenow();
+    bench_response_t *response;
+    struct iovec iov;
+
+    while (sync->responses != NULL && sync->responses->due <= now) {
+        response = sync->responses;
+        sync->responses = response->next;
+        iov.iov_len = response->length;
+        iov.iov_base = response->data;
+        if (!ioloop_send_message(sync->receiver, NULL, &iov, 1)) {
+            bench_fail(sync, "unable to send held response");
+        }
+        free(response);
+    }
+    if (sync->responses == NULL) {
+        sync->responses_tail = &sync->responses;
+    } else {
+        bench_responses_schedule(sync);
+    }
+}
+
+// Sends a response from the receiving peer, or holds it for the configured latency.
+static bool
+bench_receiver_respond(bench_sync_t *sync, message_t *responding_to, uint16_t primary, uint16_t additional)
+{
+    uint8_t dsobuf[BENCH_SIMPLE_MESSAGE_LENGTH];
+    bench_response_t *response;
+    size_t length;
+
+    if (sync->latency == 0) {
+        return bench_simple_send(sync->receiver, sync->receiver_dso, responding_to, dns_rcode_noerror, NULL,
+                                 primary, additional, false);
+    }
+    length = bench_simple_build(dsobuf, sync->receiver_dso, responding_to, dns_rcode_noerror, NULL,
+                                primary, additional, false);
+    response = malloc(sizeof(*response) + length);
+    if (length == 0 || response == NULL) {
+        free(response);
+        return false;
+    }
+    response->next = NULL;
+    response->due = ioloop_timenow() + sync->latency;
+    response->length = length;
+    memcpy(response->data, dsobuf, length);
+    *sync->responses_tail = response;
+    sync->responses_tail = &response->next;
+    if (sync->responses == response) {
+        bench_responses_schedule(sync);
+    }
+    return true;
+}
+
+static bool
+bench_candidate_send(bench_sync_t *sync, bench_host_t *host)
+{
+    uint8_t dsobuf[SRPL_CANDIDATE_MESSAGE_LENGTH];
+    dns_towire_state_t towire;
+    dso_message_t message;
+    struct iovec iov;
+
+    if (!bench_dso_message_setup(sync->sender_dso, &message, &towire, dsobuf, sizeof(dsobuf), NULL, false, 0, sync)) {
+        return false;
+    }
+    dns_u16_to_wire(&towire, kDSOType_SRPLCandidate);
+    dns_rdlength_begin(&towire);
+    dns_rdlength_end(&towire);
+    dns_u16_to_wire(&towire, kDSOType_SRPLHostname);
+    dns_rdlength_begin(&towire);
+    dns_full_name_to_wire(NULL, &towire, host->name);
+    dns_rdlength_end(&towire);
+    dns_u16_to_wire(&towire, kDSOType_SRPLTimeOffset);
+    dns_rdlength_begin(&towire);
+    dns_u32_to_wire(&towire, 60);
+    dns_rdlength_end(&towire);
+    dns_u16_to_wire(&towire, kDSOType_SRPLKeyID);
+    dns_rdlength_begin(&towire);
+    dns_u32_to_wire(&towire, 0x12345678);
+    dns_rdlength_end(&towire);
+    if (towire.error) {
+        return false;
+    }
+    iov.iov_len = towire.p - dsobuf;
+    iov.iov_base = dsobuf;
+    return ioloop_send_message(sync->sender, NULL, &iov, 1);
+}
+
+static bool
+bench_host_send(bench_sync_t *sync, bench_host_t *host)
+{
+    uint8_t dsobuf[SRPL_HOST_MESSAGE_LENGTH];
+    dns_towire_state_t towire;
+    dso_message_t message;
+    struct iovec iov[2];
+
+    if (!bench_dso_message_setup(sync->sender_dso, &message, &towire, dsobuf, sizeof(dsobuf), NULL, false, 0, sync)) {
+        return false;
+    }
+    dns_u16_to_wire(&towire, kDSOType_SRPLHost);
+    dns_rdlength_begin(&towire);
+    dns_rdlength_end(&towire);
+    dns_u16_to_wire(&towire, kDSOType_SRPLHostname);
+    dns_rdlength_begin(&towire);
+    dns_full_name_to_wire(NULL, &towire, host->name);
+    dns_rdlength_end(&towire);
+    dns_u16_to_wire(&towire, kDSOType_SRPLTimeOffset);
+    dns_rdlength_begin(&towire);
+    dns_u32_to_wire(&towire, 60);
+    dns_rdlength_end(&towire);
+    dns_u16_to_wire(&towire, kDSOType_SRPLServerStableID);
+    dns_rdlength_begin(&towire);
+    dns_u64_to_wire(&towire, 0x0123456789abcdefULL);
+    dns_rdlength_end(&towire);
+    dns_u16_to_wire(&towire, kDSOType_SRPLHostMessage);
+    dns_u16_to_wire(&towire, host->message->length);
+    if (towire.error) {
+        return false;
+    }
+    iov[0].iov_len = towire.p - dsobuf;
+    iov[0].iov_base = dsobuf;
+    iov[1].iov_len = host->message->length;
+    iov[1].iov_base = &host->message->wire;
+    return ioloop_send_message(sync->sender, NULL, iov, 2);
+}
+
+// Keep the window full, and once everything has been answered, send the "send candidates" response.
+static void
+bench_candidates_send(bench_sync_t *sync)
+{
+    for (;;) {
+        int in_flight = sync->current_candidate + 1 - sync->candidate_response_index + sync->hosts_in_flight;
+
+        if (sync->current_candidate + 1 < sync->num_hosts) {
+            if (in_flight >= sync->window) {
+                return;
+            }
+            sync->current_candidate++;
+            if (!bench_candidate_send(sync, &sync->hosts[sync->current_candidate])) {
+                bench_fail(sync, "unable to send candidate");
+                return;
+            }
+        } else {
+            if (in_flight == 0) {
+                if (!bench_simple_send(sync->sender, sync->sender_dso, sync->send_candidates, dns_rcode_noerror, NULL,
+                                       kDSOType_SRPLSendCandidates, 0, false)) {
+                    bench_fail(sync, "unable to send \"send candidates\" response");
+                }
+                ioloop_message_release(sync->send_candidates);
+                sync->send_candidates = NULL;
+            }
+            return;
+        }
+    }
+}
+
+static void
+bench_sender_dso_event(void *context, void *event_context, dso_state_t *dso, dso_event_type_t event_type)
+{
+    bench_sync_t *sync = context;
+    message_t *message;
+
+    if (event_type == kDSOEventType_DSOMessage) {
+        message = event_context;
+        if (dso->primary.opcode == kDSOType_SRPLSession) {
+            if (!bench_simple_send(sync->sender, dso, message, dns_rcode_noerror, NULL,
+                                   kDSOType_SRPLSession, 0, true)) {
+                bench_fail(sync, "unable to send session response");
+            }
+        } else if (dso->primary.opcode == kDSOType_SRPLSendCandidates) {
+            sync->send_candidates = message;
+            ioloop_message_retain(sync->send_candidates);
+            sync->current_candidate = -1;
+            sync->candidate_response_index = 0;
+            sync->hosts_in_flight = 0;
+            bench_candidates_send(sync);
+        } else {
+            bench_fail(sync, "sender got an unexpected message");
+        }
+    } else if (event_type == kDSOEventType_DSOResponse) {
+        if (dso->primary.opcode == kDSOType_SRPLCandidate) {
+            // Responses come back in order, so this is the response for the oldest candidate outstanding.
+            int index = sync->candidate_response_index++;
+            if (dso->num_additls == 1 && dso->additl[0].opcode == kDSOType_SRPLCandidateYes) {
+                if (!bench_host_send(sync, &sync->hosts[index])) {
+                    bench_fail(sync, "unable to send host");
+                    return;
+                }
+                sync->hosts_in_flight++;
+            }
+        } else if (dso->primary.opcode == kDSOType_SRPLHost) {
+            sync->hosts_in_flight--;
+        } else {
+            bench_fail(sync, "sender got an unexpected response");
+            return;
+        }
+        bench_candidates_send(sync);
+    }
+}
+
+static void
+bench_receiver_dso_event(void *context, void *event_context, dso_state_t *dso, dso_event_type_t event_type)
+{
+    bench_sync_t *sync = context;
+    message_t *message;
+    dns_message_t *parsed;
+    int i;
+
+    if (event_type == kDSOEventType_DSOMessage) {
+        message = event_context;
+        if (dso->primary.opcode == kDSOType_SRPLCandidate) {
+            if (!bench_receiver_respond(sync, message, kDSOType_SRPLCandidate, kDSOType_SRPLCandidateYes)) {
+                bench_fail(sync, "unable to send candidate response");
+            }
+        } else if (dso->primary.opcode == kDSOType_SRPLHost) {
+            for (i = 0; i < dso->num_additls; i++) {
+                if (dso->additl[i].opcode == kDSOType_SRPLHostMessage) {
+                    break;
+                }
+            }
+            if (i == dso->num_additls ||
+                !dns_wire_parse(&parsed, (dns_wire_t *)dso->additl[i].payload, dso->additl[i].length, false)) {
+                bench_fail(sync, "receiver got a host message it couldn't parse");
+                return;
+            }
+            dns_message_free(parsed);
+            sync->hosts_received++;
+            if (!bench_receiver_respond(sync, message, kDSOType_SRPLHost, 0)) {
+                bench_fail(sync, "unable to send host response");
+            }
+        } else {
+            bench_fail(sync, "receiver got an unexpected message");
+        }
+    } else if (event_type == kDSOEventType_DSOResponse) {
+        if (dso->primary.opcode == kDSOType_SRPLSession) {
+            sync->start = now_microseconds();
+            if (!bench_simple_send(sync->receiver, dso, NULL, 0, sync, kDSOType_SRPLSendCandidates, 0, false)) {
+                bench_fail(sync, "unable to send \"send candidates\"");
+            }
+        } else if (dso->primary.opcode == kDSOType_SRPLSendCandidates) {
+            sync->elapsed = now_microseconds() - sync->start;
+            sync->done = true;
+        }
+    }
+}
+
+static void
+bench_sender_datagram(comm_t *comm, message_t *message, void *context)
+{
+    bench_sync_t *sync = context;
+
+    if (sync->sender_dso == NULL) {
+        sync->sender_dso = dso_state_create(true, SRPL_DSO_MAX_OUTSTANDING_QUERIES, comm->name,
+                                            bench_sender_dso_event, sync, NULL, comm);
+        if (sync->sender_dso == NULL) {
+            bench_fail(sync, "no memory for sender DSO state");
+            return;
+        }
+    }
+    dso_message_received(sync->sender_dso, (uint8_t *)&message->wire, message->length, message);
+}
+
+static void
+bench_receiver_datagram(comm_t *UNUSED comm, message_t *message, void *context)
+{
+    bench_sync_t *sync = context;
+
+    dso_message_received(sync->receiver_dso, (uint8_t *)&message->wire, message->length, message);
+}
+
+static void
+bench_listener_connected(comm_t *connection, void *context)
+{
+    bench_sync_t *sync = context;
+
+    sync->sender = connection;
+    ioloop_comm_context_set(connection, sync, NULL);
+}
+
+static void
+bench_receiver_connected(comm_t *connection, void *context)
+{
+    bench_sync_t *sync = context;
+
+    sync->receiver_dso = dso_state_create(false, SRPL_DSO_MAX_OUTSTANDING_QUERIES, connection->name,
+                                          bench_receiver_dso_event, sync, NULL, connection);
+    if (sync->receiver_dso == NULL) {
+        bench_fail(sync, "no memory for receiver DSO state");
+        return;
+    }
+    if (!bench_simple_send(connection, sync->receiver_dso, NULL, 0, sync, kDSOType_SRPLSession, 0, true)) {
+        bench_fail(sync, "unable to send session message");
+    }
+}
+
+static void
+bench_receiver_disconnected(comm_t *UNUSED comm, void *context, int UNUSED error)
+{
+    bench_sync_t *sync = context;
+
+    if (!sync->done) {
+        bench_fail(sync, "connection dropped");
+    }
+}
+
+// Runs one sync over a fresh connection and returns the time it took, in microseconds, or a negative number on failure.
+static double
+bench_sync_run(bench_host_t *hosts, int num_hosts, int window, int latency)
+{
+    bench_sync_t sync;
+    addr_t address;
+
+    memset(&sync, 0, sizeof(sync));
+    sync.hosts = hosts;
+    sync.num_hosts = num_hosts;
+    sync.window = window;
+    sync.latency = latency;
+    sync.responses_tail = &sync.responses;
+    sync.response_wakeup = ioloop_wakeup_create();
+    if (sync.response_wakeup == NULL) {
+        return -1;
+    }
+
+    memset(&address, 0, sizeof(address));
+    address.sin.sin_family = AF_INET;
+    address.sin.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    sync.listener = ioloop_listener_create(true, false, NULL, 0, &address, NULL, "srpl-sync-bench",
+                                           bench_sender_datagram, bench_listener_connected, NULL, NULL, NULL, NULL,
+                                           &sync);
+    if (sync.listener == NULL) {
+        return -1;
+    }
+    address.sin.sin_port = htons(sync.listener->listen_port);
+    sync.receiver = ioloop_connection_create(&address, false, true, false, false, bench_receiver_datagram,
+                                             bench_receiver_connected, bench_receiver_disconnected, NULL, &sync);
+    if (sync.receiver == NULL) {
+        ioloop_listener_cancel(sync.listener);
+        return -1;
+    }
+
+    while (!sync.done) {
+        ioloop_events(ioloop_timenow() + 1000);
+    }
+    if (!sync.failed && sync.hosts_received != num_hosts) {
+        fprintf(stderr, "srpl-sync-bench: received %d hosts out of %d\n", sync.hosts_received, num_hosts);
+        sync.failed = true;
+    }
+
+    ioloop_comm_cancel(sync.receiver);
+    if (sync.sender != NULL) {
+        ioloop_comm_cancel(sync.sender);
+    }
+    ioloop_listener_cancel(sync.listener);
+    if (sync.send_candidates != NULL) {
+        ioloop_message_release(sync.send_candidates);
+    }
+    ioloop_cancel_wake_event(sync.response_wakeup);
+    ioloop_wakeup_release(sync.response_wakeup);
+    while (sync.responses != NULL) {
+        bench_response_t *response = sync.responses;
+        sync.responses = response->next;
+        free(response);
+    }
+    // Let the ioloop notice the cancellations before the next run.
+    ioloop_events(ioloop_timenow() + 10);
+    return sync.failed ? -1 : sync.elapsed;
+}
+
+int
+main(int argc, char **argv)
+{
+    bench_host_t *hosts;
+    int count = 10000, window = SRPL_SYNC_WINDOW_MAX, latency = 0, iterations = 3, i, j, opt;
+    double best[2];
+
+    while ((opt = getopt(argc, argv, "n:w:l:i:")) != -1) {
+        switch (opt) {
+        case 'n':
+            count = atoi(optarg);
+            break;
+        case 'w':
+            window = atoi(optarg);
+            break;
+        case 'l':
+            latency = atoi(optarg);
+            break;
+        case 'i':
+            iterations = atoi(optarg);
+            break;
+        default:
+            fprintf(stderr, "Usage: %s [-n hosts] [-w window] [-l latency-ms] [-i iterations]\n", argv[0]);
+            return 2;
+        }
+    }
+    if (count <= 0 || window < 1 || window > SRPL_SYNC_WINDOW_MAX || latency < 0 || iterations <= 0 || !ioloop_init()) {
+        fprintf(stderr, "Usage: %s [-n hosts] [-w window (1-%d)] [-l latency-ms] [-i iterations]\n",
+                argv[0], SRPL_SYNC_WINDOW_MAX);
+        return 2;
+    }
+
+    hosts = calloc((size_t)count, sizeof(*hosts));
+    if (hosts == NULL) {
+        fprintf(stderr, "%s: out of memory\n", argv[0]);
+        return 1;
+    }
+    srand(1);
+    for (i = 0; i < count; i++) {
+        char hostname[32];
+        snprintf(hostname, sizeof(hostname), "accessory-%05d", i);
+        snprintf(hosts[i].name, sizeof(hosts[i].name), "%s.default.service.arpa.", hostname);
+        hosts[i].message = bench_generate_update(hostname, i);
+        if (hosts[i].message == NULL) {
+            fprintf(stderr, "%s: can't generate update %d\n", argv[0], i);
+            return 1;
+        }
+    }
+
+    // Alternate the two windows so that they see the same conditions, and keep the best run of each.
+    best[0] = best[1] = 0;
+    for (j = 0; j < iterations; j++) {
+        for (i = 0; i < 2; i++) {
+            double elapsed = bench_sync_run(hosts, count, i == 0 ? 1 : window, latency);
+            if (elapsed < 0) {
+                fprintf(stderr, "%s: sync with window %d failed\n", argv[0], i == 0 ? 1 : window);
+                return 1;
+            }
+            if (j == 0 || elapsed < best[i]) {
+                best[i] = elapsed;
+            }
+        }
+    }
+
+    printf("%d hosts, %d ms latency, best of %d:\n", count, latency, iterations);
+    printf("  window %2d: %8.1f ms, %6.2f us per host\n", 1, best[0] / 1000, best[0] / count);
+    printf("  window %2d: %8.1f ms, %6.2f us per host (%.1fx)\n", window, best[1] / 1000, best[1] / count,
+           best[0] / best[1]);
+    for (i = 0; i < count; i++) {
+        ioloop_message_release(hosts[i].message);
+    }
+    free(hosts);
+    return 0;
+}
+
+// Local Variables:
+// mode: C
+// tab-width: 4
+// c-file-style: "bsd"
+// c-basic-offset: 4
+// fill-column: 108
+// indent-tabs-mode: nil
+// End:
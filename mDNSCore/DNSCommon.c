@@ -1847,10 +1847,141 @@ mDNSexport mDNSBool ValidateRData(const mDNSu16 rrtype, const mDNSu16 rdlength,
 }
 
 // ***************************************************************************
+// MARK: - RData Slab Allocator
+
+// Each object in a slab is preceded by a pointer back to its slab, so mDNS_FreeRData doesn't need to be told the size.
+typedef struct RDataSlabObject_struct RDataSlabObject;
+struct RDataSlabObject_struct
+{
+    RDataSlab       *slab;
+    RDataSlabObject *nextfree;      // Only meaningful while the object is on its slab's free list
+    RData            rdata;         // Variable length: sizeofRDataHeader + the class's MaxRDLength bytes
+};
+
+struct RDataSlab_struct
+{
+    RDataSlab       *next;          // Links in the class's Partial list
+    RDataSlab       *prev;
+    RDataSlabClass  *sizeclass;
+    RDataSlabObject *freelist;
+    mDNSu16          inuse;
+    mDNSBool         onpartial;
+};
+
+#define RDataSlabObjectHeader ((mDNSu32)((mDNSu8 *)&((RDataSlabObject *)0)->rdata - (mDNSu8 *)0))
+#define RDataSlabAlign(X)     (((X) + sizeof(void *) - 1) & ~(sizeof(void *) - 1))
+#define RDataSlabObjectSize(C) RDataSlabAlign(RDataSlabObjectHeader + sizeofRDataHeader + (C)->MaxRDLength)
+
+mDNSexport void mDNS_RDataSlabInit(mDNS *const m)
+{
+    static const mDNSu16 capacity[RDataSlabClassCount] = { 128, 256, 512, 1024, MaximumRDSize };
+    static const mDNSu16 perslab[RDataSlabClassCount]  = {  32,  16,   8,    4,             2 };
+    int i;
+    for (i = 0; i < RDataSlabClassCount; i++)
+    {
+        RDataSlabClass *const c = &m->rdataslab[i];
+        mDNSPlatformMemZero(c, sizeof(*c));
+        c->MaxRDLength    = (capacity[i] < MaximumRDSize) ? capacity[i] : MaximumRDSize;   // LIMITED_RESOURCES_TARGET
+        c->ObjectsPerSlab = perslab[i];
+    }
+}
+
+mDNSlocal void RDataSlabPartialAdd(RDataSlabClass *const c, RDataSlab *const slab)
+{
+    slab->prev = mDNSNULL;
+    slab->next = c->Partial;
+    if (c->Partial) c->Partial->prev = slab;
+    c->Partial = slab;
+    slab->onpartial = mDNStrue;
+}
+
+mDNSlocal void RDataSlabPartialRemove(RDataSlabClass *const c, RDataSlab *const slab)
+{
+    if (slab->prev) slab->prev->next = slab->next;
+    else c->Partial = slab->next;
+    if (slab->next) slab->next->prev = slab->prev;
+    slab->next = slab->prev = mDNSNULL;
+    slab->onpartial = mDNSfalse;
+}
+
+mDNSlocal RDataSlab *RDataSlabCreate(RDataSlabClass *const c)
+{
+    const mDNSu32 objsize = RDataSlabObjectSize(c);
+    const mDNSu32 hdrsize = RDataSlabAlign(sizeof(RDataSlab));
+    RDataSlab *const slab = (RDataSlab *)mDNSPlatformMemAllocate(hdrsize + objsize * c->ObjectsPerSlab);
+    mDNSu8 *p;
+    int i;
+
+    if (!slab) return(mDNSNULL);
+    slab->sizeclass = c;
+    slab->freelist  = mDNSNULL;
+    slab->inuse     = 0;
+    for (i = c->ObjectsPerSlab - 1, p = (mDNSu8 *)slab + hdrsize + objsize * i; i >= 0; i--, p -= objsize)
+    {
+        RDataSlabObject *const obj = (RDataSlabObject *)p;
+        obj->slab     = slab;
+        obj->nextfree = slab->freelist;
+        slab->freelist = obj;
+    }
+    RDataSlabPartialAdd(c, slab);
+    c->Slabs++;
+    c->SlabAllocations++;
+    return(slab);
+}
+
+mDNSexport RData *mDNS_AllocateRData(mDNS *const m, const mDNSu16 rdcapacity)
+{
+    RDataSlabClass *c = mDNSNULL;
+    RDataSlab *slab;
+    RDataSlabObject *obj;
+    int i;
+
+    for (i = 0; i < RDataSlabClassCount; i++)
+        if (m->rdataslab[i].MaxRDLength >= rdcapacity) { c = &m->rdataslab[i]; break; }
+    if (!c) { LogMsg("mDNS_AllocateRData: %u bytes is larger than MaximumRDSize", rdcapacity); return(mDNSNULL); }
+
+    slab = c->Partial;
+    if (!slab && (slab = RDataSlabCreate(c)) == mDNSNULL) return(mDNSNULL);
+
+    obj = slab->freelist;
+    slab->freelist = obj->nextfree;
+    slab->inuse++;
+    if (!slab->freelist) RDataSlabPartialRemove(c, slab);
+    c->InUse++;
+    c->Allocations++;
+
+    mDNSPlatformMemZero(&obj->rdata, sizeofRDataHeader + rdcapacity);
+    obj->rdata.MaxRDLength = c->MaxRDLength;
+    return(&obj->rdata);
+}
+
+// An empty slab is handed back to the platform as long as the class has another slab with room, so that a class
+// which has settled at a steady level doesn't allocate and free a slab every time it crosses a slab boundary.
+mDNSexport void mDNS_FreeRData(mDNS *const m, RData *const rdata)
+{
+    RDataSlabObject *const obj = (RDataSlabObject *)((mDNSu8 *)rdata - RDataSlabObjectHeader);
+    RDataSlab *const slab = obj->slab;
+    RDataSlabClass *const c = slab->sizeclass;
+    (void)m;    // The size classes live in m, but the slab already knows which one it belongs to
+
+    obj->nextfree = slab->freelist;
+    slab->freelist = obj;
+    slab->inuse--;
+    c->InUse--;
+    if (!slab->onpartial) RDataSlabPartialAdd(c, slab);
+    if (slab->inuse == 0 && (c->Partial != slab || slab->next))
+    {
+        RDataSlabPartialRemove(c, slab);
+        c->Slabs--;
+        mDNSPlatformMemFree(slab);
+    }
+}
+
 // MARK: - DNS Message Creation Functions
 
 mDNSexport void InitializeDNSMessage(DNSMessageHeader *h, mDNSOpaque16 id, mDNSOpaque16 flags)
 {
+    DNSCompressionTableReset((const DNSMessage *)h);
     h->id             = id;
     h->flags          = flags;
     h->numQuestions   = 0;
@@ -1861,6 +1992,36 @@ mDNSexport void InitializeDNSMessage(DNSMessageHeader *h, mDNSOpaque16 id, mDNSO
 
 #endif // !STANDALONE
 
+// Returns true if the labels at "result" in the packet, following any compression pointers, spell out exactly domname
+mDNSlocal mDNSBool CompressionTargetMatches(const mDNSu8 *const base, const mDNSu8 *const end,
+                                            const mDNSu8 *const result, const mDNSu8 *const domname)
+{
+    const mDNSu8 *name = domname;
+    const mDNSu8 *targ = result;
+    while (targ + *name < end)
+    {
+        // First see if this label matches
+        int i;
+        const mDNSu8 *pointertarget;
+        for (i=0; i <= *name; i++) if (targ[i] != name[i]) break;
+        if (i <= *name) break;                          // If label did not match, bail out
+        targ += 1 + *name;                              // Else, did match, so advance target pointer
+        name += 1 + *name;                              // and proceed to check next label
+        if (*name == 0 && *targ == 0) return(mDNStrue); // If no more labels, we found a match!
+        if (*name == 0) break;                          // If no more labels to match, we failed, so bail out
+
+        // The label matched, so now follow the pointer (if appropriate) and then see if the next label matches
+        if (targ[0] < 0x40) continue;                   // If length value, continue to check next label
+        if (targ[0] < 0xC0) break;                      // If 40-BF, not valid
+        if (targ+1 >= end) break;                       // Second byte not present!
+        pointertarget = base + (((mDNSu16)(targ[0] & 0x3F)) << 8) + targ[1];
+        if (targ < pointertarget) break;                // Pointertarget must point *backwards* in the packet
+        if (pointertarget[0] >= 0x40) break;            // Pointertarget must point to a valid length byte
+        targ = pointertarget;
+    }
+    return(mDNSfalse);
+}
+
 mDNSexport const mDNSu8 *FindCompressionPointer(const mDNSu8 *const base, const mDNSu8 *const end, const mDNSu8 *const domname)
 {
     const mDNSu8 *result = end - *domname - 1;
@@ -1872,37 +2033,185 @@ mDNSexport const mDNSu8 *FindCompressionPointer(const mDNSu8 *const base, const
     {
         // If the length byte and first character of the label match, then check further to see
         // if this location in the packet will yield a useful name compression pointer.
-        if (result[0] == domname[0] && result[1] == domname[1])
-        {
-            const mDNSu8 *name = domname;
-            const mDNSu8 *targ = result;
-            while (targ + *name < end)
-            {
-                // First see if this label matches
-                int i;
-                const mDNSu8 *pointertarget;
-                for (i=0; i <= *name; i++) if (targ[i] != name[i]) break;
-                if (i <= *name) break;                          // If label did not match, bail out
-                targ += 1 + *name;                              // Else, did match, so advance target pointer
-                name += 1 + *name;                              // and proceed to check next label
-                if (*name == 0 && *targ == 0) return(result);   // If no more labels, we found a match!
-                if (*name == 0) break;                          // If no more labels to match, we failed, so bail out
-
-                // The label matched, so now follow the pointer (if appropriate) and then see if the next label matches
-                if (targ[0] < 0x40) continue;                   // If length value, continue to check next label
-                if (targ[0] < 0xC0) break;                      // If 40-BF, not valid
-                if (targ+1 >= end) break;                       // Second byte not present!
-                pointertarget = base + (((mDNSu16)(targ[0] & 0x3F)) << 8) + targ[1];
-                if (targ < pointertarget) break;                // Pointertarget must point *backwards* in the packet
-                if (pointertarget[0] >= 0x40) break;            // Pointertarget must point to a valid length byte
-                targ = pointertarget;
-            }
-        }
+        if (result[0] == domname[0] && result[1] == domname[1] && CompressionTargetMatches(base, end, result, domname))
+            return(result);
         result--;   // We failed to match at this search position, so back up the tentative result pointer and try again
     }
     return(mDNSNULL);
 }
 
+// ***************************************************************************
+// MARK: - Name Compression Table
+
+// Only one message at a time (normally m->omsg) has a compression table. Names written into any other
+// message are compressed using FindCompressionPointer, exactly as before.
+mDNSlocal DNSCompressionTable *CompressionTable = mDNSNULL;
+
+// STANDALONE builds only borrow the name compression routines, and never attach a table.
+#ifndef STANDALONE
+mDNSexport void DNSCompressionTableAttach(DNSCompressionTable *const table, const DNSMessage *const msg)
+{
+    if (table)
+    {
+        table->msg = msg;
+        table->count = 0;
+        table->numOpen = 0;
+        table->overflowed = mDNSfalse;
+        mDNSPlatformMemZero(table->slots, sizeof(table->slots));
+        mDNSPlatformMemZero(table->openSlots, sizeof(table->openSlots));
+    }
+    CompressionTable = table;
+}
+
+// Called whenever a message is (re)initialized. Stale entries would be harmless, since every candidate
+// is verified against the packet bytes before use, but clearing them keeps the table from filling up.
+mDNSexport void DNSCompressionTableReset(const DNSMessage *const msg)
+{
+    if (CompressionTable && CompressionTable->msg == msg && (CompressionTable->count || CompressionTable->numOpen))
+        DNSCompressionTableAttach(CompressionTable, msg);
+}
+#endif // !STANDALONE
+
+// Hashes every suffix of the name starting at "np": hashes[i] covers the labels from the i'th label to the end.
+// Hashing proceeds from the root towards the first label, so that each suffix hash depends only on the suffix.
+mDNSlocal int CompressionSuffixHashes(const mDNSu8 *const np, mDNSu32 hashes[MAX_DOMAIN_NAME / 2])
+{
+    const mDNSu8 *labels[MAX_DOMAIN_NAME / 2];
+    const mDNSu8 *p;
+    mDNSu32 h = 2166136261U;                // FNV-1a offset basis
+    int n = 0, i;
+
+    for (p = np; *p && n < MAX_DOMAIN_NAME / 2; p += 1 + *p) labels[n++] = p;
+    for (i = n - 1; i >= 0; i--)
+    {
+        const mDNSu8 *b;
+        for (b = labels[i]; b <= labels[i] + *labels[i]; b++) h = (h ^ *b) * 16777619U;
+        hashes[i] = h;
+    }
+    return(n);
+}
+
+// Returns the highest offset in the packet below "end" at which the given suffix has already been written, if any.
+// Scanning backwards would also find that offset first, so the two methods produce identical packets, provided the
+// target starts at a label written by putDomainNameAsLabels or inside verbatim rdata. The scan could in principle also
+// match bytes that happen to look like labels inside fixed-size fields (header, TTLs, addresses, ports), or in the
+// middle of a label; those positions are not indexed.
+mDNSlocal const mDNSu8 *CompressionTableLookup(const DNSCompressionTable *const table, const mDNSu8 *const base,
+                                               const mDNSu8 *const end, const mDNSu8 *const domname, const mDNSu32 hash)
+{
+    const mDNSu8 *best = mDNSNULL;
+    mDNSu16 e;
+    for (e = table->slots[hash % DNSCompressionTableSlots]; e; e = table->entries[e - 1].next)
+    {
+        const DNSCompressionEntry *const entry = &table->entries[e - 1];
+        const mDNSu8 *const target = base + entry->offset;
+        if (entry->hash == hash && target + *domname + 1 <= end && (!best || target > best) &&
+            CompressionTargetMatches(base, end, target, domname))
+        {
+            best = target;
+        }
+    }
+    // Label sequences that started in verbatim rdata but didn't end there depend on what was written after them,
+    // so they're checked against the packet bytes, just as the scan would.
+    for (e = table->openSlots[*domname]; e; e = table->open[e - 1].next)
+    {
+        const mDNSu8 *const target = base + table->open[e - 1].offset;
+        if (target + *domname + 1 <= end && (!best || target > best) && target[1] == domname[1] &&
+            CompressionTargetMatches(base, end, target, domname))
+        {
+            best = target;
+        }
+    }
+    return(best);
+}
+
+mDNSlocal void CompressionTableAdd(DNSCompressionTable *const table, const mDNSu8 *const base, const mDNSu8 *const label,
+                                   const mDNSu32 hash)
+{
+    const mDNSu32 offset = (mDNSu32)(label - base);
+    DNSCompressionEntry *entry;
+    if (offset >= 0x4000) return;           // Beyond the reach of a compression pointer
+    if (table->count >= DNSCompressionTableEntries) { table->overflowed = mDNStrue; return; }
+    entry = &table->entries[table->count++];
+    entry->hash   = hash;
+    entry->offset = (mDNSu16)offset;
+    entry->next   = table->slots[hash % DNSCompressionTableSlots];
+    table->slots[hash % DNSCompressionTableSlots] = table->count;
+}
+
+#ifndef STANDALONE
+
+// Follows the labels at "p" the way CompressionTargetMatches would, copying them into "name". Returns 1 if they make up
+// a complete name using only bytes below "end", 0 if they run to or past "end", and -1 if no name can match at "p".
+mDNSlocal int CompressionTargetName(const mDNSu8 *const base, const mDNSu8 *const end, const mDNSu8 *p,
+                                    domainname *const name)
+{
+    mDNSu8 *np = name->c;
+    const mDNSu8 *const max = name->c + MAX_DOMAIN_NAME;
+    const mDNSu8 *pointertarget;
+
+    for (;;)
+    {
+        if (p >= end) return(0);
+        if (*p == 0)                                    // End of the name
+        {
+            if (np == name->c) return(-1);              // There's no point matching just the root label
+            *np = 0;
+            return(1);
+        }
+        if (*p < 0x40)                                  // Length byte; the whole label has to be below end
+        {
+            if (p + *p >= end) return(0);
+            if (np + 1 + *p >= max) return(-1);         // Longer than any name we could be asked to write
+            mDNSPlatformMemCopy(np, p, 1 + *p);
+            np += 1 + *p;
+            p  += 1 + *p;
+            continue;
+        }
+        if (*p < 0xC0 || np == name->c) return(-1);     // 40-BF is not valid, and a target can't start with a pointer
+        if (p + 1 >= end) return(0);
+        pointertarget = base + (((mDNSu16)(p[0] & 0x3F)) << 8) + p[1];
+        if (p < pointertarget) return(-1);              // Pointertarget must point *backwards* in the packet
+        if (pointertarget[0] == 0 || pointertarget[0] >= 0x40) return(-1);
+        p = pointertarget;
+    }
+}
+
+// Indexes rdata that was copied into the message verbatim. The backwards scan would consider every byte of it as a
+// possible compression target, so every position that starts a plausible label sequence is recorded.
+mDNSlocal void CompressionTableAddRawData(const DNSMessage *const msg, const mDNSu8 *const start, const mDNSu8 *const end)
+{
+    DNSCompressionTable *const table = (msg && CompressionTable && CompressionTable->msg == msg) ? CompressionTable : mDNSNULL;
+    const mDNSu8 *const base = (const mDNSu8 *)msg;
+    mDNSu32 hashes[MAX_DOMAIN_NAME / 2];
+    domainname name;
+    const mDNSu8 *p;
+
+    if (!table) return;
+    for (p = start; p < end && !table->overflowed; p++)
+    {
+        if (*p == 0 || *p >= 0x40) continue;           // Only a length byte can start a compression target
+        switch (CompressionTargetName(base, end, p, &name))
+        {
+            case 1:
+                CompressionSuffixHashes(name.c, hashes);
+                CompressionTableAdd(table, base, p, hashes[0]);
+                break;
+            case 0:
+                if (p - base >= 0x4000) break;
+                if (table->numOpen >= DNSCompressionTableOpenTargets) { table->overflowed = mDNStrue; break; }
+                table->open[table->numOpen].offset = (mDNSu16)(p - base);
+                table->open[table->numOpen].next = table->openSlots[*p];
+                table->openSlots[*p] = ++table->numOpen;
+                break;
+            default:
+                break;
+        }
+    }
+}
+
+#endif // !STANDALONE
+
 // domainname is a fully-qualified name (i.e. assumed to be ending in a dot, even if it doesn't)
 // msg points to the message we're building (pass mDNSNULL if we don't want to use compression pointers)
 // end points to the end of the message so far
@@ -1917,8 +2226,12 @@ mDNSexport mDNSu8 *putDomainNameAsLabels(const DNSMessage *const msg,
     const mDNSu8 *const max         = name->c + MAX_DOMAIN_NAME;    // Maximum that's valid
     const mDNSu8 *      pointer     = mDNSNULL;
     const mDNSu8 *const searchlimit = ptr;
+    DNSCompressionTable *const table = (base && CompressionTable && CompressionTable->msg == msg) ? CompressionTable : mDNSNULL;
+    mDNSu32 hashes[MAX_DOMAIN_NAME / 2];
+    int label = 0;
 
     if (!ptr) { LogMsg("putDomainNameAsLabels %##s ptr is null", name->c); return(mDNSNULL); }
+    if (table) CompressionSuffixHashes(np, hashes);
 
     if (!*np)       // If just writing one-byte root label, make sure we have space for that
     {
@@ -1942,7 +2255,8 @@ mDNSexport mDNSu8 *putDomainNameAsLabels(const DNSMessage *const msg,
             if (np + 1 + *np >= max)
             { LogMsg("Malformed domain name %##s (more than 256 bytes)", name->c); return(mDNSNULL); }
 
-            if (base) pointer = FindCompressionPointer(base, searchlimit, np);
+            if (table && !table->overflowed) pointer = CompressionTableLookup(table, base, searchlimit, np, hashes[label]);
+            else if (base) pointer = FindCompressionPointer(base, searchlimit, np);
             if (pointer)                    // Use a compression pointer if we can
             {
                 const mDNSu16 offset = (mDNSu16)(pointer - base);
@@ -1957,6 +2271,7 @@ mDNSexport mDNSu8 *putDomainNameAsLabels(const DNSMessage *const msg,
                 mDNSu8 len = *np++;
                 // If we don't at least have enough space for this label *plus* a terminating zero on the end, give up
                 if (ptr + 1 + len >= limit) return(mDNSNULL);
+                if (table) CompressionTableAdd(table, base, ptr, hashes[label++]);
                 *ptr++ = len;
                 for (i=0; i<len; i++) *ptr++ = *np++;
             }
@@ -2027,6 +2342,7 @@ mDNSexport mDNSu8 *putRData(const DNSMessage *const msg, mDNSu8 *ptr, const mDNS
     case kDNSType_LOC:
     case kDNSType_DHCID: if (ptr + rr->rdlength > limit) return(mDNSNULL);
         mDNSPlatformMemCopy(ptr, rdb->data, rr->rdlength);
+        CompressionTableAddRawData(msg, ptr, ptr + rr->rdlength);
         return(ptr + rr->rdlength);
 
     case kDNSType_MX:
@@ -2187,6 +2503,7 @@ mDNSexport mDNSu8 *putRData(const DNSMessage *const msg, mDNSu8 *ptr, const mDNS
 
             // No compression allowed for "nxt", just copy the data.
             mDNSPlatformMemCopy(ptr, rdb->data, rr->rdlength);
+            CompressionTableAddRawData(msg, ptr, ptr + rr->rdlength);
             return(ptr + rr->rdlength);
         }
     }
@@ -2194,6 +2511,7 @@ mDNSexport mDNSu8 *putRData(const DNSMessage *const msg, mDNSu8 *ptr, const mDNS
     default:            debugf("putRData: Warning! Writing unknown resource type %d as raw data", rr->rrtype);
         if (ptr + rr->rdlength > limit) return(mDNSNULL);
         mDNSPlatformMemCopy(ptr, rdb->data, rr->rdlength);
+        CompressionTableAddRawData(msg, ptr, ptr + rr->rdlength);
         return(ptr + rr->rdlength);
     }
 }
@@ -3759,6 +4077,11 @@ mDNSlocal mDNSs32 GetNextScheduledEvent(const mDNS *const m)
 #endif
 
     if (e - m->NextCacheCheck        > 0) e = m->NextCacheCheck;
+    if (CacheHashNeedsResize(m))
+    {
+        if (m->timenow - m->NextCacheHashResize >= 0) return(m->timenow);
+        if (e - m->NextCacheHashResize > 0) e = m->NextCacheHashResize;
+    }
     if (e - m->NextScheduledSPS      > 0) e = m->NextScheduledSPS;
     if (e - m->NextScheduledKA       > 0) e = m->NextScheduledKA;
 
@@ -3837,6 +4160,8 @@ mDNSexport void ShowTaskSchedulingError(mDNS *const m)
 
     if (m->timenow - m->NextCacheCheck        >= 0)
         LogTSE("Task Scheduling Error: m->NextCacheCheck %d",        m->timenow - m->NextCacheCheck);
+    if (CacheHashNeedsResize(m) && m->timenow - m->NextCacheHashResize >= 0)
+        LogTSE("Task Scheduling Error: Cache hash resize %u slots %u groups", m->rrcache_hashslots, m->rrcache_groups);
     if (m->timenow - m->NextScheduledSPS      >= 0)
         LogTSE("Task Scheduling Error: m->NextScheduledSPS %d",      m->timenow - m->NextScheduledSPS);
     if (m->timenow - m->NextScheduledKA       >= 0)
@@ -190,9 +190,15 @@ extern mStatus DNSNameToLowerCase(domainname *d, domainname *result);
 #define LocalRecordReady(X) ((X)->resrec.RecordType != kDNSRecordTypeUnique)
 
 // ***************************************************************************
+// MARK: - RData Slab Allocator
+
+extern void mDNS_RDataSlabInit(mDNS *const m);
+
 // MARK: - DNS Message Creation Functions
 
 extern void InitializeDNSMessage(DNSMessageHeader *h, mDNSOpaque16 id, mDNSOpaque16 flags);
+extern void DNSCompressionTableAttach(DNSCompressionTable *const table, const DNSMessage *const msg);
+extern void DNSCompressionTableReset(const DNSMessage *const msg);
 extern const mDNSu8 *FindCompressionPointer(const mDNSu8 *const base, const mDNSu8 *const end, const mDNSu8 *const domname);
 extern mDNSu8 *putDomainNameAsLabels(const DNSMessage *const msg, mDNSu8 *ptr, const mDNSu8 *const limit, const domainname *const name);
 extern mDNSu8 *putRData(const DNSMessage *const msg, mDNSu8 *ptr, const mDNSu8 *const limit, const ResourceRecord *const rr);
@@ -236,7 +242,16 @@ extern void NSEC3Parse(const ResourceRecord *const rr, mDNSu8 **salt, int *hashL
 // ***************************************************************************
 // MARK: - DNS Message Parsing Functions
 
-#define HashSlotFromNameHash(X) ((X) % CACHE_HASH_SLOTS)
+#define HashSlotFromNameHash(M, X) CacheHashSlot((M), (X))
+
+// The cache hash table is split one slot at a time while the average chain is longer than CacheHashMaxLoad,
+// and merged one slot at a time while it is shorter than 1/CacheHashMinLoadDivisor (but never below CACHE_HASH_SLOTS).
+#define CacheHashMaxLoad        2
+#define CacheHashMinLoadDivisor 2
+#define CacheHashNeedsGrow(M)   ((M)->rrcache_groups > (M)->rrcache_hashslots * CacheHashMaxLoad)
+#define CacheHashNeedsShrink(M) ((M)->rrcache_hashslots > CACHE_HASH_SLOTS && \
+                                 (M)->rrcache_groups * CacheHashMinLoadDivisor < (M)->rrcache_hashslots)
+#define CacheHashNeedsResize(M) (CacheHashNeedsGrow(M) || CacheHashNeedsShrink(M))
 extern mDNSu32 DomainNameHashValue(const domainname *const name);
 extern void SetNewRData(ResourceRecord *const rr, RData *NewRData, mDNSu16 rdlength);
 extern const mDNSu8 *skipDomainName(const DNSMessage *const msg, const mDNSu8 *ptr, const mDNSu8 *const end);
@@ -493,10 +493,22 @@ mDNSexport AuthGroup *RemoveAuthRecord(mDNS *const m, AuthHash *r, AuthRecord *r
     return a;
 }
 
+// The cache hash table uses linear hashing so that it can grow and shrink one slot at a time.
+// rrcache_hashlevel is the slot count at the start of the current round; the first
+// (rrcache_hashslots - rrcache_hashlevel) slots have already been split this round,
+// so names that land in them are addressed modulo twice the level instead.
+mDNSexport mDNSu32 CacheHashSlot(const mDNS *const m, const mDNSu32 namehash)
+{
+    mDNSu32 slot = namehash % m->rrcache_hashlevel;
+    if (slot < m->rrcache_hashslots - m->rrcache_hashlevel)
+        slot = namehash % (m->rrcache_hashlevel * 2);
+    return(slot);
+}
+
 mDNSexport CacheGroup *CacheGroupForName(const mDNS *const m, const mDNSu32 namehash, const domainname *const name)
 {
     CacheGroup *cg;
-    mDNSu32    slot = HashSlotFromNameHash(namehash);
+    mDNSu32    slot = HashSlotFromNameHash(m, namehash);
     for (cg = m->rrcache_hash[slot]; cg; cg=cg->next)
         if (cg->namehash == namehash && SameDomainName(cg->name, name))
             break;
@@ -508,6 +520,53 @@ mDNSlocal CacheGroup *CacheGroupForRecord(const mDNS *const m, const ResourceRec
     return(CacheGroupForName(m, rr->namehash, rr->name));
 }
 
+mDNSlocal void AddQuestionToIDIndex(mDNS *const m, DNSQuestion *const q)
+{
+    DNSQuestion **p;
+    q->NextInIDHash = mDNSNULL;
+    if (mDNSOpaque16IsZero(q->TargetQID)) return;
+    p = &QuestionsForID(m, q->TargetQID);
+    while (*p) p = &(*p)->NextInIDHash;
+    *p = q;
+}
+
+mDNSlocal void RemoveQuestionFromIDIndex(mDNS *const m, DNSQuestion *const q)
+{
+    DNSQuestion **p = &QuestionsForID(m, q->TargetQID);
+    while (*p && *p != q) p = &(*p)->NextInIDHash;
+    if (*p) *p = q->NextInIDHash;
+    q->NextInIDHash = mDNSNULL;
+}
+
+// Called when q joins m->Questions; since it goes on the end of that list, it also goes on the end of its name slot
+mDNSlocal void AddQuestionToIndexes(mDNS *const m, DNSQuestion *const q)
+{
+    DNSQuestion **p = &QuestionsForNameHash(m, q->qnamehash);
+    while (*p) p = &(*p)->NextInNameHash;
+    q->NextInNameHash = mDNSNULL;
+    *p = q;
+    AddQuestionToIDIndex(m, q);
+}
+
+mDNSlocal void RemoveQuestionFromIndexes(mDNS *const m, DNSQuestion *const q)
+{
+    DNSQuestion **p = &QuestionsForNameHash(m, q->qnamehash);
+    while (*p && *p != q) p = &(*p)->NextInNameHash;
+    if (*p) *p = q->NextInNameHash;
+    q->NextInNameHash = mDNSNULL;
+    RemoveQuestionFromIDIndex(m, q);
+}
+
+// Changes the TargetQID of a question, keeping m->QuestionsByID up to date if the question is on m->Questions
+mDNSlocal void SetQuestionTargetQID(mDNS *const m, DNSQuestion *const q, const mDNSOpaque16 id)
+{
+    const DNSQuestion *x = QuestionsForNameHash(m, q->qnamehash);
+    while (x && x != q) x = x->NextInNameHash;
+    RemoveQuestionFromIDIndex(m, q);
+    q->TargetQID = id;
+    if (x) AddQuestionToIDIndex(m, q);
+}
+
 mDNSexport mDNSBool mDNS_AddressIsLocalSubnet(mDNS *const m, const mDNSInterfaceID InterfaceID, const mDNSAddr *addr)
 {
     NetworkInterfaceInfo *intf;
@@ -695,14 +754,14 @@ mDNSexport void AnswerQuestionByFollowingCNAME(mDNS *const m, DNSQuestion *q, Re
 #endif
         if (sock)
         {
-            // If our new query is a duplicate, then it can't have a socket of its own, so we have to close the one we saved.
-            if (q->DuplicateOf) mDNSPlatformUDPClose(sock);
+            // If our new query is a duplicate, then it can't have a socket of its own, so we have to release the one we saved.
+            if (q->DuplicateOf) uDNS_ReleaseQuerySocket(m, sock);
             else
             {
                 // Transplant the old socket into the new question, and copy the query ID across too.
                 // No need to close the old q->LocalSocket value because it won't have been created yet (they're made lazily on-demand).
                 q->LocalSocket = sock;
-                q->TargetQID = id;
+                SetQuestionTargetQID(m, q, id);
             }
         }
     }
@@ -1611,6 +1670,31 @@ mDNSlocal void getKeepaliveRaddr(mDNS *const m, AuthRecord *rr, mDNSAddr *raddr)
     }
 }
 
+// m->ResourceRecordsByName holds every record on the m->ResourceRecords list, chained by name hash, so that code
+// looking for records with a particular name only has to examine one slot instead of every record we have registered.
+// Within a slot, records are kept in the same relative order as on m->ResourceRecords.
+#define ResourceRecordsForNameHash(M, H) ((M)->ResourceRecordsByName[(H) % AUTH_HASH_SLOTS])
+
+// Adds rr to its slot, immediately after 'after' if that's non-NULL, or at the end of the slot otherwise
+mDNSlocal void AddRecordToNameIndex(mDNS *const m, AuthRecord *const rr, AuthRecord *const after)
+{
+    AuthRecord **p = after ? &after->NextInNameHash : &ResourceRecordsForNameHash(m, rr->resrec.namehash);
+    if (!after) while (*p) p = &(*p)->NextInNameHash;
+    rr->NextInNameHash = *p;
+    *p = rr;
+}
+
+// Exported so uDNS.c can call this
+mDNSexport void RemoveRecordFromNameIndex(mDNS *const m, AuthRecord *const rr)
+{
+    AuthRecord **p = &ResourceRecordsForNameHash(m, rr->resrec.namehash);
+    while (*p && *p != rr) p = &(*p)->NextInNameHash;
+    if (*p) *p = rr->NextInNameHash;
+    // If someone is about to look at this, bump the pointer forward
+    if (m->CurrentRecordByName == rr) m->CurrentRecordByName = rr->NextInNameHash;
+    rr->NextInNameHash = mDNSNULL;
+}
+
 // Exported so uDNS.c can call this
 mDNSexport mStatus mDNS_Register_internal(mDNS *const m, AuthRecord *const rr)
 {
@@ -1856,6 +1940,7 @@ mDNSexport mStatus mDNS_Register_internal(mDNS *const m, AuthRecord *const rr)
         // records to the list, so we now need to update p to advance to the new end to the list before appending our new record.
         while (*p) p=&(*p)->next;
         *p = rr;
+        AddRecordToNameIndex(m, rr, mDNSNULL);
         if (rr->resrec.RecordType == kDNSRecordTypeUnique) rr->resrec.RecordType = kDNSRecordTypeVerified;
         rr->ProbeCount    = 0;
         rr->ProbeRestartCount = 0;
@@ -1875,7 +1960,7 @@ mDNSexport mStatus mDNS_Register_internal(mDNS *const m, AuthRecord *const rr)
     }
     else
     {
-        for (r = m->ResourceRecords; r; r=r->next)
+        for (r = ResourceRecordsForNameHash(m, rr->resrec.namehash); r; r=r->NextInNameHash)
             if (RecordIsLocalDuplicate(r, rr))
             {
                 if (r->resrec.RecordType == kDNSRecordTypeDeregistering) r->AnnounceCount = 0;
@@ -1915,6 +2000,7 @@ mDNSexport mStatus mDNS_Register_internal(mDNS *const m, AuthRecord *const rr)
         {
             if (!m->NewLocalRecords) m->NewLocalRecords = rr;
             *p = rr;
+            AddRecordToNameIndex(m, rr, mDNSNULL);
         }
     }
 
@@ -2037,6 +2123,7 @@ mDNSexport mStatus mDNS_Deregister_internal(mDNS *const m, AuthRecord *const rr,
                 {
                     dup->next = rr->next;       // And then...
                     rr->next  = dup;            // ... splice it in right after the record we're about to delete
+                    AddRecordToNameIndex(m, dup, rr);
                 }
                 dup->resrec.RecordType        = rr->resrec.RecordType;
                 dup->ProbeCount      = rr->ProbeCount;
@@ -2180,6 +2267,7 @@ mDNSexport mStatus mDNS_Deregister_internal(mDNS *const m, AuthRecord *const rr,
         else
         {
             *p = rr->next;                  // Cut this record from the list
+            if (!dupList) RemoveRecordFromNameIndex(m, rr);
             if (m->NewLocalRecords == rr) m->NewLocalRecords = rr->next;
             DecrementAutoTargetServices(m, rr);
         }
@@ -2268,7 +2356,7 @@ mDNSlocal void AddRRSetAdditionalsToResponseList(mDNS *const m, AuthRecord ***nr
     AuthRecord *rr2;
     if (additional->resrec.RecordType & kDNSRecordTypeUniqueMask)
     {
-        for (rr2 = m->ResourceRecords; rr2; rr2 = rr2->next)
+        for (rr2 = ResourceRecordsForNameHash(m, additional->resrec.namehash); rr2; rr2 = rr2->NextInNameHash)
         {
             if ((rr2->resrec.namehash == additional->resrec.namehash) &&
                 (rr2->resrec.rrtype   == additional->resrec.rrtype) &&
@@ -2306,7 +2394,7 @@ mDNSlocal void AddAdditionalsToResponseList(mDNS *const m, AuthRecord *ResponseR
         // For SRV records, automatically add the Address record(s) for the target host
         if (rr->resrec.rrtype == kDNSType_SRV)
         {
-            for (rr2=m->ResourceRecords; rr2; rr2=rr2->next)                    // Scan list of resource records
+            for (rr2 = ResourceRecordsForNameHash(m, rr->resrec.rdatahash); rr2; rr2 = rr2->NextInNameHash)
                 if (RRTypeIsAddressType(rr2->resrec.rrtype) &&                  // For all address records (A/AAAA) ...
                     ResourceRecordIsValidInterfaceAnswer(rr2, InterfaceID) &&   // ... which are valid for answer ...
                     rr->resrec.rdatahash == rr2->resrec.namehash &&         // ... whose name is the name of the SRV target
@@ -2315,7 +2403,7 @@ mDNSlocal void AddAdditionalsToResponseList(mDNS *const m, AuthRecord *ResponseR
         }
         else if (RRTypeIsAddressType(rr->resrec.rrtype))    // For A or AAAA, put counterpart as additional
         {
-            for (rr2=m->ResourceRecords; rr2; rr2=rr2->next)                    // Scan list of resource records
+            for (rr2 = ResourceRecordsForNameHash(m, rr->resrec.namehash); rr2; rr2 = rr2->NextInNameHash)
                 if (RRTypeIsAddressType(rr2->resrec.rrtype) &&                  // For all address records (A/AAAA) ...
                     ResourceRecordIsValidInterfaceAnswer(rr2, InterfaceID) &&   // ... which are valid for answer ...
                     rr->resrec.namehash == rr2->resrec.namehash &&              // ... and have the same name
@@ -2880,7 +2968,7 @@ mDNSlocal void SendResponses(mDNS *const m)
     for (rr = m->ResourceRecords; rr; rr=rr->next)
     {
         if (rr->ImmedAnswer && rr->resrec.rrtype == kDNSType_SRV)
-            for (r2=m->ResourceRecords; r2; r2=r2->next)                // Scan list of resource records
+            for (r2 = ResourceRecordsForNameHash(m, rr->resrec.rdatahash); r2; r2=r2->NextInNameHash)
                 if (RRTypeIsAddressType(r2->resrec.rrtype) &&           // For all address records (A/AAAA) ...
                     ResourceRecordIsValidAnswer(r2) &&                  // ... which are valid for answer ...
                     rr->LastMCTime - r2->LastMCTime >= 0 &&             // ... which we have not sent recently ...
@@ -2910,7 +2998,7 @@ mDNSlocal void SendResponses(mDNS *const m)
         {
             if (rr->ImmedAnswer)            // If we're sending this as answer, see that its whole RRSet is similarly marked
             {
-                for (r2 = m->ResourceRecords; r2; r2=r2->next)
+                for (r2 = ResourceRecordsForNameHash(m, rr->resrec.namehash); r2; r2=r2->NextInNameHash)
                 {
                     if ((r2->resrec.RecordType & kDNSRecordTypeUniqueMask) && ResourceRecordIsValidAnswer(r2) &&
                         (r2->ImmedAnswer != mDNSInterfaceMark) && (r2->ImmedAnswer != rr->ImmedAnswer) &&
@@ -2923,7 +3011,7 @@ mDNSlocal void SendResponses(mDNS *const m)
             }
             else if (rr->ImmedAdditional)   // If we're sending this as additional, see that its whole RRSet is similarly marked
             {
-                for (r2 = m->ResourceRecords; r2; r2=r2->next)
+                for (r2 = ResourceRecordsForNameHash(m, rr->resrec.namehash); r2; r2=r2->NextInNameHash)
                 {
                     if ((r2->resrec.RecordType & kDNSRecordTypeUniqueMask) && ResourceRecordIsValidAnswer(r2) &&
                         (r2->ImmedAdditional != rr->ImmedAdditional) &&
@@ -3061,7 +3149,7 @@ mDNSlocal void SendResponses(mDNS *const m)
                     if (!SendAdditional && (rr->resrec.RecordType & kDNSRecordTypeUniqueMask))
                     {
                         const AuthRecord *a;
-                        for (a = m->ResourceRecords; a; a=a->next)
+                        for (a = ResourceRecordsForNameHash(m, rr->resrec.namehash); a; a=a->NextInNameHash)
                             if (a->LastMCTime      == m->timenow &&
                                 a->LastMCInterface == intf->InterfaceID &&
                                 SameResourceRecordSignature(a, rr)) { SendAdditional = mDNStrue; break; }
@@ -3117,7 +3205,7 @@ mDNSlocal void SendResponses(mDNS *const m)
                     ptr += len;
                     *ptr++ = 0; // window number
                     *ptr++ = NSEC_MCAST_WINDOW_SIZE; // window length
-                    for (r2 = m->ResourceRecords; r2; r2=r2->next)
+                    for (r2 = ResourceRecordsForNameHash(m, rr->resrec.namehash); r2; r2=r2->NextInNameHash)
                         if (ResourceRecordIsValidAnswer(r2) && SameResourceRecordNameClassInterface(r2, rr))
                         {
                             if (r2->resrec.rrtype >= kDNSQType_ANY) { LogMsg("SendResponses: Can't create NSEC for record %s", ARDisplayString(m, r2)); break; }
@@ -3137,8 +3225,8 @@ mDNSlocal void SendResponses(mDNS *const m)
                 if (newptr || rr->SendNSECNow == mDNSInterfaceMark)
                 {
                     rr->SendNSECNow = mDNSNULL;
-                    // Run through remainder of list clearing SendNSECNow flag for all other records which would generate the same NSEC
-                    for (r2 = rr->next; r2; r2=r2->next)
+                    // Run through remainder of its name hash slot clearing SendNSECNow flag for all other records which would generate the same NSEC
+                    for (r2 = rr->NextInNameHash; r2; r2=r2->NextInNameHash)
                         if (SameResourceRecordNameClassInterface(r2, rr))
                             if (r2->SendNSECNow == mDNSInterfaceMark || r2->SendNSECNow == intf->InterfaceID)
                                 r2->SendNSECNow = mDNSNULL;
@@ -3248,7 +3336,7 @@ mDNSlocal void SendResponses(mDNS *const m)
     verbosedebugf("SendResponses: Next in %ld ticks", m->NextScheduledResponse - m->timenow);
 }
 
-// Calling CheckCacheExpiration() is an expensive operation because it has to look at the entire cache,
+// Calling CheckCacheExpiration() means walking every record in a CacheGroup and possibly delivering callbacks,
 // so we want to be lazy about how frequently we do it.
 // 1. If a cache record is currently referenced by *no* active questions,
 //    then we don't mind expiring it up to a minute late (who will know?)
@@ -3268,12 +3356,92 @@ mDNSlocal void SendResponses(mDNS *const m)
 
 #define NextCacheCheckEvent(CR) ((CR)->NextRequiredQuery + CacheCheckGracePeriod(CR))
 
-mDNSexport void ScheduleNextCacheCheckTime(mDNS *const m, const mDNSu32 slot, const mDNSs32 event)
+// CacheGroups that need CheckCacheExpiration at some future time are kept in m->rrcache_checkheap, a pairing heap
+// ordered by cg->nextcheck, so that mDNS_Execute only has to visit the groups that are actually due.
+// The heap is intrusive (its links live in the CacheGroup itself), so it needs no storage of its own.
+#define CacheCheckQueued(M, CG) ((CG)->checkprev || (M)->rrcache_checkheap == (CG))
+
+// Links two heap roots together, returning the one with the earlier nextcheck as the new root.
+mDNSlocal CacheGroup *CacheCheckMeld(CacheGroup *a, CacheGroup *b)
 {
-    if (m->rrcache_nextcheck[slot] - event > 0)
-        m->rrcache_nextcheck[slot] = event;
-    if (m->NextCacheCheck          - event > 0)
-        m->NextCacheCheck          = event;
+    if (!a) return(b);
+    if (!b) return(a);
+    if (a->nextcheck - b->nextcheck > 0) { CacheGroup *const t = a; a = b; b = t; }
+    b->checkprev    = a;
+    b->checksibling = a->checkchild;
+    if (a->checkchild) a->checkchild->checkprev = b;
+    a->checkchild   = b;
+    return(a);
+}
+
+// Standard two-pass pairing: meld siblings left to right in pairs, then meld the pairs right to left.
+mDNSlocal CacheGroup *CacheCheckMergePairs(CacheGroup *first)
+{
+    CacheGroup *pairs = mDNSNULL, *result = mDNSNULL;
+    while (first)
+    {
+        CacheGroup *a = first, *b = first->checksibling;
+        first = b ? b->checksibling : mDNSNULL;
+        a->checkprev = a->checksibling = mDNSNULL;
+        if (b) b->checkprev = b->checksibling = mDNSNULL;
+        a = CacheCheckMeld(a, b);
+        a->checksibling = pairs;
+        pairs = a;
+    }
+    while (pairs)
+    {
+        CacheGroup *const next = pairs->checksibling;
+        pairs->checksibling = mDNSNULL;
+        result = CacheCheckMeld(result, pairs);
+        pairs = next;
+    }
+    return(result);
+}
+
+// Detaches a non-root CacheGroup (along with its subtree) from its parent or sibling list
+mDNSlocal void CacheCheckCut(CacheGroup *const cg)
+{
+    if (cg->checkprev->checkchild == cg) cg->checkprev->checkchild = cg->checksibling;
+    else                                 cg->checkprev->checksibling = cg->checksibling;
+    if (cg->checksibling) cg->checksibling->checkprev = cg->checkprev;
+    cg->checkprev = cg->checksibling = mDNSNULL;
+}
+
+mDNSlocal void CacheCheckDequeue(mDNS *const m, CacheGroup *const cg)
+{
+    CacheGroup *children;
+    if (!CacheCheckQueued(m, cg)) return;
+    if (cg != m->rrcache_checkheap) CacheCheckCut(cg);
+    children = cg->checkchild;
+    cg->checkchild = mDNSNULL;
+    if (children) children->checkprev = mDNSNULL;
+    if (cg == m->rrcache_checkheap) m->rrcache_checkheap = CacheCheckMergePairs(children);
+    else m->rrcache_checkheap = CacheCheckMeld(m->rrcache_checkheap, CacheCheckMergePairs(children));
+}
+
+mDNSexport void ScheduleNextCacheCheckTime(mDNS *const m, CacheGroup *const cg, const mDNSs32 event)
+{
+    if (cg)
+    {
+        if (!CacheCheckQueued(m, cg))
+        {
+            cg->nextcheck    = event;
+            cg->checkchild   = mDNSNULL;
+            cg->checksibling = mDNSNULL;
+            m->rrcache_checkheap = CacheCheckMeld(m->rrcache_checkheap, cg);
+        }
+        else if (cg->nextcheck - event > 0)
+        {
+            cg->nextcheck = event;
+            if (cg != m->rrcache_checkheap)
+            {
+                CacheCheckCut(cg);
+                m->rrcache_checkheap = CacheCheckMeld(m->rrcache_checkheap, cg);
+            }
+        }
+    }
+    if (m->NextCacheCheck - event > 0)
+        m->NextCacheCheck = event;
 }
 
 // Note: MUST call SetNextCacheCheckTimeForRecord any time we change:
@@ -3294,7 +3462,7 @@ mDNSexport void SetNextCacheCheckTimeForRecord(mDNS *const m, CacheRecord *const
         verbosedebugf("SetNextCacheCheckTimeForRecord: NextRequiredQuery in %ld sec CacheCheckGracePeriod %d ticks for %s",
                       (rr->NextRequiredQuery - m->timenow) / mDNSPlatformOneSecond, CacheCheckGracePeriod(rr), CRDisplayString(m,rr));
     }
-    ScheduleNextCacheCheckTime(m, HashSlotFromNameHash(rr->resrec.namehash), NextCacheCheckEvent(rr));
+    ScheduleNextCacheCheckTime(m, CacheGroupForRecord(m, &rr->resrec), NextCacheCheckEvent(rr));
 }
 
 #define kMinimumReconfirmTime                     ((mDNSu32)mDNSPlatformOneSecond *  5)
@@ -4317,6 +4485,8 @@ mDNSexport void AnswerCurrentQuestionWithResourceRecord(mDNS *const m, CacheReco
             return;
     }
     
+    if (AddRecord) rr->CacheReferenced = mDNStrue;
+
     //  Set the record to immortal if appropriate
     if (AddRecord == QC_add && Question_uDNS(q) && rr->resrec.RecordType != kDNSRecordTypePacketNegative &&
         q->allowExpired != AllowExpired_None && rr->resrec.mortality == Mortality_Mortal ) rr->resrec.mortality = Mortality_Immortal; // Update a non-expired cache record to immortal if appropriate
@@ -4414,8 +4584,8 @@ mDNSexport void AnswerCurrentQuestionWithResourceRecord(mDNS *const m, CacheReco
 
             if (sock)                                           // Transplant saved socket, if appropriate
             {
-                if (q->DuplicateOf) mDNSPlatformUDPClose(sock);
-                else { q->LocalSocket = sock; q->TargetQID = id; }
+                if (q->DuplicateOf) uDNS_ReleaseQuerySocket(m, sock);
+                else { q->LocalSocket = sock; SetQuestionTargetQID(m, q, id); }
             }
             return;                                             // All done for now; wait until we get the next answer
         }
@@ -4724,8 +4894,10 @@ mDNSlocal void ReleaseCacheGroup(mDNS *const m, CacheGroup **cp)
     //  LogMsg("ReleaseCacheGroup: %##s, %p %p", (*cp)->name->c, (*cp)->name, (domainname*)((*cp)->namestorage));
     if ((*cp)->name != (domainname*)((*cp)->namestorage)) mDNSPlatformMemFree((*cp)->name);
     (*cp)->name = mDNSNULL;
+    CacheCheckDequeue(m, *cp);
     *cp = (*cp)->next;          // Cut record from list
     ReleaseCacheEntity(m, e);
+    m->rrcache_groups--;
 }
 
 mDNSlocal void ReleaseAdditionalCacheRecords(mDNS *const m, CacheRecord **rp)
@@ -4736,7 +4908,7 @@ mDNSlocal void ReleaseAdditionalCacheRecords(mDNS *const m, CacheRecord **rp)
         *rp = (*rp)->next;          // Cut record from list
         if (rr->resrec.rdata && rr->resrec.rdata != (RData*)&rr->smallrdatastorage)
         {
-            mDNSPlatformMemFree(rr->resrec.rdata);
+            mDNS_FreeRData(m, rr->resrec.rdata);
             rr->resrec.rdata = mDNSNULL;
         }
         // NSEC or SOA records that are not added to the CacheGroup do not share the name
@@ -4761,7 +4933,7 @@ mDNSexport void ReleaseCacheRecord(mDNS *const m, CacheRecord *r)
     CacheGroup *cg;
 
     //LogMsg("ReleaseCacheRecord: Releasing %s", CRDisplayString(m, r));
-    if (r->resrec.rdata && r->resrec.rdata != (RData*)&r->smallrdatastorage) mDNSPlatformMemFree(r->resrec.rdata);
+    if (r->resrec.rdata && r->resrec.rdata != (RData*)&r->smallrdatastorage) mDNS_FreeRData(m, r->resrec.rdata);
     r->resrec.rdata = mDNSNULL;
 #if MDNSRESPONDER_SUPPORTS(APPLE, QUERIER)
     mdns_forget(&r->resrec.dnsservice);
@@ -4799,13 +4971,23 @@ mDNSexport void ReleaseCacheRecord(mDNS *const m, CacheRecord *r)
 // Note: We want to be careful that we deliver all the CacheRecordRmv calls before delivering
 // CacheRecordDeferredAdd calls. The in-order nature of the cache lists ensures that all
 // callbacks for old records are delivered before callbacks for newer records.
-mDNSlocal void CheckCacheExpiration(mDNS *const m, const mDNSu32 slot, CacheGroup *const cg)
+mDNSlocal void CheckCacheExpiration(mDNS *const m, CacheGroup *const cg)
 {
     CacheRecord **rp = &cg->members;
 
-    if (m->lock_rrcache) { LogMsg("CheckCacheExpiration ERROR! Cache already locked!"); return; }
+    if (m->lock_rrcache)
+    {
+        LogMsg("CheckCacheExpiration ERROR! Cache already locked!");
+        // Push this group back so that mDNS_Execute doesn't keep finding it at the top of the heap
+        CacheCheckDequeue(m, cg);
+        ScheduleNextCacheCheckTime(m, cg, NonZeroTime(m->timenow + mDNSPlatformOneSecond));
+        return;
+    }
     m->lock_rrcache = 1;
 
+    // We're about to recompute when this group next needs attention, so take it off the check heap for now
+    CacheCheckDequeue(m, cg);
+
     while (*rp)
     {
         CacheRecord *const rr = *rp;
@@ -4893,8 +5075,7 @@ mDNSlocal void CheckCacheExpiration(mDNS *const m, const mDNSu32 slot, CacheGrou
         {
             verbosedebugf("CheckCacheExpiration:%6d %5d %s",
                           (event - m->timenow) / mDNSPlatformOneSecond, CacheCheckGracePeriod(rr), CRDisplayString(m, rr));
-            if (m->rrcache_nextcheck[slot] - event > 0)
-                m->rrcache_nextcheck[slot] = event;
+            if (event - m->timenow < FutureTime) ScheduleNextCacheCheckTime(m, cg, event);
             rp = &rr->next;
         }
     }
@@ -5015,7 +5196,7 @@ mDNSlocal void AnswerNewQuestion(mDNS *const m)
 
     verbosedebugf("AnswerNewQuestion: Answering %##s (%s)", q->qname.c, DNSTypeName(q->qtype));
 
-    if (cg) CheckCacheExpiration(m, HashSlotFromNameHash(q->qnamehash), cg);
+    if (cg) CheckCacheExpiration(m, cg);
     if (m->NewQuestions != q) { LogInfo("AnswerNewQuestion: Question deleted while doing CheckCacheExpiration"); goto exit; }
     m->NewQuestions = q->next;
     // Advance NewQuestions to the next *after* calling CheckCacheExpiration, because if we advance it first
@@ -5218,6 +5399,59 @@ mDNSlocal void AnswerNewLocalOnlyQuestion(mDNS *const m)
     m->CurrentRecord   = mDNSNULL;
 }
 
+// The number of hash slots one eviction sweep visits once it has freed something, so that reclaiming space doesn't
+// usually turn into a walk over the whole cache, and the number of entities a sweep tries to free before returning.
+#define CACHE_EVICT_MAX_SLOTS 64
+#define CACHE_EVICT_BATCH     4
+
+// Approximate-LRU (CLOCK) eviction. The hand advances over the hash slots one at a time. A record that has been used
+// since the hand last passed gets its reference bit cleared and a second chance; one that hasn't is evicted.
+// Records answering active questions, or on the CacheFlushRecords list, are never evicted. A sweep that has freed
+// nothing keeps going past CACHE_EVICT_MAX_SLOTS, for up to two full laps: the first lap clears every reference bit,
+// so the second finds any evictable record there is.
+mDNSlocal void EvictCacheRecords(mDNS *const m, const CacheGroup *const PreserveCG, const mDNSu32 needed)
+{
+    const mDNSu32 oldtotalused = m->rrcache_totalused;
+    mDNSu32 evicted = 0;
+    mDNSu32 visited;
+
+    for (visited = 0; oldtotalused - m->rrcache_totalused < needed; visited++)
+    {
+        if (visited >= CACHE_EVICT_MAX_SLOTS &&
+            (oldtotalused != m->rrcache_totalused || visited >= 2 * m->rrcache_hashslots)) break;
+        // The hash table may have shrunk since the hand last moved.
+        const mDNSu32 slot = m->rrcache_clockhand % m->rrcache_hashslots;
+        CacheGroup **cp = &m->rrcache_hash[slot];
+        m->rrcache_clockhand = slot + 1;
+        while (*cp && oldtotalused - m->rrcache_totalused < needed)
+        {
+            CacheRecord **rp = &(*cp)->members;
+            while (*rp && oldtotalused - m->rrcache_totalused < needed)
+            {
+                CacheRecord *const cr = *rp;
+                if (cr->CRActiveQuestion || cr->NextInCFList)
+                    rp = &cr->next;
+                else if (cr->CacheReferenced)
+                {
+                    cr->CacheReferenced = mDNSfalse;
+                    rp = &cr->next;
+                }
+                else
+                {
+                    *rp = cr->next;          // Cut record from list
+                    if (!*rp) (*cp)->rrcache_tail = rp;
+                    ReleaseCacheRecord(m, cr);
+                    evicted++;
+                }
+            }
+            if ((*cp)->members || (*cp)==PreserveCG) cp=&(*cp)->next;
+            else ReleaseCacheGroup(m, cp);
+        }
+    }
+    m->mDNSStats.CacheEvictions += evicted;
+    verbosedebugf("EvictCacheRecords: evicted %u records in %u slots", evicted, visited);
+}
+
 mDNSlocal CacheEntity *GetCacheEntity(mDNS *const m, const CacheGroup *const PreserveCG)
 {
     CacheEntity *e = mDNSNULL;
@@ -5244,6 +5478,10 @@ mDNSlocal CacheEntity *GetCacheEntity(mDNS *const m, const CacheGroup *const Pre
             LogRedact(MDNS_LOG_CATEGORY_DEFAULT, MDNS_LOG_DEFAULT, "Possible denial-of-service attack in progress: m->rrcache_size %u; m->rrcache_active %u",
                 m->rrcache_size, m->rrcache_active);
         }
+        else if (m->rrcache_budget && m->rrcache_size >= m->rrcache_budget)
+        {
+            // The cache is as big as we're allowed to make it, so make room by evicting records below.
+        }
         else
         {
             mDNS_DropLockBeforeCallback();      // Allow client to legally make mDNS API calls from the callback
@@ -5252,40 +5490,16 @@ mDNSlocal CacheEntity *GetCacheEntity(mDNS *const m, const CacheGroup *const Pre
         }
     }
 
-    // If we still have no free records, recycle all the records we can.
-    // Enumerating the entire cache is moderately expensive, so when we do it, we reclaim all the records we can in one pass.
+    // If we still have no free records, evict a few of the least recently used ones.
     if (!m->rrcache_free)
     {
-        mDNSu32 oldtotalused = m->rrcache_totalused;
-        mDNSu32 slot;
-        for (slot = 0; slot < CACHE_HASH_SLOTS; slot++)
+        EvictCacheRecords(m, PreserveCG, CACHE_EVICT_BATCH);
+        if (!m->rrcache_free)
         {
-            CacheGroup **cp = &m->rrcache_hash[slot];
-            while (*cp)
-            {
-                CacheRecord **rp = &(*cp)->members;
-                while (*rp)
-                {
-                    // Records that answer still-active questions are not candidates for recycling
-                    // Records that are currently linked into the CacheFlushRecords list may not be recycled, or we'll crash
-                    if ((*rp)->CRActiveQuestion || (*rp)->NextInCFList)
-                        rp=&(*rp)->next;
-                    else
-                    {
-                        CacheRecord *rr = *rp;
-                        *rp = (*rp)->next;          // Cut record from list
-                        ReleaseCacheRecord(m, rr);
-                    }
-                }
-                if ((*cp)->rrcache_tail != rp)
-                    verbosedebugf("GetFreeCacheRR: Updating rrcache_tail[%lu] from %p to %p", slot, (*cp)->rrcache_tail, rp);
-                (*cp)->rrcache_tail = rp;
-                if ((*cp)->members || (*cp)==PreserveCG) cp=&(*cp)->next;
-                else ReleaseCacheGroup(m, cp);
-            }
+            m->mDNSStats.CacheEvictionFailures++;
+            LogRedact(MDNS_LOG_CATEGORY_DEFAULT, MDNS_LOG_INFO, "GetCacheEntity: no evictable records; %u of %u entities in use",
+                m->rrcache_totalused, m->rrcache_size);
         }
-        LogRedact(MDNS_LOG_CATEGORY_DEFAULT, MDNS_LOG_DEFAULT,  "GetCacheEntity recycled %d records to reduce cache from %d to %d",
-            oldtotalused - m->rrcache_totalused, oldtotalused, m->rrcache_totalused);
     }
 
     if (m->rrcache_free)    // If there are records in the free list, take one
@@ -5312,11 +5526,12 @@ mDNSlocal CacheRecord *GetCacheRecord(mDNS *const m, CacheGroup *cg, mDNSu16 RDL
     CacheRecord *r = (CacheRecord *)GetCacheEntity(m, cg);
     if (r)
     {
+        r->CacheReferenced = mDNStrue;                      // Give new records a full lap of the eviction hand
         r->resrec.rdata = (RData*)&r->smallrdatastorage;    // By default, assume we're usually going to be using local storage
         if (RDLength > InlineCacheRDSize)           // If RDLength is too big, allocate extra storage
         {
-            r->resrec.rdata = (RData*) mDNSPlatformMemAllocateClear(sizeofRDataHeader + RDLength);
-            if (r->resrec.rdata) r->resrec.rdata->MaxRDLength = r->resrec.rdlength = RDLength;
+            r->resrec.rdata = mDNS_AllocateRData(m, RDLength);
+            if (r->resrec.rdata) r->resrec.rdlength = RDLength;
             else { ReleaseCacheEntity(m, (CacheEntity*)r); r = mDNSNULL; }
         }
     }
@@ -5332,6 +5547,9 @@ mDNSlocal CacheGroup *GetCacheGroup(mDNS *const m, const mDNSu32 slot, const Res
     cg->namehash     = rr->namehash;
     cg->members      = mDNSNULL;
     cg->rrcache_tail = &cg->members;
+    cg->checkchild   = mDNSNULL;
+    cg->checksibling = mDNSNULL;
+    cg->checkprev    = mDNSNULL;
     if (namelen > sizeof(cg->namestorage))
         cg->name = (domainname *) mDNSPlatformMemAllocate(namelen);
     else
@@ -5346,11 +5564,112 @@ mDNSlocal CacheGroup *GetCacheGroup(mDNS *const m, const mDNSu32 slot, const Res
 
     if (CacheGroupForRecord(m, rr)) LogMsg("GetCacheGroup: Already have CacheGroup for %##s", rr->name->c);
     m->rrcache_hash[slot] = cg;
+    m->rrcache_groups++;
     if (CacheGroupForRecord(m, rr) != cg) LogMsg("GetCacheGroup: Not finding CacheGroup for %##s", rr->name->c);
 
     return(cg);
 }
 
+// Moves the cache hash table to new storage with room for "capacity" slots, copying the slots in use.
+// At the minimum size the table lives in the fixed arrays inside mDNS_struct, so a platform
+// without a general-purpose allocator simply never grows past CACHE_HASH_SLOTS.
+mDNSlocal mDNSBool CacheHashSetCapacity(mDNS *const m, const mDNSu32 capacity)
+{
+    CacheGroup **hash;
+
+    if (capacity == CACHE_HASH_SLOTS) hash = m->rrcache_hash_initial;
+    else
+    {
+        hash = (CacheGroup **)mDNSPlatformMemAllocate(capacity * (mDNSu32)sizeof(*hash));
+        if (!hash) return(mDNSfalse);
+    }
+    mDNSPlatformMemCopy(hash, m->rrcache_hash, m->rrcache_hashslots * (mDNSu32)sizeof(*hash));
+    if (m->rrcache_hash != m->rrcache_hash_initial) mDNSPlatformMemFree(m->rrcache_hash);
+    m->rrcache_hash         = hash;
+    m->rrcache_hashcapacity = capacity;
+    return(mDNStrue);
+}
+
+// Adds one slot to the end of the table and moves into it the CacheGroups from the slot that it splits.
+mDNSlocal mDNSBool CacheHashSplitSlot(mDNS *const m)
+{
+    const mDNSu32 from = m->rrcache_hashslots - m->rrcache_hashlevel;
+    const mDNSu32 to   = m->rrcache_hashslots;
+    CacheGroup **cp;
+
+    if (to >= m->rrcache_hashcapacity && !CacheHashSetCapacity(m, m->rrcache_hashlevel * 2)) return(mDNSfalse);
+
+    m->rrcache_hash[to] = mDNSNULL;
+    m->rrcache_hashslots++;
+    if (m->rrcache_hashslots == m->rrcache_hashlevel * 2) m->rrcache_hashlevel = m->rrcache_hashslots;
+
+    cp = &m->rrcache_hash[from];
+    while (*cp)
+    {
+        CacheGroup *const cg = *cp;
+        if (HashSlotFromNameHash(m, cg->namehash) != to) cp = &cg->next;
+        else
+        {
+            *cp = cg->next;
+            cg->next = m->rrcache_hash[to];
+            m->rrcache_hash[to] = cg;
+        }
+    }
+    return(mDNStrue);
+}
+
+// Removes the last slot from the table, appending its CacheGroups to the slot it was split from.
+mDNSlocal void CacheHashMergeSlot(mDNS *const m)
+{
+    mDNSu32 from, to;
+    CacheGroup **cp;
+
+    if (m->rrcache_hashslots == m->rrcache_hashlevel) m->rrcache_hashlevel /= 2;
+    from = m->rrcache_hashslots - 1;
+    to   = from - m->rrcache_hashlevel;
+
+    for (cp = &m->rrcache_hash[to]; *cp; cp = &(*cp)->next) continue;
+    *cp = m->rrcache_hash[from];
+    m->rrcache_hash[from] = mDNSNULL;
+    m->rrcache_hashslots--;
+
+    // Give back storage once we're back down to half of it. If that fails we just keep the larger table.
+    if (m->rrcache_hashcapacity > CACHE_HASH_SLOTS && m->rrcache_hashslots <= m->rrcache_hashcapacity / 2)
+        CacheHashSetCapacity(m, m->rrcache_hashcapacity / 2);
+}
+
+// Called from mDNS_Execute when the table's load factor is out of range. Each call does a bounded
+// amount of work, so a large cache is rehashed over several passes rather than in one long stall.
+#define CacheHashResizeStepsPerPass 64
+
+mDNSlocal void CacheHashResize(mDNS *const m)
+{
+    int steps;
+    m->NextCacheHashResize = m->timenow;
+    for (steps = 0; steps < CacheHashResizeStepsPerPass; steps++)
+    {
+        if (CacheHashNeedsGrow(m))
+        {
+            if (!CacheHashSplitSlot(m))
+            {
+                LogRedact(MDNS_LOG_CATEGORY_DEFAULT, MDNS_LOG_ERROR,
+                    "CacheHashResize: Failed to grow cache hash table beyond %u slots (%u groups)", m->rrcache_hashslots, m->rrcache_groups);
+                m->NextCacheHashResize = NonZeroTime(m->timenow + 60 * mDNSPlatformOneSecond);
+                return;
+            }
+        }
+        else if (CacheHashNeedsShrink(m))
+        {
+            CacheHashMergeSlot(m);
+        }
+        else
+        {
+            break;
+        }
+    }
+    debugf("CacheHashResize: %u slots, %u groups", m->rrcache_hashslots, m->rrcache_groups);
+}
+
 mDNSexport void mDNS_PurgeCacheResourceRecord(mDNS *const m, CacheRecord *rr)
 {
     mDNS_CheckLock(m);
@@ -5534,30 +5853,27 @@ mDNSexport mDNSs32 mDNS_Execute(mDNS *const m)
         if (m->rrcache_size && m->timenow - m->NextCacheCheck >= 0)
         {
             mDNSu32 numchecked = 0;
-            m->NextCacheCheck = m->timenow + FutureTime;
-            for (slot = 0; slot < CACHE_HASH_SLOTS; slot++)
+            CacheGroup *cg;
+            // CheckCacheExpiration always reschedules a group strictly in the future, so this loop terminates
+            while ((cg = m->rrcache_checkheap) != mDNSNULL && m->timenow - cg->nextcheck >= 0)
             {
-                if (m->timenow - m->rrcache_nextcheck[slot] >= 0)
+                debugf("m->NextCacheCheck %4d %##s", numchecked, cg->name);
+                numchecked++;
+                CheckCacheExpiration(m, cg);
+                if (!cg->members)
                 {
-                    CacheGroup **cp = &m->rrcache_hash[slot];
-                    m->rrcache_nextcheck[slot] = m->timenow + FutureTime;
-                    while (*cp)
-                    {
-                        debugf("m->NextCacheCheck %4d Slot %3d %##s", numchecked, slot, *cp ? (*cp)->name : (domainname*)"\x04NULL");
-                        numchecked++;
-                        CheckCacheExpiration(m, slot, *cp);
-                        if ((*cp)->members) cp=&(*cp)->next;
-                        else ReleaseCacheGroup(m, cp);
-                    }
+                    CacheGroup **cp = &m->rrcache_hash[HashSlotFromNameHash(m, cg->namehash)];
+                    while (*cp != cg) cp = &(*cp)->next;
+                    ReleaseCacheGroup(m, cp);
                 }
-                // Even if we didn't need to actually check this slot yet, still need to
-                // factor its nextcheck time into our overall NextCacheCheck value
-                if (m->NextCacheCheck - m->rrcache_nextcheck[slot] > 0)
-                    m->NextCacheCheck = m->rrcache_nextcheck[slot];
             }
+            m->NextCacheCheck = cg ? cg->nextcheck : m->timenow + FutureTime;
             debugf("m->NextCacheCheck %4d checked, next in %d", numchecked, m->NextCacheCheck - m->timenow);
         }
 
+        // 4. Grow or shrink the cache hash table if its load factor has drifted out of range
+        if (CacheHashNeedsResize(m) && m->timenow - m->NextCacheHashResize >= 0) CacheHashResize(m);
+
         if (m->timenow - m->NextScheduledSPS >= 0)
         {
             m->NextScheduledSPS = m->timenow + FutureTime;
@@ -5675,6 +5991,9 @@ mDNSexport mDNSs32 mDNS_Execute(mDNS *const m)
                     tail = rr;
                 }
                 rr->next = mDNSNULL;
+                // Move it to the end of its name hash slot too, so the slot stays in m->ResourceRecords order
+                RemoveRecordFromNameIndex(m, rr);
+                AddRecordToNameIndex(m, rr, mDNSNULL);
             }
         }
         m->NewLocalRecords = head;
@@ -6237,10 +6556,9 @@ mDNSexport mStatus UpdateKeepaliveRData(mDNS *const m, AuthRecord *rr, NetworkIn
     newrdlength += 2;
 
     rdsize = newrdlength > sizeof(RDataBody) ? newrdlength : sizeof(RDataBody);
-    newrd = (RData *) mDNSPlatformMemAllocate(sizeof(RData) - sizeof(RDataBody) + rdsize);
+    newrd = mDNS_AllocateRData(m, (mDNSu16) rdsize);
     if (!newrd) { LogMsg("UpdateKeepaliveRData: ptr NULL"); return mStatus_NoMemoryErr; }
 
-    newrd->MaxRDLength = (mDNSu16) rdsize;
     mDNSPlatformMemCopy(&newrd->u, txt.c, newrdlength);
 
     //  If we are updating the record for the first time, rdata points to rdatastorage as the rdata memory
@@ -6250,7 +6568,7 @@ mDNSexport mStatus UpdateKeepaliveRData(mDNS *const m, AuthRecord *rr, NetworkIn
     if ( rr->resrec.rdata != &rr->rdatastorage)
     {
         LogSPS("UpdateKeepaliveRData: Freed allocated memory for keep alive packet: %s ", ARDisplayString(m, rr));
-        mDNSPlatformMemFree(rr->resrec.rdata);
+        mDNS_FreeRData(m, rr->resrec.rdata);
     }
     SetNewRData(&rr->resrec, newrd, newrdlength);    // Update our rdata
 
@@ -7366,7 +7684,7 @@ mDNSlocal mDNSBool PacketRecordMatches(const AuthRecord *const rr, const CacheRe
 mDNSlocal mDNSBool MatchDependentOn(const mDNS *const m, const CacheRecord *const pktrr, const AuthRecord *const master)
 {
     const AuthRecord *r1;
-    for (r1 = m->ResourceRecords; r1; r1=r1->next)
+    for (r1 = ResourceRecordsForNameHash(m, pktrr->resrec.namehash); r1; r1=r1->NextInNameHash)
     {
         if (PacketRecordMatches(r1, pktrr, master)) return(mDNStrue);
     }
@@ -7384,7 +7702,7 @@ mDNSlocal mDNSBool MatchDependentOn(const mDNS *const m, const CacheRecord *cons
 mDNSlocal const AuthRecord *FindRRSet(const mDNS *const m, const CacheRecord *const pktrr)
 {
     const AuthRecord *rr;
-    for (rr = m->ResourceRecords; rr; rr=rr->next)
+    for (rr = ResourceRecordsForNameHash(m, pktrr->resrec.namehash); rr; rr=rr->NextInNameHash)
     {
         if (IdenticalResourceRecord(&rr->resrec, &pktrr->resrec))
         {
@@ -7626,8 +7944,11 @@ mDNSlocal mDNSu8 *ProcessQuery(mDNS *const m, const DNSMessage *const query, con
     const mDNSu8 *ptr;
     mDNSu8       *responseptr        = mDNSNULL;
     AuthRecord   *rr;
+    mDNSu8 QuestionSlots[(AUTH_HASH_SLOTS + 7) / 8];                // ResourceRecordsByName slots named by our questions
     int i;
 
+    mDNSPlatformMemZero(QuestionSlots, sizeof(QuestionSlots));
+
     // ***
     // *** 1. Look in Additional Section for an OPT record
     // ***
@@ -7683,18 +8004,20 @@ mDNSlocal mDNSu8 *ProcessQuery(mDNS *const m, const DNSMessage *const query, con
         // Clear the UnicastResponse flag -- don't want to confuse the rest of the code that follows later
         pktq.qclass &= ~kDNSQClass_UnicastResponse;
 
-        // Note: We use the m->CurrentRecord mechanism here because calling ResolveSimultaneousProbe
+        // Only records whose name hashes to the same ResourceRecordsByName slot as the question can answer it.
+        // Note: We use the m->CurrentRecordByName mechanism here because calling ResolveSimultaneousProbe
         // can result in user callbacks which may change the record list and/or question list.
         // Also note: we just mark potential answer records here, without trying to build the
         // "ResponseRecords" list, because we don't want to risk user callbacks deleting records
         // from that list while we're in the middle of trying to build it.
-        if (m->CurrentRecord)
-            LogMsg("ProcessQuery ERROR m->CurrentRecord already set %s", ARDisplayString(m, m->CurrentRecord));
-        m->CurrentRecord = m->ResourceRecords;
-        while (m->CurrentRecord)
-        {
-            rr = m->CurrentRecord;
-            m->CurrentRecord = rr->next;
+        QuestionSlots[(pktq.qnamehash % AUTH_HASH_SLOTS) / 8] |= (mDNSu8)(1 << ((pktq.qnamehash % AUTH_HASH_SLOTS) % 8));
+        if (m->CurrentRecordByName)
+            LogMsg("ProcessQuery ERROR m->CurrentRecordByName already set %s", ARDisplayString(m, m->CurrentRecordByName));
+        m->CurrentRecordByName = ResourceRecordsForNameHash(m, pktq.qnamehash);
+        while (m->CurrentRecordByName)
+        {
+            rr = m->CurrentRecordByName;
+            m->CurrentRecordByName = rr->NextInNameHash;
             if (AnyTypeRecordAnswersQuestion(rr, &pktq) && (QueryWasMulticast || QueryWasLocalUnicast || rr->AllowRemoteQuery))
             {
                 m->mDNSStats.MatchingAnswersForQueries++;
@@ -7783,7 +8106,7 @@ mDNSlocal mDNSu8 *ProcessQuery(mDNS *const m, const DNSMessage *const query, con
             // We only do this for non-truncated queries. Right now it would be too complicated to try
             // to keep track of duplicate suppression state between multiple packets, especially when we
             // can't guarantee to receive all of the Known Answer packets that go with a particular query.
-            for (q = m->Questions; q; q=q->next)
+            for (q = QuestionsForNameHash(m, pktq.qnamehash); q; q=q->NextInNameHash)
             {
                 if (ActiveQuestion(q) && m->timenow - q->LastQTxTime > mDNSPlatformOneSecond / 4)
                 {
@@ -7805,9 +8128,11 @@ mDNSlocal mDNSu8 *ProcessQuery(mDNS *const m, const DNSMessage *const query, con
     // ***
     // *** 3. Now we can safely build the list of marked answers
     // ***
-    for (rr = m->ResourceRecords; rr; rr=rr->next)              // Now build our list of potential answers
-        if (rr->NR_AnswerTo)                                    // If we marked the record...
-            AddRecordToResponseList(&nrp, rr, mDNSNULL);        // ... add it to the list
+    for (i=0; i<AUTH_HASH_SLOTS; i++)                           // Now build our list of potential answers
+        if (QuestionSlots[i / 8] & (1 << (i % 8)))              // Only the slots we searched can hold marked records
+            for (rr = m->ResourceRecordsByName[i]; rr; rr=rr->NextInNameHash)
+                if (rr->NR_AnswerTo)                            // If we marked the record...
+                    AddRecordToResponseList(&nrp, rr, mDNSNULL);    // ... add it to the list
 
     // ***
     // *** 4. Add additional records
@@ -7837,7 +8162,7 @@ mDNSlocal mDNSu8 *ProcessQuery(mDNS *const m, const DNSMessage *const query, con
             }
 
             // See if this Known-Answer suppresses any previously scheduled answers (for multi-packet KA suppression)
-            for (rr=m->ResourceRecords; rr; rr=rr->next)
+            for (rr = ResourceRecordsForNameHash(m, m->rec.r.resrec.namehash); rr; rr=rr->NextInNameHash)
             {
                 // If we're planning to send this answer on this interface, and only on this interface, then allow KA suppression
                 if (rr->ImmedAnswer == InterfaceID && ShouldSuppressKnownAnswer(&m->rec.r, rr))
@@ -8150,12 +8475,15 @@ struct UDPSocket_struct
     mDNSIPPort port; // MUST BE FIRST FIELD -- mDNSCoreReceive expects every UDPSocket_struct to begin with mDNSIPPort port
 };
 
+// Query sockets are shared between questions (see uDNS_AcquireQuerySocket), so several questions for the same name
+// can be waiting on the same port; the message ID is what tells them apart, so look the question up by ID first.
 mDNSlocal DNSQuestion *ExpectingUnicastResponseForQuestion(const mDNS *const m, const mDNSIPPort port,
     const mDNSOpaque16 id, const DNSQuestion *const question, mDNSBool tcp)
 {
     DNSQuestion *q;
-    for (q = m->Questions; q; q=q->next)
+    for (q = QuestionsForID(m, id); q; q=q->NextInIDHash)
     {
+        if (!mDNSSameOpaque16(q->TargetQID, id)) continue;
         if (!tcp && !q->LocalSocket) continue;
         if (mDNSSameIPPort(tcp ? q->tcpSrcPort : q->LocalSocket->port, port)       &&
             q->qtype                  == question->qtype     &&
@@ -8163,11 +8491,7 @@ mDNSlocal DNSQuestion *ExpectingUnicastResponseForQuestion(const mDNS *const m,
             q->qnamehash              == question->qnamehash &&
             SameDomainName(&q->qname, &question->qname))
         {
-            if (mDNSSameOpaque16(q->TargetQID, id)) return(q);
-            else
-            {
-                return(mDNSNULL);
-            }
+            return(q);
         }
     }
     return(mDNSNULL);
@@ -8181,7 +8505,7 @@ mDNSlocal DNSQuestion *ExpectingUnicastResponseForRecord(mDNS *const m,
     DNSQuestion *q;
     (void)id;
 
-    for (q = m->Questions; q; q=q->next)
+    for (q = QuestionsForNameHash(m, rr->resrec.namehash); q; q=q->NextInNameHash)
     {
         if (!q->DuplicateOf && ResourceRecordAnswersUnicastResponse(&rr->resrec, q))
         {
@@ -8267,7 +8591,7 @@ mDNSexport CacheRecord *CreateNewCacheEntryEx(mDNS *const m, const mDNSu32 slot,
         else if (rr->resrec.rdata != (RData*)&rr->smallrdatastorage && RDLength <= InlineCacheRDSize)
             LogMsg("rr->resrec.rdata != &rr->rdatastorage but length <= InlineCacheRDSize %##s", m->rec.r.resrec.name->c);
         if (RDLength > InlineCacheRDSize)
-            mDNSPlatformMemCopy(rr->resrec.rdata, m->rec.r.resrec.rdata, sizeofRDataHeader + RDLength);
+            mDNSPlatformMemCopy(rr->resrec.rdata->u.data, m->rec.r.resrec.rdata->u.data, RDLength);  // Body only; keep our MaxRDLength
 
         rr->next = mDNSNULL;                    // Clear 'next' pointer
         rr->soa  = mDNSNULL;
@@ -8314,6 +8638,8 @@ mDNSexport CacheRecord *CreateNewCacheEntryEx(mDNS *const m, const mDNSu32 slot,
             }
         }
     }
+    // If we're left holding an empty CacheGroup, let mDNS_Execute reclaim it
+    if (cg && !cg->members) ScheduleNextCacheCheckTime(m, cg, m->timenow);
     return(rr);
 }
 
@@ -8566,7 +8892,7 @@ mDNSlocal void mDNSCoreReceiveNoUnicastAnswers(mDNS *const m, const DNSMessage *
 
                             // Create the SOA record as we may have to return this to the questions
                             // that we are acting as a proxy for currently or in the future.
-                            SOARecord = CreateNewCacheEntry(m, HashSlotFromNameHash(m->rec.r.resrec.namehash), cgSOA, 1, mDNSfalse, mDNSNULL);
+                            SOARecord = CreateNewCacheEntry(m, HashSlotFromNameHash(m, m->rec.r.resrec.namehash), cgSOA, 1, mDNSfalse, mDNSNULL);
 
                             // Special check for SOA queries: If we queried for a.b.c.d.com, and got no answer,
                             // with an Authority Section SOA record for d.com, then this is a hint that the authority
@@ -8646,7 +8972,7 @@ mDNSlocal void mDNSCoreReceiveNoUnicastAnswers(mDNS *const m, const DNSMessage *
                             // look up the cache group again to re-initialize cg again.
                             cg = CacheGroupForName(m, hash, name);
                             // Need to add with a delay so that we can tag the SOA record
-                            negcr = CreateNewCacheEntry(m, HashSlotFromNameHash(hash), cg, 1, mDNStrue, mDNSNULL);
+                            negcr = CreateNewCacheEntry(m, HashSlotFromNameHash(m, hash), cg, 1, mDNStrue, mDNSNULL);
 
                             if (negcr)
                             {
@@ -8751,7 +9077,7 @@ mDNSexport CacheRecord* mDNSCoreReceiveCacheCheck(mDNS *const m, const DNSMessag
                     if (!(cr->resrec.RecordType & kDNSRecordTypePacketUniqueMask))
                     {
                         DNSQuestion *q;
-                        for (q = m->Questions; q; q=q->next)
+                        for (q = QuestionsForNameHash(m, cr->resrec.namehash); q; q=q->NextInNameHash)
                         {
                             if (CacheRecordAnswersQuestion(cr, q))
                                 q->UniqueAnswers++;
@@ -8775,8 +9101,7 @@ mDNSexport CacheRecord* mDNSCoreReceiveCacheCheck(mDNS *const m, const DNSMessag
                     LogRedact(MDNS_LOG_CATEGORY_DEFAULT, MDNS_LOG_DEFAULT,  "mDNSCoreReceiveCacheCheck: Discarding due to domainname case change new: " PRI_S,
                         CRDisplayString(m, &m->rec.r));
                     LogRedact(MDNS_LOG_CATEGORY_DEFAULT, MDNS_LOG_DEFAULT,  "mDNSCoreReceiveCacheCheck: Discarding due to domainname case change in "
-                        "%d slot %3d in %d %d", NextCacheCheckEvent(cr) - m->timenow, slot,
-                        m->rrcache_nextcheck[slot] - m->timenow, m->NextCacheCheck - m->timenow);
+                        "%d slot %3d in %d", NextCacheCheckEvent(cr) - m->timenow, slot, m->NextCacheCheck - m->timenow);
                     // DO NOT break out here -- we want to continue as if we never found it
                 }
                 else if (m->rec.r.resrec.rroriginalttl > 0)
@@ -8819,7 +9144,7 @@ mDNSexport CacheRecord* mDNSCoreReceiveCacheCheck(mDNS *const m, const DNSMessag
                     // true for records like A etc. but not for PTR.
                     if (cr->resrec.RecordType & kDNSRecordTypePacketUniqueMask)
                     {
-                        for (q = m->Questions; q; q=q->next)
+                        for (q = QuestionsForNameHash(m, cr->resrec.namehash); q; q=q->NextInNameHash)
                         {
                             if (!q->DuplicateOf && !q->LongLived &&
                                 ActiveQuestion(q) && CacheRecordAnswersQuestion(cr, q))
@@ -9293,13 +9618,13 @@ mDNSlocal void mDNSCoreReceiveResponse(mDNS *const m, const DNSMessage *const re
         // 1. Check that this packet resource record does not conflict with any of ours
         if (ResponseIsMDNS && m->rec.r.resrec.rrtype != kDNSType_NSEC)
         {
-            if (m->CurrentRecord)
-                LogMsg("mDNSCoreReceiveResponse ERROR m->CurrentRecord already set %s", ARDisplayString(m, m->CurrentRecord));
-            m->CurrentRecord = m->ResourceRecords;
-            while (m->CurrentRecord)
+            if (m->CurrentRecordByName)
+                LogMsg("mDNSCoreReceiveResponse ERROR m->CurrentRecordByName already set %s", ARDisplayString(m, m->CurrentRecordByName));
+            m->CurrentRecordByName = ResourceRecordsForNameHash(m, m->rec.r.resrec.namehash);
+            while (m->CurrentRecordByName)
             {
-                AuthRecord *rr = m->CurrentRecord;
-                m->CurrentRecord = rr->next;
+                AuthRecord *rr = m->CurrentRecordByName;
+                m->CurrentRecordByName = rr->NextInNameHash;
                 // We accept all multicast responses, and unicast responses resulting from queries we issued
                 // For other unicast responses, this code accepts them only for responses with an
                 // (apparently) local source address that pertain to a record of our own that's in probing state
@@ -9454,7 +9779,7 @@ mDNSlocal void mDNSCoreReceiveResponse(mDNS *const m, const DNSMessage *const re
 
         if (m->rrcache_size && AcceptableResponse)
         {
-            const mDNSu32 slot = HashSlotFromNameHash(m->rec.r.resrec.namehash);
+            const mDNSu32 slot = HashSlotFromNameHash(m, m->rec.r.resrec.namehash);
             CacheGroup *cg = CacheGroupForRecord(m, &m->rec.r.resrec);
             CacheRecord *rr = mDNSNULL;
 
@@ -9491,7 +9816,7 @@ mDNSlocal void mDNSCoreReceiveResponse(mDNS *const m, const DNSMessage *const re
                     }
                     else if (rr->DelayDelivery)
                     {
-                        ScheduleNextCacheCheckTime(m, slot, rr->DelayDelivery);
+                        ScheduleNextCacheCheckTime(m, CacheGroupForRecord(m, &rr->resrec), rr->DelayDelivery);
                     }
                 }
             }
@@ -9507,8 +9832,7 @@ exit:
     while (CacheFlushRecords != (CacheRecord*)1)
     {
         CacheRecord *r1 = CacheFlushRecords, *r2;
-        const mDNSu32 slot = HashSlotFromNameHash(r1->resrec.namehash);
-        const CacheGroup *cg = CacheGroupForRecord(m, &r1->resrec);
+        CacheGroup *const cg = CacheGroupForRecord(m, &r1->resrec);
         mDNSBool purgedRecords = mDNSfalse;
         CacheFlushRecords = CacheFlushRecords->NextInCFList;
         r1->NextInCFList = mDNSNULL;
@@ -9664,7 +9988,7 @@ exit:
             }
             // If no longer delaying, deliver answer now, else schedule delivery for the appropriate time
             if (!r1->DelayDelivery) CacheRecordDeferredAdd(m, r1);
-            else ScheduleNextCacheCheckTime(m, slot, r1->DelayDelivery);
+            else ScheduleNextCacheCheckTime(m, cg, r1->DelayDelivery);
         }
     }
 
@@ -10665,8 +10989,8 @@ mDNSlocal DNSQuestion *FindDuplicateQuestion(const mDNS *const m, const DNSQuest
     // Note: A question can only be marked as a duplicate of one that occurs *earlier* in the list.
     // This prevents circular references, where two questions are each marked as a duplicate of the other.
     // Accordingly, we break out of the loop when we get to 'question', because there's no point searching
-    // further in the list.
-    for (q = m->Questions; q && (q != question); q = q->next)
+    // further in the list. Questions in a name slot are in m->Questions order, so it's enough to search that slot.
+    for (q = QuestionsForNameHash(m, question->qnamehash); q && (q != question); q = q->NextInNameHash)
     {
         if (!SameQuestionKind(q, question))                             continue;
         if (q->qnamehash          != question->qnamehash)               continue;
@@ -10705,7 +11029,8 @@ mDNSlocal void UpdateQuestionDuplicates(mDNS *const m, DNSQuestion *const questi
         return;
     }
 
-    for (q = m->Questions; q; q=q->next)        // Scan our list of questions
+    // Duplicates always have the same name as the question they duplicate, so we only need to scan its name slot
+    for (q = QuestionsForNameHash(m, question->qnamehash); q; q=q->NextInNameHash)
         if (q->DuplicateOf == question)         // To see if any questions were referencing this as their duplicate
         {
             q->DuplicateOf = first;
@@ -10739,7 +11064,7 @@ mDNSlocal void UpdateQuestionDuplicates(mDNS *const m, DNSQuestion *const questi
                 q->triedAllServersOnce = question->triedAllServersOnce;
 #endif
 
-                q->TargetQID         = question->TargetQID;
+                SetQuestionTargetQID(m, q, question->TargetQID);
 #if !MDNSRESPONDER_SUPPORTS(APPLE, QUERIER)
                 q->LocalSocket       = question->LocalSocket;
                 // No need to close old q->LocalSocket first -- duplicate questions can't have their own sockets
@@ -11968,6 +12293,10 @@ mDNSexport mStatus mDNS_StartQuery_internal(mDNS *const m, DNSQuestion *const qu
     InitLLQState(question);
     InitDNSSECProxyState(m, question);
 
+    // InitCommonState computes qnamehash, so we can only add the question to the indexes now
+    if (!LocalOnlyOrP2PInterface(question->InterfaceID))
+        AddQuestionToIndexes(m, question);
+
     // FindDuplicateQuestion should be called last after all the intialization
     // as the duplicate logic could be potentially based on any field in the
     // question.
@@ -12089,7 +12418,12 @@ mDNSexport mStatus mDNS_StopQuery_internal(mDNS *const m, DNSQuestion *const que
     if (LocalOnlyOrP2PInterface(question->InterfaceID))
         qp = &m->LocalOnlyQuestions;
     while (*qp && *qp != question) qp=&(*qp)->next;
-    if (*qp) *qp = (*qp)->next;
+    if (*qp)
+    {
+        *qp = (*qp)->next;
+        if (!LocalOnlyOrP2PInterface(question->InterfaceID))
+            RemoveQuestionFromIndexes(m, question);
+    }
     else
     {
 #if !ForceAlerts
@@ -12192,7 +12526,7 @@ mDNSexport mStatus mDNS_StopQuery_internal(mDNS *const m, DNSQuestion *const que
     // invalid before we even use it. By making sure that we update m->CurrentQuestion and m->NewQuestions if necessary
     // *first*, then they're all ready to be updated a second time if necessary when we cancel our GetZoneData query.
     if (question->tcp) { DisposeTCPConn(question->tcp); question->tcp = mDNSNULL; }
-    if (question->LocalSocket) { mDNSPlatformUDPClose(question->LocalSocket); question->LocalSocket = mDNSNULL; }
+    if (question->LocalSocket) { uDNS_ReleaseQuerySocket(m, question->LocalSocket); question->LocalSocket = mDNSNULL; }
 
     if (!mDNSOpaque16IsZero(question->TargetQID) && question->LongLived)
     {
@@ -13892,7 +14226,7 @@ mDNSlocal mDNSBool mDNS_IdUsedInResourceRecordsList(mDNS * const m, mDNSOpaque16
 mDNSlocal mDNSBool mDNS_IdUsedInQuestionsList(mDNS * const m, mDNSOpaque16 id)
 {
     DNSQuestion *q;
-    for (q = m->Questions; q; q=q->next) if (mDNSSameOpaque16(id, q->TargetQID)) return mDNStrue;
+    for (q = QuestionsForID(m, id); q; q=q->NextInIDHash) if (mDNSSameOpaque16(id, q->TargetQID)) return mDNStrue;
     return mDNSfalse;
 }
 
@@ -14475,6 +14809,16 @@ mDNSexport void mDNS_GrowCache(mDNS *const m, CacheEntity *storage, mDNSu32 numr
     mDNS_Unlock(m);
 }
 
+// Storage already handed to the cache is kept, so a budget below the current size just stops further growth.
+mDNSexport void mDNS_SetCacheBudget(mDNS *const m, mDNSu32 bytes)
+{
+    mDNS_Lock(m);
+    m->rrcache_budget = bytes / sizeof(CacheEntity);
+    if (bytes && !m->rrcache_budget) m->rrcache_budget = 1;
+    LogRedact(MDNS_LOG_CATEGORY_DEFAULT, MDNS_LOG_DEFAULT, "mDNS_SetCacheBudget: %u bytes (%u entities)", bytes, m->rrcache_budget);
+    mDNS_Unlock(m);
+}
+
 mDNSlocal mStatus mDNS_InitStorage(mDNS *const m, mDNS_PlatformSupport *const p,
                                    CacheEntity *rrcachestorage, mDNSu32 rrcachesize,
                                    mDNSBool AdvertiseLocalAddresses, mDNSCallback *Callback, void *Context)
@@ -14548,6 +14892,9 @@ mDNSlocal mStatus mDNS_InitStorage(mDNS *const m, mDNS_PlatformSupport *const p,
 
     // These fields only required for mDNS Searcher...
     m->Questions               = mDNSNULL;
+    for (slot = 0; slot < CACHE_HASH_SLOTS; slot++) m->QuestionsByName[slot] = mDNSNULL;
+    for (slot = 0; slot < CACHE_HASH_SLOTS; slot++) m->QuestionsByID[slot]   = mDNSNULL;
+    m->QuerySocketCount        = 0;
     m->NewQuestions            = mDNSNULL;
     m->CurrentQuestion         = mDNSNULL;
     m->LocalOnlyQuestions      = mDNSNULL;
@@ -14557,13 +14904,19 @@ mDNSlocal mStatus mDNS_InitStorage(mDNS *const m, mDNS_PlatformSupport *const p,
     m->rrcache_totalused       = 0;
     m->rrcache_active          = 0;
     m->rrcache_report          = 10;
+    m->rrcache_budget          = 0;
+    m->rrcache_clockhand       = 0;
     m->rrcache_free            = mDNSNULL;
 
-    for (slot = 0; slot < CACHE_HASH_SLOTS; slot++)
-    {
-        m->rrcache_hash[slot]      = mDNSNULL;
-        m->rrcache_nextcheck[slot] = timenow + FutureTime;;
-    }
+    m->rrcache_hash            = m->rrcache_hash_initial;
+    m->rrcache_checkheap       = mDNSNULL;
+    mDNS_RDataSlabInit(m);
+    m->rrcache_hashslots       = CACHE_HASH_SLOTS;
+    m->rrcache_hashlevel       = CACHE_HASH_SLOTS;
+    m->rrcache_hashcapacity    = CACHE_HASH_SLOTS;
+    m->rrcache_groups          = 0;
+    m->NextCacheHashResize     = timenow;
+    for (slot = 0; slot < CACHE_HASH_SLOTS; slot++) m->rrcache_hash[slot] = mDNSNULL;
 
     mDNS_GrowCache_internal(m, rrcachestorage, rrcachesize);
     m->rrauth.rrauth_free            = mDNSNULL;
@@ -14571,6 +14924,8 @@ mDNSlocal mStatus mDNS_InitStorage(mDNS *const m, mDNS_PlatformSupport *const p,
     for (slot = 0; slot < AUTH_HASH_SLOTS; slot++)
         m->rrauth.rrauth_hash[slot] = mDNSNULL;
 
+    DNSCompressionTableAttach(&m->omsgCompression, &m->omsg);
+
     // Fields below only required for mDNS Responder...
     m->hostlabel.c[0]          = 0;
     m->nicelabel.c[0]          = 0;
@@ -14581,10 +14936,12 @@ mDNSlocal mStatus mDNS_InitStorage(mDNS *const m, mDNS_PlatformSupport *const p,
     m->HIHardware.c[0]         = 0;
     m->HISoftware.c[0]         = 0;
     m->ResourceRecords         = mDNSNULL;
+    for (slot = 0; slot < AUTH_HASH_SLOTS; slot++) m->ResourceRecordsByName[slot] = mDNSNULL;
     m->DuplicateRecords        = mDNSNULL;
     m->NewLocalRecords         = mDNSNULL;
     m->NewLocalOnlyRecords     = mDNSfalse;
     m->CurrentRecord           = mDNSNULL;
+    m->CurrentRecordByName     = mDNSNULL;
     m->HostInterfaces          = mDNSNULL;
     m->ProbeFailTime           = 0;
     m->NumFailedProbes         = 0;
@@ -14775,16 +15132,14 @@ mDNSexport void DNSServerChangeForQuestion(mDNS *const m, DNSQuestion *q, DNSSer
 {
     DNSQuestion *qptr;
 
-    (void) m;
-
     if (q->DuplicateOf)
         LogMsg("DNSServerChangeForQuestion: ERROR: Called for duplicate question %##s", q->qname.c);
 
     // Make sure all the duplicate questions point to the same DNSServer so that delivery
-    // of events for all of them are consistent. Duplicates for a question are always inserted
-    // after in the list.
+    // of events for all of them are consistent. Duplicates for a question always have the
+    // same name, so they're all in the same name slot as the question.
     q->qDNSServer = new;
-    for (qptr = q->next ; qptr; qptr = qptr->next)
+    for (qptr = QuestionsForNameHash(m, q->qnamehash); qptr; qptr = qptr->NextInNameHash)
     {
         if (qptr->DuplicateOf == q) { qptr->validDNSServers = q->validDNSServers; qptr->qDNSServer = new; }
     }
@@ -15018,7 +15373,7 @@ mDNSexport mStatus uDNS_SetupDNSConfig(mDNS *const m)
 
         q->Suppressed = ShouldSuppressUnicastQuery(q, s);
         q->unansweredQueries = 0;
-        q->TargetQID = mDNS_NewMessageID(m);
+        SetQuestionTargetQID(m, q, mDNS_NewMessageID(m));
         if (!q->Suppressed) ActivateUnicastQuery(m, q, mDNStrue);
     }
 
@@ -15353,10 +15708,13 @@ mDNSexport void mDNS_FinalExit(mDNS *const m)
     mDNSu32 slot;
     AuthRecord *rr;
 
+    // Close the idle pooled query sockets while the platform layer can still close them
+    uDNS_CloseIdleQuerySockets(m);
+
     LogRedact(MDNS_LOG_CATEGORY_DEFAULT, MDNS_LOG_DEFAULT, "mDNS_FinalExit: mDNSPlatformClose");
     mDNSPlatformClose(m);
 
-    for (slot = 0; slot < CACHE_HASH_SLOTS; slot++)
+    for (slot = 0; slot < m->rrcache_hashslots; slot++)
     {
         while (m->rrcache_hash[slot])
         {
@@ -15372,6 +15730,14 @@ mDNSexport void mDNS_FinalExit(mDNS *const m)
             ReleaseCacheGroup(m, &m->rrcache_hash[slot]);
         }
     }
+    if (m->rrcache_hash != m->rrcache_hash_initial)
+    {
+        mDNSPlatformMemFree(m->rrcache_hash);
+        m->rrcache_hash         = m->rrcache_hash_initial;
+        m->rrcache_hashslots    = CACHE_HASH_SLOTS;
+        m->rrcache_hashlevel    = CACHE_HASH_SLOTS;
+        m->rrcache_hashcapacity = CACHE_HASH_SLOTS;
+    }
     debugf("mDNS_FinalExit: RR Cache was using %ld records, %lu active", rrcache_totalused, rrcache_active);
     if (rrcache_active != m->rrcache_active)
     {
@@ -547,6 +547,43 @@ typedef struct
     mDNSu8 data[AbsoluteMaxDNSMessageData]; // 40 (IPv6) + 8 (UDP) + 12 (DNS header) + 8940 (data) = 9000
 } DNSMessage;
 
+// Index of the name suffixes already written into an outgoing DNSMessage, so that putDomainNameAsLabels can find
+// a compression target by hash lookup instead of scanning backwards through the whole packet.
+// Each entry records the offset of one label, keyed by a hash of the complete name suffix starting at that label.
+// Rdata that putRData copies verbatim (TXT, HINFO, NULL, unicast NSEC, etc.) is indexed too, since the scan could
+// match names inside it; label sequences there that run off the end of the rdata are kept on separate "open" lists,
+// one per first label length, and checked directly against the packet bytes on each lookup.
+// If a message needs more entries than we have room for, putDomainNameAsLabels reverts to scanning for that message.
+#ifndef DNSCompressionTableEntries
+#define DNSCompressionTableEntries 1024
+#endif
+#define DNSCompressionTableSlots 256
+#define DNSCompressionTableOpenTargets 512
+typedef struct
+{
+    mDNSu32 hash;                           // Hash of the name suffix starting at this offset
+    mDNSu16 offset;                         // Offset of the suffix from the start of the message
+    mDNSu16 next;                           // Index + 1 of the next entry in the same hash slot; zero terminates
+} DNSCompressionEntry;
+
+typedef struct
+{
+    mDNSu16 offset;                         // Offset of the first label from the start of the message
+    mDNSu16 next;                           // Index + 1 of the next open target with the same first label length
+} DNSCompressionOpenTarget;
+
+typedef struct
+{
+    const DNSMessage *msg;                  // The message this table indexes
+    mDNSu16 count;                          // Number of entries in use
+    mDNSBool overflowed;                    // Set if we ran out of entries; lookups fall back to scanning
+    mDNSu16 numOpen;                        // Number of open targets in use
+    mDNSu16 slots[DNSCompressionTableSlots];
+    mDNSu16 openSlots[MAX_DOMAIN_LABEL + 1]; // Open targets, by the length of their first label
+    DNSCompressionEntry entries[DNSCompressionTableEntries];
+    DNSCompressionOpenTarget open[DNSCompressionTableOpenTargets]; // Label sequences in raw rdata that run past its end
+} DNSCompressionTable;
+
 typedef struct tcpInfo_t
 {
     mDNS             *m;
@@ -970,6 +1007,21 @@ typedef struct
 // sizeofRDataHeader should be 4 bytes
 #define sizeofRDataHeader (sizeof(RData) - sizeof(RDataBody))
 
+// Out-of-line rdata owned by mDNSCore (and by the daemon, for records it updates) is carved from slabs of a few fixed
+// size classes instead of being allocated individually; see mDNS_AllocateRData() in DNSCommon.c.
+#define RDataSlabClassCount 5
+typedef struct RDataSlab_struct RDataSlab;
+typedef struct
+{
+    mDNSu16    MaxRDLength;         // Rdata capacity of each object in this class
+    mDNSu16    ObjectsPerSlab;
+    RDataSlab *Partial;             // Slabs of this class with at least one free object
+    mDNSu32    Slabs;               // Slabs currently allocated
+    mDNSu32    InUse;               // Objects currently handed out
+    mDNSu32    Allocations;         // Total objects ever handed out
+    mDNSu32    SlabAllocations;     // Total slabs ever allocated from the platform
+} RDataSlabClass;
+
 // RData_small is a smaller version of the RData object, used for inline data storage embedded in a CacheRecord_struct
 typedef struct
 {
@@ -1441,6 +1493,7 @@ struct AuthRecord_struct
     mDNSInterfaceID SendRNow;           // The interface this query is being sent on right now
     mDNSv4Addr v4Requester;             // Recent v4 query for this record, or all-ones if more than one recent query
     mDNSv6Addr v6Requester;             // Recent v6 query for this record, or all-ones if more than one recent query
+    AuthRecord     *NextInNameHash;     // Next record in the same m->ResourceRecordsByName slot
     AuthRecord     *NextResponse;       // Link to the next element in the chain of responses to generate
     const mDNSu8   *NR_AnswerTo;        // Set if this record was selected by virtue of being a direct answer to a question
     AuthRecord     *NR_AdditionalTo;    // Set if this record was selected by virtue of being additional to another
@@ -1546,6 +1599,7 @@ struct CacheRecord_struct
     DNSQuestion    *CRActiveQuestion;   // Points to an active question referencing this answer. Can never point to a NewQuestion.
     mDNSs32 LastUnansweredTime;         // In platform time units; last time we incremented UnansweredQueries
     mDNSu8  UnansweredQueries;          // Number of times we've issued a query for this record without getting an answer
+    mDNSu8  CacheReferenced;            // CLOCK reference bit: set when the record is used, cleared as the eviction hand passes
 
 #if MDNSRESPONDER_SUPPORTS(COMMON, DNS_PUSH)
     mDNSBool DNSPushSubscribed;         // Indicate whether the cached record has an active DNS push subscription. If
@@ -1570,6 +1624,10 @@ struct CacheGroup_base
     CacheRecord    *members;
     CacheRecord   **rrcache_tail;
     domainname     *name;
+    mDNSs32         nextcheck;
+    CacheGroup     *checkchild;
+    CacheGroup     *checksibling;
+    CacheGroup     *checkprev;
 };
 
 struct CacheGroup_struct                // Header object for a list of CacheRecords with the same name
@@ -1579,6 +1637,10 @@ struct CacheGroup_struct                // Header object for a list of CacheReco
     CacheRecord    *members;            // List of CacheRecords with this same name
     CacheRecord   **rrcache_tail;       // Tail end of that list
     domainname     *name;               // Common name for all CacheRecords in this list
+    mDNSs32         nextcheck;          // Earliest time one of our members needs CheckCacheExpiration
+    CacheGroup     *checkchild;         // Links in m->rrcache_checkheap, ordered by nextcheck
+    CacheGroup     *checksibling;
+    CacheGroup     *checkprev;          // Parent if we're its first child, else previous sibling; NULL if root or not queued
     mDNSu8 namestorage[sizeof(CacheRecord) - sizeof(struct CacheGroup_base)];  // match sizeof(CacheRecord)
 };
 
@@ -1778,6 +1840,18 @@ extern void mDNSPlatformDispatchAsync(mDNS *const m, void *context, AsyncDispatc
 // RFC 4122 defines it to be 16 bytes 
 #define UUID_SIZE       16
 
+// Unicast questions send their queries from a pool of randomly-bound UDP sockets shared among questions of the same
+// client, instead of each opening its own socket; responses are matched to questions by message ID (m->QuestionsByID).
+#define UnicastQuerySocketPoolSize 32
+typedef struct
+{
+    UDPSocket *sock;
+    mDNSs32    pid;                     // Client the socket was delegated to when it was opened (see mDNSPlatformSetSocktOpt)
+    mDNSu8     uuid[UUID_SIZE];
+    mDNSu32    users;                   // Questions currently sending from this socket
+    mDNSu32    uses;                    // Questions ever given this socket; once it's served enough, it is retired
+} UnicastQuerySocket;
+
 #if MDNSRESPONDER_SUPPORTS(APPLE, DNS_ANALYTICS)
 typedef struct
 {
@@ -1818,6 +1892,8 @@ struct DNSQuestion_struct
     DomainAuthInfo       *AuthInfo;         // Non-NULL if query is currently being done using Private DNS
     DNSQuestion          *DuplicateOf;
     DNSQuestion          *NextInDQList;
+    DNSQuestion          *NextInNameHash;   // Next question in the same m->QuestionsByName slot
+    DNSQuestion          *NextInIDHash;     // Next question in the same m->QuestionsByID slot
     DupSuppressInfo DupSuppress[DupSuppressInfoSize];
     mDNSInterfaceID SendQNow;               // The interface this query is being sent on right now
     mDNSBool SendOnAll;                     // Set if we're sending this question on all active interfaces
@@ -1834,7 +1910,7 @@ struct DNSQuestion_struct
     mDNSs32 StopTime;                       // Time this question should be stopped by giving them a negative answer
 
     // Wide Area fields. These are used internally by the uDNS core (Unicast)
-    UDPSocket            *LocalSocket;
+    UDPSocket            *LocalSocket;      // Pooled query socket; see uDNS_AcquireQuerySocket()
 
     // |-> DNS Configuration related fields used in uDNS (Subset of Wide Area/Unicast fields)
 #if MDNSRESPONDER_SUPPORTS(APPLE, QUERIER)
@@ -2063,6 +2139,8 @@ extern SearchListElem *SearchList;      // This really ought to be part of mDNS_
 
 typedef void mDNSCallback (mDNS *const m, mStatus result);
 
+// Initial (and minimum) number of slots in the record cache hash table.
+// The table grows and shrinks from here according to its load factor; see CacheHashResize() in mDNS.c.
 #ifndef CACHE_HASH_SLOTS
 #define CACHE_HASH_SLOTS 499
 #endif
@@ -2097,6 +2175,15 @@ typedef struct
     mDNSu32 CacheRefreshQueries;            // Number of queries that we sent for refreshing cache
     mDNSu32 CacheRefreshed;                 // Number of times the cache was refreshed due to a response
     mDNSu32 WakeOnResolves;                 // Number of times we did a wake on resolve
+    mDNSu32 CacheEvictions;                 // Number of cache records evicted to stay within the cache budget
+    mDNSu32 CacheEvictionFailures;          // Number of times an eviction sweep found nothing it could reclaim
+    mDNSu32 QuerySocketAcquisitions;        // Number of times a unicast question was given a pooled query socket
+    mDNSu32 QuerySocketsShared;             // ...of which were given a socket that was already open
+    mDNSu32 QuerySocketsOverloaded;         // ...of which were given a busy or retired socket because the pool was full
+    mDNSu32 QuerySocketsOpened;             // Number of pooled query sockets opened
+    mDNSu32 QuerySocketsClosed;             // Number of pooled query sockets closed
+    mDNSu32 QuerySocketsHighWater;          // Largest number of pooled query sockets open at once
+    mDNSu32 QuerySocketsUnpooled;           // Number of times a unicast question was given a socket outside the pool
 } mDNSStatistics;
 
 extern void LogMDNSStatisticsToFD(int fd, mDNS *const m);
@@ -2179,6 +2266,10 @@ struct mDNS_struct
 
     // These fields only required for mDNS Searcher...
     DNSQuestion *Questions;             // List of all registered questions, active and inactive
+    DNSQuestion *QuestionsByName[CACHE_HASH_SLOTS]; // The questions on Questions, indexed by name hash
+    DNSQuestion *QuestionsByID[CACHE_HASH_SLOTS];   // The unicast questions on Questions, indexed by TargetQID
+    UnicastQuerySocket QuerySockets[UnicastQuerySocketPoolSize];   // Open pooled query sockets, packed at the front
+    mDNSu32 QuerySocketCount;
     DNSQuestion *NewQuestions;          // Fresh questions not yet answered from cache
     DNSQuestion *CurrentQuestion;       // Next question about to be examined in AnswerLocalQuestions()
     DNSQuestion *LocalOnlyQuestions;    // Questions with InterfaceID set to mDNSInterface_LocalOnly or mDNSInterface_P2P
@@ -2189,9 +2280,18 @@ struct mDNS_struct
     mDNSu32 rrcache_totalused_unicast;  // Number of cache entries currently occupied by unicast
     mDNSu32 rrcache_active;             // Number of cache entries currently occupied by records that answer active questions
     mDNSu32 rrcache_report;
+    mDNSu32 rrcache_budget;             // Don't ask the platform to grow the cache past this many entities; zero means no limit
+    mDNSu32 rrcache_clockhand;          // Next hash slot the eviction sweep will visit
     CacheEntity *rrcache_free;
-    CacheGroup *rrcache_hash[CACHE_HASH_SLOTS];
-    mDNSs32 rrcache_nextcheck[CACHE_HASH_SLOTS];
+    CacheGroup **rrcache_hash;          // Cache hash table, rrcache_hashslots slots in use
+    mDNSu32 rrcache_hashslots;          // Number of hash slots currently in use
+    mDNSu32 rrcache_hashlevel;          // Slot count at the start of the current linear hashing round
+    mDNSu32 rrcache_hashcapacity;       // Number of slots allocated for rrcache_hash
+    mDNSu32 rrcache_groups;             // Number of CacheGroups currently in the hash table
+    mDNSs32 NextCacheHashResize;        // Earliest time we may next split or merge hash slots
+    CacheGroup *rrcache_hash_initial[CACHE_HASH_SLOTS]; // Fixed storage used while the table is at its minimum size
+    CacheGroup *rrcache_checkheap;      // Pairing heap of CacheGroups waiting for CheckCacheExpiration, earliest first
+    RDataSlabClass rdataslab[RDataSlabClassCount]; // Size classes for out-of-line rdata, smallest first
 
     AuthHash rrauth;
 
@@ -2211,9 +2311,11 @@ struct mDNS_struct
     UTF8str255 HISoftware;
     AuthRecord DeviceInfo;
     AuthRecord *ResourceRecords;
+    AuthRecord *ResourceRecordsByName[AUTH_HASH_SLOTS]; // The records on ResourceRecords, indexed by name hash
     AuthRecord *DuplicateRecords;       // Records currently 'on hold' because they are duplicates of existing records
     AuthRecord *NewLocalRecords;        // Fresh AuthRecords (public) not yet delivered to our local-only questions
     AuthRecord *CurrentRecord;          // Next AuthRecord about to be examined
+    AuthRecord *CurrentRecordByName;    // Next AuthRecord about to be examined in a ResourceRecordsByName slot
     mDNSBool NewLocalOnlyRecords;       // Fresh AuthRecords (local only) not yet delivered to our local questions
     NetworkInterfaceInfo *HostInterfaces;
     mDNSs32 ProbeFailTime;
@@ -2322,6 +2424,7 @@ struct mDNS_struct
     // The imsg is declared as a union with a pointer type to enforce CPU-appropriate alignment
     union { DNSMessage m; void *p; } imsg;  // Incoming message received from wire
     DNSMessage omsg;                        // Outgoing message we're building
+    DNSCompressionTable omsgCompression;    // Name compression index for omsg
     LargeCacheRecord rec;                   // Resource Record extracted from received message
 
 #ifndef MaxMsg
@@ -2331,7 +2434,7 @@ struct mDNS_struct
 };
 
 #define FORALL_CACHERECORDS(SLOT,CG,CR)                           \
-    for ((SLOT) = 0; (SLOT) < CACHE_HASH_SLOTS; (SLOT)++)         \
+    for ((SLOT) = 0; (SLOT) < m->rrcache_hashslots; (SLOT)++)     \
         for ((CG)=m->rrcache_hash[(SLOT)]; (CG); (CG)=(CG)->next) \
             for ((CR) = (CG)->members; (CR); (CR)=(CR)->next)
 
@@ -2482,6 +2585,8 @@ mDNSinline mDNSu32 mDNSVal32(mDNSOpaque32 x)
 // (i.e. the size of the cache memory needs to be sizeof(CacheRecord) * rrcachesize).
 // OS X 10.3 Panther uses an initial cache size of 64 entries, and then mDNSCore sends an
 // mStatus_GrowCache message if it needs more.
+// mDNS_SetCacheBudget caps that growth: once the cache holds the given number of bytes' worth of entries (rounded
+// up to the platform's growth increment), mDNSCore evicts the least recently used records to make room instead.
 //
 // Most clients should use mDNS_Init_AdvertiseLocalAddresses. This causes mDNSCore to automatically
 // create the correct address records for all the hosts interfaces. If you plan to advertise
@@ -2537,6 +2642,13 @@ extern mStatus mDNS_Init      (mDNS *const m, mDNS_PlatformSupport *const p,
 
 extern void    mDNS_ConfigChanged(mDNS *const m);
 extern void    mDNS_GrowCache (mDNS *const m, CacheEntity *storage, mDNSu32 numrecords);
+extern void    mDNS_SetCacheBudget(mDNS *const m, mDNSu32 bytes);
+
+// mDNS_AllocateRData returns an RData with room for at least rdcapacity bytes of rdata (MaxRDLength is set to the
+// actual capacity), or mDNSNULL if rdcapacity exceeds MaximumRDSize or memory is exhausted. The header and the
+// first rdcapacity bytes are zeroed. Anything it returns must be released with mDNS_FreeRData, on the mDNS thread.
+extern RData  *mDNS_AllocateRData(mDNS *const m, mDNSu16 rdcapacity);
+extern void    mDNS_FreeRData(mDNS *const m, RData *rdata);
 extern void    mDNS_StartExit (mDNS *const m);
 extern void    mDNS_FinalExit (mDNS *const m);
 #define mDNS_Close(m) do { mDNS_StartExit(m); mDNS_FinalExit(m); } while(0)
@@ -3226,8 +3338,9 @@ extern CacheRecord *CreateNewCacheEntryEx(mDNS *m, mDNSu32 slot, CacheGroup *cg,
                                           const mDNSAddr *sourceAddress, CreateNewCacheEntryFlags flags);
 extern CacheRecord *CreateNewCacheEntry(mDNS *const m, const mDNSu32 slot, CacheGroup *cg, mDNSs32 delay, mDNSBool Add, const mDNSAddr *sourceAddress);
 extern CacheGroup *CacheGroupForName(const mDNS *const m, const mDNSu32 namehash, const domainname *const name);
+extern mDNSu32 CacheHashSlot(const mDNS *const m, const mDNSu32 namehash);
 extern void ReleaseCacheRecord(mDNS *const m, CacheRecord *r);
-extern void ScheduleNextCacheCheckTime(mDNS *const m, const mDNSu32 slot, const mDNSs32 event);
+extern void ScheduleNextCacheCheckTime(mDNS *const m, CacheGroup *const cg, const mDNSs32 event);
 extern void SetNextCacheCheckTimeForRecord(mDNS *const m, CacheRecord *const rr);
 extern void RefreshCacheRecord(mDNS *const m, CacheRecord *rr, mDNSu32 ttl);
 extern void GrantCacheExtensions(mDNS *const m, DNSQuestion *q, mDNSu32 lease);
@@ -1205,7 +1205,7 @@ mDNSexport uDNS_LLQType uDNS_recvLLQResponse(mDNS *const m, const DNSMessage *co
     {
         const rdataOPT *opt = GetLLQOptData(m, msg, end);
 
-        for (q = m->Questions; q; q = q->next)
+        for (q = QuestionsForNameHash(m, pktQ.qnamehash); q; q = q->NextInNameHash)
         {
             if (!mDNSOpaque16IsZero(q->TargetQID) && q->LongLived && q->qtype == pktQ.qtype && q->qnamehash == pktQ.qnamehash && SameDomainName(&q->qname, &pktQ.qname))
             {
@@ -2220,6 +2220,7 @@ mDNSlocal mStatus UnlinkResourceRecord(mDNS *const m, AuthRecord *const rr)
     {
         *list = rr->next;
         rr->next = mDNSNULL;
+        RemoveRecordFromNameIndex(m, rr);
 
         // Temporary workaround to cancel any active NAT mapping operation
         if (rr->NATinfo.clientContext)
@@ -3876,7 +3877,7 @@ mDNSexport void uDNS_ReceiveMsg(mDNS *const m, DNSMessage *const msg, const mDNS
     if (QR_OP == StdR)
     {
         //if (srcaddr && recvLLQResponse(m, msg, end, srcaddr, srcport)) return;
-        for (qptr = m->Questions; qptr; qptr = qptr->next)
+        for (qptr = QuestionsForID(m, msg->h.id); qptr; qptr = qptr->NextInIDHash)
             if (msg->h.flags.b[0] & kDNSFlag0_TC && mDNSSameOpaque16(qptr->TargetQID, msg->h.id) && m->timenow - qptr->LastQTime < RESPONSE_WINDOW)
             {
                 if (!srcaddr) LogMsg("uDNS_ReceiveMsg: TCP DNS response had TC bit set: ignoring");
@@ -3924,6 +3925,134 @@ mDNSexport void uDNS_ReceiveMsg(mDNS *const m, DNSMessage *const msg, const mDNS
     debugf("Received unexpected response: ID %d matches no active records", mDNSVal16(msg->h.id));
 }
 
+// ***************************************************************************
+// MARK: - Query Socket Pool
+
+// A socket is shared by up to QUERY_SOCKET_TARGET_USERS questions before another is opened, and is retired after it
+// has been handed to QUERY_SOCKET_MAX_USES questions, so that a long-running daemon keeps moving to fresh source ports.
+#define QUERY_SOCKET_TARGET_USERS 8
+#define QUERY_SOCKET_MAX_USES     64
+
+// On platforms that delegate sockets to the requesting client, only that client's questions may share the socket
+mDNSlocal mDNSBool QuerySocketOwnedBy(const UnicastQuerySocket *const s, const DNSQuestion *const q)
+{
+    return(s->pid == q->pid && (q->pid || mDNSPlatformMemSame(s->uuid, q->uuid, UUID_SIZE)));
+}
+
+mDNSlocal UDPSocket *QuerySocketOpen(const DNSQuestion *const q)
+{
+    UDPSocket *const sock = mDNSPlatformUDPSocket(zeroIPPort);    // Zero port asks for a random ephemeral port
+    if (sock)
+    {
+        mDNSPlatformSetSocktOpt(sock, mDNSTransport_UDP, mDNSAddrType_IPv4, q);
+        mDNSPlatformSetSocktOpt(sock, mDNSTransport_UDP, mDNSAddrType_IPv6, q);
+    }
+    return(sock);
+}
+
+mDNSlocal void QuerySocketClose(mDNS *const m, const mDNSu32 i)
+{
+    mDNSPlatformUDPClose(m->QuerySockets[i].sock);
+    m->QuerySockets[i] = m->QuerySockets[--m->QuerySocketCount];
+    m->mDNSStats.QuerySocketsClosed++;
+}
+
+mDNSexport UDPSocket *uDNS_AcquireQuerySocket(mDNS *const m, const DNSQuestion *const q)
+{
+    UnicastQuerySocket *s = mDNSNULL, *busiest = mDNSNULL;
+    mDNSu32 i, eligible = 0, idle = UnicastQuerySocketPoolSize;
+
+    for (i = 0; i < m->QuerySocketCount; i++)
+    {
+        UnicastQuerySocket *const x = &m->QuerySockets[i];
+        if (!QuerySocketOwnedBy(x, q)) { if (!x->users) idle = i; continue; }
+        if (x->users < QUERY_SOCKET_TARGET_USERS && x->uses < QUERY_SOCKET_MAX_USES)
+        {
+            // Pick uniformly among the sockets with room, so consecutive queries don't all leave from the same port
+            if (mDNSRandom(eligible++) == 0) s = x;
+        }
+        else if (!busiest || x->users < busiest->users) busiest = x;
+    }
+
+    if (s) m->mDNSStats.QuerySocketsShared++;
+    else
+    {
+        // Make room by closing another client's idle socket if the pool is full
+        if (m->QuerySocketCount == UnicastQuerySocketPoolSize && idle < UnicastQuerySocketPoolSize)
+        {
+            if (busiest == &m->QuerySockets[m->QuerySocketCount - 1]) busiest = &m->QuerySockets[idle];
+            QuerySocketClose(m, idle);
+        }
+        if (m->QuerySocketCount < UnicastQuerySocketPoolSize)
+        {
+            UDPSocket *const sock = QuerySocketOpen(q);
+            if (sock)
+            {
+                s = &m->QuerySockets[m->QuerySocketCount++];
+                mDNSPlatformMemZero(s, sizeof(*s));
+                s->sock = sock;
+                s->pid  = q->pid;
+                mDNSPlatformMemCopy(s->uuid, q->uuid, UUID_SIZE);
+                m->mDNSStats.QuerySocketsOpened++;
+                if (m->QuerySocketCount > m->mDNSStats.QuerySocketsHighWater)
+                    m->mDNSStats.QuerySocketsHighWater = m->QuerySocketCount;
+            }
+        }
+        // Over the cap (or out of sockets), so overload the least busy socket this client already has
+        if (!s && busiest) { s = busiest; m->mDNSStats.QuerySocketsShared++; m->mDNSStats.QuerySocketsOverloaded++; }
+        // The pool is full of other clients' busy sockets, so give the question a socket of its own;
+        // uDNS_ReleaseQuerySocket closes it, since it isn't in the pool
+        if (!s)
+        {
+            UDPSocket *const sock = QuerySocketOpen(q);
+            if (sock) m->mDNSStats.QuerySocketsUnpooled++;
+            return(sock);
+        }
+    }
+
+    s->users++;
+    s->uses++;
+    m->mDNSStats.QuerySocketAcquisitions++;
+    return(s->sock);
+}
+
+// Called when a question gives up its LocalSocket. Sockets that aren't from the pool are simply closed.
+mDNSexport void uDNS_ReleaseQuerySocket(mDNS *const m, UDPSocket *const sock)
+{
+    mDNSu32 i, j;
+
+    for (i = 0; i < m->QuerySocketCount; i++) if (m->QuerySockets[i].sock == sock) break;
+    if (i == m->QuerySocketCount) { mDNSPlatformUDPClose(sock); return; }
+
+    if (m->QuerySockets[i].users > 0) m->QuerySockets[i].users--;
+    if (m->QuerySockets[i].users) return;
+
+    // Keep at most one idle socket per client around for the next question
+    if (m->QuerySockets[i].uses >= QUERY_SOCKET_MAX_USES) { QuerySocketClose(m, i); return; }
+    for (j = 0; j < m->QuerySocketCount; j++)
+    {
+        const UnicastQuerySocket *const x = &m->QuerySockets[j];
+        if (j != i && !x->users && x->pid == m->QuerySockets[i].pid &&
+            (x->pid || mDNSPlatformMemSame(x->uuid, m->QuerySockets[i].uuid, UUID_SIZE)))
+        {
+            QuerySocketClose(m, i);
+            return;
+        }
+    }
+}
+
+// Called on exit to close the sockets that no question is using
+mDNSexport void uDNS_CloseIdleQuerySockets(mDNS *const m)
+{
+    mDNSu32 i = 0;
+
+    while (i < m->QuerySocketCount)
+    {
+        if (!m->QuerySockets[i].users) QuerySocketClose(m, i);  // Moves the last socket into slot i
+        else i++;
+    }
+}
+
 // ***************************************************************************
 // MARK: - Query Routines
 
@@ -4735,15 +4864,7 @@ mDNSlocal void uDNS_CheckCurrentQuestion(mDNS *const m)
                 debugf("uDNS_CheckCurrentQuestion sending %p %##s (%s) %#a:%d UnansweredQueries %d",
                        q, q->qname.c, DNSTypeName(q->qtype),
                        q->qDNSServer ? &q->qDNSServer->addr : mDNSNULL, mDNSVal16(q->qDNSServer ? q->qDNSServer->port : zeroIPPort), q->unansweredQueries);
-                if (!q->LocalSocket)
-                {
-                    q->LocalSocket = mDNSPlatformUDPSocket(zeroIPPort);
-                    if (q->LocalSocket)
-                    {
-                        mDNSPlatformSetSocktOpt(q->LocalSocket, mDNSTransport_UDP, mDNSAddrType_IPv4, q);
-                        mDNSPlatformSetSocktOpt(q->LocalSocket, mDNSTransport_UDP, mDNSAddrType_IPv6, q);
-                    }
-                }
+                if (!q->LocalSocket) q->LocalSocket = uDNS_AcquireQuerySocket(m, q);
                 if (!q->LocalSocket) err = mStatus_NoMemoryErr; // If failed to make socket (should be very rare), we'll try again next time
                 else
                 {
@@ -4845,7 +4966,7 @@ mDNSlocal void uDNS_CheckCurrentQuestion(mDNS *const m)
             // passed to uDNS_CheckCurrentQuestion -- we only want one set of query packets hitting the wire --
             // but we want *all* of the questions to get answer callbacks.)
             CacheRecord *cr;
-            const mDNSu32 slot = HashSlotFromNameHash(q->qnamehash);
+            const mDNSu32 slot = HashSlotFromNameHash(m, q->qnamehash);
             CacheGroup *const cg = CacheGroupForName(m, q->qnamehash, &q->qname);
 
             if (!q->qDNSServer)
@@ -4917,8 +5038,8 @@ mDNSlocal void uDNS_CheckCurrentQuestion(mDNS *const m)
             // We're already using the m->CurrentQuestion pointer, so CacheRecordAdd can't use it to walk the question list.
             // To solve this problem we set cr->DelayDelivery to a nonzero value (which happens to be 'now') so that we
             // momentarily defer generating answer callbacks until mDNS_Execute time.
-            CreateNewCacheEntry(m, slot, cg, NonZeroTime(m->timenow), mDNStrue, mDNSNULL);
-            ScheduleNextCacheCheckTime(m, slot, NonZeroTime(m->timenow));
+            cr = CreateNewCacheEntry(m, slot, cg, NonZeroTime(m->timenow), mDNStrue, mDNSNULL);
+            if (cr) ScheduleNextCacheCheckTime(m, CacheGroupForName(m, cr->resrec.namehash, cr->resrec.name), NonZeroTime(m->timenow));
             m->rec.r.responseFlags = zeroID;
             m->rec.r.resrec.RecordType = 0;     // Clear RecordType to show we're not still using it
             // MUST NOT touch m->CurrentQuestion (or q) after this -- client callback could have deleted it
@@ -5889,7 +6010,7 @@ mDNSlocal void DNSPushProcessResponse(mDNS *const m, const DNSMessage *const msg
         // We only try to cache answers if we have a cache to put them in
         if (m->rrcache_size)
         {
-            const mDNSu32 slot = HashSlotFromNameHash(mrr->namehash);
+            const mDNSu32 slot = HashSlotFromNameHash(m, mrr->namehash);
             CacheGroup *cg = CacheGroupForName(m, mrr->namehash, mrr->name);
             CacheRecord *rr = mDNSNULL;
 
@@ -5930,7 +6051,7 @@ mDNSlocal void DNSPushProcessResponses(mDNS *const m, const DNSMessage *const ms
     while ((ptr = GetLargeResourceRecord(m, msg, ptr, end, mDNSNULL, kDNSRecordTypePacketAns, &m->rec)))
     {
         int gotOne = 0;
-        for (q = m->Questions; q; q = q->next)
+        for (q = QuestionsForNameHash(m, mrr->namehash); q; q = q->NextInNameHash)
         {
             if (q->LongLived &&
                 (q->qtype == mrr->rrtype || q->qtype == kDNSServiceType_ANY)
@@ -7013,7 +7134,7 @@ DNSPushUpdateQuestionDuplicate(DNSQuestion *const NONNULL primary, DNSQuestion *
                                                                kDNSPushActivity_Subscription, primary);
             if (activity != mDNSNULL)
             {
-                activity->context = duplicate;
+                dso_set_activity_context(primary->dnsPushServer->connection, activity, duplicate);
             }
         }
 
@@ -7067,6 +7188,26 @@ mDNSlocal const char *LLQStateToString(const LLQ_State state)
 // MARK: -
 #else // !UNICAST_DISABLED
 
+mDNSexport UDPSocket *uDNS_AcquireQuerySocket(mDNS *const m, const DNSQuestion *const q)
+{
+    (void) m;
+    (void) q;
+
+    return mDNSNULL;
+}
+
+mDNSexport void uDNS_ReleaseQuerySocket(mDNS *const m, UDPSocket *const sock)
+{
+    (void) m;
+
+    mDNSPlatformUDPClose(sock);
+}
+
+mDNSexport void uDNS_CloseIdleQuerySockets(mDNS *const m)
+{
+    (void) m;
+}
+
 mDNSexport const domainname *GetServiceTarget(mDNS *m, AuthRecord *const rr)
 {
     (void) m;
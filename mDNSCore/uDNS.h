@@ -55,6 +55,11 @@ extern "C" {
 #define UDNSBackOffMultiplier 2 
 #define MinQuestionInterval (1 * mDNSPlatformOneSecond)
 
+// Every question on m->Questions is also chained into m->QuestionsByName by name hash, and, if it has a non-zero
+// TargetQID, into m->QuestionsByID by message ID. Within a name slot, questions keep their m->Questions order.
+#define QuestionsForNameHash(M, H) ((M)->QuestionsByName[(H) % CACHE_HASH_SLOTS])
+#define QuestionsForID(M, ID)      ((M)->QuestionsByID[mDNSVal16(ID) % CACHE_HASH_SLOTS])
+
 // For Unicast record registrations, we initialize the interval to 1 second. When we send any query for
 // the record registration e.g., GetZoneData, we always back off by QuestionIntervalStep
 // so that the first retry does not happen until 3 seconds which should be enough for TCP/TLS to be done.
@@ -154,8 +159,12 @@ extern void SleepRecordRegistrations(mDNS *m);
 extern mStatus uDNS_UpdateRecord(mDNS *m, AuthRecord *rr);
 
 extern void SetNextQueryTime(mDNS *const m, const DNSQuestion *const q);
+extern UDPSocket *uDNS_AcquireQuerySocket(mDNS *const m, const DNSQuestion *const q);
+extern void uDNS_ReleaseQuerySocket(mDNS *const m, UDPSocket *const sock);
+extern void uDNS_CloseIdleQuerySockets(mDNS *const m);
 extern mStatus mDNS_Register_internal(mDNS *const m, AuthRecord *const rr);
 extern mStatus mDNS_Deregister_internal(mDNS *const m, AuthRecord *const rr, mDNS_Dereg_type drt);
+extern void RemoveRecordFromNameIndex(mDNS *const m, AuthRecord *const rr);
 extern mStatus mDNS_StartQuery_internal(mDNS *const m, DNSQuestion *const question);
 extern mStatus mDNS_StopQuery_internal(mDNS *const m, DNSQuestion *const question);
 extern mStatus mDNS_StartNATOperation_internal(mDNS *const m, NATTraversalInfo *traversal);
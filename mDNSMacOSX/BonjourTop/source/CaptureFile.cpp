@@ -8,8 +8,11 @@
 
 #include "CaptureFile.h"
 #include <stdio.h>
+#include <string.h>
 #include <pcap.h>
 #include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
 
 #define BJ_MAX_PACKET (1024*20)
 
@@ -26,9 +29,14 @@ struct packetheader
 CCaptureFile::CCaptureFile()
 {
     m_pFileHeader = NULL;
+    m_pFrameBuffer = NULL;
     m_pFrameData = NULL;
     m_pFrameHeader = NULL;
     m_hFile = NULL;
+    m_pMap = NULL;
+    m_nMapLen = 0;
+    m_nMapReserved = 0;
+    m_nMapOffset = 0;
 
     m_nFirstFrameTime = 0;
 
@@ -44,18 +52,57 @@ bool CCaptureFile::Init()
 {
     m_pFileHeader = new BJ_UINT8[sizeof(pcap_file_header)];
     m_pFrameHeader = new BJ_UINT8[sizeof(packetheader)];
-    m_pFrameData = new BJ_UINT8[BJ_MAX_PACKET];
+    m_pFrameBuffer = new BJ_UINT8[BJ_MAX_PACKET];
+    m_pFrameData = m_pFrameBuffer;
 
-    return (m_pFrameHeader && m_pFrameData && m_pFileHeader);
+    return (m_pFrameHeader && m_pFrameBuffer && m_pFileHeader);
 }
 
 bool CCaptureFile::Clear()
 {
     delete m_pFileHeader; m_pFileHeader = NULL;
-    delete m_pFrameData; m_pFrameData = NULL;
+    delete m_pFrameBuffer; m_pFrameBuffer = NULL;
+    m_pFrameData = NULL;
     delete m_pFrameHeader; m_pFrameHeader = NULL;
 
-    fclose(m_hFile); m_hFile = NULL;
+    if (m_pMap)
+        munmap(m_pMap, m_nMapReserved);
+    m_pMap = NULL;
+
+    if (m_hFile)
+        fclose(m_hFile);
+    m_hFile = NULL;
+    return true;
+}
+
+// Maps the whole capture file so frames can be handed out without copying. The frame parsers trust the lengths
+// inside a frame and can read a little past its end, which the fread buffer used to absorb; so the file is mapped
+// over a larger anonymous (zero-filled) reservation, and a bad last frame reads zeroes instead of faulting.
+bool CCaptureFile::Map()
+{
+    struct stat st;
+    const size_t nSlack = BJ_MAX_PACKET + 64*1024;
+
+    if (fstat(fileno(m_hFile), &st) != 0 || !S_ISREG(st.st_mode) || st.st_size == 0)
+        return false;
+
+    m_nMapLen = (size_t)st.st_size;
+    m_nMapReserved = m_nMapLen + nSlack;
+    void* pReserved = mmap(NULL, m_nMapReserved, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANON, -1, 0);
+    if (pReserved == MAP_FAILED)
+        return false;
+
+    // PROT_WRITE with MAP_PRIVATE keeps the frame buffers writable like the fread buffer was, without touching the file
+    void* pFile = mmap(pReserved, m_nMapLen, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_FIXED, fileno(m_hFile), 0);
+    if (pFile == MAP_FAILED)
+    {
+        munmap(pReserved, m_nMapReserved);
+        return false;
+    }
+    madvise(pFile, m_nMapLen, MADV_SEQUENTIAL);
+
+    m_pMap = (BJ_UINT8*)pFile;
+    m_nMapOffset = 0;
     return true;
 }
 
@@ -70,7 +117,18 @@ bool CCaptureFile::Open(const char* pFileName)
     }
 
 
-    fread(m_pFileHeader, sizeof(pcap_file_header), 1,m_hFile);
+    if (Map() && m_nMapLen >= sizeof(pcap_file_header))
+    {
+        memcpy(m_pFileHeader, m_pMap, sizeof(pcap_file_header));
+        m_nMapOffset = sizeof(pcap_file_header);
+    }
+    else
+    {
+        if (m_pMap)
+            munmap(m_pMap, m_nMapReserved);
+        m_pMap = NULL;
+        fread(m_pFileHeader, sizeof(pcap_file_header), 1,m_hFile);
+    }
 
    //  pcap_file_header* pHeader = (pcap_file_header*)m_pFileHeader;
    // int magic = pHeader->magic;
@@ -89,7 +147,14 @@ bool CCaptureFile::NextFrame()
     if(!m_hFile)
         return false;
 
-    if (fread(m_pFrameHeader,1,sizeof(packetheader),m_hFile)< sizeof(packetheader))
+    if (m_pMap)
+    {
+        if (m_nMapLen - m_nMapOffset < sizeof(packetheader))
+            return false;
+        memcpy(m_pFrameHeader, m_pMap + m_nMapOffset, sizeof(packetheader));
+        m_nMapOffset += sizeof(packetheader);
+    }
+    else if (fread(m_pFrameHeader,1,sizeof(packetheader),m_hFile)< sizeof(packetheader))
         return false;
 
     pFrameHeader = (packetheader*) m_pFrameHeader;
@@ -107,11 +172,22 @@ bool CCaptureFile::NextFrame()
         m_nCaptureLen = BJ_MAX_PACKET;
     }
 
-    if (fread(m_pFrameData,1,m_nCaptureLen,m_hFile) < m_nCaptureLen)
-        return false;
+    if (m_pMap)
+    {
+        if (m_nMapLen - m_nMapOffset < m_nCaptureLen)
+            return false;
+        m_pFrameData = m_pMap + m_nMapOffset;
+        m_nMapOffset += m_nCaptureLen;
+        m_nMapOffset += ((size_t)nSkip < m_nMapLen - m_nMapOffset) ? (size_t)nSkip : m_nMapLen - m_nMapOffset;
+    }
+    else
+    {
+        if (fread(m_pFrameData,1,m_nCaptureLen,m_hFile) < m_nCaptureLen)
+            return false;
 
-    if (nSkip)
-        fseek(m_hFile, nSkip, SEEK_CUR);
+        if (nSkip)
+            fseek(m_hFile, nSkip, SEEK_CUR);
+    }
 
     m_CurrentFrame.Set(m_pFrameData, m_nCaptureLen,pFrameHeader->sec*1000000ll + pFrameHeader->usec);
 
@@ -37,10 +37,16 @@ public:
 private:
     bool Init();
     bool Clear();
+    bool Map();
 
     FILE* m_hFile;
+    BJ_UINT8* m_pMap;
+    size_t m_nMapLen;       // Length of the file within the mapping
+    size_t m_nMapReserved;  // Length of the whole mapping, including the zeroed slack after the file
+    size_t m_nMapOffset;
     BJ_UINT8* m_pFrameHeader;
-    BJ_UINT8* m_pFrameData;
+    BJ_UINT8* m_pFrameBuffer;
+    BJ_UINT8* m_pFrameData; // Current frame; either m_pFrameBuffer or a view into m_pMap
     BJ_UINT8* m_pFileHeader;
     __uint32_t  m_nCaptureLen;
     __uint32_t  m_nWireLen;
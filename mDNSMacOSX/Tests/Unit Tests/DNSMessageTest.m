@@ -53,13 +53,127 @@
     XCTAssertEqual(msg->h.numAuthorities, 0);
 }
 
-#if 0
-- (void)testPerformanceExample {
-    // This is an example of a performance test case.
+// Sets up a record with verbatim rdata, as putRData would copy it into the message.
+static void SetupRawRecord(AuthRecord *const ar, const char *const name, const mDNSu16 rrtype, const void *const rdata, const mDNSu16 rdlength)
+{
+    mDNS_SetupResourceRecord(ar, mDNSNULL, mDNSInterface_Any, rrtype, kStandardTTL, kDNSRecordTypeShared, AuthRecordAny, mDNSNULL, mDNSNULL);
+    MakeDomainNameFromDNSNameString(&ar->namestorage, name);
+    mDNSPlatformMemCopy(ar->resrec.rdata->u.data, rdata, rdlength);
+    ar->resrec.rdlength = rdlength;
+}
+
+static void SetupSRVRecord(AuthRecord *const ar, const char *const name, const char *const target)
+{
+    mDNS_SetupResourceRecord(ar, mDNSNULL, mDNSInterface_Any, kDNSType_SRV, kHostNameTTL, kDNSRecordTypeShared, AuthRecordAny, mDNSNULL, mDNSNULL);
+    MakeDomainNameFromDNSNameString(&ar->namestorage, name);
+    ar->resrec.rdata->u.srv.priority = 0;
+    ar->resrec.rdata->u.srv.weight   = 0;
+    ar->resrec.rdata->u.srv.port     = mDNSOpaque16fromIntVal(631);
+    MakeDomainNameFromDNSNameString(&ar->resrec.rdata->u.srv.target, target);
+    ar->resrec.rdlength = 6 + DomainNameLength(&ar->resrec.rdata->u.srv.target);
+}
+
+// Builds a response out of the given records, with or without a compression table, and returns its length.
+// If ends is non-NULL, it gets the end of each record in the message.
+static size_t BuildResponse(DNSMessage *const msg, DNSCompressionTable *const table, AuthRecord *const records, const int count,
+                            mDNSu8 **const ends)
+{
+    const mDNSu8 *const limit = msg->data + AbsoluteMaxDNSMessageData;
+    mDNSu8 *ptr = msg->data;
+    int i;
+
+    DNSCompressionTableAttach(table, msg);
+    mDNSPlatformMemZero(msg, sizeof(*msg));
+    InitializeDNSMessage(&msg->h, zeroID, ResponseFlags);
+    for (i = 0; i < count && ptr; i++)
+    {
+        ptr = PutResourceRecordTTLWithLimit(msg, ptr, &msg->h.numAnswers, &records[i].resrec, records[i].resrec.rroriginalttl, limit);
+        if (ends) ends[i] = ptr;
+    }
+    DNSCompressionTableAttach(mDNSNULL, mDNSNULL);
+    return(ptr ? (size_t)(ptr - (mDNSu8 *)msg) : 0);
+}
+
+// Names that the old backwards scan finds inside TXT, HINFO, NULL and unicast NSEC rdata must be found by the
+// compression table too, so that both produce the same bytes on the wire.
+- (void)testCompressionIntoVerbatimRData
+{
+    static const mDNSu8 nullRData[]  = "\x04" "dev1" "\x05" "local";                             // A complete name
+    static const mDNSu8 hinfoRData[] = "\x03" "x86" "\x04" "dev2";                               // Ends in the next owner name
+    static const mDNSu8 txtRData[]   = "\x09" "txtvers=1" "\x04" "dev4";                         // Ends in the next owner name
+    static const mDNSu8 nsecRData[]  = "\x04" "dev3" "\x05" "local" "\x00" "\x00\x06\x00\x00\x00\x00\x00\x01";
+    DNSCompressionTable *const table = (DNSCompressionTable *)malloc(sizeof(*table));
+    DNSMessage *const scanned = (DNSMessage *)malloc(sizeof(*scanned));
+    AuthRecord *const records = (AuthRecord *)calloc(9, sizeof(*records));
+    mDNSu8 *ends[9];
+    size_t length;
+    int i;
+
+    XCTAssert(table != NULL && scanned != NULL && records != NULL);
+    SetupRawRecord(&records[0], "host.local.",                    kDNSType_NULL,  nullRData,  sizeof(nullRData));
+    SetupRawRecord(&records[1], "host.local.",                    kDNSType_HINFO, hinfoRData, sizeof(hinfoRData) - 1);
+    SetupRawRecord(&records[2], "local.",                         kDNSType_NSEC,  nsecRData,  sizeof(nsecRData) - 1);
+    SetupRawRecord(&records[3], "Printer._ipp._tcp.local.",       kDNSType_TXT,   txtRData,   sizeof(txtRData) - 1);
+    SetupSRVRecord(&records[4], "_tcp.local.",                    "dev1.local.");
+    SetupSRVRecord(&records[5], "Printer._ipp._tcp.local.",       "dev2.local.");
+    SetupSRVRecord(&records[6], "Printer._ipp._tcp.local.",       "dev3.local.");
+    SetupSRVRecord(&records[7], "Printer._ipp._tcp.local.",       "dev4._tcp.local.");
+    SetupSRVRecord(&records[8], "Printer._ipp._tcp.local.",       "txtvers=1.dev4._tcp.local.");
+    XCTAssert(UNICAST_NSEC(&records[2].resrec));
+
+    length = BuildResponse(msg, table, records, 9, ends);
+    XCTAssert(length > 0);
+    XCTAssertEqual(BuildResponse(scanned, mDNSNULL, records, 9, mDNSNULL), length);
+    XCTAssertEqual(memcmp(msg, scanned, length), 0);
+
+    // Each SRV target is written as nothing but a pointer into the verbatim rdata of one of the first four records.
+    for (i = 4; i < 9; i++)
+    {
+        const mDNSu8 *const pointer = ends[i] - 2;
+        const int raw = (i == 8) ? 3 : i - 4;
+        const mDNSu8 *const target = (const mDNSu8 *)msg + (((mDNSu16)(pointer[0] & 0x3F)) << 8) + pointer[1];
+        XCTAssertEqual(pointer[0] & 0xC0, 0xC0);
+        XCTAssert(target >= ends[raw] - records[raw].resrec.rdlength && target < ends[raw]);
+    }
+
+    free(records);
+    free(scanned);
+    free(table);
+}
+
+// Writing a large response with the compression table attached, which is how mDNS_Execute sends responses.
+- (void)testCompressionTablePerformance
+{
+    DNSCompressionTable *const table = (DNSCompressionTable *)malloc(sizeof(*table));
+    AuthRecord *const records = (AuthRecord *)calloc(180, sizeof(*records));
+    static const mDNSu8 txtRData[] = "\x09" "txtvers=1" "\x07" "model=J" "\x0A" "features=0";
+    char name[MAX_ESCAPED_DOMAIN_NAME], target[MAX_ESCAPED_DOMAIN_NAME];
+    int i;
+
+    XCTAssert(table != NULL && records != NULL);
+    for (i = 0; i < 60; i++)
+    {
+        AuthRecord *const ptr = &records[i * 3];
+        mDNS_snprintf(name, sizeof(name), "Device %d._airplay._tcp.local.", i);
+        mDNS_snprintf(target, sizeof(target), "device-%d.local.", i);
+        mDNS_SetupResourceRecord(ptr, mDNSNULL, mDNSInterface_Any, kDNSType_PTR, kStandardTTL, kDNSRecordTypeShared, AuthRecordAny, mDNSNULL, mDNSNULL);
+        MakeDomainNameFromDNSNameString(&ptr->namestorage, "_airplay._tcp.local.");
+        MakeDomainNameFromDNSNameString(&ptr->resrec.rdata->u.name, name);
+        ptr->resrec.rdlength = DomainNameLength(&ptr->resrec.rdata->u.name);
+        SetupSRVRecord(&records[i * 3 + 1], name, target);
+        SetupRawRecord(&records[i * 3 + 2], name, kDNSType_TXT, txtRData, sizeof(txtRData) - 1);
+    }
+
     [self measureBlock:^{
-        // Put the code you want to measure the time of here.
+        int n;
+        for (n = 0; n < 100; n++)
+        {
+            XCTAssert(BuildResponse(self->msg, table, records, 180, mDNSNULL) > 0);
+        }
     }];
+
+    free(records);
+    free(table);
 }
-#endif
 
 @end
@@ -0,0 +1,115 @@
+/*
+ * Copyright (c) 2021 Apple Inc. All rights reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "mDNSEmbeddedAPI.h"
+#include "dso.h"
+#import <XCTest/XCTest.h>
+
+#define kTestActivityCount 5000
+
+static const char kTestActivityType[] = "test-activity";
+
+@interface DSOTest : XCTestCase
+{
+    dso_state_t *dso;
+    int contexts[kTestActivityCount];
+    char names[kTestActivityCount][32];
+}
+@end
+
+@implementation DSOTest
+
+- (void)setUp
+{
+    int i;
+
+    dso = dso_state_create(true, 1, "DSOTest", NULL, NULL, NULL, NULL);
+    XCTAssert(dso != NULL);
+    for (i = 0; i < kTestActivityCount; i++)
+    {
+        mDNS_snprintf(names[i], sizeof(names[i]), "subscription-%d.example.com.", i);
+    }
+}
+
+- (void)tearDown
+{
+    dso_state_cancel(dso);
+    dso_idle(NULL, 0, 0);
+}
+
+// Activities have to be found by name and by context as they are added, moved to a new context and dropped,
+// including while the indexes are being resized.
+- (void)testActivityIndex
+{
+    dso_activity_t *activities[kTestActivityCount];
+    int moved = 0;
+    int i;
+
+    for (i = 0; i < kTestActivityCount; i++)
+    {
+        activities[i] = dso_add_activity(dso, names[i], kTestActivityType, &contexts[i], NULL);
+        XCTAssert(activities[i] != NULL);
+    }
+    for (i = 0; i < kTestActivityCount; i++)
+    {
+        XCTAssertEqual(dso_find_activity(dso, names[i], kTestActivityType, NULL), activities[i]);
+        XCTAssertEqual(dso_find_activity(dso, NULL, kTestActivityType, &contexts[i]), activities[i]);
+    }
+
+    // Moving an activity to a new context has to take it out of the old context's chain.
+    dso_set_activity_context(dso, activities[0], &moved);
+    XCTAssertEqual(dso_find_activity(dso, NULL, kTestActivityType, &moved), activities[0]);
+    XCTAssertEqual(dso_find_activity(dso, NULL, kTestActivityType, &contexts[0]), NULL);
+    XCTAssertEqual(dso_find_activity(dso, names[0], kTestActivityType, NULL), activities[0]);
+
+    for (i = 0; i < kTestActivityCount; i += 2)
+    {
+        dso_drop_activity(dso, activities[i]);
+    }
+    for (i = 0; i < kTestActivityCount; i++)
+    {
+        dso_activity_t *const expected = (i % 2) ? activities[i] : NULL;
+        XCTAssertEqual(dso_find_activity(dso, names[i], kTestActivityType, NULL), expected);
+        XCTAssertEqual(dso_find_activity(dso, NULL, kTestActivityType, &contexts[i]), expected);
+    }
+    XCTAssertEqual(dso_find_activity(dso, NULL, kTestActivityType, &moved), NULL);
+}
+
+// Adds a session's worth of DNS Push style subscriptions, looks each one up by name and by context, then drops them.
+- (void)testActivityLookupPerformance
+{
+    [self measureBlock:^{
+        dso_activity_t *activity;
+        int i;
+
+        for (i = 0; i < kTestActivityCount; i++)
+        {
+            XCTAssert(dso_add_activity(self->dso, self->names[i], kTestActivityType, &self->contexts[i], NULL) != NULL);
+        }
+        for (i = 0; i < kTestActivityCount; i++)
+        {
+            XCTAssert(dso_find_activity(self->dso, self->names[i], kTestActivityType, NULL) != NULL);
+            XCTAssert(dso_find_activity(self->dso, NULL, kTestActivityType, &self->contexts[i]) != NULL);
+        }
+        for (i = 0; i < kTestActivityCount; i++)
+        {
+            activity = dso_find_activity(self->dso, NULL, kTestActivityType, &self->contexts[i]);
+            dso_drop_activity(self->dso, activity);
+        }
+    }];
+}
+
+@end
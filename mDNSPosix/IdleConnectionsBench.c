@@ -0,0 +1,118 @@
+/* -*- Mode: C; tab-width: 4 -*-
+ *
+ * Copyright (c) 2021 Apple Inc. All rights reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+// Measures how the cost of a client request to a running mdnsd grows with the number of idle client connections
+// the daemon is holding open. It opens the requested number of DNSServiceCreateConnection() connections, leaves them
+// idle, and times DNSServiceRegister()/DNSServiceRefDeallocate() round trips on connections of their own.
+// Build it with 'make os=linux Benchmarks'; compare a daemon built with 'epoll=no' to see the select() loop.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <arpa/inet.h>
+#include <sys/resource.h>
+
+#include "dns_sd.h"
+
+static const char *gProgramName = "IdleConnectionsBench";
+
+static void PrintUsage(void)
+{
+    fprintf(stderr, "Usage: %s [-i idle connections] [-r round trips]\n", gProgramName);
+}
+
+// The replies are never read; DNSServiceRegister() just insists on having somewhere to deliver them.
+static void DNSSD_API RegisterReply(DNSServiceRef sdRef, DNSServiceFlags flags, DNSServiceErrorType errorCode,
+                                   const char *name, const char *regtype, const char *domain, void *context)
+{
+    (void)sdRef;
+    (void)flags;
+    (void)errorCode;
+    (void)name;
+    (void)regtype;
+    (void)domain;
+    (void)context;
+}
+
+static double NowMicroseconds(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (double)ts.tv_sec * 1e6 + (double)ts.tv_nsec / 1e3;
+}
+
+int main(int argc, char **argv)
+{
+    DNSServiceRef *idle;
+    struct rlimit limit;
+    double start;
+    long idleCount = 0, rounds = 500, i;
+    int opt;
+
+    while ((opt = getopt(argc, argv, "i:r:")) != -1)
+    {
+        switch (opt)
+        {
+            case 'i': idleCount = strtol(optarg, NULL, 10); break;
+            case 'r': rounds    = strtol(optarg, NULL, 10); break;
+            default:  PrintUsage(); return 2;
+        }
+    }
+    if (idleCount < 0 || rounds <= 0) { PrintUsage(); return 2; }
+
+    // Every idle connection costs us a descriptor too.
+    if (getrlimit(RLIMIT_NOFILE, &limit) == 0 && limit.rlim_cur < (rlim_t)idleCount + 64)
+    {
+        limit.rlim_cur = (rlim_t)idleCount + 64;
+        if (limit.rlim_max < limit.rlim_cur) limit.rlim_cur = limit.rlim_max;
+        (void)setrlimit(RLIMIT_NOFILE, &limit);
+    }
+
+    idle = (DNSServiceRef *)calloc((size_t)idleCount + 1, sizeof(*idle));
+    if (!idle) { fprintf(stderr, "%s: out of memory\n", gProgramName); return 1; }
+    for (i = 0; i < idleCount; i++)
+    {
+        const DNSServiceErrorType err = DNSServiceCreateConnection(&idle[i]);
+        if (err != kDNSServiceErr_NoError)
+        {
+            fprintf(stderr, "%s: DNSServiceCreateConnection %ld failed: %d\n", gProgramName, i, err);
+            return 1;
+        }
+    }
+
+    start = NowMicroseconds();
+    for (i = 0; i < rounds; i++)
+    {
+        DNSServiceRef ref;
+        const DNSServiceErrorType err = DNSServiceRegister(&ref, kDNSServiceFlagsNoAutoRename, 0, "IdleConnectionsBench",
+                                                           "_bench._tcp", NULL, NULL, htons(9), 0, NULL, RegisterReply, NULL);
+        if (err != kDNSServiceErr_NoError)
+        {
+            fprintf(stderr, "%s: DNSServiceRegister failed: %d\n", gProgramName, err);
+            return 1;
+        }
+        DNSServiceRefDeallocate(ref);
+    }
+    printf("%ld idle connections: %.1f us per register/deallocate round trip\n", idleCount,
+           (NowMicroseconds() - start) / (double)rounds);
+
+    for (i = 0; i < idleCount; i++) DNSServiceRefDeallocate(idle[i]);
+    free(idle);
+    return 0;
+}
@@ -0,0 +1,117 @@
+/* -*- Mode: C; tab-width: 4 -*-
+ *
+ * Copyright (c) 2021 Apple Inc. All rights reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+// Measures repeated host name lookups through nss_mdns against a running mdnsd. nss_mdns is linked in directly and
+// _nss_mdns_gethostbyname2_r() is called from one or more threads, so the time per call covers the module and the
+// daemon but not the rest of the Name Service Switch. Point -c at an nss_mdns.conf with 'cache_entries 0' to measure
+// without the lookup cache.
+// Build it with 'make os=linux Benchmarks'.
+
+#include <errno.h>
+#include <netdb.h>
+#include <nss.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/socket.h>
+
+// Provided by nss_mdns.c
+extern const char *k_conf_file;
+extern enum nss_status _nss_mdns_gethostbyname2_r(const char *name, int af, struct hostent *result_buf, char *buf,
+                                                  size_t buflen, int *errnop, int *h_errnop);
+
+static const char *gProgramName = "NSSLookupBench";
+static const char *gHostName;
+static long gIterations = 1000;
+
+static void PrintUsage(void)
+{
+    fprintf(stderr, "Usage: %s [-c nss_mdns.conf] [-t threads] [-n lookups per thread] hostname\n", gProgramName);
+}
+
+static double NowMicroseconds(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (double)ts.tv_sec * 1e6 + (double)ts.tv_nsec / 1e3;
+}
+
+// Returns the number of lookups that found the name.
+static void *LookupThread(void *context)
+{
+    struct hostent result;
+    char buf[1024];
+    long i, found = 0;
+    (void)context;
+
+    for (i = 0; i < gIterations; i++)
+    {
+        int err = 0, herr = 0;
+        if (_nss_mdns_gethostbyname2_r(gHostName, AF_INET, &result, buf, sizeof(buf), &err, &herr) == NSS_STATUS_SUCCESS)
+            found++;
+    }
+    return (void *)found;
+}
+
+int main(int argc, char **argv)
+{
+    pthread_t *threads;
+    double start, elapsed;
+    long threadCount = 1, found = 0, i;
+    int opt;
+
+    while ((opt = getopt(argc, argv, "c:t:n:")) != -1)
+    {
+        switch (opt)
+        {
+            case 'c': k_conf_file = optarg; break;
+            case 't': threadCount = strtol(optarg, NULL, 10); break;
+            case 'n': gIterations = strtol(optarg, NULL, 10); break;
+            default:  PrintUsage(); return 2;
+        }
+    }
+    if (optind != argc - 1 || threadCount <= 0 || gIterations <= 0) { PrintUsage(); return 2; }
+    gHostName = argv[optind];
+
+    threads = (pthread_t *)calloc((size_t)threadCount, sizeof(*threads));
+    if (!threads) { fprintf(stderr, "%s: out of memory\n", gProgramName); return 1; }
+
+    start = NowMicroseconds();
+    for (i = 0; i < threadCount; i++)
+    {
+        if (pthread_create(&threads[i], NULL, LookupThread, NULL) != 0)
+        {
+            fprintf(stderr, "%s: pthread_create failed: %s\n", gProgramName, strerror(errno));
+            return 1;
+        }
+    }
+    for (i = 0; i < threadCount; i++)
+    {
+        void *threadFound;
+        pthread_join(threads[i], &threadFound);
+        found += (long)threadFound;
+    }
+    elapsed = NowMicroseconds() - start;
+
+    printf("%s, %ld thread%s: %.1f us per lookup, %ld of %ld found\n", gHostName, threadCount,
+           threadCount == 1 ? "" : "s", elapsed / (double)gIterations, found, threadCount * gIterations);
+    free(threads);
+    return 0;
+}
@@ -99,13 +99,36 @@ static void Reconfigure(mDNS *m)
     mDNS_ConfigChanged(m);
 }
 
+static mDNSu32 CacheBudget = 0;    // Bytes of record cache we may grow to; zero for no limit
+
+// Converts a -cachebudget argument from kilobytes to bytes. Calls exit() unless it's a whole number of kilobytes,
+// greater than zero, that fits in an mDNSu32 once it's converted to bytes.
+mDNSlocal mDNSu32 ParseCacheBudget(const char *progname, const char *arg)
+{
+    char *end;
+    unsigned long kilobytes;
+
+    errno = 0;
+    kilobytes = strtoul(arg, &end, 10);
+    // strtoul skips leading white space and accepts a sign, so insist on a digit first.
+    if (arg[0] < '0' || arg[0] > '9' || *end || errno || kilobytes == 0 || kilobytes > 0xFFFFFFFFUL / 1024)
+    {
+        fprintf(stderr, "%s: -cachebudget must be a number of kilobytes from 1 to %lu, not \"%s\"\n",
+                progname, 0xFFFFFFFFUL / 1024, arg);
+        exit(1);
+    }
+    return (mDNSu32)(kilobytes * 1024);
+}
+
 // Do appropriate things at startup with command line arguments. Calls exit() if unhappy.
 mDNSlocal void ParseCmdLineArgs(int argc, char **argv)
 {
-    if (argc > 1)
+    int i;
+    for (i = 1; i < argc; i++)
     {
-        if (0 == strcmp(argv[1], "-debug")) mDNS_DebugMode = mDNStrue;
-        else printf("Usage: %s [-debug]\n", argv[0]);
+        if (0 == strcmp(argv[i], "-debug")) mDNS_DebugMode = mDNStrue;
+        else if (0 == strcmp(argv[i], "-cachebudget") && i + 1 < argc) CacheBudget = ParseCacheBudget(argv[0], argv[++i]);
+        else printf("Usage: %s [-debug] [-cachebudget <kilobytes>]\n", argv[0]);
     }
     if (!mDNS_DebugMode)
     {
@@ -131,6 +154,7 @@ mDNSlocal void DumpStateLog()
     LogRedact(MDNS_LOG_CATEGORY_DEFAULT, MDNS_LOG_DEFAULT, "---- BEGIN STATE LOG ---- (%s mDNSResponder Build %d.%02d.%02d)", timestamp, major_version, minor_version1, minor_version2);
 
     udsserver_info_dump_to_fd(STDERR_FILENO);
+    mDNSPosixLogBatchStatistics();
 
     getLocalTimestampNow(timestamp, sizeof(timestamp));
     LogRedact(MDNS_LOG_CATEGORY_DEFAULT, MDNS_LOG_DEFAULT, "---- END STATE LOG ---- (%s mDNSResponder Build %d.%02d.%02d)", timestamp, major_version, minor_version1, minor_version2);
@@ -189,6 +213,9 @@ int main(int argc, char **argv)
     err = mDNS_Init(&mDNSStorage, &PlatformStorage, gRRCache, RR_CACHE_SIZE, mDNS_Init_AdvertiseLocalAddresses,
                     mDNS_StatusCallback, mDNS_Init_NoInitCallbackContext);
 
+    if (mStatus_NoError == err && CacheBudget)
+        mDNS_SetCacheBudget(&mDNSStorage, CacheBudget);
+
     if (mStatus_NoError == err)
         err = udsserver_init(mDNSNULL, 0);
 
@@ -0,0 +1,251 @@
+/* -*- Mode: C; tab-width: 4 -*-
+ *
+ * Copyright (c) 2021 Apple Inc. All rights reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+// Measures how quickly DNSServiceProcessResult() delivers replies that are already waiting on the daemon socket.
+// Unlike the other benchmarks this one doesn't need mdnsd: it forks a stand-in that listens on a socket of its own
+// (handed to the client library through DNSSD_UDS_PATH), answers each DNSServiceBrowse() with the requested number of
+// browse replies, and writes them in chunks of the requested size, the way a busy daemon's replies pile up. The
+// client times draining them with DNSServiceProcessResult() and counts how many calls that took.
+// Build it with 'make os=linux Benchmarks'.
+
+#include <errno.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <arpa/inet.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <sys/wait.h>
+
+#include "dns_sd.h"
+#include "dnssd_ipc.h"
+
+static const char *gProgramName = "ProcessResultBench";
+
+typedef struct
+{
+    long replies;
+    long expected;
+} BrowseState;
+
+static void PrintUsage(void)
+{
+    fprintf(stderr, "Usage: %s [-n replies] [-c chunk bytes] [-i iterations]\n", gProgramName);
+}
+
+static void DNSSD_API BrowseReply(DNSServiceRef sdRef, DNSServiceFlags flags, uint32_t interfaceIndex,
+                                  DNSServiceErrorType errorCode, const char *name, const char *regtype,
+                                  const char *domain, void *context)
+{
+    BrowseState *const state = (BrowseState *)context;
+    (void)sdRef;
+    (void)flags;
+    (void)interfaceIndex;
+    (void)errorCode;
+    (void)name;
+    (void)regtype;
+    (void)domain;
+    state->replies++;
+}
+
+static double NowMicroseconds(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (double)ts.tv_sec * 1e6 + (double)ts.tv_nsec / 1e3;
+}
+
+static int ReadFully(int fd, void *buf, size_t len)
+{
+    uint8_t *p = (uint8_t *)buf;
+    while (len > 0)
+    {
+        const ssize_t n = read(fd, p, len);
+        if (n < 0 && errno == EINTR) continue;
+        if (n <= 0) return -1;
+        p   += n;
+        len -= (size_t)n;
+    }
+    return 0;
+}
+
+static int WriteFully(int fd, const void *buf, size_t len)
+{
+    const uint8_t *p = (const uint8_t *)buf;
+    while (len > 0)
+    {
+        const ssize_t n = write(fd, p, len);
+        if (n < 0 && errno == EINTR) continue;
+        if (n <= 0) return -1;
+        p   += n;
+        len -= (size_t)n;
+    }
+    return 0;
+}
+
+// Lays out count browse replies back to back, exactly as mdnsd would send them, and returns the total length.
+static uint8_t *BuildReplies(long count, size_t *outLen)
+{
+    const size_t replyMax = sizeof(ipc_msg_hdr) + 3 * sizeof(uint32_t) + 64 + sizeof("_bench._tcp.") + sizeof("local.");
+    uint8_t *const replies = (uint8_t *)malloc((size_t)count * replyMax);
+    uint8_t *ptr = replies;
+    long i;
+
+    if (!replies) return NULL;
+    for (i = 0; i < count; i++)
+    {
+        ipc_msg_hdr *const hdr = (ipc_msg_hdr *)ptr;
+        uint8_t *const data = ptr + sizeof(*hdr);
+        char name[64];
+
+        snprintf(name, sizeof(name), "Bench Service %ld", i);
+        ptr = data;
+        put_flags(kDNSServiceFlagsAdd, &ptr);
+        put_uint32(0, &ptr);
+        put_error_code(kDNSServiceErr_NoError, &ptr);
+        put_string(name, &ptr);
+        put_string("_bench._tcp.", &ptr);
+        put_string("local.", &ptr);
+
+        memset(hdr, 0, sizeof(*hdr));
+        hdr->version = VERSION;
+        hdr->datalen = (uint32_t)(ptr - data);
+        hdr->op      = browse_reply_op;
+        ConvertHeaderBytes(hdr);
+    }
+    *outLen = (size_t)(ptr - replies);
+    return replies;
+}
+
+// The daemon stand-in. Each connection gets the browse request's error code followed by every reply, and is then
+// held open until the client hangs up, so that the client never sees EOF while it's still reading.
+static void RunStandIn(int listenfd, const uint8_t *replies, size_t repliesLen, size_t chunk)
+{
+    for (;;)
+    {
+        ipc_msg_hdr hdr;
+        uint8_t request[1024];
+        const uint32_t err = htonl(kDNSServiceErr_NoError);
+        size_t offset;
+        int fd = accept(listenfd, NULL, NULL);
+
+        if (fd < 0)
+        {
+            if (errno == EINTR) continue;
+            _exit(1);
+        }
+        if (ReadFully(fd, &hdr, sizeof(hdr)) != 0) { close(fd); continue; }
+        ConvertHeaderBytes(&hdr);
+        if (hdr.datalen > sizeof(request) || ReadFully(fd, request, hdr.datalen) != 0) { close(fd); continue; }
+        if (WriteFully(fd, &err, sizeof(err)) != 0) { close(fd); continue; }
+        for (offset = 0; offset < repliesLen; offset += chunk)
+        {
+            const size_t len = (repliesLen - offset < chunk) ? repliesLen - offset : chunk;
+            if (WriteFully(fd, replies + offset, len) != 0) break;
+        }
+        while (read(fd, request, sizeof(request)) > 0) continue;
+        close(fd);
+    }
+}
+
+int main(int argc, char **argv)
+{
+    char dir[] = "/tmp/ProcessResultBench.XXXXXX";
+    struct sockaddr_un addr;
+    uint8_t *replies;
+    size_t repliesLen = 0;
+    long count = 2000, chunk = 65536, iterations = 20, calls = 0, i;
+    double elapsed = 0;
+    int listenfd, opt, status = 0;
+    pid_t standIn;
+
+    while ((opt = getopt(argc, argv, "n:c:i:")) != -1)
+    {
+        switch (opt)
+        {
+            case 'n': count      = strtol(optarg, NULL, 10); break;
+            case 'c': chunk      = strtol(optarg, NULL, 10); break;
+            case 'i': iterations = strtol(optarg, NULL, 10); break;
+            default:  PrintUsage(); return 2;
+        }
+    }
+    if (count <= 0 || chunk <= 0 || iterations <= 0) { PrintUsage(); return 2; }
+
+    replies = BuildReplies(count, &repliesLen);
+    if (!replies) { fprintf(stderr, "%s: out of memory\n", gProgramName); return 1; }
+
+    if (!mkdtemp(dir)) { fprintf(stderr, "%s: mkdtemp: %s\n", gProgramName, strerror(errno)); return 1; }
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_LOCAL;
+    snprintf(addr.sun_path, sizeof(addr.sun_path), "%s/mdnsd", dir);
+    listenfd = socket(AF_LOCAL, SOCK_STREAM, 0);
+    if (listenfd < 0 || bind(listenfd, (struct sockaddr *)&addr, sizeof(addr)) != 0 || listen(listenfd, 1) != 0)
+    {
+        fprintf(stderr, "%s: can't listen on %s: %s\n", gProgramName, addr.sun_path, strerror(errno));
+        rmdir(dir);
+        return 1;
+    }
+
+    standIn = fork();
+    if (standIn < 0) { fprintf(stderr, "%s: fork: %s\n", gProgramName, strerror(errno)); return 1; }
+    if (standIn == 0) RunStandIn(listenfd, replies, repliesLen, (size_t)chunk);
+    close(listenfd);
+    setenv(MDNS_UDS_SERVERPATH_ENVVAR, addr.sun_path, 1);
+
+    for (i = 0; i < iterations && status == 0; i++)
+    {
+        BrowseState state = { 0, count };
+        DNSServiceRef ref;
+        double start;
+        DNSServiceErrorType err = DNSServiceBrowse(&ref, 0, 0, "_bench._tcp", NULL, BrowseReply, &state);
+        if (err != kDNSServiceErr_NoError)
+        {
+            fprintf(stderr, "%s: DNSServiceBrowse failed: %d\n", gProgramName, err);
+            status = 1;
+            break;
+        }
+        start = NowMicroseconds();
+        while (state.replies < state.expected)
+        {
+            err = DNSServiceProcessResult(ref);
+            calls++;
+            if (err != kDNSServiceErr_NoError)
+            {
+                fprintf(stderr, "%s: DNSServiceProcessResult failed: %d\n", gProgramName, err);
+                status = 1;
+                break;
+            }
+        }
+        elapsed += NowMicroseconds() - start;
+        DNSServiceRefDeallocate(ref);
+    }
+    if (status == 0)
+    {
+        printf("%ld replies of %.0f bytes in %ld-byte chunks: %.1f ns per reply, %.1f DNSServiceProcessResult calls per browse\n",
+               count, (double)repliesLen / count, chunk, elapsed * 1e3 / ((double)count * iterations), (double)calls / iterations);
+    }
+
+    kill(standIn, SIGTERM);
+    waitpid(standIn, NULL, 0);
+    unlink(addr.sun_path);
+    rmdir(dir);
+    free(replies);
+    return status;
+}
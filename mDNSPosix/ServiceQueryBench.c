@@ -0,0 +1,281 @@
+/* -*- Mode: C; tab-width: 4 -*-
+ *
+ * Copyright (c) 2021 Apple Inc. All rights reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+// Measures how a running mdnsd answers queries when it holds many registered services. It registers the requested
+// number of services over one shared connection, then replays queries to the daemon as legacy unicast queries (from
+// an ephemeral port to port 5353 on one of the host's addresses) and times each answer: SRV queries for one randomly
+// chosen instance, and PTR queries for the service type, which every instance answers. Given the daemon's pid with -p
+// it also reports the daemon's CPU time per query, which leaves out the time the query and answer spend in transit.
+// Build it with 'make os=linux Benchmarks'.
+
+#include <errno.h>
+#include <ifaddrs.h>
+#include <net/if.h>
+#include <poll.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <sys/socket.h>
+
+#include "dns_sd.h"
+
+#define kServiceType "_qbench._tcp"
+
+static const char *gProgramName = "ServiceQueryBench";
+
+static void PrintUsage(void)
+{
+    fprintf(stderr, "Usage: %s [-n services] [-q queries] [-s settle seconds] [-a address] [-p mdnsd pid]\n", gProgramName);
+}
+
+static void DNSSD_API RegisterReply(DNSServiceRef sdRef, DNSServiceFlags flags, DNSServiceErrorType errorCode,
+                                   const char *name, const char *regtype, const char *domain, void *context)
+{
+    long *const pending = (long *)context;
+    (void)sdRef;
+    (void)flags;
+    (void)name;
+    (void)regtype;
+    (void)domain;
+    if (errorCode != kDNSServiceErr_NoError) fprintf(stderr, "%s: registering %s failed: %d\n", gProgramName, name, errorCode);
+    (*pending)--;
+}
+
+static double NowMicroseconds(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (double)ts.tv_sec * 1e6 + (double)ts.tv_nsec / 1e3;
+}
+
+// Delivers registration replies until none arrive within the timeout, or until all have arrived. Returns 0 if the
+// connection to the daemon was lost.
+static int DrainReplies(DNSServiceRef connection, const long *pending, int timeoutMs)
+{
+    struct pollfd pfd;
+
+    pfd.fd     = DNSServiceRefSockFD(connection);
+    pfd.events = POLLIN;
+    while (*pending > 0 && poll(&pfd, 1, timeoutMs) > 0)
+    {
+        if (DNSServiceProcessResult(connection) != kDNSServiceErr_NoError) return 0;
+    }
+    return 1;
+}
+
+// Returns the CPU time in microseconds that the process has used so far, or -1 if it can't be read.
+static double ProcessCPUMicroseconds(long pid)
+{
+    char path[64], stat[1024];
+    const char *p;
+    unsigned long utime, stime;
+    size_t len;
+    FILE *f;
+
+    snprintf(path, sizeof(path), "/proc/%ld/stat", pid);
+    f = fopen(path, "r");
+    if (!f) return -1;
+    len = fread(stat, 1, sizeof(stat) - 1, f);
+    fclose(f);
+    stat[len] = 0;
+    // Fields 14 and 15, counted after the parenthesized command name, which may itself contain spaces.
+    p = strrchr(stat, ')');
+    if (!p || sscanf(p + 2, "%*c %*d %*d %*d %*d %*d %*u %*u %*u %*u %*u %lu %lu", &utime, &stime) != 2) return -1;
+    return (double)(utime + stime) * 1e6 / (double)sysconf(_SC_CLK_TCK);
+}
+
+// Picks an address that mdnsd will be listening on: the first IPv4 address on an interface that's up and isn't
+// loopback, since the daemon only uses loopback when there's nothing else.
+static int FindInterfaceAddress(struct in_addr *addr)
+{
+    struct ifaddrs *ifa, *list;
+    int found = 0;
+
+    if (getifaddrs(&list) != 0) return 0;
+    for (ifa = list; ifa && !found; ifa = ifa->ifa_next)
+    {
+        if (!ifa->ifa_addr || ifa->ifa_addr->sa_family != AF_INET) continue;
+        if (!(ifa->ifa_flags & IFF_UP) || (ifa->ifa_flags & IFF_LOOPBACK)) continue;
+        *addr = ((struct sockaddr_in *)ifa->ifa_addr)->sin_addr;
+        found = 1;
+    }
+    freeifaddrs(list);
+    return found;
+}
+
+// Writes a query for the given name, which is a sequence of labels separated by dots, and returns its length.
+static size_t BuildQuery(uint8_t *msg, size_t size, uint16_t id, const char *name, uint16_t qtype)
+{
+    uint8_t *ptr = msg + 12;
+    const uint8_t *const limit = msg + size - 5;
+
+    memset(msg, 0, 12);
+    msg[0] = (uint8_t)(id >> 8);
+    msg[1] = (uint8_t)id;
+    msg[5] = 1; // QDCOUNT
+    while (*name)
+    {
+        const char *dot = strchr(name, '.');
+        const size_t len = dot ? (size_t)(dot - name) : strlen(name);
+        if (len > 63 || ptr + 1 + len >= limit) return 0;
+        *ptr++ = (uint8_t)len;
+        memcpy(ptr, name, len);
+        ptr += len;
+        name += len;
+        if (*name == '.') name++;
+    }
+    *ptr++ = 0;
+    *ptr++ = (uint8_t)(qtype >> 8);
+    *ptr++ = (uint8_t)qtype;
+    *ptr++ = 0;
+    *ptr++ = 1; // IN
+    return (size_t)(ptr - msg);
+}
+
+// Sends queries for the given name and type, and reports the average time to the answer. A query that isn't
+// answered within a second counts as timed out and is left out of the average.
+static void ReplayQueries(int sock, const struct sockaddr_in *to, long services, long queries, uint16_t qtype,
+                          long pid)
+{
+    double total = 0, cpuStart = pid ? ProcessCPUMicroseconds(pid) : -1, cpuEnd;
+    long i, answered = 0;
+
+    for (i = 0; i < queries; i++)
+    {
+        uint8_t query[512], answer[9000];
+        char name[256];
+        const uint16_t id = (uint16_t)(i + 1);
+        size_t len;
+        double start;
+
+        if (qtype == kDNSServiceType_SRV)
+            snprintf(name, sizeof(name), "ServiceQueryBench %ld." kServiceType ".local.", random() % services);
+        else
+            snprintf(name, sizeof(name), kServiceType ".local.");
+        len = BuildQuery(query, sizeof(query), id, name, qtype);
+
+        start = NowMicroseconds();
+        if (sendto(sock, query, len, 0, (const struct sockaddr *)to, sizeof(*to)) < 0)
+        {
+            fprintf(stderr, "%s: sendto: %s\n", gProgramName, strerror(errno));
+            return;
+        }
+        for (;;)
+        {
+            const ssize_t n = recv(sock, answer, sizeof(answer), 0);
+            if (n < 0) break; // Timed out
+            if (n >= 12 && answer[0] == (uint8_t)(id >> 8) && answer[1] == (uint8_t)id)
+            {
+                total += NowMicroseconds() - start;
+                answered++;
+                break;
+            }
+        }
+    }
+    cpuEnd = pid ? ProcessCPUMicroseconds(pid) : -1;
+
+    printf("%s queries: %ld of %ld answered, %.3f ms per answer", qtype == kDNSServiceType_SRV ? "SRV" : "PTR",
+           answered, queries, answered ? total / 1e3 / (double)answered : 0.0);
+    if (cpuStart >= 0 && cpuEnd >= 0) printf(", %.3f ms daemon CPU per query", (cpuEnd - cpuStart) / 1e3 / (double)queries);
+    printf("\n");
+}
+
+int main(int argc, char **argv)
+{
+    DNSServiceRef connection, ref;
+    struct sockaddr_in to;
+    struct timeval timeout = { 1, 0 };
+    long services = 10000, queries = 200, settle = 10, pid = 0, pending, i;
+    double start;
+    int opt, sock;
+
+    memset(&to, 0, sizeof(to));
+    to.sin_family = AF_INET;
+    to.sin_port   = htons(5353);
+    while ((opt = getopt(argc, argv, "n:q:s:a:p:")) != -1)
+    {
+        switch (opt)
+        {
+            case 'n': services = strtol(optarg, NULL, 10); break;
+            case 'q': queries  = strtol(optarg, NULL, 10); break;
+            case 's': settle   = strtol(optarg, NULL, 10); break;
+            case 'p': pid      = strtol(optarg, NULL, 10); break;
+            case 'a':
+                if (inet_pton(AF_INET, optarg, &to.sin_addr) != 1) { PrintUsage(); return 2; }
+                break;
+            default:  PrintUsage(); return 2;
+        }
+    }
+    if (services <= 0 || queries <= 0 || settle < 0) { PrintUsage(); return 2; }
+    if (to.sin_addr.s_addr == 0 && !FindInterfaceAddress(&to.sin_addr))
+    {
+        fprintf(stderr, "%s: no interface address to query; give one with -a\n", gProgramName);
+        return 1;
+    }
+
+    if (DNSServiceCreateConnection(&connection) != kDNSServiceErr_NoError)
+    {
+        fprintf(stderr, "%s: DNSServiceCreateConnection failed\n", gProgramName);
+        return 1;
+    }
+    pending = services;
+    start = NowMicroseconds();
+    for (i = 0; i < services; i++)
+    {
+        char name[64];
+        DNSServiceErrorType err;
+
+        snprintf(name, sizeof(name), "ServiceQueryBench %ld", i);
+        ref = connection;
+        err = DNSServiceRegister(&ref, kDNSServiceFlagsShareConnection | kDNSServiceFlagsNoAutoRename, 0, name,
+                                 kServiceType, NULL, NULL, htons((uint16_t)(1024 + i % 60000)), 0, NULL, RegisterReply, &pending);
+        if (err != kDNSServiceErr_NoError)
+        {
+            fprintf(stderr, "%s: DNSServiceRegister %ld failed: %d\n", gProgramName, i, err);
+            return 1;
+        }
+        // Keep up with the replies as we go; the daemon gives up on a client that leaves too many unread.
+        if (!DrainReplies(connection, &pending, 0)) break;
+    }
+    // Every service has probed and announced its name once its reply arrives.
+    if (i < services || !DrainReplies(connection, &pending, -1) || pending > 0)
+    {
+        fprintf(stderr, "%s: lost the connection to mdnsd\n", gProgramName);
+        return 1;
+    }
+    printf("%ld services registered in %.1f s\n", services, (NowMicroseconds() - start) / 1e6);
+    // The daemon goes on announcing the new services for several seconds, which would be counted as query time.
+    sleep((unsigned)settle);
+
+    sock = socket(AF_INET, SOCK_DGRAM, 0);
+    if (sock < 0 || setsockopt(sock, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout)) != 0)
+    {
+        fprintf(stderr, "%s: can't make the query socket: %s\n", gProgramName, strerror(errno));
+        return 1;
+    }
+    srandom(1);
+    ReplayQueries(sock, &to, services, queries, kDNSServiceType_SRV, pid);
+    ReplayQueries(sock, &to, services, queries, kDNSServiceType_PTR, pid);
+
+    close(sock);
+    DNSServiceRefDeallocate(connection);
+    return 0;
+}
@@ -41,6 +41,10 @@
 #include <time.h>                   // platform support for UTC time
 #include <ifaddrs.h>
 
+#if POSIX_USE_EPOLL
+#include <sys/epoll.h>
+#endif
+
 #if USES_NETLINK
 #include <asm/types.h>
 #include <linux/netlink.h>
@@ -75,12 +79,41 @@ struct IfChangeRec
 };
 typedef struct IfChangeRec IfChangeRec;
 
+// An interface change decoded from a notification, waiting for the coalescing window to close.
+// A later notification for the same link or address overwrites the earlier one, so a burst of
+// changes collapses to the final state of each link and address it touched.
+typedef struct PosixIfChange PosixIfChange;
+struct PosixIfChange
+{
+    PosixIfChange *next;
+    int index;                          // Interface index
+    int family;                         // AF_INET or AF_INET6 for an address change; AF_UNSPEC for a link change
+    mDNSBool present;                   // Link or address exists (RTM_NEWLINK/RTM_NEWADDR) or is gone
+    unsigned int flags;                 // Link flags (link changes only)
+    mDNSAddr ip;                        // Address changes only: the address, for matching against coreIntf.ip,
+    struct sockaddr_storage addr;       // and the address and netmask to hand to SetupOneInterface
+    struct sockaddr_storage mask;
+};
+
 // Note that static data is initialized to zero in (modern) C.
 static PosixEventSource *gEventSources;             // linked list of PosixEventSource's
 static sigset_t gEventSignalSet;                // Signals which event loop listens for
 static sigset_t gEventSignals;                  // Signals which were received while inside loop
+#if POSIX_USE_EPOLL
+static int gEpollFD = -1;                       // epoll instance watching gEventSources and the mDNS sockets
+static unsigned int gEventSourcesGeneration;    // Bumped whenever an event source is taken off gEventSources
+#endif
 
 static PosixNetworkInterface *gRecentInterfaces;
+static mDNSBool gLoopbackFallback;              // Loopback is registered because no v4 interface was found
+
+// Interface change notifications are held for kIfChangeCoalesceTicks before being applied, so that a burst
+// (a link coming up with several addresses, a container starting) costs one pass rather than one per message.
+#define kIfChangeCoalesceTicks (mDNSPlatformOneSecond / 4)
+static PosixIfChange *gPendingIfChanges;        // Decoded changes to apply when the window closes
+static mDNSBool gIfChangePending;               // A window is open
+static mDNSBool gIfChangeRefreshAll;            // Some change could not be decoded; rebuild the whole list
+static mDNSs32 gIfChangeDeadline;               // When the window closes
 
 // ***************************************************************************
 // Globals (for debugging)
@@ -89,6 +122,40 @@ static int num_registered_interfaces = 0;
 static int num_pkts_accepted = 0;
 static int num_pkts_rejected = 0;
 
+// recvmmsg() and sendmmsg() let a single system call move a whole burst of mDNS datagrams.
+#if defined(HAVE_LINUX) && !defined(POSIX_NO_MMSG)
+#define POSIX_USE_MMSG 1
+#endif
+
+#define kPosixMaxBatch 8
+
+// Histogram of how many datagrams each recvmmsg()/sendmmsg() call moved, for the state dump.
+typedef struct
+{
+    mDNSu32 calls;
+    mDNSu32 packets;
+    mDNSu32 sizes[kPosixMaxBatch + 1];
+} PosixBatchStats;
+
+static PosixBatchStats gRecvBatchStats;
+static PosixBatchStats gSendBatchStats;
+
+#if POSIX_USE_MMSG
+// Multicast packets queued by mDNSPlatformSendUDP() until PosixFlushSendBatch().
+typedef struct
+{
+    PosixNetworkInterface *intf;
+    int socket;
+    struct sockaddr_storage to;
+    mDNSAddr dst;
+    size_t length;
+    DNSMessage packet;
+} PosixPendingPacket;
+
+static PosixPendingPacket gSendBatch[kPosixMaxBatch];
+static int gSendBatchCount;
+#endif
+
 // ***************************************************************************
 // Locals
 mDNSlocal void requestReadEvents(PosixEventSource *eventSource,
@@ -119,6 +186,88 @@ mDNSexport void mDNSPlatformValidateLists(void)
 
 int gMDNSPlatformPosixVerboseLevel = 0;
 
+#if POSIX_USE_EPOLL
+// When built with POSIX_USE_EPOLL, every event source and every mDNS socket is also registered with a single
+// level-triggered epoll instance, so mDNSPosixRunEventLoopOnce() costs O(ready descriptors) rather than O(nfds)
+// and is not limited to FD_SETSIZE. gEventSources is still maintained for clients that run their own select()
+// loop through mDNSPosixGetFDSet(). An mDNS socket is stored in epoll_data as (fd << 1) | kPosixEpollSocketTag;
+// anything else is a PosixEventSource pointer, whose low bit is always clear.
+#define kPosixEpollSocketTag 1
+#define kPosixEpollMaxEvents 64
+
+mDNSlocal int PosixEpollFD(void)
+{
+    if (gEpollFD < 0)
+    {
+        gEpollFD = epoll_create1(EPOLL_CLOEXEC);
+        if (gEpollFD < 0) LogMsg("PosixEpollFD: epoll_create1 failed: %s", strerror(errno));
+    }
+    return gEpollFD;
+}
+
+mDNSlocal void PosixEpollWatchSocket(int fd)
+{
+    struct epoll_event ev;
+    const int epfd = PosixEpollFD();
+
+    if (epfd < 0) return;
+    mDNSPlatformMemZero(&ev, sizeof(ev));
+    ev.events = EPOLLIN;
+    ev.data.u64 = ((uint64_t)fd << 1) | kPosixEpollSocketTag;
+    if (epoll_ctl(epfd, EPOLL_CTL_ADD, fd, &ev) < 0)
+        LogMsg("PosixEpollWatchSocket: epoll_ctl(ADD, %d) failed: %s", fd, strerror(errno));
+}
+
+// Must be called before the socket is closed, in case the descriptor has been duplicated into a child process.
+mDNSlocal void PosixEpollForgetSocket(int fd)
+{
+    if (gEpollFD >= 0) (void)epoll_ctl(gEpollFD, EPOLL_CTL_DEL, fd, NULL);
+}
+
+// Bring the epoll registration for an event source in line with the callbacks it currently has installed.
+mDNSlocal void PosixEpollUpdateSource(PosixEventSource *source)
+{
+    struct epoll_event ev;
+    const int epfd = PosixEpollFD();
+    int op;
+
+    if (epfd < 0) return;
+    mDNSPlatformMemZero(&ev, sizeof(ev));
+    if (source->readCallback  != NULL) ev.events |= EPOLLIN;
+    if (source->writeCallback != NULL) ev.events |= EPOLLOUT;
+    ev.data.ptr = source;
+
+    if (ev.events == 0)
+    {
+        // EPOLLERR and EPOLLHUP are reported even with an empty mask, so a source nobody is listening to has to go.
+        if (source->flags & PosixEventFlag_Epoll)
+        {
+            (void)epoll_ctl(epfd, EPOLL_CTL_DEL, source->fd, NULL);
+            source->flags &= ~PosixEventFlag_Epoll;
+        }
+        return;
+    }
+    op = (source->flags & PosixEventFlag_Epoll) ? EPOLL_CTL_MOD : EPOLL_CTL_ADD;
+    if (epoll_ctl(epfd, op, source->fd, &ev) < 0)
+    {
+        // The fd may have been closed and reused behind our back, which silently drops the old registration.
+        if (op == EPOLL_CTL_MOD && errno == ENOENT)      op = EPOLL_CTL_ADD;
+        else if (op == EPOLL_CTL_ADD && errno == EEXIST) op = EPOLL_CTL_MOD;
+        else op = -1;
+        if (op == -1 || epoll_ctl(epfd, op, source->fd, &ev) < 0)
+        {
+            LogMsg("PosixEpollUpdateSource: epoll_ctl(%d) failed: %s", source->fd, strerror(errno));
+            return;
+        }
+    }
+    source->flags |= PosixEventFlag_Epoll;
+}
+#else
+#define PosixEpollWatchSocket(FD)       ((void)0)
+#define PosixEpollForgetSocket(FD)      ((void)0)
+#define PosixEpollUpdateSource(SOURCE)  ((void)0)
+#endif
+
 #define PosixErrorToStatus(errNum) ((errNum) == 0 ? mStatus_NoError : mStatus_UnknownErr)
 
 mDNSlocal void SockAddrTomDNSAddr(const struct sockaddr *const sa, mDNSAddr *ipAddr, mDNSIPPort *ipPort)
@@ -160,6 +309,101 @@ mDNSlocal void SockAddrTomDNSAddr(const struct sockaddr *const sa, mDNSAddr *ipA
 #pragma mark ***** Send and Receive
 #endif
 
+mDNSlocal void CountBatch(PosixBatchStats *stats, int count)
+{
+    stats->calls++;
+    stats->packets += count;
+    stats->sizes[count < kPosixMaxBatch ? count : kPosixMaxBatch]++;
+}
+
+// Reports errno for a failed send.
+mDNSlocal void LogSendError(const PosixNetworkInterface *thisIntf, const mDNSAddr *dst)
+{
+    static int MessageCount = 0;
+
+    if (MessageCount < 1000)
+    {
+        MessageCount++;
+        if (thisIntf)
+            LogMsg("mDNSPlatformSendUDP got error %d (%s) sending packet to %#a on interface %#a/%s/%d",
+                   errno, strerror(errno), dst, &thisIntf->coreIntf.ip, thisIntf->intfName, thisIntf->index);
+        else
+            LogMsg("mDNSPlatformSendUDP got error %d (%s) sending packet to %#a", errno, strerror(errno), dst);
+    }
+}
+
+#if POSIX_USE_MMSG
+// Send everything queued by PosixQueueMulticastPacket(), with one sendmmsg() call per socket where possible.
+// Must be called before blocking for events, and before any interface socket is closed.
+mDNSlocal void PosixFlushSendBatch(void)
+{
+    struct mmsghdr msgs[kPosixMaxBatch];
+    struct iovec iov[kPosixMaxBatch];
+    int indexes[kPosixMaxBatch];
+    mDNSBool sent[kPosixMaxBatch];
+    int i, j;
+
+    mDNSPlatformMemZero(sent, sizeof(sent));
+    for (i = 0; i < gSendBatchCount; i++)
+    {
+        const int skt = gSendBatch[i].socket;
+        int count = 0, first = 0;
+
+        if (sent[i]) continue;
+        // Gather every queued packet for this socket, keeping them in the order the core sent them.
+        mDNSPlatformMemZero(msgs, sizeof(msgs));
+        for (j = i; j < gSendBatchCount; j++)
+        {
+            PosixPendingPacket *const pending = &gSendBatch[j];
+            if (sent[j] || pending->socket != skt) continue;
+            iov[count].iov_base           = &pending->packet;
+            iov[count].iov_len            = pending->length;
+            msgs[count].msg_hdr.msg_name    = &pending->to;
+            msgs[count].msg_hdr.msg_namelen = GET_SA_LEN(pending->to);
+            msgs[count].msg_hdr.msg_iov     = &iov[count];
+            msgs[count].msg_hdr.msg_iovlen  = 1;
+            indexes[count++] = j;
+            sent[j] = mDNStrue;
+        }
+        while (first < count)
+        {
+            const int n = sendmmsg(skt, &msgs[first], (unsigned int)(count - first), 0);
+            if (n > 0)
+            {
+                CountBatch(&gSendBatchStats, n);
+                first += n;
+            }
+            else
+            {
+                // sendmmsg() reports the error for the first message it couldn't send; log it and carry on with the rest.
+                const PosixPendingPacket *const pending = &gSendBatch[indexes[first]];
+                LogSendError(pending->intf, &pending->dst);
+                first++;
+            }
+        }
+    }
+    gSendBatchCount = 0;
+}
+
+mDNSlocal void PosixQueueMulticastPacket(PosixNetworkInterface *intf, int skt, const struct sockaddr_storage *to,
+                                         const mDNSAddr *dst, const void *const msg, const mDNSu8 *const end)
+{
+    PosixPendingPacket *pending;
+    const size_t length = (size_t)(end - (const mDNSu8 *)msg);
+
+    if (gSendBatchCount == kPosixMaxBatch) PosixFlushSendBatch();
+    pending = &gSendBatch[gSendBatchCount++];
+    pending->intf   = intf;
+    pending->socket = skt;
+    pending->to     = *to;
+    pending->dst    = *dst;
+    pending->length = (length < sizeof(pending->packet)) ? length : sizeof(pending->packet);
+    mDNSPlatformMemCopy(&pending->packet, msg, pending->length);
+}
+#else
+#define PosixFlushSendBatch() ((void)0)
+#endif
+
 // mDNS core calls this routine when it needs to send a packet.
 mDNSexport mStatus mDNSPlatformSendUDP(const mDNS *const m, const void *const msg, const mDNSu8 *const end,
                                        mDNSInterfaceID InterfaceID, UDPSocket *src, const mDNSAddr *dst,
@@ -277,26 +521,27 @@ mDNSexport mStatus mDNSPlatformSendUDP(const mDNS *const m, const void *const ms
         sendingsocket = src->events.fd;
     }
 
+#if POSIX_USE_MMSG
+    // Multicast traffic on an interface socket is queued and sent in bursts with sendmmsg(). The core doesn't act on
+    // the result of these sends, and any error is still logged when the queue is flushed.
+    if (thisIntf && !src && sendingsocket >= 0 && mDNSAddressIsAllDNSLinkGroup(dst))
+    {
+        PosixQueueMulticastPacket(thisIntf, sendingsocket, &to, dst, msg, end);
+        return mStatus_NoError;
+    }
+#endif
+
     if (sendingsocket >= 0)
         err = sendto(sendingsocket, msg, (char*)end - (char*)msg, 0, (struct sockaddr *)&to, GET_SA_LEN(to));
 
     if      (err > 0) err = 0;
     else if (err < 0)
     {
-        static int MessageCount = 0;
         // Don't report EHOSTDOWN (i.e. ARP failure), ENETDOWN, or no route to host for unicast destinations
         if (!mDNSAddressIsAllDNSLinkGroup(dst))
             if (errno == EHOSTDOWN || errno == ENETDOWN || errno == EHOSTUNREACH || errno == ENETUNREACH) return(mStatus_TransientErr);
 
-        if (MessageCount < 1000)
-        {
-            MessageCount++;
-            if (thisIntf)
-                LogMsg("mDNSPlatformSendUDP got error %d (%s) sending packet to %#a on interface %#a/%s/%d",
-                       errno, strerror(errno), dst, &thisIntf->coreIntf.ip, thisIntf->intfName, thisIntf->index);
-            else
-                LogMsg("mDNSPlatformSendUDP got error %d (%s) sending packet to %#a", errno, strerror(errno), dst);
-        }
+        LogSendError(thisIntf, dst);
     }
 
     return PosixErrorToStatus(err);
@@ -382,10 +627,144 @@ mDNSlocal void tcpConnectCallback(int fd, void *context)
 }
 
 // This routine is called when the main loop detects that data is available on a socket.
-mDNSlocal void SocketDataReady(mDNS *const m, PosixNetworkInterface *intf, int skt, UDPSocket *sock)
+// Check that a datagram read from skt arrived where we expected it, and if so hand it to the core.
+// localPort is the port of the receiving socket, captured by the caller in case the core closes it.
+mDNSlocal void SocketPacketReceived(mDNS *const m, PosixNetworkInterface *intf, int skt, mDNSIPPort localPort,
+                                    DNSMessage *packet, ssize_t packetLen, const struct sockaddr_storage *from,
+                                    const struct my_in_pktinfo *packetInfo, int flags)
 {
     mDNSAddr senderAddr, destAddr;
     mDNSIPPort senderPort, destPort;
+    mDNSBool reject;
+    const mDNSInterfaceID InterfaceID = intf ? intf->coreIntf.InterfaceID : NULL;
+
+    (void)skt;          // Only used for debugging output
+    (void)flags;        // Only used on platforms with broken IP_RECVDSTADDR
+
+    SockAddrTomDNSAddr((const struct sockaddr*)from, &senderAddr, &senderPort);
+    SockAddrTomDNSAddr((const struct sockaddr*)&packetInfo->ipi_addr, &destAddr, &destPort);
+
+    // If we have broken IP_RECVDSTADDR functionality (so far
+    // I've only seen this on OpenBSD) then apply a hack to
+    // convince mDNS Core that this isn't a spoof packet.
+    // Basically what we do is check to see whether the
+    // packet arrived as a multicast and, if so, set its
+    // destAddr to the mDNS address.
+    //
+    // I must admit that I could just be doing something
+    // wrong on OpenBSD and hence triggering this problem
+    // but I'm at a loss as to how.
+    //
+    // If this platform doesn't have IP_PKTINFO or IP_RECVDSTADDR, then we have
+    // no way to tell the destination address or interface this packet arrived on,
+    // so all we can do is just assume it's a multicast
+
+    #if HAVE_BROKEN_RECVDSTADDR || (!defined(IP_PKTINFO) && !defined(IP_RECVDSTADDR))
+    if ((destAddr.NotAnInteger == 0) && (flags & MSG_MCAST))
+    {
+        destAddr.type = senderAddr.type;
+        if      (senderAddr.type == mDNSAddrType_IPv4) destAddr.ip.v4 = AllDNSLinkGroup_v4.ip.v4;
+        else if (senderAddr.type == mDNSAddrType_IPv6) destAddr.ip.v6 = AllDNSLinkGroup_v6.ip.v6;
+    }
+    #endif
+
+    // We only accept the packet if the interface on which it came
+    // in matches the interface associated with this socket.
+    // We do this match by name or by index, depending on which
+    // information is available.  recvfrom_flags sets the name
+    // to "" if the name isn't available, or the index to -1
+    // if the index is available.  This accomodates the various
+    // different capabilities of our target platforms.
+
+    reject = mDNSfalse;
+    if (!intf)
+    {
+        // Ignore multicasts accidentally delivered to our unicast receiving socket
+        if (mDNSAddrIsDNSMulticast(&destAddr)) packetLen = -1;
+    }
+    else
+    {
+        if      (packetInfo->ipi_ifname[0] != 0) reject = (strcmp(packetInfo->ipi_ifname, intf->intfName) != 0);
+        else if (packetInfo->ipi_ifindex != -1) reject = (packetInfo->ipi_ifindex != intf->index);
+
+        if (reject)
+        {
+            verbosedebugf("SocketDataReady ignored a packet from %#a to %#a on interface %s/%d expecting %#a/%s/%d/%d",
+                          &senderAddr, &destAddr, packetInfo->ipi_ifname, packetInfo->ipi_ifindex,
+                          &intf->coreIntf.ip, intf->intfName, intf->index, skt);
+            packetLen = -1;
+            num_pkts_rejected++;
+            if (num_pkts_rejected > (num_pkts_accepted + 1) * (num_registered_interfaces + 1) * 2)
+            {
+                fprintf(stderr,
+                        "*** WARNING: Received %d packets; Accepted %d packets; Rejected %d packets because of interface mismatch\n",
+                        num_pkts_accepted + num_pkts_rejected, num_pkts_accepted, num_pkts_rejected);
+                num_pkts_accepted = 0;
+                num_pkts_rejected = 0;
+            }
+        }
+        else
+        {
+            verbosedebugf("SocketDataReady got a packet from %#a to %#a on interface %#a/%s/%d/%d",
+                          &senderAddr, &destAddr, &intf->coreIntf.ip, intf->intfName, intf->index, skt);
+            num_pkts_accepted++;
+        }
+    }
+
+    if (packetLen >= 0)
+        mDNSCoreReceive(m, packet, (mDNSu8 *)packet + packetLen, &senderAddr, senderPort, &destAddr, localPort, InterfaceID);
+}
+
+#if POSIX_USE_MMSG
+// Drain up to kPosixMaxBatch datagrams from the socket with a single recvmmsg() call.
+mDNSlocal void SocketDataReady(mDNS *const m, PosixNetworkInterface *intf, int skt, UDPSocket *sock)
+{
+    // mDNSCore is single-threaded and never re-enters this routine, so the receive buffers can be static.
+    static DNSMessage packets[kPosixMaxBatch];
+    static struct sockaddr_storage from[kPosixMaxBatch];
+    static union
+    {
+        struct cmsghdr cm;
+        char control[1024];
+    } control[kPosixMaxBatch];
+    struct mmsghdr msgs[kPosixMaxBatch];
+    struct iovec iov[kPosixMaxBatch];
+    const mDNSIPPort localPort = (sock == mDNSNULL) ? MulticastDNSPort : sock->port;
+    int i, count;
+
+    assert(m    != NULL);
+    assert(skt  >= 0);
+
+    mDNSPlatformMemZero(msgs, sizeof(msgs));
+    for (i = 0; i < kPosixMaxBatch; i++)
+    {
+        iov[i].iov_base                 = &packets[i];
+        iov[i].iov_len                  = sizeof(packets[i]);
+        msgs[i].msg_hdr.msg_name        = &from[i];
+        msgs[i].msg_hdr.msg_namelen     = sizeof(from[i]);
+        msgs[i].msg_hdr.msg_iov         = &iov[i];
+        msgs[i].msg_hdr.msg_iovlen      = 1;
+        msgs[i].msg_hdr.msg_control     = control[i].control;
+        msgs[i].msg_hdr.msg_controllen  = sizeof(control[i].control);
+    }
+
+    count = recvmmsg(skt, msgs, kPosixMaxBatch, MSG_DONTWAIT, NULL);
+    if (count <= 0) return;
+    CountBatch(&gRecvBatchStats, count);
+
+    for (i = 0; i < count; i++)
+    {
+        struct my_in_pktinfo packetInfo;
+        int flags;
+        mDNSu8 ttl;
+
+        recvmsg_ancillary(&msgs[i].msg_hdr, &flags, &packetInfo, &ttl);
+        SocketPacketReceived(m, intf, skt, localPort, &packets[i], (ssize_t)msgs[i].msg_len, &from[i], &packetInfo, flags);
+    }
+}
+#else
+mDNSlocal void SocketDataReady(mDNS *const m, PosixNetworkInterface *intf, int skt, UDPSocket *sock)
+{
     ssize_t packetLen;
     DNSMessage packet;
     struct my_in_pktinfo packetInfo;
@@ -393,8 +772,6 @@ mDNSlocal void SocketDataReady(mDNS *const m, PosixNetworkInterface *intf, int s
     socklen_t fromLen;
     int flags;
     mDNSu8 ttl;
-    mDNSBool reject;
-    const mDNSInterfaceID InterfaceID = intf ? intf->coreIntf.InterfaceID : NULL;
 
     assert(m    != NULL);
     assert(skt  >= 0);
@@ -402,84 +779,14 @@ mDNSlocal void SocketDataReady(mDNS *const m, PosixNetworkInterface *intf, int s
     fromLen = sizeof(from);
     flags   = 0;
     packetLen = recvfrom_flags(skt, &packet, sizeof(packet), &flags, (struct sockaddr *) &from, &fromLen, &packetInfo, &ttl);
-
     if (packetLen >= 0)
     {
-        SockAddrTomDNSAddr((struct sockaddr*)&from, &senderAddr, &senderPort);
-        SockAddrTomDNSAddr((struct sockaddr*)&packetInfo.ipi_addr, &destAddr, &destPort);
-
-        // If we have broken IP_RECVDSTADDR functionality (so far
-        // I've only seen this on OpenBSD) then apply a hack to
-        // convince mDNS Core that this isn't a spoof packet.
-        // Basically what we do is check to see whether the
-        // packet arrived as a multicast and, if so, set its
-        // destAddr to the mDNS address.
-        //
-        // I must admit that I could just be doing something
-        // wrong on OpenBSD and hence triggering this problem
-        // but I'm at a loss as to how.
-        //
-        // If this platform doesn't have IP_PKTINFO or IP_RECVDSTADDR, then we have
-        // no way to tell the destination address or interface this packet arrived on,
-        // so all we can do is just assume it's a multicast
-
-        #if HAVE_BROKEN_RECVDSTADDR || (!defined(IP_PKTINFO) && !defined(IP_RECVDSTADDR))
-        if ((destAddr.NotAnInteger == 0) && (flags & MSG_MCAST))
-        {
-            destAddr.type = senderAddr.type;
-            if      (senderAddr.type == mDNSAddrType_IPv4) destAddr.ip.v4 = AllDNSLinkGroup_v4.ip.v4;
-            else if (senderAddr.type == mDNSAddrType_IPv6) destAddr.ip.v6 = AllDNSLinkGroup_v6.ip.v6;
-        }
-        #endif
-
-        // We only accept the packet if the interface on which it came
-        // in matches the interface associated with this socket.
-        // We do this match by name or by index, depending on which
-        // information is available.  recvfrom_flags sets the name
-        // to "" if the name isn't available, or the index to -1
-        // if the index is available.  This accomodates the various
-        // different capabilities of our target platforms.
-
-        reject = mDNSfalse;
-        if (!intf)
-        {
-            // Ignore multicasts accidentally delivered to our unicast receiving socket
-            if (mDNSAddrIsDNSMulticast(&destAddr)) packetLen = -1;
-        }
-        else
-        {
-            if      (packetInfo.ipi_ifname[0] != 0) reject = (strcmp(packetInfo.ipi_ifname, intf->intfName) != 0);
-            else if (packetInfo.ipi_ifindex != -1) reject = (packetInfo.ipi_ifindex != intf->index);
-
-            if (reject)
-            {
-                verbosedebugf("SocketDataReady ignored a packet from %#a to %#a on interface %s/%d expecting %#a/%s/%d/%d",
-                              &senderAddr, &destAddr, packetInfo.ipi_ifname, packetInfo.ipi_ifindex,
-                              &intf->coreIntf.ip, intf->intfName, intf->index, skt);
-                packetLen = -1;
-                num_pkts_rejected++;
-                if (num_pkts_rejected > (num_pkts_accepted + 1) * (num_registered_interfaces + 1) * 2)
-                {
-                    fprintf(stderr,
-                            "*** WARNING: Received %d packets; Accepted %d packets; Rejected %d packets because of interface mismatch\n",
-                            num_pkts_accepted + num_pkts_rejected, num_pkts_accepted, num_pkts_rejected);
-                    num_pkts_accepted = 0;
-                    num_pkts_rejected = 0;
-                }
-            }
-            else
-            {
-                verbosedebugf("SocketDataReady got a packet from %#a to %#a on interface %#a/%s/%d/%d",
-                              &senderAddr, &destAddr, &intf->coreIntf.ip, intf->intfName, intf->index, skt);
-                num_pkts_accepted++;
-            }
-        }
+        CountBatch(&gRecvBatchStats, 1);
+        SocketPacketReceived(m, intf, skt, sock == mDNSNULL ? MulticastDNSPort : sock->port,
+                             &packet, packetLen, &from, &packetInfo, flags);
     }
-
-    if (packetLen >= 0)
-        mDNSCoreReceive(m, &packet, (mDNSu8 *)&packet + packetLen,
-                        &senderAddr, senderPort, &destAddr, sock == mDNSNULL ? MulticastDNSPort : sock->port, InterfaceID);
 }
+#endif
 
 mDNSlocal void UDPReadCallback(int fd, void *context)
 {
@@ -1019,15 +1326,18 @@ mDNSlocal void FreePosixNetworkInterface(PosixNetworkInterface *intf)
 {
     int rv;
     assert(intf != NULL);
+    PosixFlushSendBatch();      // Packets may still be queued on this interface's sockets
     if (intf->intfName != NULL) mdns_free(intf->intfName);
     if (intf->multicastSocket4 != -1)
     {
+        PosixEpollForgetSocket(intf->multicastSocket4);
         rv = close(intf->multicastSocket4);
         assert(rv == 0);
     }
 #if HAVE_IPV6
     if (intf->multicastSocket6 != -1)
     {
+        PosixEpollForgetSocket(intf->multicastSocket6);
         rv = close(intf->multicastSocket6);
         assert(rv == 0);
     }
@@ -1052,10 +1362,24 @@ mDNSlocal void ClearInterfaceList(mDNS *const m)
         FreePosixNetworkInterface(intf);
     }
     num_registered_interfaces = 0;
+    gLoopbackFallback = mDNSfalse;
     num_pkts_accepted = 0;
     num_pkts_rejected = 0;
 }
 
+// Throws away queued interface changes, e.g. because the whole list is about to be rebuilt anyway.
+mDNSlocal void DiscardInterfaceChanges(void)
+{
+    while (gPendingIfChanges)
+    {
+        PosixIfChange *change = gPendingIfChanges;
+        gPendingIfChanges = change->next;
+        mDNSPlatformMemFree(change);
+    }
+    gIfChangePending = mDNSfalse;
+    gIfChangeRefreshAll = mDNSfalse;
+}
+
 mDNSlocal int SetupIPv6Socket(int fd)
 {
     int err;
@@ -1315,6 +1639,7 @@ mDNSlocal int SetupSocket(struct sockaddr *intfAddr, mDNSIPPort port, int interf
         *sktPtr = -1;
     }
     assert((err == 0) == (*sktPtr != -1));
+    if (err == 0) PosixEpollWatchSocket(*sktPtr);
     return err;
 }
 
@@ -1444,6 +1769,75 @@ mDNSlocal int SetupOneInterface(mDNS *const m, struct sockaddr *intfAddr, struct
     return err;
 }
 
+// Returns true if the getifaddrs() entry is one SetupInterfaceList would consider (loopback included).
+mDNSlocal mDNSBool IfAddrIsCandidate(const struct ifaddrs *const i)
+{
+    return i->ifa_addr != NULL &&
+           ((i->ifa_addr->sa_family == AF_INET)
+#if HAVE_IPV6
+            || (i->ifa_addr->sa_family == AF_INET6)
+#endif
+           ) && (i->ifa_flags & IFF_UP) && !(i->ifa_flags & IFF_POINTOPOINT);
+}
+
+#if defined(TARGET_OS_LINUX) && TARGET_OS_LINUX
+// Looks up the Ethernet address of the named interface. Returns its length, or 0 if it has none.
+mDNSlocal int GetInterfaceHardwareAddress(const char *intfName, mDNSu8 *hwaddr)
+{
+    const int ethernet_addr_len = 6;
+    int hwaddr_len = 0;
+    struct ifreq ifr;
+    int sockfd = socket(AF_INET6, SOCK_DGRAM, 0);
+    if (sockfd >= 0)
+    {
+        /* Add hardware address */
+        mDNSPlatformMemZero(&ifr, sizeof(ifr));
+        mDNSPlatformStrLCopy(ifr.ifr_name, intfName, sizeof(ifr.ifr_name));
+        if (ioctl(sockfd, SIOCGIFHWADDR, &ifr) != -1)
+        {
+            if (ifr.ifr_hwaddr.sa_family == ARPHRD_ETHER)
+            {
+                memcpy(hwaddr, ifr.ifr_hwaddr.sa_data, ethernet_addr_len);
+                hwaddr_len = ethernet_addr_len;
+            }
+        }
+        close(sockfd);
+    }
+    return hwaddr_len;
+}
+#endif // TARGET_OS_LINUX
+
+// Registers the non-loopback getifaddrs() entry i, taken from intfList, as interface ifIndex.
+mDNSlocal int SetupInterfaceFromIfAddrs(mDNS *const m, struct ifaddrs *intfList, struct ifaddrs *i, int ifIndex)
+{
+    const int ethernet_addr_len = 6;
+    uint8_t hwaddr[ethernet_addr_len];
+    int hwaddr_len = 0;
+
+    (void)intfList; // Unused except on Mac OS X
+    memset(hwaddr, 0, sizeof(hwaddr));
+#if defined(TARGET_OS_LINUX) && TARGET_OS_LINUX
+    hwaddr_len = GetInterfaceHardwareAddress(i->ifa_name, hwaddr);
+#endif
+
+#if defined(TARGET_OS_MAC) && TARGET_OS_MAC
+    for (struct ifaddrs *hw_scan = intfList; hw_scan != NULL; hw_scan = hw_scan->ifa_next)
+    {
+        if (hw_scan->ifa_addr->sa_family == AF_LINK && !strcmp(hw_scan->ifa_name, i->ifa_name))
+        {
+            struct sockaddr_dl *sdl = (struct sockaddr_dl *)hw_scan->ifa_addr;
+            if (sdl->sdl_alen == ethernet_addr_len)
+            {
+                hwaddr_len = ethernet_addr_len;
+                memcpy(hwaddr, LLADDR(sdl), hwaddr_len);
+            }
+            break;
+        }
+    }
+#endif
+    return SetupOneInterface(m, i->ifa_addr, i->ifa_netmask, hwaddr, hwaddr_len, i->ifa_name, ifIndex);
+}
+
 // Call get_ifi_info() to obtain a list of active interfaces and call SetupOneInterface() on each one.
 mDNSlocal int SetupInterfaceList(mDNS *const m)
 {
@@ -1467,12 +1861,7 @@ mDNSlocal int SetupInterfaceList(mDNS *const m)
         struct ifaddrs *i = intfList;
         while (i)
         {
-            if (     i->ifa_addr != NULL &&
-                     ((i->ifa_addr->sa_family == AF_INET)
-#if HAVE_IPV6
-                      || (i->ifa_addr->sa_family == AF_INET6)
-#endif
-                      ) &&  (i->ifa_flags & IFF_UP) && !(i->ifa_flags & IFF_POINTOPOINT))
+            if (IfAddrIsCandidate(i))
             {
                 int ifIndex = if_nametoindex(i->ifa_name);
                 if (ifIndex == 0)
@@ -1489,50 +1878,7 @@ mDNSlocal int SetupInterfaceList(mDNS *const m)
                 }
                 else
                 {
-                    const int ethernet_addr_len = 6;
-                    uint8_t hwaddr[ethernet_addr_len];
-                    int hwaddr_len = 0;
-
-#if defined(TARGET_OS_LINUX) && TARGET_OS_LINUX
-                    struct ifreq ifr;
-                    int sockfd = socket(AF_INET6, SOCK_DGRAM, 0);
-                    if (sockfd >= 0)
-                    {
-                        /* Add hardware address */
-                        memcpy(ifr.ifr_name, i->ifa_name, IFNAMSIZ);
-                        if (ioctl(sockfd, SIOCGIFHWADDR, &ifr) != -1)
-                        {
-                            if (ifr.ifr_hwaddr.sa_family == ARPHRD_ETHER)
-                            {
-                                memcpy(hwaddr, ifr.ifr_hwaddr.sa_data, ethernet_addr_len);
-                                hwaddr_len = ethernet_addr_len;
-                            }
-                        }
-                        close(sockfd);
-                    }
-                    else
-                    {
-                        memset(hwaddr, 0, sizeof(hwaddr));
-                    }
-#endif // TARGET_OS_LINUX
-
-#if defined(TARGET_OS_MAC) && TARGET_OS_MAC
-                    for (struct ifaddrs *hw_scan = intfList; hw_scan != NULL; hw_scan = hw_scan->ifa_next)
-                    {
-                        if (hw_scan->ifa_addr->sa_family == AF_LINK && !strcmp(hw_scan->ifa_name, i->ifa_name))
-                        {
-                            struct sockaddr_dl *sdl = (struct sockaddr_dl *)hw_scan->ifa_addr;
-                            if (sdl->sdl_alen == ethernet_addr_len)
-                            {
-                                hwaddr_len = ethernet_addr_len;
-                                memcpy(hwaddr, LLADDR(sdl), hwaddr_len);
-                            }
-                            break;
-                        }
-                    }
-#endif
-                    if (SetupOneInterface(m, i->ifa_addr, i->ifa_netmask,
-                                          hwaddr, hwaddr_len, i->ifa_name, ifIndex) == 0)
+                    if (SetupInterfaceFromIfAddrs(m, intfList, i, ifIndex) == 0)
                     {
                         if (i->ifa_addr->sa_family == AF_INET)
                             foundav4 = mDNStrue;
@@ -1548,8 +1894,11 @@ mDNSlocal int SetupInterfaceList(mDNS *const m)
         // In the interim, we skip loopback interface only if we found at least one v4 interface to use
         // if ((m->HostInterfaces == NULL) && (firstLoopback != NULL))
         if (!foundav4 && firstLoopback)
-            (void) SetupOneInterface(m, firstLoopback->ifa_addr, firstLoopback->ifa_netmask,
-                NULL, 0, firstLoopback->ifa_name, firstLoopbackIndex);
+        {
+            if (SetupOneInterface(m, firstLoopback->ifa_addr, firstLoopback->ifa_netmask,
+                    NULL, 0, firstLoopback->ifa_name, firstLoopbackIndex) == 0)
+                gLoopbackFallback = mDNStrue;
+        }
     }
 
     // Clean up.
@@ -1627,14 +1976,111 @@ mDNSlocal void      PrintNetLinkMsg(const struct nlmsghdr *pNLMsg)
 }
 #endif
 
-mDNSlocal mDNSu32       ProcessRoutingNotification(int sd)
-// Read through the messages on sd and if any indicate that any interface records should
-// be torn down and rebuilt, return affected indices as a bitmask. Otherwise return 0.
+// Returns the pending change for the given link (family AF_UNSPEC) or address, creating it if necessary.
+mDNSlocal PosixIfChange *GetPendingIfChange(int index, int family, const mDNSAddr *ip)
+{
+    PosixIfChange *change;
+    for (change = gPendingIfChanges; change; change = change->next)
+    {
+        if (change->index == index && change->family == family && (family == AF_UNSPEC || mDNSSameAddress(&change->ip, ip)))
+            return change;
+    }
+    change = (PosixIfChange *)mDNSPlatformMemAllocateClear(sizeof(*change));
+    if (change == NULL)
+        return NULL;
+    change->index  = index;
+    change->family = family;
+    if (ip) change->ip = *ip;
+    change->next = gPendingIfChanges;
+    gPendingIfChanges = change;
+    return change;
+}
+
+mDNSlocal void QueueLinkChange(const struct nlmsghdr *pNLMsg)
+{
+    const struct ifinfomsg *pIfInfo = (const struct ifinfomsg *)NLMSG_DATA(pNLMsg);
+    PosixIfChange *change = GetPendingIfChange(pIfInfo->ifi_index, AF_UNSPEC, NULL);
+
+    if (change == NULL) { gIfChangeRefreshAll = mDNStrue; return; }
+    change->present = (pNLMsg->nlmsg_type == RTM_NEWLINK);
+    change->flags   = pIfInfo->ifi_flags;
+}
+
+// Fills in *sa with an address of the given family, and *mask with the netmask for prefixLen.
+mDNSlocal mDNSBool MakeIfChangeSockAddrs(int family, const void *rawAddr, int prefixLen, int index,
+                                         struct sockaddr_storage *sa, struct sockaddr_storage *mask)
+{
+    mDNSu8 *maskBytes;
+    int maskLen, b;
+
+    mDNSPlatformMemZero(sa, sizeof(*sa));
+    mDNSPlatformMemZero(mask, sizeof(*mask));
+    if (family == AF_INET)
+    {
+        struct sockaddr_in *sin = (struct sockaddr_in *)sa;
+        sin->sin_family = AF_INET;
+        memcpy(&sin->sin_addr, rawAddr, sizeof(sin->sin_addr));
+        ((struct sockaddr_in *)mask)->sin_family = AF_INET;
+        maskBytes = (mDNSu8 *)&((struct sockaddr_in *)mask)->sin_addr;
+        maskLen   = sizeof(struct in_addr);
+    }
+#if HAVE_IPV6
+    else if (family == AF_INET6)
+    {
+        struct sockaddr_in6 *sin6 = (struct sockaddr_in6 *)sa;
+        sin6->sin6_family   = AF_INET6;
+        memcpy(&sin6->sin6_addr, rawAddr, sizeof(sin6->sin6_addr));
+        if (IN6_IS_ADDR_LINKLOCAL(&sin6->sin6_addr)) sin6->sin6_scope_id = index;
+        ((struct sockaddr_in6 *)mask)->sin6_family = AF_INET6;
+        maskBytes = (mDNSu8 *)&((struct sockaddr_in6 *)mask)->sin6_addr;
+        maskLen   = sizeof(struct in6_addr);
+    }
+#endif
+    else
+        return mDNSfalse;
+
+    for (b = 0; b < maskLen && prefixLen > 0; b++, prefixLen -= 8)
+        maskBytes[b] = (prefixLen >= 8) ? 0xFF : (mDNSu8)(0xFF << (8 - prefixLen));
+    return mDNStrue;
+}
+
+mDNSlocal void QueueAddressChange(const struct nlmsghdr *pNLMsg)
+{
+    const struct ifaddrmsg *pIfAddr = (const struct ifaddrmsg *)NLMSG_DATA(pNLMsg);
+    const struct rtattr *rta;
+    int rtaLen = IFA_PAYLOAD(pNLMsg);
+    const void *local = NULL, *address = NULL;
+    struct sockaddr_storage sa, mask;
+    mDNSAddr ip;
+    PosixIfChange *change;
+
+    // For a point-to-point link IFA_ADDRESS is the peer and IFA_LOCAL is ours; otherwise they are the same.
+    for (rta = IFA_RTA(pIfAddr); RTA_OK(rta, rtaLen); rta = RTA_NEXT(rta, rtaLen))
+    {
+        if      (rta->rta_type == IFA_LOCAL)   local   = RTA_DATA(rta);
+        else if (rta->rta_type == IFA_ADDRESS) address = RTA_DATA(rta);
+    }
+    if (local == NULL) local = address;
+    if (local == NULL || !MakeIfChangeSockAddrs(pIfAddr->ifa_family, local, pIfAddr->ifa_prefixlen,
+                                                (int)pIfAddr->ifa_index, &sa, &mask))
+        return;     // Not an address family we use
+
+    SockAddrTomDNSAddr((struct sockaddr *)&sa, &ip, NULL);
+    change = GetPendingIfChange((int)pIfAddr->ifa_index, pIfAddr->ifa_family, &ip);
+    if (change == NULL) { gIfChangeRefreshAll = mDNStrue; return; }
+    change->present = (pNLMsg->nlmsg_type == RTM_NEWADDR);
+    change->addr    = sa;
+    change->mask    = mask;
+}
+
+mDNSlocal mDNSBool      ProcessRoutingNotification(int sd)
+// Read through the messages on sd and queue the link and address changes they describe.
+// Returns true if anything was queued.
 {
     ssize_t readCount;
     char buff[4096];
     struct nlmsghdr         *pNLMsg = (struct nlmsghdr*) buff;
-    mDNSu32 result = 0;
+    mDNSBool result = mDNSfalse;
 
     // The structure here is more complex than it really ought to be because,
     // unfortunately, there's no good way to size a buffer in advance large
@@ -1642,6 +2088,12 @@ mDNSlocal mDNSu32       ProcessRoutingNotification(int sd)
     // (Note that FIONREAD is not supported on AF_NETLINK.)
 
     readCount = read(sd, buff, sizeof buff);
+    if (readCount < 0 && errno == ENOBUFS)
+    {
+        // The kernel dropped notifications, so we no longer know what changed.
+        gIfChangeRefreshAll = mDNStrue;
+        return mDNStrue;
+    }
     while (1)
     {
         // Make sure we've got an entire nlmsghdr in the buffer, and payload, too.
@@ -1669,10 +2121,16 @@ mDNSlocal mDNSu32       ProcessRoutingNotification(int sd)
 #endif
 
         // Process the NetLink message
-        if (pNLMsg->nlmsg_type == RTM_GETLINK || pNLMsg->nlmsg_type == RTM_NEWLINK)
-            result |= 1 << ((struct ifinfomsg*) NLMSG_DATA(pNLMsg))->ifi_index;
+        if (pNLMsg->nlmsg_type == RTM_NEWLINK || pNLMsg->nlmsg_type == RTM_DELLINK)
+        {
+            QueueLinkChange(pNLMsg);
+            result = mDNStrue;
+        }
         else if (pNLMsg->nlmsg_type == RTM_DELADDR || pNLMsg->nlmsg_type == RTM_NEWADDR)
-            result |= 1 << ((struct ifaddrmsg*) NLMSG_DATA(pNLMsg))->ifa_index;
+        {
+            QueueAddressChange(pNLMsg);
+            result = mDNStrue;
+        }
 
         // Advance pNLMsg to the next message in the buffer
         if ((pNLMsg->nlmsg_flags & NLM_F_MULTI) != 0 && pNLMsg->nlmsg_type != NLMSG_DONE)
@@ -1687,6 +2145,143 @@ mDNSlocal mDNSu32       ProcessRoutingNotification(int sd)
     return result;
 }
 
+mDNSlocal PosixNetworkInterface *SearchForInterfaceByAddress(mDNS *const m, int index, const mDNSAddr *ip)
+{
+    PosixNetworkInterface *intf;
+    for (intf = (PosixNetworkInterface *)m->HostInterfaces; intf; intf = (PosixNetworkInterface *)intf->coreIntf.next)
+    {
+        if (intf->index == index && (ip == NULL || mDNSSameAddress(&intf->coreIntf.ip, ip)))
+            break;
+    }
+    return intf;
+}
+
+mDNSlocal void TearDownInterface(mDNS *const m, PosixNetworkInterface *intf)
+{
+    mDNS_DeregisterInterface(m, &intf->coreIntf, NormalActivation);
+    if (gMDNSPlatformPosixVerboseLevel > 0) fprintf(stderr, "Deregistered interface %s\n", intf->intfName);
+    FreePosixNetworkInterface(intf);
+    num_registered_interfaces--;
+}
+
+// Deregisters and frees every interface on link index. Aliases go first, because the interface
+// they alias owns the multicast sockets they send on.
+mDNSlocal void TearDownInterfacesForIndex(mDNS *const m, int index)
+{
+    PosixNetworkInterface *intf;
+    mDNSBool aliases = mDNStrue;
+
+    while ((intf = SearchForInterfaceByAddress(m, index, NULL)) != NULL)
+    {
+        if (aliases)
+        {
+            while (intf && (intf->index != index || intf->coreIntf.InterfaceID == (mDNSInterfaceID)intf))
+                intf = (PosixNetworkInterface *)intf->coreIntf.next;
+            if (intf == NULL) { aliases = mDNSfalse; continue; }
+        }
+        TearDownInterface(m, intf);
+    }
+}
+
+// Registers every usable address getifaddrs() reports on link index that isn't registered already.
+mDNSlocal void SetupInterfacesForIndex(mDNS *const m, int index)
+{
+    struct ifaddrs *intfList = NULL, *i;
+
+    if (getifaddrs(&intfList) < 0 || intfList == NULL)
+        return;
+    for (i = intfList; i; i = i->ifa_next)
+    {
+        mDNSAddr ip;
+        if (!IfAddrIsCandidate(i) || (i->ifa_flags & IFF_LOOPBACK) || (int)if_nametoindex(i->ifa_name) != index)
+            continue;
+        SockAddrTomDNSAddr(i->ifa_addr, &ip, NULL);
+        if (SearchForInterfaceByAddress(m, index, &ip) == NULL)
+            (void) SetupInterfaceFromIfAddrs(m, intfList, i, index);
+    }
+    freeifaddrs(intfList);
+}
+
+mDNSlocal void ApplyLinkChange(mDNS *const m, const PosixIfChange *change)
+{
+    const mDNSBool usable = change->present && (change->flags & IFF_UP) &&
+                            !(change->flags & (IFF_POINTOPOINT | IFF_LOOPBACK));
+    const mDNSBool registered = (SearchForInterfaceByAddress(m, change->index, NULL) != NULL);
+
+    // A link that stays up keeps its registrations; RTM_NEWLINK also fires for MTU, carrier and other changes we don't use.
+    if (!usable && registered)
+        TearDownInterfacesForIndex(m, change->index);
+    else if (usable && !registered)
+        SetupInterfacesForIndex(m, change->index);
+}
+
+mDNSlocal void ApplyAddressChange(mDNS *const m, const PosixIfChange *change)
+{
+    PosixNetworkInterface *intf = SearchForInterfaceByAddress(m, change->index, &change->ip);
+
+    if (!change->present)
+    {
+        PosixNetworkInterface *other;
+        if (intf == NULL)
+            return;
+        for (other = (PosixNetworkInterface *)m->HostInterfaces; other; other = (PosixNetworkInterface *)other->coreIntf.next)
+        {
+            if (other != intf && other->coreIntf.InterfaceID == (mDNSInterfaceID)intf)
+                break;
+        }
+        if (other)
+        {
+            // Other addresses on this link share intf's sockets, so rebuild the link from what remains.
+            TearDownInterfacesForIndex(m, change->index);
+            SetupInterfacesForIndex(m, change->index);
+        }
+        else
+        {
+            TearDownInterface(m, intf);
+        }
+    }
+    else if (intf == NULL)
+    {
+        char name[IF_NAMESIZE];
+        struct ifreq ifr;
+        mDNSu8 hwaddr[6];
+        int hwaddr_len, sockfd, flags = 0;
+
+        // Only register the address if SetupInterfaceList would have: the link must still exist, be up,
+        // and be neither point-to-point nor loopback.
+        if (if_indextoname((unsigned int)change->index, name) == NULL)
+            return;
+        sockfd = socket(AF_INET, SOCK_DGRAM, 0);
+        if (sockfd < 0)
+            return;
+        mDNSPlatformMemZero(&ifr, sizeof(ifr));
+        mDNSPlatformStrLCopy(ifr.ifr_name, name, sizeof(ifr.ifr_name));
+        if (ioctl(sockfd, SIOCGIFFLAGS, &ifr) != -1)
+            flags = ifr.ifr_flags;
+        close(sockfd);
+        if (!(flags & IFF_UP) || (flags & (IFF_POINTOPOINT | IFF_LOOPBACK)))
+            return;
+
+        mDNSPlatformMemZero(hwaddr, sizeof(hwaddr));
+        hwaddr_len = GetInterfaceHardwareAddress(name, hwaddr);
+        (void) SetupOneInterface(m, (struct sockaddr *)&change->addr, (struct sockaddr *)&change->mask,
+                                 hwaddr, hwaddr_len, name, change->index);
+    }
+}
+
+// Applies and frees the queued changes: link changes first, since they may tear down or set up
+// a link's addresses wholesale, then the individual address changes.
+mDNSlocal void ApplyInterfaceChanges(mDNS *const m)
+{
+    PosixIfChange *change;
+
+    for (change = gPendingIfChanges; change; change = change->next)
+        if (change->family == AF_UNSPEC) ApplyLinkChange(m, change);
+    for (change = gPendingIfChanges; change; change = change->next)
+        if (change->family != AF_UNSPEC) ApplyAddressChange(m, change);
+    DiscardInterfaceChanges();
+}
+
 #else // USES_NETLINK
 
 // Open a socket that will receive interface change notifications
@@ -1716,31 +2311,30 @@ mDNSlocal void      PrintRoutingSocketMsg(const struct ifa_msghdr *pRSMsg)
 }
 #endif
 
-mDNSlocal mDNSu32       ProcessRoutingNotification(int sd)
-// Read through the messages on sd and if any indicate that any interface records should
-// be torn down and rebuilt, return affected indices as a bitmask. Otherwise return 0.
+mDNSlocal mDNSBool      ProcessRoutingNotification(int sd)
+// Read through the messages on sd and if any indicate that interface records should be
+// torn down and rebuilt, schedule a rebuild and return true.
 {
     ssize_t readCount;
     char buff[4096];
     struct ifa_msghdr       *pRSMsg = (struct ifa_msghdr*) buff;
-    mDNSu32 result = 0;
+    mDNSBool result = mDNSfalse;
 
     readCount = read(sd, buff, sizeof buff);
     if (readCount < (ssize_t) sizeof(struct ifa_msghdr))
-        return mStatus_UnsupportedErr;      // cannot decipher message
+        return mDNSfalse;                   // cannot decipher message
 
 #if MDNS_DEBUGMSGS
     PrintRoutingSocketMsg(pRSMsg);
 #endif
 
     // Process the message
+    // Routing socket messages are not decoded any further; the whole list is rebuilt.
     if (pRSMsg->ifam_type == RTM_NEWADDR || pRSMsg->ifam_type == RTM_DELADDR ||
         pRSMsg->ifam_type == RTM_IFINFO)
     {
-        if (pRSMsg->ifam_type == RTM_IFINFO)
-            result |= 1 << ((struct if_msghdr*) pRSMsg)->ifm_index;
-        else
-            result |= 1 << pRSMsg->ifam_index;
+        gIfChangeRefreshAll = mDNStrue;
+        result = mDNStrue;
     }
 
     return result;
@@ -1753,7 +2347,7 @@ mDNSlocal void InterfaceChangeCallback(int fd, void *context)
 {
     IfChangeRec     *pChgRec = (IfChangeRec*) context;
     fd_set readFDs;
-    mDNSu32 changedInterfaces = 0;
+    mDNSBool changed = mDNSfalse;
     struct timeval zeroTimeout = { 0, 0 };
 
     (void)fd; // Unused
@@ -1763,15 +2357,60 @@ mDNSlocal void InterfaceChangeCallback(int fd, void *context)
 
     do
     {
-        changedInterfaces |= ProcessRoutingNotification(pChgRec->NotifySD);
+        if (ProcessRoutingNotification(pChgRec->NotifySD))
+            changed = mDNStrue;
     }
     while (0 < select(pChgRec->NotifySD + 1, &readFDs, (fd_set*) NULL, (fd_set*) NULL, &zeroTimeout));
 
-    // Currently we rebuild the entire interface list whenever any interface change is
-    // detected. If this ever proves to be a performance issue in a multi-homed
-    // configuration, more care should be paid to changedInterfaces.
-    if (changedInterfaces)
-        mDNSPlatformPosixRefreshInterfaceList(pChgRec->mDNS);
+    // The window opens with the first change and is not extended by later ones, so a steady stream
+    // of changes is still applied every kIfChangeCoalesceTicks.
+    if (changed && !gIfChangePending)
+    {
+        gIfChangePending  = mDNStrue;
+        gIfChangeDeadline = mDNS_TimeNow(pChgRec->mDNS) + kIfChangeCoalesceTicks;
+    }
+}
+
+// Applies the queued interface changes once the coalescing window has closed.
+// Returns true if it did so.
+mDNSlocal mDNSBool PosixServiceInterfaceChanges(mDNS *const m)
+{
+    if (!gIfChangePending || mDNS_TimeNow(m) - gIfChangeDeadline < 0)
+        return mDNSfalse;
+    gIfChangePending = mDNSfalse;
+#if USES_NETLINK
+    // Whether loopback should stand in for a missing v4 interface is SetupInterfaceList's decision, so
+    // fall back to a full rebuild whenever that might change.
+    if (!gIfChangeRefreshAll && !gLoopbackFallback)
+    {
+        PosixNetworkInterface *intf;
+        ApplyInterfaceChanges(m);
+        for (intf = (PosixNetworkInterface *)m->HostInterfaces; intf; intf = (PosixNetworkInterface *)intf->coreIntf.next)
+        {
+            if (intf->coreIntf.ip.type == mDNSAddrType_IPv4)
+                return mDNStrue;
+        }
+    }
+#endif
+    (void) mDNSPlatformPosixRefreshInterfaceList(m);
+    return mDNStrue;
+}
+
+// Reduces *timeout so that the event loop wakes up when the coalescing window closes.
+mDNSlocal void PosixClampTimeoutForInterfaceChanges(mDNS *const m, struct timeval *timeout)
+{
+    struct timeval interval;
+    mDNSs32 ticks;
+
+    if (!gIfChangePending)
+        return;
+    ticks = gIfChangeDeadline - mDNS_TimeNow(m);
+    if (ticks < 0) ticks = 0;
+    interval.tv_sec  = ticks / mDNSPlatformOneSecond;
+    interval.tv_usec = (ticks % mDNSPlatformOneSecond) * 1000000 / mDNSPlatformOneSecond;
+    if (timeout->tv_sec > interval.tv_sec ||
+        (timeout->tv_sec == interval.tv_sec && timeout->tv_usec > interval.tv_usec))
+        *timeout = interval;
 }
 
 // Register with either a Routing Socket or RtNetLink to listen for interface changes.
@@ -1883,15 +2522,18 @@ mDNSexport void mDNSPlatformClose(mDNS *const m)
 {
     int rv;
     assert(m != NULL);
+    DiscardInterfaceChanges();
     ClearInterfaceList(m);
     if (m->p->unicastSocket4 != -1)
     {
+        PosixEpollForgetSocket(m->p->unicastSocket4);
         rv = close(m->p->unicastSocket4);
         assert(rv == 0);
     }
 #if HAVE_IPV6
     if (m->p->unicastSocket6 != -1)
     {
+        PosixEpollForgetSocket(m->p->unicastSocket6);
         rv = close(m->p->unicastSocket6);
         assert(rv == 0);
     }
@@ -1907,6 +2549,8 @@ mDNSexport mStatus mDNSPlatformPosixRefreshInterfaceList(mDNS *const m)
     // This is a pretty heavyweight way to process interface changes --
     // destroying the entire interface list and then making fresh one from scratch.
     // We should make it like the OS X version, which leaves unchanged interfaces alone.
+    // (On Linux, InterfaceChangeCallback now only comes here when it can't apply netlink changes incrementally.)
+    DiscardInterfaceChanges();
     ClearInterfaceList(m);
     err = SetupInterfaceList(m);
     return PosixErrorToStatus(err);
@@ -2210,6 +2854,11 @@ mDNSlocal void mDNSPosixGetFDSetForSelect(mDNS *m, int *nfds, fd_set *readfds, f
     // to initialize their FD sets first and then call mDNSPosixGetFDSet()
     for (iSource = gEventSources; iSource; iSource = iSource->next)
     {
+#if POSIX_USE_EPOLL
+        // Sources are no longer limited to FD_SETSIZE, but a client-supplied fd_set still is.
+        if (iSource->fd >= (int) FD_SETSIZE)
+            continue;
+#endif
         if (iSource->readCallback != NULL)
             FD_SET(iSource->fd, readfds);
         if (iSource->writeCallback != NULL)
@@ -2224,9 +2873,12 @@ mDNSexport void mDNSPosixGetFDSet(mDNS *m, int *nfds, fd_set *readfds, fd_set *w
 {
     mDNSs32 ticks;
     struct timeval interval;
+    mDNSs32 nextevent;
 
     // 1. Call mDNS_Execute() to let mDNSCore do what it needs to do
-    mDNSs32 nextevent = mDNS_Execute(m);
+    (void) PosixServiceInterfaceChanges(m);
+    nextevent = mDNS_Execute(m);
+    PosixFlushSendBatch();
 
     // 3. Calculate the time remaining to the next scheduled event (in struct timeval format)
     ticks = nextevent - mDNS_TimeNow(m);
@@ -2238,6 +2890,7 @@ mDNSexport void mDNSPosixGetFDSet(mDNS *m, int *nfds, fd_set *readfds, fd_set *w
     if (timeout->tv_sec > interval.tv_sec ||
         (timeout->tv_sec == interval.tv_sec && timeout->tv_usec > interval.tv_usec))
         *timeout = interval;
+    PosixClampTimeoutForInterfaceChanges(m, timeout);
 
     mDNSPosixGetFDSetForSelect(m, nfds, readfds, writefds);
 }
@@ -2283,6 +2936,10 @@ mDNSexport void mDNSPosixProcessFDSet(mDNS *const m, fd_set *readfds, fd_set *wr
     // Now process routing socket events, discovery relay events and anything else of that ilk.
     for (iSource = gEventSources; iSource; iSource = iSource->next)
     {
+#if POSIX_USE_EPOLL
+        if (iSource->fd >= (int) FD_SETSIZE)
+            continue;
+#endif
         if (iSource->readCallback != NULL && FD_ISSET(iSource->fd, readfds))
         {
             iSource->readCallback(iSource->fd, iSource->readContext);
@@ -2295,6 +2952,7 @@ mDNSexport void mDNSPosixProcessFDSet(mDNS *const m, fd_set *readfds, fd_set *wr
             // We reset this before calling the callback just in case the callback requests another write
             // callback, or deletes the event context from the list.
             iSource->writeCallback = NULL;
+            PosixEpollUpdateSource(iSource);
             writeCallback(iSource->fd, iSource->writeContext);
             break;  // in case callback removed elements from gEventSources
         }
@@ -2308,7 +2966,11 @@ mDNSlocal void requestIOEvents(PosixEventSource *newSource, const char *taskName
 {
     PosixEventSource **epp = &gEventSources;
 
+#if POSIX_USE_EPOLL
+    if (newSource->fd < 0)
+#else
     if (newSource->fd >= (int) FD_SETSIZE || newSource->fd < 0)
+#endif
     {
         LogMsg("requestIOEvents called with fd %d > FD_SETSIZE %d.", newSource->fd, FD_SETSIZE);
         assert(0);
@@ -2336,7 +2998,7 @@ mDNSlocal void requestIOEvents(PosixEventSource *newSource, const char *taskName
         {
             *epp = newSource;
             newSource->next = NULL;
-            newSource->flags = PosixEventFlag_OnList;
+            newSource->flags = PosixEventFlag_OnList | (newSource->flags & PosixEventFlag_Epoll);
         }
     }
 
@@ -2354,6 +3016,7 @@ mDNSlocal void requestIOEvents(PosixEventSource *newSource, const char *taskName
         newSource->flags |= PosixEventFlag_Write;
         newSource->writeTaskName = taskName;
     }
+    PosixEpollUpdateSource(newSource);
 }
 
 mDNSlocal void requestReadEvents(PosixEventSource *eventSource,
@@ -2388,10 +3051,16 @@ mDNSlocal mStatus stopReadOrWriteEvents(int fd, mDNSBool freeContext, mDNSBool r
                 iSource->writeCallback = NULL;
                 iSource->writeContext = NULL;
             }
+            PosixEpollUpdateSource(iSource);
             if (iSource->writeCallback == NULL && iSource->readCallback == NULL)
             {
                 if (removeContext || freeContext)
+                {
                     *epp = iSource->next;
+#if POSIX_USE_EPOLL
+                    gEventSourcesGeneration++;
+#endif
+                }
                 if (freeContext)
                     mdns_free(iSource);
             }
@@ -2445,6 +3114,32 @@ mStatus mDNSPosixListenForSignalInEventLoop(int signum)
     return err;
 }
 
+mDNSlocal void LogBatchStatistics(const char *const name, const PosixBatchStats *const stats)
+{
+    char sizes[kPosixMaxBatch * 16];
+    int i, len = 0;
+
+    sizes[0] = 0;
+    for (i = 1; i <= kPosixMaxBatch; i++)
+    {
+        if (stats->sizes[i] == 0) continue;
+        len += snprintf(sizes + len, sizeof(sizes) - len, " %d%s:%u", i, i == kPosixMaxBatch ? "+" : "", stats->sizes[i]);
+        if (len >= (int)sizeof(sizes)) break;
+    }
+    LogMsg("%s: %u calls, %u packets; batch sizes%s", name, stats->calls, stats->packets, sizes[0] ? sizes : " none");
+}
+
+// Log how well recvmmsg()/sendmmsg() have been batching mDNS traffic.
+mDNSexport void mDNSPosixLogBatchStatistics(void)
+{
+#if POSIX_USE_MMSG
+    LogBatchStatistics("UDP receive (recvmmsg)", &gRecvBatchStats);
+    LogBatchStatistics("UDP multicast send (sendmmsg)", &gSendBatchStats);
+#else
+    LogBatchStatistics("UDP receive (recvmsg)", &gRecvBatchStats);
+#endif
+}
+
 // Tell the event package to stop listening for signal in mDNSPosixRunEventLoopOnce().
 mStatus mDNSPosixIgnoreSignalInEventLoop(int signum)
 {
@@ -2460,6 +3155,85 @@ mStatus mDNSPosixIgnoreSignalInEventLoop(int signum)
     return err;
 }
 
+#if POSIX_USE_EPOLL
+// Hand a readable mDNS socket to the core, finding the interface it belongs to as mDNSPosixProcessFDSet() would.
+mDNSlocal void PosixEpollSocketReady(mDNS *const m, int fd)
+{
+    PosixNetworkInterface *info;
+
+    if (fd == m->p->unicastSocket4)
+    {
+        SocketDataReady(m, NULL, fd, NULL);
+        return;
+    }
+#if HAVE_IPV6
+    if (fd == m->p->unicastSocket6)
+    {
+        SocketDataReady(m, NULL, fd, NULL);
+        return;
+    }
+#endif
+    for (info = (PosixNetworkInterface *)(m->HostInterfaces); info; info = (PosixNetworkInterface *)(info->coreIntf.next))
+    {
+#if HAVE_IPV6
+        if (info->multicastSocket4 == fd || info->multicastSocket6 == fd)
+#else
+        if (info->multicastSocket4 == fd)
+#endif
+        {
+            SocketDataReady(m, info, fd, NULL);
+            return;
+        }
+    }
+}
+
+// Wait for the epoll instance and dispatch everything it reports. Returns the epoll_wait() result.
+mDNSlocal int PosixEpollWaitAndDispatch(mDNS *const m, int epfd, const struct timeval *timeout)
+{
+    struct epoll_event events[kPosixEpollMaxEvents];
+    const unsigned int generation = gEventSourcesGeneration;
+    long timeoutMS;
+    int numReady, i;
+
+    timeoutMS = (long)timeout->tv_sec * 1000 + (timeout->tv_usec + 999) / 1000;
+    if (timeoutMS > 0x7FFFFFFF) timeoutMS = 0x7FFFFFFF;
+    numReady = epoll_wait(epfd, events, kPosixEpollMaxEvents, (int)timeoutMS);
+
+    for (i = 0; i < numReady; i++)
+    {
+        PosixEventSource *iSource;
+        const uint32_t ready = events[i].events;
+
+        if (events[i].data.u64 & kPosixEpollSocketTag)
+        {
+            PosixEpollSocketReady(m, (int)(events[i].data.u64 >> 1));
+            continue;
+        }
+
+        // Once a callback has taken a source off gEventSources, the remaining pointers may be stale.
+        // The loop is level-triggered, so anything we skip here is reported again on the next pass.
+        if (generation != gEventSourcesGeneration)
+            continue;
+        iSource = (PosixEventSource *)events[i].data.ptr;
+        if (iSource->readCallback != NULL && (ready & (EPOLLIN | EPOLLERR | EPOLLHUP)))
+        {
+            iSource->readCallback(iSource->fd, iSource->readContext);
+            if (generation != gEventSourcesGeneration)
+                continue;
+        }
+        if (iSource->writeCallback != NULL && (ready & (EPOLLOUT | EPOLLERR | EPOLLHUP)))
+        {
+            mDNSPosixEventCallback writeCallback = iSource->writeCallback;
+            // Write events are one-shot, as in mDNSPosixProcessFDSet().
+            iSource->writeCallback = NULL;
+            PosixEpollUpdateSource(iSource);
+            writeCallback(iSource->fd, iSource->writeContext);
+        }
+    }
+    return numReady;
+}
+#endif
+
 // Do a single pass through the attendent event sources and dispatch any found to their callbacks.
 // Return as soon as internal timeout expires, or a signal we're listening for is received.
 mStatus mDNSPosixRunEventLoopOnce(mDNS *m, const struct timeval *pTimeout,
@@ -2470,23 +3244,38 @@ mStatus mDNSPosixRunEventLoopOnce(mDNS *m, const struct timeval *pTimeout,
     int numFDs = 0, numReady;
     struct timeval timeout = *pTimeout;
 
-    // 1. Set up the fd_set as usual here.
-    // This example client has no file descriptors of its own,
-    // but a real application would call FD_SET to add them to the set here
-    FD_ZERO(&listenFDs);
-    FD_ZERO(&writeFDs);
+    // Put anything the core has queued for sending on the wire before we go to sleep.
+    PosixFlushSendBatch();
+    PosixClampTimeoutForInterfaceChanges(m, &timeout);
 
-    // 2. Set up the timeout.
-    // MainLoop has already called mDNS_Execute and udsserver_idle, so the timeout we
-    // were passed is already set up.
+#if POSIX_USE_EPOLL
+    // If the epoll instance could not be created, fall back to select(); gEventSources is always kept up to date.
+    if (PosixEpollFD() >= 0)
+    {
+        numReady = PosixEpollWaitAndDispatch(m, gEpollFD, &timeout);
+    }
+    else
+#endif
+    {
+        // 1. Set up the fd_set as usual here.
+        // This example client has no file descriptors of its own,
+        // but a real application would call FD_SET to add them to the set here
+        FD_ZERO(&listenFDs);
+        FD_ZERO(&writeFDs);
+
+        // 2. Set up the timeout.
+        // MainLoop has already called mDNS_Execute and udsserver_idle, so the timeout we
+        // were passed is already set up.
 
-    // Include the sockets that are listening to the wire in our select() set
-    mDNSPosixGetFDSetForSelect(m, &numFDs, &listenFDs, &writeFDs);
-    numReady = select(numFDs, &listenFDs, &writeFDs, (fd_set*) NULL, &timeout);
+        // Include the sockets that are listening to the wire in our select() set
+        mDNSPosixGetFDSetForSelect(m, &numFDs, &listenFDs, &writeFDs);
+        numReady = select(numFDs, &listenFDs, &writeFDs, (fd_set*) NULL, &timeout);
+        if (numReady > 0)
+            mDNSPosixProcessFDSet(m, &listenFDs, &writeFDs);
+    }
 
     if (numReady > 0)
     {
-        mDNSPosixProcessFDSet(m, &listenFDs, &writeFDs);
         *pDataDispatched = mDNStrue;
     }
     else if (numReady < 0)
@@ -2502,6 +3291,10 @@ mStatus mDNSPosixRunEventLoopOnce(mDNS *m, const struct timeval *pTimeout,
     else
         *pDataDispatched = mDNSfalse;
 
+    // Interfaces registered or deregistered here schedule work in the core; have the caller run it straight away.
+    if (PosixServiceInterfaceChanges(m))
+        *pDataDispatched = mDNStrue;
+
     (void) sigprocmask(SIG_BLOCK, &gEventSignalSet, (sigset_t*) NULL);
     *pSignalsReceived = gEventSignals;
     sigemptyset(&gEventSignals);
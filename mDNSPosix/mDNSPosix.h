@@ -62,6 +62,7 @@ struct mDNS_PlatformSupport_struct
 #define PosixEventFlag_OnList   1
 #define PosixEventFlag_Read     2
 #define PosixEventFlag_Write    4
+#define PosixEventFlag_Epoll    8   // Registered with the epoll instance (POSIX_USE_EPOLL builds only)
     
 typedef void (*mDNSPosixEventCallback)(int fd, void *context);
 struct PosixEventSource
@@ -133,6 +134,7 @@ extern mStatus mDNSPosixRemoveFDFromEventLoop( int fd);
 extern mStatus mDNSPosixListenForSignalInEventLoop( int signum);
 extern mStatus mDNSPosixIgnoreSignalInEventLoop( int signum);
 extern mStatus mDNSPosixRunEventLoopOnce( mDNS *m, const struct timeval *pTimeout, sigset_t *pSignalsReceived, mDNSBool *pDataDispatched);
+extern void mDNSPosixLogBatchStatistics(void);
 
 extern mStatus mDNSPosixListenForSignalInEventLoop( int signum);
 extern mStatus mDNSPosixIgnoreSignalInEventLoop( int signum);
@@ -53,14 +53,11 @@ recvfrom_flags(int fd, void *ptr, size_t nbytes, int *flagsp,
     ssize_t n;
 
 #ifdef CMSG_FIRSTHDR
-    struct cmsghdr  *cmptr;
     union {
         struct cmsghdr cm;
         char control[1024];
     } control_un;
 
-    *ttl = 255;         // If kernel fails to provide TTL data then assume the TTL was 255 as it should be
-
     msg.msg_control = control_un.control;
     msg.msg_controllen = sizeof(control_un.control);
     msg.msg_flags = 0;
@@ -79,6 +76,25 @@ recvfrom_flags(int fd, void *ptr, size_t nbytes, int *flagsp,
         return(n);
 
     *salenptr = msg.msg_namelen;    /* pass back results */
+    recvmsg_ancillary(&msg, flagsp, pktp, ttl);
+    return(n);
+}
+
+/* Pass back the msg_flags, destination address, interface and TTL of a datagram that has already been */
+/* received with recvmsg() or recvmmsg(), using a msghdr set up the way recvfrom_flags() sets it up. */
+void
+recvmsg_ancillary(const struct msghdr *msgp, int *flagsp, struct my_in_pktinfo *pktp, u_char *ttl)
+{
+#ifdef CMSG_FIRSTHDR
+    struct msghdr msg = *msgp;      /* CMSG_NXTHDR isn't const-clean on every platform */
+    struct cmsghdr  *cmptr;
+
+    *ttl = 255;         // If kernel fails to provide TTL data then assume the TTL was 255 as it should be
+#else
+    (void)msgp;
+    (void)ttl;
+#endif /* CMSG_FIRSTHDR */
+
     if (pktp) {
         /* 0.0.0.0, i/f = -1 */
         /* We set the interface to -1 so that the caller can
@@ -96,13 +112,12 @@ recvfrom_flags(int fd, void *ptr, size_t nbytes, int *flagsp,
 #ifndef CMSG_FIRSTHDR
     #warning CMSG_FIRSTHDR not defined. Will not be able to determine destination address, received interface, etc.
     *flagsp = 0;                    /* pass back results */
-    return(n);
 #else
 
     *flagsp = msg.msg_flags;        /* pass back results */
     if (msg.msg_controllen < (socklen_t)sizeof(struct cmsghdr) ||
         (msg.msg_flags & MSG_CTRUNC) || pktp == NULL)
-        return(n);
+        return;
 
     for (cmptr = CMSG_FIRSTHDR(&msg); cmptr != NULL;
          cmptr = CMSG_NXTHDR(&msg, cmptr)) {
@@ -203,7 +218,6 @@ recvfrom_flags(int fd, void *ptr, size_t nbytes, int *flagsp,
 #endif
         assert(0);  // unknown ancillary data
     }
-    return(n);
 #endif /* CMSG_FIRSTHDR */
 }
 
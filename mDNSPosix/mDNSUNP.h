@@ -74,6 +74,9 @@ struct my_in_pktinfo {
 extern ssize_t recvfrom_flags(int fd, void *ptr, size_t nbytes, int *flagsp,
                               struct sockaddr *sa, socklen_t *salenptr, struct my_in_pktinfo *pktp, u_char *ttl);
 
+/* The ancillary-data half of recvfrom_flags, for callers that receive with recvmmsg() */
+extern void recvmsg_ancillary(const struct msghdr *msgp, int *flagsp, struct my_in_pktinfo *pktp, u_char *ttl);
+
 #if defined(AF_INET6) && HAVE_IPV6
 #define INET6_ADDRSTRLEN 46 /*Maximum length of IPv6 address */
 #endif
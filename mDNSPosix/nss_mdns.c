@@ -76,10 +76,12 @@
 #include <syslog.h>
 #include <pthread.h>
 #include <ctype.h>
+#include <stddef.h>
 
 #include <sys/types.h>
 #include <sys/time.h>
 #include <sys/socket.h>
+#include <time.h>
 
 #include <netinet/in.h>
 
@@ -363,6 +365,28 @@ int
 config_is_mdns_suffix (const char * name);
 
 
+/*
+    Get the lookup cache settings.
+
+    Parameters
+        entries
+            Receives the maximum number of cached lookups.  Zero means
+            lookups are not cached.
+        max_ttl
+            Receives the longest time, in seconds, that a successful
+            lookup is cached.  It is never kept longer than the TTL of the
+            records that answered it.
+        negative_ttl
+            Receives the time, in seconds, that a failed lookup is cached.
+
+    Returns
+        0 success
+        non-zero configuration error code
+ */
+errcode_t
+config_cache_params (int * entries, int * max_ttl, int * negative_ttl);
+
+
 /*
     Loads all relevant data from configuration file.  Other code should
     rarely need to call this function, since all other public configuration
@@ -515,12 +539,55 @@ typedef struct result_map
     // Index points to lowest entry
     int r_errno;
     int r_h_errno;
+    uint32_t ttl;
+    // Smallest TTL of the records added to the result
 } result_map_t;
 
 static const struct timeval
 k_select_time = { 0, 500000 };
 // 0 seconds, 500 milliseconds
 
+// Lookup cache entry.
+// The data array holds, in order: addr_count addresses of addr_len bytes
+// each, then the lookup key and the name_count names, each null
+// terminated.  Addresses come first to keep them int aligned for
+// add_address_to_buffer.
+typedef struct cache_entry
+{
+    struct cache_entry * hash_next;
+    struct cache_entry * lru_prev;
+    struct cache_entry * lru_next;
+    // Most recently used at the head of the LRU list
+    unsigned int hash;
+    int rrtype;
+    time_t expires;
+    // CLOCK_MONOTONIC seconds
+    nss_status status;
+    // NSS_STATUS_SUCCESS, or NSS_STATUS_NOTFOUND for a cached failure
+    int name_count;
+    int addr_count;
+    int addr_len;
+    const char * key;
+    union
+    {
+        uint32_t align;
+        char bytes [1];
+    } data;
+} cache_entry_t;
+
+typedef struct
+{
+    int entries;
+    // Maximum number of entries; zero when caching is disabled
+    int max_ttl;
+    int negative_ttl;
+    int count;
+    unsigned int hash_mask;
+    cache_entry_t ** hash;
+    cache_entry_t * lru_head;
+    cache_entry_t * lru_tail;
+} lookup_cache_t;
+
 //----------
 // Local prototypes
 
@@ -595,6 +662,21 @@ init_result (
     size_t buflen
     );
 
+
+/*
+    Look up a previous result in the cache.  On a hit, copies the cached
+    result into 'result' and returns 1.  Returns 0 on a miss, or if caching
+    is disabled.
+ */
+static int
+cache_lookup (int rrtype, const char * key, result_map_t * result);
+
+/*
+    Add the outcome of a completed lookup to the cache.
+ */
+static void
+cache_store (int rrtype, const char * key, const result_map_t * result);
+
 static int
 callback_body_ptr (
     const char * fullname,
@@ -651,6 +733,10 @@ static nss_status set_err_success (result_map_t * result);
 //----------
 // Global variables
 
+static lookup_cache_t g_cache;
+static int g_cache_initialised = 0;
+static pthread_mutex_t g_cache_mutex = PTHREAD_MUTEX_INITIALIZER;
+
 
 //----------
 // NSS functions
@@ -883,6 +969,11 @@ mdns_lookup_name (
     }
     result->hostent->h_addrtype = af;
 
+    if (cache_lookup (rrtype, fullname, result))
+    {
+        return result->status;
+    }
+
     errcode =
         DNSServiceQueryRecord (
             &sdref,
@@ -906,6 +997,7 @@ mdns_lookup_name (
 
     status = handle_events (sdref, result, fullname);
     DNSServiceRefDeallocate (sdref);
+    cache_store (rrtype, fullname, result);
     return status;
 }
 
@@ -958,6 +1050,11 @@ mdns_lookup_addr (
 
     result->hostent->h_name [0] = 0;
 
+    if (cache_lookup (kDNSServiceType_PTR, addr_str, result))
+    {
+        return result->status;
+    }
+
     errcode =
         DNSServiceQueryRecord (
             &sdref,
@@ -981,6 +1078,7 @@ mdns_lookup_addr (
 
     status = handle_events (sdref, result, addr_str);
     DNSServiceRefDeallocate (sdref);
+    cache_store (kDNSServiceType_PTR, addr_str, result);
     return status;
 }
 
@@ -1076,7 +1174,6 @@ mdns_lookup_callback
 
     (void)sdref; // Unused
     (void)interface_index; // Unused
-    (void)ttl; // Unused
 
     if (!(flags & kDNSServiceFlagsMoreComing) )
     {
@@ -1145,6 +1242,9 @@ mdns_lookup_callback
             return;
         }
 
+        if (ttl < result->ttl)
+            result->ttl = ttl;
+
         if (result->status != NSS_STATUS_SUCCESS)
             set_err_success (result);
     }
@@ -1517,6 +1617,7 @@ init_result (
     result->addr_idx = 0;
     result->alias_idx = buflen - sizeof (buf_header_t);
     result->done = 0;
+    result->ttl = 0xFFFFFFFF;
     set_err_notfound (result);
 
     // Point hostent to the right buffers
@@ -1681,6 +1782,334 @@ is_applicable_addr (
     }
 }
 
+//----------
+// Cache functions
+
+/*
+    Current time in seconds, for cache expiry.  Uses the monotonic clock so
+    that cached entries aren't affected by changes to the system time.
+ */
+static time_t
+cache_now (void)
+{
+    struct timespec ts;
+    clock_gettime (CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec;
+}
+
+
+/*
+    Case insensitive hash of a lookup key, since DNS names are case
+    insensitive.
+ */
+static unsigned int
+cache_hash (int rrtype, const char * key)
+{
+    unsigned int hash = 2166136261u ^ (unsigned int) rrtype;
+    for (; *key; key++)
+    {
+        hash = (hash ^ (unsigned char) tolower ((unsigned char) *key)) * 16777619u;
+    }
+
+    return hash;
+}
+
+
+/*
+    Set up the cache from the configuration on first use.
+    Must be called with g_cache_mutex held.
+
+    Returns
+        1 if caching is enabled
+        0 otherwise
+ */
+static int
+cache_init_locked (void)
+{
+    if (!g_cache_initialised)
+    {
+        int entries = 0;
+        int max_ttl = 0;
+        int negative_ttl = 0;
+        unsigned int buckets = 1;
+
+        if (config_cache_params (&entries, &max_ttl, &negative_ttl))
+        {
+            // Config not ready yet - try again next time
+            return 0;
+        }
+
+        while (entries > 0 && buckets < (unsigned int) entries && buckets < 0x10000)
+        {
+            buckets <<= 1;
+        }
+        if (entries > 0)
+        {
+            g_cache.hash =
+                (cache_entry_t **) calloc (buckets, sizeof (cache_entry_t *));
+            if (!g_cache.hash)
+            {
+                syslog (LOG_ERR,
+                        "mdns: Can't allocate memory in nss_mdns:cache_init_locked, %s:%d",
+                        __FILE__, __LINE__
+                        );
+                entries = 0;
+            }
+        }
+        g_cache.entries = entries;
+        g_cache.max_ttl = max_ttl;
+        g_cache.negative_ttl = negative_ttl;
+        g_cache.hash_mask = buckets - 1;
+        g_cache_initialised = 1;
+    }
+
+    return g_cache.entries > 0;
+}
+
+
+static void
+cache_lru_unlink (cache_entry_t * entry)
+{
+    if (entry->lru_prev)
+        entry->lru_prev->lru_next = entry->lru_next;
+    else
+        g_cache.lru_head = entry->lru_next;
+
+    if (entry->lru_next)
+        entry->lru_next->lru_prev = entry->lru_prev;
+    else
+        g_cache.lru_tail = entry->lru_prev;
+}
+
+
+static void
+cache_lru_push_front (cache_entry_t * entry)
+{
+    entry->lru_prev = NULL;
+    entry->lru_next = g_cache.lru_head;
+    if (g_cache.lru_head)
+        g_cache.lru_head->lru_prev = entry;
+    else
+        g_cache.lru_tail = entry;
+    g_cache.lru_head = entry;
+}
+
+
+/*
+    Unlink an entry from the hash table and LRU list, and free it.
+ */
+static void
+cache_remove (cache_entry_t * entry)
+{
+    cache_entry_t ** p = &g_cache.hash [entry->hash & g_cache.hash_mask];
+    while (*p != entry)
+    {
+        p = &(*p)->hash_next;
+    }
+    *p = entry->hash_next;
+
+    cache_lru_unlink (entry);
+    g_cache.count--;
+    free (entry);
+}
+
+
+/*
+    Find the entry for a key, discarding it if it has expired.
+    Must be called with g_cache_mutex held.
+ */
+static cache_entry_t *
+cache_find (int rrtype, const char * key, unsigned int hash)
+{
+    cache_entry_t * entry = g_cache.hash [hash & g_cache.hash_mask];
+
+    for (; entry; entry = entry->hash_next)
+    {
+        if (
+            entry->hash == hash
+            && entry->rrtype == rrtype
+            && strcasecmp (entry->key, key) == 0
+            )
+        {
+            if (entry->expires - cache_now () <= 0)
+            {
+                cache_remove (entry);
+                return NULL;
+            }
+            return entry;
+        }
+    }
+
+    return NULL;
+}
+
+
+static int
+cache_lookup (int rrtype, const char * key, result_map_t * result)
+{
+    cache_entry_t * entry;
+    int hit = 0;
+
+    pthread_mutex_lock (&g_cache_mutex);
+    if (cache_init_locked ())
+    {
+        entry = cache_find (rrtype, key, cache_hash (rrtype, key));
+        if (entry)
+        {
+            const char * addr = entry->data.bytes;
+            const char * name =
+                addr + entry->addr_count * entry->addr_len + strlen (entry->key) + 1;
+            int i;
+
+            hit = 1;
+            cache_lru_unlink (entry);
+            cache_lru_push_front (entry);
+
+            if (entry->status == NSS_STATUS_SUCCESS)
+            {
+                // Rebuild the result the same way the query callback would,
+                // so that a too-small buffer is reported in the same way.
+                for (i = 0; i < entry->name_count; i++)
+                {
+                    int len = strlen (name);
+                    if (!add_hostname_or_alias (result, name, len))
+                        break;
+                    name += len + 1;
+                }
+                for (i = 0; i < entry->addr_count; i++)
+                {
+                    if (!add_address_to_buffer (result, addr, entry->addr_len))
+                        break;
+                    addr += entry->addr_len;
+                }
+                if (result->status == NSS_STATUS_NOTFOUND)
+                    set_err_success (result);
+            }
+            else
+            {
+                set_err_notfound (result);
+            }
+
+            if (MDNS_VERBOSE)
+                syslog (LOG_DEBUG,
+                        "mdns: Cache hit for %s",
+                        key
+                        );
+        }
+    }
+    pthread_mutex_unlock (&g_cache_mutex);
+
+    return hit;
+}
+
+
+static void
+cache_store (int rrtype, const char * key, const result_map_t * result)
+{
+    const buf_header_t * header = result->header;
+    int addr_len = result->hostent->h_length;
+    int addr_count = 0;
+    int name_count = 0;
+    size_t size;
+    int ttl;
+    int i;
+    char * p;
+    unsigned int hash;
+    cache_entry_t * entry;
+
+    pthread_mutex_lock (&g_cache_mutex);
+    if (!cache_init_locked ())
+    {
+        pthread_mutex_unlock (&g_cache_mutex);
+        return;
+    }
+
+    if (result->status == NSS_STATUS_SUCCESS)
+    {
+        ttl = (result->ttl < (uint32_t) g_cache.max_ttl) ? (int) result->ttl : g_cache.max_ttl;
+        // For a PTR lookup the address is the query itself, not part of the answer
+        if (rrtype != kDNSServiceType_PTR)
+            addr_count = result->addrs_count;
+        name_count = (header->hostname [0] ? 1 : 0) + result->aliases_count;
+    }
+    else if (result->status == NSS_STATUS_NOTFOUND)
+    {
+        ttl = g_cache.negative_ttl;
+    }
+    else
+    {
+        // Don't cache errors that may go away if retried
+        ttl = 0;
+    }
+    if (ttl <= 0)
+    {
+        pthread_mutex_unlock (&g_cache_mutex);
+        return;
+    }
+
+    size = offsetof (cache_entry_t, data) + addr_count * addr_len + strlen (key) + 1;
+    if (name_count > 0)
+    {
+        size += strlen (header->hostname) + 1;
+        for (i = 0; i < result->aliases_count; i++)
+            size += strlen (header->aliases [i]) + 1;
+    }
+
+    entry = (cache_entry_t *) malloc (size);
+    if (!entry)
+    {
+        pthread_mutex_unlock (&g_cache_mutex);
+        return;
+    }
+
+    hash = cache_hash (rrtype, key);
+    entry->hash = hash;
+    entry->rrtype = rrtype;
+    entry->expires = cache_now () + ttl;
+    entry->status = result->status;
+    entry->name_count = name_count;
+    entry->addr_count = addr_count;
+    entry->addr_len = addr_len;
+
+    p = entry->data.bytes;
+    for (i = 0; i < addr_count; i++)
+    {
+        memcpy (p, header->addrs [i], addr_len);
+        p += addr_len;
+    }
+    entry->key = p;
+    strcpy (p, key);
+    p += strlen (p) + 1;
+    if (name_count > 0)
+    {
+        strcpy (p, header->hostname);
+        p += strlen (p) + 1;
+        for (i = 0; i < result->aliases_count; i++)
+        {
+            strcpy (p, header->aliases [i]);
+            p += strlen (p) + 1;
+        }
+    }
+
+    // Replace any entry stored by another thread doing the same lookup,
+    // then make room if necessary
+    {
+        cache_entry_t * old = cache_find (rrtype, key, hash);
+        if (old)
+            cache_remove (old);
+    }
+    if (g_cache.count >= g_cache.entries)
+        cache_remove (g_cache.lru_tail);
+
+    entry->hash_next = g_cache.hash [hash & g_cache.hash_mask];
+    g_cache.hash [hash & g_cache.hash_mask] = entry;
+    cache_lru_push_front (entry);
+    g_cache.count++;
+
+    pthread_mutex_unlock (&g_cache_mutex);
+}
+
+
 //----------
 // Types and Constants
 
@@ -1690,6 +2119,9 @@ const char * k_conf_file = "/etc/nss_mdns.conf";
 const char k_comment_char = '#';
 
 const char * k_keyword_domain = "domain";
+const char * k_keyword_cache_entries = "cache_entries";
+const char * k_keyword_cache_max_ttl = "cache_max_ttl";
+const char * k_keyword_cache_negative_ttl = "cache_negative_ttl";
 
 const char * k_default_domains [] =
 {
@@ -1719,11 +2151,20 @@ typedef struct domain_entry
 typedef struct
 {
     domain_entry_t * domains;
+    int cache_entries;
+    int cache_max_ttl;
+    int cache_negative_ttl;
 } config_t;
 
 const config_t k_empty_config =
 {
-    NULL
+    NULL,
+    128,
+    // cache_entries
+    60,
+    // cache_max_ttl, seconds
+    5
+    // cache_negative_ttl, seconds
 };
 
 
@@ -1757,6 +2198,14 @@ default_config (config_t * conf);
 static errcode_t
 add_domain (config_t * conf, const char * domain);
 
+static void
+set_cache_param (
+    int * param,
+    const char * keyword,
+    char * line,
+    config_file_context_t * context
+    );
+
 static int
 contains_domain (const config_t * conf, const char * domain);
 
@@ -1878,6 +2327,21 @@ config_is_mdns_suffix (const char * name)
 }
 
 
+errcode_t
+config_cache_params (int * entries, int * max_ttl, int * negative_ttl)
+{
+    int errcode = init_config ();
+    if (!errcode)
+    {
+        *entries = g_config->cache_entries;
+        *max_ttl = g_config->cache_max_ttl;
+        *negative_ttl = g_config->cache_negative_ttl;
+    }
+
+    return errcode;
+}
+
+
 //----------
 // Local functions
 
@@ -1978,6 +2442,18 @@ process_config_line (
                     );
         }
     }
+    else if (strcmp (word, k_keyword_cache_entries) == 0)
+    {
+        set_cache_param (&conf->cache_entries, word, curr, context);
+    }
+    else if (strcmp (word, k_keyword_cache_max_ttl) == 0)
+    {
+        set_cache_param (&conf->cache_max_ttl, word, curr, context);
+    }
+    else if (strcmp (word, k_keyword_cache_negative_ttl) == 0)
+    {
+        set_cache_param (&conf->cache_negative_ttl, word, curr, context);
+    }
     else
     {
         syslog (LOG_WARNING,
@@ -2106,6 +2582,59 @@ add_domain (config_t * conf, const char * domain)
 }
 
 
+/*
+    Parse the non-negative integer value of a cache keyword.  Bad values
+    are reported to syslog and leave the setting unchanged.
+ */
+static void
+set_cache_param (
+    int * param,
+    const char * keyword,
+    char * line,
+    config_file_context_t * context
+    )
+{
+    char * word = get_next_word (line, &line);
+    char * end;
+    long value;
+
+    if (!word)
+    {
+        syslog (LOG_WARNING,
+                "%s, line %d: no value specified for %s",
+                context->filename,
+                context->linenum,
+                keyword
+                );
+        return;
+    }
+
+    value = strtol (word, &end, 10);
+    if (*end || value < 0 || value > 0x7FFFFFFF)
+    {
+        syslog (LOG_WARNING,
+                "%s, line %d: bad value %s for %s - skipping",
+                context->filename,
+                context->linenum,
+                word,
+                keyword
+                );
+        return;
+    }
+    *param = (int) value;
+
+    if (get_next_word (line, NULL))
+    {
+        syslog (LOG_WARNING,
+                "%s, line %d: ignored extra text found after %s",
+                context->filename,
+                context->linenum,
+                keyword
+                );
+    }
+}
+
+
 static int
 contains_domain (const config_t * conf, const char * domain)
 {
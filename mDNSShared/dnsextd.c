@@ -38,6 +38,10 @@
 #include <time.h>
 #include <errno.h>
 
+#if POSIX_USE_EPOLL
+#include <sys/epoll.h>
+#endif
+
 #if __APPLE__
 #undef daemon
 extern int daemon(int, int);
@@ -74,6 +78,15 @@ mDNSexport const char ProgramName[] = "dnsextd";
 #define SRV_TTL                     7200                // TTL For _dns-update SRV records
 #define CONFIG_FILE                 "/etc/dnsextd.conf"
 #define TCP_SOCKET_FLAGS            kTCPSocketFlags_UseTLS
+#define DEFAULT_WORKER_THREADS      16                  // threads relaying requests to the server
+#define WORK_QUEUE_MAX              4096                // requests waiting for a worker before new ones are refused
+
+#if POSIX_USE_EPOLL
+// Listening sockets are stored in epoll_data as (fd << 1) | EPOLL_SOCKET_TAG; anything else is an
+// EventSource pointer, whose low bit is always clear.
+#define EPOLL_SOCKET_TAG            1
+#define EPOLL_MAX_EVENTS            64
+#endif
 
 // LLQ Lease bounds (seconds)
 #define LLQ_MIN_LEASE (15 * 60)
@@ -96,7 +109,7 @@ mDNSexport const char ProgramName[] = "dnsextd";
 // Structs/fields that must be locked for thread safety are explicitly commented
 //
 
-// args passed to UDP request handler thread as void*
+// args passed to UDP request handler as void*
 
 typedef struct
 {
@@ -106,7 +119,7 @@ typedef struct
     int sd;
 } UDPContext;
 
-// args passed to TCP request handler thread as void*
+// args passed to TCP request handler as void*
 typedef struct
 {
     PktMsg pkt;
@@ -115,7 +128,7 @@ typedef struct
     DaemonInfo *d;
 } TCPContext;
 
-// args passed to UpdateAnswerList thread as void*
+// args passed to UpdateAnswerList as void*
 typedef struct
 {
     DaemonInfo *d;
@@ -255,6 +268,26 @@ mDNSlocal mStatus AddSourceToEventLoop( DaemonInfo * self, TCPSocket *sock, Even
     newSource->context = context;
     newSource->sock = sock;
     newSource->fd = mDNSPlatformTCPGetFD( sock );
+    newSource->markedForDeletion = mDNSfalse;
+
+#if POSIX_USE_EPOLL
+    if ( self->epollfd >= 0 )
+    {
+        struct epoll_event ev;
+
+        mDNSPlatformMemZero( &ev, sizeof( ev ) );
+        ev.events = EPOLLIN;
+        ev.data.ptr = newSource;
+
+        if ( epoll_ctl( self->epollfd, EPOLL_CTL_ADD, newSource->fd, &ev ) < 0 )
+        {
+            LogErr( "AddSourceToEventLoop", "epoll_ctl" );
+            free( newSource );
+            err = mStatus_UnknownErr;
+            goto exit;
+        }
+    }
+#endif
 
     AddToTail( &self->eventSources, newSource );
 
@@ -265,6 +298,7 @@ exit:
 
 
 // Remove socket from event loop
+// The EventSource itself is only freed by FreeDeadSources, since Run may still be holding a pointer to it
 
 mDNSlocal mStatus RemoveSourceFromEventLoop( DaemonInfo * self, TCPSocket *sock )
 {
@@ -275,9 +309,17 @@ mDNSlocal mStatus RemoveSourceFromEventLoop( DaemonInfo * self, TCPSocket *sock
     {
         if ( source->sock == sock )
         {
+#if POSIX_USE_EPOLL
+            if ( self->epollfd >= 0 )
+            {
+                epoll_ctl( self->epollfd, EPOLL_CTL_DEL, source->fd, NULL );
+            }
+#endif
             RemoveFromList( &self->eventSources, source );
 
-            free( source );
+            source->markedForDeletion = mDNStrue;
+            source->next = self->deadSources;
+            self->deadSources = source;
             err = mStatus_NoError;
             goto exit;
         }
@@ -290,6 +332,206 @@ exit:
     return err;
 }
 
+mDNSlocal void FreeDeadSources( DaemonInfo * self )
+{
+    while ( self->deadSources )
+    {
+        EventSource * source = self->deadSources;
+        self->deadSources = source->next;
+        free( source );
+    }
+}
+
+
+//
+// Worker Pool
+// Requests that have to wait on the server are queued for a fixed pool of worker threads instead of each
+// getting a thread of its own.  The lease table is locked; the LLQ tables stay with the main thread.
+//
+
+static const char * const kWorkTypeNames[ kWorkTypeCount ] = { "UDP request", "TCP request", "LLQ answer refresh" };
+
+mDNSlocal unsigned long UsecSince( const struct timeval * then, const struct timeval * now )
+{
+    long usec = ( now->tv_sec - then->tv_sec ) * 1000000L + ( now->tv_usec - then->tv_usec );
+    return ( usec > 0 ) ? ( unsigned long ) usec : 0;
+}
+
+mDNSlocal void*
+WorkerThread
+(
+    void * vptr
+)
+{
+    DaemonInfo  *   d = ( DaemonInfo* ) vptr;
+
+    if ( pthread_mutex_lock( &d->worklock ) ) { LogErr( "WorkerThread", "pthread_mutex_lock" ); return NULL; }
+
+    while ( 1 )
+    {
+        WorkItem    *   item;
+        WorkStats   *   stats;
+        struct timeval start, done;
+        unsigned long usec;
+
+        while ( !d->workhead && !d->workstop )
+        {
+            pthread_cond_wait( &d->workready, &d->worklock );
+        }
+
+        item = d->workhead;
+        if ( !item ) break;     // shutting down, and nothing left to do
+
+        d->workhead = item->next;
+        if ( !d->workhead ) d->worktail = NULL;
+        d->workdepth--;
+
+        stats = &d->workstats[ item->type ];
+        stats->depth--;
+        stats->running++;
+        gettimeofday( &start, NULL );
+        usec = UsecSince( &item->queued, &start );
+        stats->totalWait += usec;
+        if ( usec > stats->maxWait ) stats->maxWait = usec;
+
+        pthread_mutex_unlock( &d->worklock );
+        item->handler( item->context );
+        gettimeofday( &done, NULL );
+        pthread_mutex_lock( &d->worklock );
+
+        stats->running--;
+        stats->completed++;
+        usec = UsecSince( &start, &done );
+        stats->totalRun += usec;
+        if ( usec > stats->maxRun ) stats->maxRun = usec;
+        pthread_cond_broadcast( &d->workdone );
+        free( item );
+    }
+
+    pthread_mutex_unlock( &d->worklock );
+    return NULL;
+}
+
+// Hand handler( context ) to the worker pool.  Requests from clients are refused once WORK_QUEUE_MAX items
+// are waiting, in which case the caller still owns context.
+mDNSlocal mStatus QueueWork( DaemonInfo * d, WorkType type, WorkHandler handler, void * context )
+{
+    WorkItem    *   item;
+    WorkStats   *   stats = &d->workstats[ type ];
+    mStatus err = mStatus_NoError;
+
+    item = malloc( sizeof( *item ) );
+    require_action( item, exit, err = mStatus_NoMemoryErr; LogErr( "QueueWork", "malloc" ) );
+
+    item->next = NULL;
+    item->type = type;
+    item->handler = handler;
+    item->context = context;
+    gettimeofday( &item->queued, NULL );
+
+    if ( pthread_mutex_lock( &d->worklock ) ) { LogErr( "QueueWork", "pthread_mutex_lock" ); free( item ); return mStatus_UnknownErr; }
+
+    if ( type != kWorkAnswerRefresh && d->workdepth >= WORK_QUEUE_MAX )
+    {
+        stats->dropped++;
+        pthread_mutex_unlock( &d->worklock );
+        free( item );
+        err = mStatus_Refused;
+        goto exit;
+    }
+
+    if ( d->worktail ) d->worktail->next = item;
+    else d->workhead = item;
+    d->worktail = item;
+    d->workdepth++;
+    stats->queued++;
+    if ( ++stats->depth > stats->maxDepth ) stats->maxDepth = stats->depth;
+
+    pthread_cond_signal( &d->workready );
+    pthread_mutex_unlock( &d->worklock );
+
+exit:
+
+    return err;
+}
+
+// Block until every queued item of the given type has been handled
+mDNSlocal void WaitForWork( DaemonInfo * d, WorkType type )
+{
+    if ( pthread_mutex_lock( &d->worklock ) ) { LogErr( "WaitForWork", "pthread_mutex_lock" ); return; }
+    while ( d->workstats[ type ].depth || d->workstats[ type ].running )
+    {
+        pthread_cond_wait( &d->workdone, &d->worklock );
+    }
+    pthread_mutex_unlock( &d->worklock );
+}
+
+mDNSlocal int StartWorkers( DaemonInfo * d )
+{
+    sigset_t all, old;
+    int i;
+
+    if ( pthread_mutex_init( &d->worklock, NULL ) ) { LogErr( "StartWorkers", "pthread_mutex_init" ); return -1; }
+    if ( pthread_cond_init( &d->workready, NULL ) ) { LogErr( "StartWorkers", "pthread_cond_init" ); return -1; }
+    if ( pthread_cond_init( &d->workdone, NULL ) ) { LogErr( "StartWorkers", "pthread_cond_init" ); return -1; }
+
+    d->workers = calloc( d->nworkers, sizeof( pthread_t ) );
+    if ( !d->workers ) { LogErr( "StartWorkers", "calloc" ); return -1; }
+
+    // Workers inherit a mask that blocks every signal, so signals interrupt the main thread's wait in Run
+    sigfillset( &all );
+    pthread_sigmask( SIG_SETMASK, &all, &old );
+    for ( i = 0; i < d->nworkers; i++ )
+    {
+        if ( pthread_create( &d->workers[ i ], NULL, WorkerThread, d ) ) { LogErr( "StartWorkers", "pthread_create" ); break; }
+    }
+    pthread_sigmask( SIG_SETMASK, &old, NULL );
+
+    d->nworkers = i;
+    return ( i > 0 ) ? 0 : -1;
+}
+
+// Let the workers finish what is already queued, then wait for them to exit
+mDNSlocal void StopWorkers( DaemonInfo * d )
+{
+    int i;
+
+    pthread_mutex_lock( &d->worklock );
+    d->workstop = mDNStrue;
+    pthread_cond_broadcast( &d->workready );
+    pthread_mutex_unlock( &d->worklock );
+
+    for ( i = 0; i < d->nworkers; i++ )
+    {
+        pthread_join( d->workers[ i ], NULL );
+    }
+    free( d->workers );
+    d->workers = NULL;
+    d->nworkers = 0;
+}
+
+mDNSlocal void PrintWorkStats( DaemonInfo * d )
+{
+    int i;
+
+    if ( pthread_mutex_lock( &d->worklock ) ) { LogErr( "PrintWorkStats", "pthread_mutex_lock" ); return; }
+
+    Log( "Worker pool: %d threads; %d items waiting", d->nworkers, d->workdepth );
+
+    for ( i = 0; i < kWorkTypeCount; i++ )
+    {
+        const WorkStats * stats = &d->workstats[ i ];
+        unsigned long n = stats->completed ? stats->completed : 1;
+
+        Log( "%s: queued %lu, dropped %lu, completed %lu; depth %d (max %d), running %d; "
+             "wait avg %lu max %lu usec; run avg %lu max %lu usec",
+             kWorkTypeNames[ i ], stats->queued, stats->dropped, stats->completed, stats->depth, stats->maxDepth,
+             stats->running, stats->totalWait / n, stats->maxWait, stats->totalRun / n, stats->maxRun );
+    }
+
+    pthread_mutex_unlock( &d->worklock );
+}
+
 // create a socket connected to nameserver
 // caller terminates connection via close()
 mDNSlocal TCPSocket *ConnectToServer(DaemonInfo *d)
@@ -1021,7 +1263,7 @@ mDNSlocal int SetUpdateSRV(DaemonInfo *d)
 
 mDNSlocal void PrintUsage(void)
 {
-    fprintf(stderr, "Usage: dnsextd [-f <config file>] [-vhd] ...\n"
+    fprintf(stderr, "Usage: dnsextd [-f <config file>] [-t <threads>] [-vhd] ...\n"
             "Use \"dnsextd -h\" for help\n");
 }
 
@@ -1048,6 +1290,8 @@ mDNSlocal void PrintHelp(void)
 
             "-h    Print help.\n\n"
 
+            "-t    Number of threads relaying requests to the name server. The default is 16.\n\n"
+
             "-v    Verbose output.\n\n"
             );
 }
@@ -1091,14 +1335,16 @@ mDNSlocal int ProcessArgs(int argc, char *argv[], DaemonInfo *d)
 
     d->private_port = PrivateDNSPort;
     d->llq_port     = DNSEXTPort;
+    d->nworkers     = DEFAULT_WORKER_THREADS;
 
-    while ((opt = getopt(argc, argv, "f:hdv")) != -1)
+    while ((opt = getopt(argc, argv, "f:hdt:v")) != -1)
     {
         switch(opt)
         {
         case 'f': free( cfgfile ); cfgfile = strdup( optarg ); require_action( cfgfile, arg_error, err = mStatus_NoMemoryErr ); break;
         case 'h': PrintHelp();    return -1;
         case 'd': foreground = 1; break;            // Also used when launched via OS X's launchd mechanism
+        case 't': d->nworkers = atoi( optarg ); require_action( d->nworkers > 0, arg_error, err = mStatus_BadParamErr ); break;
         case 'v': verbose = 1;    break;
         default:  goto arg_error;
         }
@@ -1138,6 +1384,7 @@ arg_error:
 mDNSlocal int InitLeaseTable(DaemonInfo *d)
 {
     if (pthread_mutex_init(&d->tablelock, NULL)) { LogErr("InitLeaseTable", "pthread_mutex_init"); return -1; }
+    if (pthread_mutex_init(&d->updatelock, NULL)) { LogErr("InitLeaseTable", "pthread_mutex_init"); return -1; }
     d->nbuckets = LEASETABLE_INIT_NBUCKETS;
     d->nelems = 0;
     d->table = malloc(sizeof(RRTableElem *) * LEASETABLE_INIT_NBUCKETS);
@@ -1237,8 +1484,6 @@ SetupSockets
 
     // set up socket on which we receive private requests
 
-    self->llq_tcpsd = socket( AF_INET, SOCK_STREAM, 0 );
-    require_action( dnssd_SocketValid(self->tlssd), exit, err = mStatus_UnknownErr; LogErr( "SetupSockets", "socket" ) );
     mDNSPlatformMemZero(&daddr, sizeof(daddr));
     daddr.sin_family        = AF_INET;
     daddr.sin_addr.s_addr   = zerov4Addr.NotAnInteger;
@@ -1284,6 +1529,42 @@ exit:
 // periodic table updates
 //
 
+// Hand a zone change to the main thread so it can send LLQ events.  update is an accepted update request in
+// network byte order, or NULL if the zone changed in a way that requires every answer list to be re-queried.
+mDNSlocal void QueueLLQUpdate(DaemonInfo *d, const PktMsg *update)
+{
+    LLQUpdate *u = NULL;
+    mDNSBool wake;
+    char pingmsg[4] = { 0 };
+
+    if (update)
+    {
+        u = malloc(sizeof(*u));
+        if (!u) LogErr("QueueLLQUpdate", "malloc");    // fall back to a full refresh
+        else
+        {
+            memcpy(&u->pkt, update, (const mDNSu8 *)&update->msg - (const mDNSu8 *)update + update->len);
+            u->next = NULL;
+        }
+    }
+
+    if (pthread_mutex_lock(&d->updatelock)) { LogErr("QueueLLQUpdate", "pthread_mutex_lock"); free(u); return; }
+    wake = !d->updatehead && !d->updaterefresh;
+    if (u)
+    {
+        if (d->updatetail) d->updatetail->next = u;
+        else d->updatehead = u;
+        d->updatetail = u;
+    }
+    else d->updaterefresh = mDNStrue;
+    pthread_mutex_unlock(&d->updatelock);
+
+    // tell the main thread there was an update so it can send LLQs.  It takes everything queued when it wakes,
+    // so only a change made to an empty queue needs to wake it.
+    if (wake && send(d->LLQEventNotifySock, pingmsg, sizeof(pingmsg), 0) != sizeof(pingmsg))
+        LogErr("QueueLLQUpdate", "send");
+}
+
 // Delete a resource record from the nameserver via a dynamic update
 // sd is a socket already connected to the server
 mDNSlocal void DeleteOneRecord(DaemonInfo *d, CacheRecord *rr, domainname *zname, TCPSocket *sock)
@@ -1325,6 +1606,7 @@ mDNSlocal void DeleteOneRecord(DaemonInfo *d, CacheRecord *rr, domainname *zname
 
     if (!SuccessfulUpdateTransaction(&pkt, reply))
         Log("Expiration update failed with rcode %d", reply ? reply->msg.h.flags.b[1] & kDNSFlag1_RC_Mask : -1);
+    else QueueLLQUpdate(d, &pkt);
 
 end:
     if (!ptr) { Log("DeleteOneRecord: Error constructing lease expiration update"); }
@@ -1577,7 +1859,6 @@ HandleRequest
 
     if ( reply && ( ( reply->msg.h.flags.b[0] & kDNSFlag0_QROP_Mask ) == ( kDNSFlag0_OP_Update | kDNSFlag0_QR_Response ) ) )
     {
-        char pingmsg[4];
         mDNSBool ok = SuccessfulUpdateTransaction( request, reply );
         require_action( ok, exit, err = mStatus_UnknownErr; VLog( "Message from %s not a successful update.", inet_ntop(AF_INET, &request->src.sin_addr, addrbuf, 32 ) ) );
 
@@ -1596,12 +1877,9 @@ HandleRequest
             reply = leaseReply;
         }
 
-        // tell the main thread there was an update so it can send LLQs
+        // hand the update's records to the main thread so it can send LLQ events
 
-        if ( send( self->LLQEventNotifySock, pingmsg, sizeof( pingmsg ), 0 ) != sizeof( pingmsg ) )
-        {
-            LogErr("HandleRequest", "send");
-        }
+        QueueLLQUpdate( self, request );
     }
 
 exit:
@@ -1791,7 +2069,7 @@ mDNSlocal CacheRecord *AnswerQuestion(DaemonInfo *d, AnswerListElem *e)
         if (!ansptr) { Log("AnswerQuestions: GetLargeResourceRecord returned NULL"); goto end; }
         if (lcr.r.resrec.RecordType != kDNSRecordTypePacketNegative)
         {
-            if (lcr.r.resrec.rrtype != e->type || lcr.r.resrec.rrclass != kDNSClass_IN || !SameDomainName(lcr.r.resrec.name, &e->name))
+            if ((lcr.r.resrec.rrtype != e->type && e->type != kDNSQType_ANY) || lcr.r.resrec.rrclass != kDNSClass_IN || !SameDomainName(lcr.r.resrec.name, &e->name))
             {
                 Log("AnswerQuestion: response %##s type #d does not answer question %##s type #d.  Discarding",
                     lcr.r.resrec.name->c, lcr.r.resrec.rrtype, e->name.c, e->type);
@@ -1811,8 +2089,8 @@ end:
     return AnswerList;
 }
 
-// Routine forks a thread to set EventList to contain Add/Remove events, and deletes any removes from the KnownAnswer list
-mDNSlocal void *UpdateAnswerList(void *args)
+// Worker pool routine to set EventList to contain Add/Remove events, and delete any removes from the KnownAnswer list
+mDNSlocal void UpdateAnswerList(void *args)
 {
     CacheRecord *cr, *NewAnswers, **na, **ka; // "new answer", "known answer"
     DaemonInfo *d = ((UpdateAnswerListArgs *)args)->d;
@@ -1877,8 +2155,6 @@ mDNSlocal void *UpdateAnswerList(void *args)
         NewAnswers = NewAnswers->next;
         free(cr);
     }
-
-    return NULL;
 }
 
 mDNSlocal void SendEvents(DaemonInfo *d, LLQEntry *e)
@@ -1967,7 +2243,208 @@ mDNSlocal void PrintLLQTable(DaemonInfo *d)
     }
 }
 
-// Send events to clients as a result of a change in the zone
+// Send the pending events of an answer list to every established LLQ that shares it
+mDNSlocal void SendAnswerListEvents(DaemonInfo *d, AnswerListElem *a, mDNSs32 now)
+{
+    LLQEntry *e;
+
+    for (e = d->LLQTable[DomainNameHashValue(&a->name) % LLQ_TABLESIZE]; e; e = e->next)
+        if (e->AnswerList == a && e->state == Established && e->expire >= now) SendEvents(d, e);
+}
+
+// Once events have been sent, move Add events from the Event list to the Known Answer list, and free Removes
+mDNSlocal void CommitLLQEvents(AnswerListElem *a)
+{
+    CacheRecord *cr = a->EventList, *tmp;
+
+    while (cr)
+    {
+        tmp = cr;
+        cr = cr->next;
+        if ((signed)tmp->resrec.rroriginalttl < 0) free(tmp);
+        else
+        {
+            tmp->next = a->KnownAnswers;
+            a->KnownAnswers = tmp;
+            tmp->resrec.rroriginalttl = 0;
+        }
+    }
+    a->EventList = NULL;
+}
+
+// Delete LLQs whose lease has run out.  GenLLQEvents does this as it goes; this catches them in between.
+mDNSlocal void DeleteExpiredLLQs(DaemonInfo *d)
+{
+    LLQEntry **e;
+    int i;
+    struct timeval t;
+
+    gettimeofday(&t, NULL);
+
+    for (i = 0; i < LLQ_TABLESIZE; i++)
+    {
+        e = &d->LLQTable[i];
+        while(*e)
+        {
+            if ((*e)->expire < t.tv_sec) DeleteLLQ(d, *e);
+            else e = &(*e)->next;
+        }
+    }
+}
+
+// Record that rr was added to the zone.  Cancels a pending Remove of the same record, and does nothing if the
+// clients already have it.
+mDNSlocal void AddLLQAnswer(AnswerListElem *a, const CacheRecord *rr)
+{
+    CacheRecord *cr, **ptr;
+
+    for (cr = a->KnownAnswers; cr; cr = cr->next)
+        if (IdenticalResourceRecord(&cr->resrec, &rr->resrec)) return;
+
+    for (ptr = &a->EventList; *ptr; ptr = &(*ptr)->next)
+    {
+        if (IdenticalResourceRecord(&(*ptr)->resrec, &rr->resrec))
+        {
+            cr = *ptr;
+            if ((signed)cr->resrec.rroriginalttl < 0)
+            {
+                // the clients were never told it went away, so it is still a known answer
+                *ptr = cr->next;
+                cr->resrec.rroriginalttl = 0;
+                cr->next = a->KnownAnswers;
+                a->KnownAnswers = cr;
+            }
+            return;
+        }
+    }
+
+    cr = CopyCacheRecord(rr, &a->name);
+    if (!cr) return;
+    cr->resrec.rroriginalttl = 1; // 1 means add
+    cr->next = a->EventList;
+    a->EventList = cr;
+}
+
+mDNSlocal mDNSBool LLQAnswerRemoved(const CacheRecord *cr, const ResourceRecord *rr, mDNSu16 rrtype)
+{
+    if (rr) return IdenticalResourceRecord(&cr->resrec, rr);
+    return (rrtype == kDNSQType_ANY || cr->resrec.rrtype == rrtype);
+}
+
+// Record that rr was removed from the zone, or if rr is NULL, every answer of type rrtype (kDNSQType_ANY for all
+// of them).  Known answers become Remove events, and pending Adds are dropped since the clients never saw them.
+mDNSlocal void RemoveLLQAnswers(AnswerListElem *a, const ResourceRecord *rr, mDNSu16 rrtype)
+{
+    CacheRecord *cr, **ptr;
+
+    ptr = &a->EventList;
+    while (*ptr)
+    {
+        cr = *ptr;
+        if ((signed)cr->resrec.rroriginalttl > 0 && LLQAnswerRemoved(cr, rr, rrtype))
+        { *ptr = cr->next; free(cr); }
+        else ptr = &cr->next;
+    }
+
+    ptr = &a->KnownAnswers;
+    while (*ptr)
+    {
+        cr = *ptr;
+        if (LLQAnswerRemoved(cr, rr, rrtype))
+        {
+            *ptr = cr->next;
+            cr->resrec.rroriginalttl = (unsigned)-1; // -1 means delete
+            cr->next = a->EventList;
+            a->EventList = cr;
+        }
+        else ptr = &cr->next;
+    }
+}
+
+// Turn the records of an accepted update into Add/Remove events on the answer lists for the same name and type,
+// and send them right away.  Returns -1 if the update can't be parsed.
+mDNSlocal int GenUpdateEvents(DaemonInfo *d, PktMsg *pkt)
+{
+    const mDNSu8 *ptr, *end = (mDNSu8 *)&pkt->msg + pkt->len;
+    LargeCacheRecord lcr;
+    ResourceRecord *rr = &lcr.r.resrec;
+    AnswerListElem *a;
+    struct timeval t;
+    int i, pass;
+
+    if (gettimeofday(&t, NULL)) { LogErr("GenUpdateEvents", "gettimeofday"); return -1; }
+    HdrNToH(pkt);
+
+    // pass 0 checks that every record can be read, pass 1 makes the events, and pass 2 sends them.  Events
+    // are sent only after the whole update is applied, so that deleting an rrset and adding back one of its
+    // records doesn't show up as a Remove.
+    for (pass = 0; pass < 3; pass++)
+    {
+        ptr = LocateAuthorities(&pkt->msg, end);
+        if (!ptr) { Log("GenUpdateEvents: Format error"); return -1; }
+
+        for (i = 0; i < pkt->msg.h.mDNS_numUpdates; i++)
+        {
+            mDNSBool DeleteAllRRSets = mDNSfalse, DeleteOneRRSet = mDNSfalse, DeleteOneRR = mDNSfalse;
+
+            ptr = GetLargeResourceRecord(NULL, &pkt->msg, ptr, end, 0, kDNSRecordTypePacketAns, &lcr);
+            if (!ptr || rr->RecordType == kDNSRecordTypePacketNegative) { Log("GenUpdateEvents: GetLargeResourceRecord failed"); return -1; }
+            if (pass == 0) continue;
+
+            if (rr->rrtype == kDNSQType_ANY && !rr->rroriginalttl && rr->rrclass == kDNSQClass_ANY && !rr->rdlength)
+                DeleteAllRRSets = mDNStrue; // delete all rrsets for a name
+            else if (!rr->rroriginalttl && rr->rrclass == kDNSQClass_ANY && !rr->rdlength)
+                DeleteOneRRSet = mDNStrue;
+            else if (!rr->rroriginalttl && rr->rrclass == kDNSClass_NONE)
+            { DeleteOneRR = mDNStrue; rr->rrclass = kDNSClass_IN; }    // so it matches the answer it deletes
+            else if (rr->rrclass != kDNSClass_IN) continue;             // answer lists only hold IN records
+
+            for (a = d->AnswerTable[rr->namehash % LLQ_TABLESIZE]; a; a = a->next)
+            {
+                // An LLQ for type ANY is answered by every record type, just as a cache record answers a type ANY question
+                if ((!DeleteAllRRSets && a->type != rr->rrtype && a->type != kDNSQType_ANY) || !SameDomainName(&a->name, rr->name)) continue;
+
+                if (pass == 2)
+                {
+                    // CommitLLQEvents empties the Event list, so each answer list is sent at most once
+                    if (a->EventList) { SendAnswerListEvents(d, a, t.tv_sec); CommitLLQEvents(a); }
+                }
+                else if (DeleteAllRRSets) RemoveLLQAnswers(a, NULL, kDNSQType_ANY);
+                else if (DeleteOneRRSet) RemoveLLQAnswers(a, NULL, rr->rrtype);
+                else if (DeleteOneRR) RemoveLLQAnswers(a, rr, rr->rrtype);
+                else AddLLQAnswer(a, &lcr.r);
+            }
+        }
+    }
+    return 0;
+}
+
+// Take the zone changes queued by QueueLLQUpdate and send LLQ events for them.  Returns true if the answer lists
+// need a full refresh, which the caller runs once the zone has been quiet for a moment.
+mDNSlocal mDNSBool ProcessLLQUpdates(DaemonInfo *d)
+{
+    LLQUpdate *u;
+    mDNSBool refresh;
+
+    if (pthread_mutex_lock(&d->updatelock)) { LogErr("ProcessLLQUpdates", "pthread_mutex_lock"); return mDNStrue; }
+    u = d->updatehead;
+    refresh = d->updaterefresh;
+    d->updatehead = d->updatetail = NULL;
+    d->updaterefresh = mDNSfalse;
+    pthread_mutex_unlock(&d->updatelock);
+
+    while (u)
+    {
+        LLQUpdate *next = u->next;
+        if (!refresh && GenUpdateEvents(d, &u->pkt) < 0) refresh = mDNStrue;
+        free(u);
+        u = next;
+    }
+    return refresh;
+}
+
+// Send events to clients as a result of a change in the zone that we can't attribute to an update,
+// by re-querying the server for every answer list
 mDNSlocal void GenLLQEvents(DaemonInfo *d)
 {
     LLQEntry **e;
@@ -1979,31 +2456,22 @@ mDNSlocal void GenLLQEvents(DaemonInfo *d)
 
     gettimeofday(&t, NULL);
 
-    // get all answers up to date
+    // get all answers up to date, in parallel on the worker pool
     for (i = 0; i < LLQ_TABLESIZE; i++)
     {
         AnswerListElem *a = d->AnswerTable[i];
         while(a)
         {
             args = malloc(sizeof(*args));
-            if (!args) { LogErr("GenLLQEvents", "malloc"); return; }
+            if (!args) { LogErr("GenLLQEvents", "malloc"); WaitForWork(d, kWorkAnswerRefresh); return; }
             args->d = d;
             args->a = a;
-            if (pthread_create(&a->tid, NULL, UpdateAnswerList, args) < 0) { LogErr("GenLLQEvents", "pthread_create"); return; }
-            usleep(1);
+            if (QueueWork(d, kWorkAnswerRefresh, UpdateAnswerList, args)) UpdateAnswerList(args);
             a = a->next;
         }
     }
 
-    for (i = 0; i < LLQ_TABLESIZE; i++)
-    {
-        AnswerListElem *a = d->AnswerTable[i];
-        while(a)
-        {
-            if (pthread_join(a->tid, NULL)) LogErr("GenLLQEvents", "pthread_join");
-            a = a->next;
-        }
-    }
+    WaitForWork(d, kWorkAnswerRefresh);
 
     // for each established LLQ, send events
     for (i = 0; i < LLQ_TABLESIZE; i++)
@@ -2026,23 +2494,7 @@ mDNSlocal void GenLLQEvents(DaemonInfo *d)
         AnswerListElem *a = d->AnswerTable[i];
         while(a)
         {
-            if (a->EventList)
-            {
-                CacheRecord *cr = a->EventList, *tmp;
-                while (cr)
-                {
-                    tmp = cr;
-                    cr = cr->next;
-                    if ((signed)tmp->resrec.rroriginalttl < 0) free(tmp);
-                    else
-                    {
-                        tmp->next = a->KnownAnswers;
-                        a->KnownAnswers = tmp;
-                        tmp->resrec.rroriginalttl = 0;
-                    }
-                }
-                a->EventList = NULL;
-            }
+            if (a->EventList) CommitLLQEvents(a);
             a = a->next;
         }
     }
@@ -2305,6 +2757,10 @@ RecvNotify
     res = sendto( d->udpsd, &pkt->msg, pkt->len, 0, ( struct sockaddr* ) &pkt->src, sizeof( pkt->src ) );
     require_action( res == ( int ) pkt->len, exit, err = mStatus_UnknownErr; LogErr( "RecvNotify", "sendto" ) );
 
+    // The zone changed behind our back, so we can't tell which answers changed
+
+    QueueLLQUpdate( d, NULL );
+
 exit:
 
     return err;
@@ -2515,9 +2971,9 @@ exit:
 }
 
 // request handler wrappers for TCP and UDP requests
-// (read message off socket, fork thread that invokes main processing routine and handles cleanup)
+// (read message off socket, queue work for the pool that invokes main processing routine and handles cleanup)
 
-mDNSlocal void*
+mDNSlocal void
 UDPMessageHandler
 (
     void * vptr
@@ -2545,10 +3001,6 @@ exit:
     }
 
     free( context );
-
-    pthread_exit( NULL );
-
-    return NULL;
 }
 
 
@@ -2560,7 +3012,6 @@ RecvUDPMessage
 )
 {
     UDPContext      *   context = NULL;
-    pthread_t tid;
     mDNSu16 rcode;
     mDNSu16 tcode;
     DomainAuthInfo  *   key;
@@ -2612,10 +3063,8 @@ RecvUDPMessage
             return 0;
         }
 
-        err = pthread_create( &tid, NULL, UDPMessageHandler, context );
-        require_action( !err, exit, LogErr( "RecvUDPMessage", "pthread_create" ) );
-
-        pthread_detach(tid);
+        err = QueueWork( self, kWorkUDPRequest, UDPMessageHandler, context );
+        require_action( !err, exit, VLog( "RecvUDPMessage: work queue full, dropping request" ) );
     }
     else
     {
@@ -2662,7 +3111,7 @@ FreeTCPContext
 }
 
 
-mDNSlocal void*
+mDNSlocal void
 TCPMessageHandler
 (
     void * vptr
@@ -2673,9 +3122,6 @@ TCPMessageHandler
     int res;
     char buf[32];
 
-    //!!!KRS if this read blocks indefinitely, we can run out of threads
-    // read the request
-
     reply = HandleRequest( context->d, &context->pkt );
     require_action_quiet( reply, exit, LogMsg( "TCPMessageHandler: No reply for client %s", inet_ntop( AF_INET, &context->cliaddr.sin_addr, buf, 32 ) ) );
 
@@ -2692,8 +3138,6 @@ exit:
     {
         free( reply );
     }
-
-    pthread_exit(NULL);
 }
 
 
@@ -2706,7 +3150,6 @@ RecvTCPMessage
     TCPContext      *   context = ( TCPContext* ) param;
     mDNSu16 rcode;
     mDNSu16 tcode;
-    pthread_t tid;
     DomainAuthInfo  *   key;
     PktMsg          *   pkt;
     mDNSBool closed;
@@ -2745,20 +3188,18 @@ RecvTCPMessage
             }
             else
             {
-                err = pthread_create( &tid, NULL, TCPMessageHandler, context );
+                err = QueueWork( context->d, kWorkTCPRequest, TCPMessageHandler, context );
 
                 if ( err )
                 {
-                    LogErr( "RecvTCPMessage", "pthread_create" );
+                    VLog( "RecvTCPMessage: work queue full, dropping request" );
                     err = mStatus_NoError;
                     goto exit;
                 }
 
-                // Let the thread free the context
+                // Let the worker free the context
 
                 freeContext = mDNSfalse;
-
-                pthread_detach(tid);
             }
         }
         else
@@ -2832,6 +3273,63 @@ exit:
 }
 
 
+// Handle a readable listening socket, or a ping on the socket that tells us the zone has changed
+mDNSlocal int
+HandleListenSocket
+(
+    DaemonInfo      *   d,
+    int fd,
+    mDNSBool        *   EventsPending,
+    struct timeval  *   EventTS
+)
+{
+    if ( fd == d->udpsd || fd == d->llq_udpsd ) RecvUDPMessage( d, fd );
+    else if ( fd == d->tcpsd || fd == d->llq_tcpsd ) AcceptTCPConnection( d, fd, 0 );
+    else if ( fd == d->tlssd ) AcceptTCPConnection( d, fd, TCP_SOCKET_FLAGS );
+    else if ( fd == d->LLQEventListenSock )
+    {
+        // clear signalling data off socket
+        char buf[256];
+        recv(d->LLQEventListenSock, buf, 256, 0);
+        if (ProcessLLQUpdates(d) && !*EventsPending)
+        {
+            *EventsPending = mDNStrue;
+            if (gettimeofday(EventTS, NULL)) { LogErr("Run", "gettimeofday"); return -1; }
+        }
+    }
+    return 0;
+}
+
+#if POSIX_USE_EPOLL
+// Create the epoll instance and register the listening sockets with it.  On failure Run falls back to select().
+mDNSlocal void SetupEventLoop(DaemonInfo *d)
+{
+    const int fds[] = { d->tcpsd, d->udpsd, d->tlssd, d->llq_tcpsd, d->llq_udpsd, d->LLQEventListenSock };
+    unsigned int i;
+
+    d->epollfd = epoll_create1( EPOLL_CLOEXEC );
+    if ( d->epollfd < 0 ) { LogErr( "SetupEventLoop", "epoll_create1" ); return; }
+
+    for ( i = 0; i < sizeof( fds ) / sizeof( fds[0] ); i++ )
+    {
+        struct epoll_event ev;
+
+        mDNSPlatformMemZero( &ev, sizeof( ev ) );
+        ev.events = EPOLLIN;
+        ev.data.u64 = ( ( uint64_t ) fds[i] << 1 ) | EPOLL_SOCKET_TAG;
+
+        // llq_tcpsd and llq_udpsd are the same sockets as tcpsd and udpsd when they share a port
+        if ( epoll_ctl( d->epollfd, EPOLL_CTL_ADD, fds[i], &ev ) < 0 && errno != EEXIST )
+        {
+            LogErr( "SetupEventLoop", "epoll_ctl" );
+            close( d->epollfd );
+            d->epollfd = -1;
+            return;
+        }
+    }
+}
+#endif
+
 // main event loop
 // listen for incoming requests, periodically check table for expired records, respond to signals
 mDNSlocal int Run(DaemonInfo *d)
@@ -2840,6 +3338,11 @@ mDNSlocal int Run(DaemonInfo *d)
     fd_set rset;
     struct timeval timenow, timeout, EventTS, tablecheck = { 0, 0 };
     mDNSBool EventsPending = mDNSfalse;
+#if POSIX_USE_EPOLL
+    struct epoll_event events[EPOLL_MAX_EVENTS];
+
+    SetupEventLoop(d);
+#endif
 
     VLog("Listening for requests...");
 
@@ -2871,32 +3374,41 @@ mDNSlocal int Run(DaemonInfo *d)
         {
             // if no pending events, timeout when we need to check for expired records
             if (tablecheck.tv_sec && timenow.tv_sec - tablecheck.tv_sec >= 0)
-            { DeleteRecords(d, mDNSfalse); tablecheck.tv_sec = 0; }     // table check overdue
+            { DeleteRecords(d, mDNSfalse); DeleteExpiredLLQs(d); tablecheck.tv_sec = 0; }     // table check overdue
             if (!tablecheck.tv_sec) tablecheck.tv_sec = timenow.tv_sec + EXPIRATION_INTERVAL;
             timeout.tv_sec = tablecheck.tv_sec - timenow.tv_sec;
         }
 
-        FD_ZERO(&rset);
-        FD_SET( d->tcpsd, &rset );
-        FD_SET( d->udpsd, &rset );
-        FD_SET( d->tlssd, &rset );
-        FD_SET( d->llq_tcpsd, &rset );
-        FD_SET( d->llq_udpsd, &rset );
-        FD_SET( d->LLQEventListenSock, &rset );
-
-        maxFD = staticMaxFD;
-
-        for ( source = ( EventSource* ) d->eventSources.Head; source; source = source->next )
+#if POSIX_USE_EPOLL
+        if ( d->epollfd >= 0 )
         {
-            FD_SET( source->fd, &rset );
+            nfds = epoll_wait( d->epollfd, events, EPOLL_MAX_EVENTS, ( int ) ( timeout.tv_sec * 1000 + ( timeout.tv_usec + 999 ) / 1000 ) );
+        }
+        else
+#endif
+        {
+            FD_ZERO(&rset);
+            FD_SET( d->tcpsd, &rset );
+            FD_SET( d->udpsd, &rset );
+            FD_SET( d->tlssd, &rset );
+            FD_SET( d->llq_tcpsd, &rset );
+            FD_SET( d->llq_udpsd, &rset );
+            FD_SET( d->LLQEventListenSock, &rset );
 
-            if ( source->fd > maxFD )
+            maxFD = staticMaxFD;
+
+            for ( source = ( EventSource* ) d->eventSources.Head; source; source = source->next )
             {
-                maxFD = source->fd;
+                FD_SET( source->fd, &rset );
+
+                if ( source->fd > maxFD )
+                {
+                    maxFD = source->fd;
+                }
             }
-        }
 
-        nfds = select( maxFD + 1, &rset, NULL, NULL, &timeout);
+            nfds = select( maxFD + 1, &rset, NULL, NULL, &timeout);
+        }
         if (nfds < 0)
         {
             if (errno == EINTR)
@@ -2920,6 +3432,7 @@ mDNSlocal int Run(DaemonInfo *d)
                     PrintLeaseTable(d);
                     PrintLLQTable(d);
                     PrintLLQAnswers(d);
+                    PrintWorkStats(d);
                     dumptable = 0;
                 }
                 else if (hangup)
@@ -2950,37 +3463,54 @@ mDNSlocal int Run(DaemonInfo *d)
         }
         else if (nfds)
         {
-            if (FD_ISSET(d->udpsd, &rset)) RecvUDPMessage( d, d->udpsd );
-            if (FD_ISSET(d->llq_udpsd, &rset)) RecvUDPMessage( d, d->llq_udpsd );
-            if (FD_ISSET(d->tcpsd, &rset)) AcceptTCPConnection( d, d->tcpsd, 0 );
-            if (FD_ISSET(d->llq_tcpsd, &rset)) AcceptTCPConnection( d, d->llq_tcpsd, 0 );
-            if (FD_ISSET(d->tlssd, &rset)) AcceptTCPConnection( d, d->tlssd, TCP_SOCKET_FLAGS );
-            if (FD_ISSET(d->LLQEventListenSock, &rset))
+#if POSIX_USE_EPOLL
+            if ( d->epollfd >= 0 )
             {
-                // clear signalling data off socket
-                char buf[256];
-                recv(d->LLQEventListenSock, buf, 256, 0);
-                if (!EventsPending)
+                int i;
+
+                for ( i = 0; i < nfds; i++ )
                 {
-                    EventsPending = mDNStrue;
-                    if (gettimeofday(&EventTS, NULL)) { LogErr("Run", "gettimeofday"); return -1; }
+                    if ( events[i].data.u64 & EPOLL_SOCKET_TAG )
+                    {
+                        if ( HandleListenSocket( d, ( int ) ( events[i].data.u64 >> 1 ), &EventsPending, &EventTS ) < 0 ) return -1;
+                    }
+                    else
+                    {
+                        // A callback earlier in this pass may have removed this source from the event loop
+                        source = ( EventSource* ) events[i].data.ptr;
+                        if ( !source->markedForDeletion ) source->callback( source->context );
+                    }
                 }
             }
-
-            for ( source = ( EventSource* ) d->eventSources.Head; source; source = source->next )
+            else
+#endif
             {
-                if ( FD_ISSET( source->fd, &rset ) )
+                const int fds[] = { d->udpsd, d->llq_udpsd, d->tcpsd, d->llq_tcpsd, d->tlssd, d->LLQEventListenSock };
+                unsigned int i;
+
+                for ( i = 0; i < sizeof( fds ) / sizeof( fds[0] ); i++ )
                 {
-                    source->callback( source->context );
-                    break;  // in case we removed this guy from the event loop
+                    if ( i > 0 && fds[i] == fds[i - 1] ) continue;      // llq sockets may be the same as the dns sockets
+                    if ( FD_ISSET( fds[i], &rset ) && HandleListenSocket( d, fds[i], &EventsPending, &EventTS ) < 0 ) return -1;
+                }
+
+                for ( source = ( EventSource* ) d->eventSources.Head; source; source = source->next )
+                {
+                    if ( FD_ISSET( source->fd, &rset ) )
+                    {
+                        source->callback( source->context );
+                        break;  // in case we removed this guy from the event loop
+                    }
                 }
             }
+
+            FreeDeadSources( d );
         }
         else
         {
             // timeout
             if (EventsPending) { GenLLQEvents(d); EventsPending = mDNSfalse; }
-            else { DeleteRecords(d, mDNSfalse); tablecheck.tv_sec = 0; }
+            else { DeleteRecords(d, mDNSfalse); DeleteExpiredLLQs(d); tablecheck.tv_sec = 0; }
         }
     }
     return 0;
@@ -3028,6 +3558,7 @@ int main(int argc, char *argv[])
     d = malloc(sizeof(*d));
     if (!d) { LogErr("main", "malloc"); exit(1); }
     mDNSPlatformMemZero(d, sizeof(DaemonInfo));
+    d->epollfd = -1;
 
     // Setup the public SRV record names
 
@@ -3075,8 +3606,10 @@ int main(int argc, char *argv[])
     if (InitLeaseTable(d) < 0) { LogErr("main", "InitLeaseTable"); exit(1); }
     if (SetupSockets(d) < 0) { LogErr("main", "SetupSockets"); exit(1); }
     if (SetUpdateSRV(d) < 0) { LogErr("main", "SetUpdateSRV"); exit(1); }
+    if (StartWorkers(d) < 0) { LogErr("main", "StartWorkers"); exit(1); }
 
     Run(d);
+    StopWorkers(d);
 
     Log("dnsextd stopping");
 
@@ -25,6 +25,7 @@
 #include "GenLinkedList.h"
 #include <sys/types.h>
 #include <sys/socket.h>
+#include <sys/time.h>
 #include <netinet/in.h>
 
 
@@ -85,9 +86,15 @@ typedef struct AnswerListElem
     CacheRecord *EventList;     // New answers (adds/removes) to be sent to client
     int refcount;
     mDNSBool UseTCP;            // Use TCP if UDP would cause truncation
-    pthread_t tid;              // Allow parallel list updates
 } AnswerListElem;
 
+// accepted update, handed from a worker to the main thread so it can send LLQ events for the records it changed
+typedef struct LLQUpdate
+{
+    struct LLQUpdate *next;
+    PktMsg pkt;               // update request, in network byte order
+} LLQUpdate;
+
 // llq table entry
 typedef struct LLQEntry
 {
@@ -116,6 +123,40 @@ typedef struct EventSource
 } EventSource;
 
 
+typedef void (*WorkHandler)( void * context );
+
+// Kinds of work handed to the worker pool; statistics are kept separately for each
+typedef enum
+{
+    kWorkUDPRequest    = 0,     // query or update from a UDP client, relayed to the server
+    kWorkTCPRequest    = 1,     // query or update from a TCP or TLS client, relayed to the server
+    kWorkAnswerRefresh = 2,     // LLQ answer list re-fetched from the server after a zone change
+    kWorkTypeCount
+} WorkType;
+
+typedef struct WorkItem
+{
+    struct WorkItem *   next;
+    WorkType type;
+    WorkHandler handler;
+    void                *   context;
+    struct timeval queued;      // when the item was put on the queue
+} WorkItem;
+
+typedef struct
+{
+    unsigned long queued;       // items accepted onto the queue
+    unsigned long dropped;      // items refused because the queue was full
+    unsigned long completed;
+    int depth;                  // items waiting for a worker
+    int maxDepth;
+    int running;                // items being handled by a worker
+    unsigned long totalWait;    // microseconds spent on the queue
+    unsigned long maxWait;
+    unsigned long totalRun;     // microseconds spent in the handler
+    unsigned long maxRun;
+} WorkStats;
+
 // daemon-wide information
 typedef struct
 {
@@ -148,7 +189,27 @@ typedef struct
     int LLQEventNotifySock;          // Unix domain socket pair - update handling thread writes to EventNotifySock, which wakes
     int LLQEventListenSock;          // the main thread listening on EventListenSock, indicating that the zone has changed
 
+    // pending zone changes for LLQ events (locked via updatelock after initialization)
+    pthread_mutex_t updatelock;
+    LLQUpdate       *   updatehead;     // accepted updates not yet turned into events
+    LLQUpdate       *   updatetail;
+    mDNSBool updaterefresh;             // zone changed in a way we can't track - re-query every answer list
+
     GenLinkedList eventSources;     // linked list of EventSource's
+    EventSource     *   deadSources;    // removed from eventSources, freed once the current dispatch pass is over
+    int epollfd;                        // epoll instance watching the listening sockets and eventSources (POSIX_USE_EPOLL only)
+
+    // worker pool variables (locked via worklock after initialization)
+    pthread_t       *   workers;        // fixed pool of threads that relay requests to the server
+    int nworkers;
+    WorkItem        *   workhead;       // FIFO of work waiting for a worker
+    WorkItem        *   worktail;
+    int workdepth;                      // total items waiting, across all types
+    mDNSBool workstop;                  // set at shutdown; workers exit once the queue is empty
+    pthread_mutex_t worklock;
+    pthread_cond_t workready;           // signalled when work is queued
+    pthread_cond_t workdone;            // signalled when a worker finishes an item
+    WorkStats workstats[kWorkTypeCount];
 } DaemonInfo;
 
 
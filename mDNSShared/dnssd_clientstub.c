@@ -104,6 +104,10 @@ static void syslog( int priority, const char * message, ...)
 // in mDNSResponder's INIT may take a much longer time to return
 #define DNSSD_CLIENT_TIMEOUT 60
 
+// Initial size of the buffer DNSServiceProcessResult reads replies into. Each recv() takes as many queued replies as
+// fit, and the buffer grows if a single reply is larger than this.
+#define DNSSD_CLIENT_RXBUF_SIZE 8192
+
 #ifdef USE_NAMED_ERROR_RETURN_SOCKET
 #ifndef CTL_PATH_PREFIX
 #define CTL_PATH_PREFIX "/var/tmp/dnssd_result_socket."
@@ -163,6 +167,10 @@ struct _DNSServiceRef_t
     uint32_t max_index;                 // Largest assigned record index - 0 if no additional records registered
     uint32_t logcounter;                // Counter used to control number of syslog messages we write
     int              *moreptr;          // Set while DNSServiceProcessResult working on this particular DNSServiceRef
+    uint8_t          *rxbuf;            // Replies read from sockfd but not yet delivered (primary DNSServiceRef only)
+    size_t            rxsize;           // Allocated size of rxbuf
+    size_t            rxstart;          // Offset in rxbuf of the first byte not yet delivered
+    size_t            rxend;            // Offset in rxbuf of the end of the data read so far
     ProcessReplyFn ProcessReply;        // Function pointer to the code to handle received messages
     void             *AppCallback;      // Client callback function and context
     void             *AppContext;
@@ -269,6 +277,41 @@ static int write_all(dnssd_sock_t sd, char *buf, size_t len)
 
 enum { read_all_success = 0, read_all_fail = -1, read_all_wouldblock = -2, read_all_defunct = -3 };
 
+// Called when recv() on sd returned zero or an error: logs the failure and classifies it.
+// Returns read_all_fail, read_all_wouldblock, or read_all_defunct.
+static int read_failed(const dnssd_sock_t sd, const ssize_t num_read, const size_t len)
+{
+    int printWarn = 0;
+    int defunct = 0;
+
+    // Check whether socket has gone defunct,
+    // otherwise, an error here indicates some OS bug
+    // or that the mDNSResponder daemon crashed (which should never happen).
+#if defined(WIN32)
+    // <rdar://problem/7481776> Suppress logs for "A non-blocking socket operation
+    //                          could not be completed immediately"
+    if (WSAGetLastError() != WSAEWOULDBLOCK)
+        printWarn = 1;
+#endif
+#if !defined(__ppc__) && defined(SO_ISDEFUNCT)
+    {
+        socklen_t dlen = sizeof (defunct);
+        if (getsockopt(sd, SOL_SOCKET, SO_ISDEFUNCT, &defunct, &dlen) < 0)
+            syslog(LOG_WARNING, "dnssd_clientstub read_all: SO_ISDEFUNCT failed %d %s", dnssd_errno, dnssd_strerror(dnssd_errno));
+    }
+    if (!defunct)
+        printWarn = 1;
+#endif
+    if (printWarn)
+        syslog(LOG_WARNING, "dnssd_clientstub read_all(%d) failed %ld/%ld %d %s", sd,
+               (long)num_read, (long)len,
+               (num_read < 0) ? dnssd_errno                 : 0,
+               (num_read < 0) ? dnssd_strerror(dnssd_errno) : "");
+    else if (defunct)
+        syslog(LOG_INFO, "dnssd_clientstub read_all(%d) DEFUNCT", sd);
+    return (num_read < 0 && dnssd_errno == dnssd_EWOULDBLOCK) ? read_all_wouldblock : (defunct ? read_all_defunct : read_all_fail);
+}
+
 // Read len bytes. Return 0 on success, read_all_fail on error, or read_all_wouldblock for
 static int read_all(const dnssd_sock_t sd, uint8_t *buf, size_t len)
 {
@@ -286,40 +329,51 @@ static int read_all(const dnssd_sock_t sd, uint8_t *buf, size_t len)
             continue; 
         }
         if ((num_read == 0) || (num_read < 0) || (((size_t)num_read) > len))
+            return read_failed(sd, num_read, len);
+        buf += num_read;
+        len -= num_read;
+    }
+    return read_all_success;
+}
+
+// Read at least one more byte into sdr's receive buffer, making room for 'needed' bytes from rxstart first.
+// Like read_all(), this blocks until data arrives, and returns read_all_success or one of the read_all error codes.
+static int read_into_buffer(DNSServiceOp *const sdr, const size_t needed)
+{
+    ssize_t num_read;
+
+    if (sdr->rxstart > 0)
+    {
+        memmove(sdr->rxbuf, sdr->rxbuf + sdr->rxstart, sdr->rxend - sdr->rxstart);
+        sdr->rxend  -= sdr->rxstart;
+        sdr->rxstart = 0;
+    }
+    if (sdr->rxsize < needed || !sdr->rxbuf)
+    {
+        const size_t newsize = (needed > DNSSD_CLIENT_RXBUF_SIZE) ? needed : DNSSD_CLIENT_RXBUF_SIZE;
+        uint8_t *const newbuf = (uint8_t *)mdns_malloc(newsize);
+        if (!newbuf) return read_all_fail;
+        if (sdr->rxbuf)
         {
-            int printWarn = 0;
-            int defunct = 0;
+            memcpy(newbuf, sdr->rxbuf, sdr->rxend);
+            mdns_free(sdr->rxbuf);
+        }
+        sdr->rxbuf  = newbuf;
+        sdr->rxsize = newsize;
+    }
 
-            // Check whether socket has gone defunct,
-            // otherwise, an error here indicates some OS bug
-            // or that the mDNSResponder daemon crashed (which should never happen).
-#if defined(WIN32)
-            // <rdar://problem/7481776> Suppress logs for "A non-blocking socket operation
-            //                          could not be completed immediately"
-            if (WSAGetLastError() != WSAEWOULDBLOCK)
-                printWarn = 1;
-#endif
-#if !defined(__ppc__) && defined(SO_ISDEFUNCT)
-            {
-                socklen_t dlen = sizeof (defunct);
-                if (getsockopt(sd, SOL_SOCKET, SO_ISDEFUNCT, &defunct, &dlen) < 0)
-                    syslog(LOG_WARNING, "dnssd_clientstub read_all: SO_ISDEFUNCT failed %d %s", dnssd_errno, dnssd_strerror(dnssd_errno));
-            }
-            if (!defunct)
-                printWarn = 1;
-#endif
-            if (printWarn)
-                syslog(LOG_WARNING, "dnssd_clientstub read_all(%d) failed %ld/%ld %d %s", sd,
-                       (long)num_read, (long)len,
-                       (num_read < 0) ? dnssd_errno                 : 0,
-                       (num_read < 0) ? dnssd_strerror(dnssd_errno) : "");
-            else if (defunct)
-                syslog(LOG_INFO, "dnssd_clientstub read_all(%d) DEFUNCT", sd);
-            return (num_read < 0 && dnssd_errno == dnssd_EWOULDBLOCK) ? read_all_wouldblock : (defunct ? read_all_defunct : read_all_fail);
+    for (;;)
+    {
+        num_read = recv(sdr->sockfd, sdr->rxbuf + sdr->rxend, sdr->rxsize - sdr->rxend, 0);
+        if ((num_read < 0) && (errno == EINTR))
+        {
+            syslog(LOG_INFO, "dnssd_clientstub read_into_buffer: EINTR continue");
+            continue;
         }
-        buf += num_read;
-        len -= num_read;
+        break;
     }
+    if (num_read <= 0) return read_failed(sdr->sockfd, num_read, needed - (sdr->rxend - sdr->rxstart));
+    sdr->rxend += (size_t)num_read;
     return read_all_success;
 }
 
@@ -489,6 +543,10 @@ static void FreeDNSServiceOp(DNSServiceOp *x)
         x->max_index    = 0;
         x->logcounter   = 0;
         x->moreptr      = NULL;
+        if (x->rxbuf) mdns_free(x->rxbuf);
+        x->rxsize       = 0;
+        x->rxstart      = 0;
+        x->rxend        = 0;
         x->ProcessReply = NULL;
         x->AppCallback  = NULL;
         x->AppContext   = NULL;
@@ -571,6 +629,10 @@ static DNSServiceErrorType ConnectToServer(DNSServiceRef *ref, DNSServiceFlags f
     sdr->max_index     = 0;
     sdr->logcounter    = 0;
     sdr->moreptr       = NULL;
+    sdr->rxbuf         = NULL;
+    sdr->rxsize        = 0;
+    sdr->rxstart       = 0;
+    sdr->rxend         = 0;
     sdr->uid.u32[0]    = 0;
     sdr->uid.u32[1]    = 0;
     sdr->ProcessReply  = ProcessReply;
@@ -1097,110 +1159,132 @@ DNSServiceErrorType DNSSD_API DNSServiceProcessResult(DNSServiceRef sdRef)
         return kDNSServiceErr_BadReference;
     }
 
+    // Replies are read into sdRef's receive buffer as many at a time as the socket has queued, and every complete
+    // reply in the buffer is delivered before we return. This matters to callers who wait for the socket to become
+    // readable before calling us, since replies already in the buffer will never make it readable again.
     do
     {
         CallbackHeader cbh;
-        uint8_t *data;
+        const uint8_t *data;
+        uint8_t replybuf[1024], *reply;
+        size_t replylen;
+        int alive;
 
+        // Read until the buffer holds a complete reply. The first read blocks if nothing is buffered.
         // return NoError on EWOULDBLOCK. This will handle the case
         // where a non-blocking socket is told there is data, but it was a false positive.
         // On error, read_all will write a message to syslog for us, so don't need to duplicate that here
         // Note: If we want to properly support using non-blocking sockets in the future
-        ioresult = read_all(sdRef->sockfd, (void *)&cbh.ipc_hdr, sizeof(cbh.ipc_hdr));
-        if (ioresult == read_all_fail || ioresult == read_all_defunct)
+        for (;;)
         {
-            error = (ioresult == read_all_defunct) ? kDNSServiceErr_DefunctConnection : kDNSServiceErr_ServiceNotRunning;
-            
-            // Set the ProcessReply to NULL before callback as the sdRef can get deallocated
-            // in the callback.
-            sdRef->ProcessReply = NULL;
-#if _DNS_SD_LIBDISPATCH
-            // Call the callbacks with an error if using the dispatch API, as DNSServiceProcessResult
-            // is not called by the application and hence need to communicate the error. Cancel the
-            // source so that we don't get any more events
-            // Note: read_all fails if we could not read from the daemon which can happen if the
-            // daemon dies or the file descriptor is disconnected (defunct).
-            if (sdRef->disp_source)
+            const size_t buffered = sdRef->rxend - sdRef->rxstart;
+            size_t needed = sizeof(cbh.ipc_hdr);
+            if (buffered >= sizeof(cbh.ipc_hdr))
             {
-                dispatch_source_cancel(sdRef->disp_source);
-                MDNS_DISPOSE_DISPATCH(sdRef->disp_source);
-                CallbackWithError(sdRef, error);
+                memcpy(&cbh.ipc_hdr, sdRef->rxbuf + sdRef->rxstart, sizeof(cbh.ipc_hdr));
+                ConvertHeaderBytes(&cbh.ipc_hdr);
+                if (cbh.ipc_hdr.version != VERSION)
+                {
+                    syslog(LOG_WARNING, "dnssd_clientstub DNSServiceProcessResult daemon version %d does not match client version %d", cbh.ipc_hdr.version, VERSION);
+                    sdRef->ProcessReply = NULL;
+                    return kDNSServiceErr_Incompatible;
+                }
+                needed += cbh.ipc_hdr.datalen;
+                if (buffered >= needed) break;
             }
+
+            ioresult = read_into_buffer(sdRef, needed);
+            if (ioresult == read_all_fail || ioresult == read_all_defunct)
+            {
+                error = (ioresult == read_all_defunct) ? kDNSServiceErr_DefunctConnection : kDNSServiceErr_ServiceNotRunning;
+
+                // Set the ProcessReply to NULL before callback as the sdRef can get deallocated
+                // in the callback.
+                sdRef->ProcessReply = NULL;
+#if _DNS_SD_LIBDISPATCH
+                // Call the callbacks with an error if using the dispatch API, as DNSServiceProcessResult
+                // is not called by the application and hence need to communicate the error. Cancel the
+                // source so that we don't get any more events
+                // Note: read_all fails if we could not read from the daemon which can happen if the
+                // daemon dies or the file descriptor is disconnected (defunct).
+                if (sdRef->disp_source)
+                {
+                    dispatch_source_cancel(sdRef->disp_source);
+                    MDNS_DISPOSE_DISPATCH(sdRef->disp_source);
+                    CallbackWithError(sdRef, error);
+                }
 #endif
-            // Don't touch sdRef anymore as it might have been deallocated
-            return error;
-        }
-        else if (ioresult == read_all_wouldblock)
-        {
-            if (morebytes && sdRef->logcounter < 100)
+                // Don't touch sdRef anymore as it might have been deallocated
+                return error;
+            }
+            else if (ioresult == read_all_wouldblock)
             {
-                sdRef->logcounter++;
-                syslog(LOG_WARNING, "dnssd_clientstub DNSServiceProcessResult error: select indicated data was waiting but read_all returned EWOULDBLOCK");
+                if (morebytes && sdRef->logcounter < 100)
+                {
+                    sdRef->logcounter++;
+                    syslog(LOG_WARNING, "dnssd_clientstub DNSServiceProcessResult error: select indicated data was waiting but read_all returned EWOULDBLOCK");
+                }
+                return kDNSServiceErr_NoError;
             }
-            return kDNSServiceErr_NoError;
         }
 
-        ConvertHeaderBytes(&cbh.ipc_hdr);
-        if (cbh.ipc_hdr.version != VERSION)
-        {
-            syslog(LOG_WARNING, "dnssd_clientstub DNSServiceProcessResult daemon version %d does not match client version %d", cbh.ipc_hdr.version, VERSION);
-            sdRef->ProcessReply = NULL;
-            return kDNSServiceErr_Incompatible;
-        }
+        data = sdRef->rxbuf + sdRef->rxstart + sizeof(cbh.ipc_hdr);
+        sdRef->rxstart += sizeof(cbh.ipc_hdr) + cbh.ipc_hdr.datalen;
 
-        data = mdns_malloc(cbh.ipc_hdr.datalen);
-        if (!data) return kDNSServiceErr_NoMemory;
-        ioresult = read_all(sdRef->sockfd, data, cbh.ipc_hdr.datalen);
-        if (ioresult < read_all_success) // On error, read_all will write a message to syslog for us
+        // If nothing more is buffered, see whether the daemon has sent anything more. Where we can, top up the
+        // buffer without blocking rather than just asking, to save a recv() next time around.
+        morebytes = (sdRef->rxend > sdRef->rxstart);
+        if (!morebytes)
         {
-            error = (ioresult == read_all_defunct) ? kDNSServiceErr_DefunctConnection : kDNSServiceErr_ServiceNotRunning;
-            
-            // Set the ProcessReply to NULL before callback as the sdRef can get deallocated
-            // in the callback.
-            sdRef->ProcessReply = NULL;
-#if _DNS_SD_LIBDISPATCH
-            // Call the callbacks with an error if using the dispatch API, as DNSServiceProcessResult
-            // is not called by the application and hence need to communicate the error. Cancel the
-            // source so that we don't get any more events
-            if (sdRef->disp_source)
+#if defined(MSG_DONTWAIT)
+            if (sdRef->rxend < sdRef->rxsize)
             {
-                dispatch_source_cancel(sdRef->disp_source);
-                MDNS_DISPOSE_DISPATCH(sdRef->disp_source);
-                CallbackWithError(sdRef, error);
+                ssize_t num_read;
+                do num_read = recv(sdRef->sockfd, sdRef->rxbuf + sdRef->rxend, sdRef->rxsize - sdRef->rxend, MSG_DONTWAIT);
+                while (num_read < 0 && errno == EINTR);
+                if (num_read > 0) sdRef->rxend += (size_t)num_read;
+                // On EOF or an error, say there's more so that our next read reports it
+                morebytes = (num_read >= 0 || dnssd_errno != dnssd_EWOULDBLOCK);
             }
+            else
 #endif
-            // Don't touch sdRef anymore as it might have been deallocated
-            mdns_free(data);
-            return error;
+            morebytes = more_bytes(sdRef->sockfd);
         }
-        else
+
+        cbh.cb_flags     = get_flags     (&data, sdRef->rxbuf + sdRef->rxstart);
+        cbh.cb_interface = get_uint32    (&data, sdRef->rxbuf + sdRef->rxstart);
+        cbh.cb_err       = get_error_code(&data, sdRef->rxbuf + sdRef->rxstart);
+        if (morebytes) cbh.cb_flags |= kDNSServiceFlagsMoreComing;
+
+        // The callback may call DNSServiceProcessResult() itself, which reads into (and may move) the receive buffer,
+        // so the reply being delivered is copied out of it. The buffer itself stays with sdRef, so that a nested call
+        // delivers the replies we've already buffered before it reads any more, and replies stay in order.
+        reply = NULL;
+        replylen = 0;
+        if (data)
         {
-            const uint8_t *ptr = data;
-            cbh.cb_flags     = get_flags     (&ptr, data + cbh.ipc_hdr.datalen);
-            cbh.cb_interface = get_uint32    (&ptr, data + cbh.ipc_hdr.datalen);
-            cbh.cb_err       = get_error_code(&ptr, data + cbh.ipc_hdr.datalen);
-
-            // CAUTION: We have to handle the case where the client calls DNSServiceRefDeallocate from within the callback function.
-            // To do this we set moreptr to point to morebytes. If the client does call DNSServiceRefDeallocate(),
-            // then that routine will clear morebytes for us, and cause us to exit our loop.
-            morebytes = more_bytes(sdRef->sockfd);
-            if (morebytes)
-            {
-                cbh.cb_flags |= kDNSServiceFlagsMoreComing;
-                sdRef->moreptr = &morebytes;
-            }
-            if (ptr) sdRef->ProcessReply(sdRef, &cbh, ptr, data + cbh.ipc_hdr.datalen);
-            // Careful code here:
-            // If morebytes is non-zero, that means we set sdRef->moreptr above, and the operation was not
-            // cancelled out from under us, so now we need to clear sdRef->moreptr so we don't leave a stray
-            // dangling pointer pointing to a long-gone stack variable.
-            // If morebytes is zero, then one of two thing happened:
-            // (a) morebytes was 0 above, so we didn't set sdRef->moreptr, so we don't need to clear it
-            // (b) morebytes was 1 above, and we set sdRef->moreptr, but the operation was cancelled (with DNSServiceRefDeallocate()),
-            //     so we MUST NOT try to dereference our stale sdRef pointer.
-            if (morebytes) sdRef->moreptr = NULL;
+            replylen = (size_t)((sdRef->rxbuf + sdRef->rxstart) - data);
+            reply = (replylen <= sizeof(replybuf)) ? replybuf : (uint8_t *)mdns_malloc(replylen);
+            if (!reply) return kDNSServiceErr_NoMemory;
+            memcpy(reply, data, replylen);
+        }
+
+        // CAUTION: We have to handle the case where the client calls DNSServiceRefDeallocate from within the callback function.
+        // To do this we set moreptr to point to alive. If the client does call DNSServiceRefDeallocate(),
+        // then that routine will clear alive for us, and we must not touch sdRef again.
+        alive = 1;
+        sdRef->moreptr = &alive;
+        if (reply) sdRef->ProcessReply(sdRef, &cbh, reply, reply + replylen);
+        if (reply && reply != replybuf) mdns_free(reply);
+        if (!alive) return kDNSServiceErr_NoError;
+        sdRef->moreptr = NULL;
+
+        if (sdRef->rxstart == sdRef->rxend)
+        {
+            sdRef->rxstart = sdRef->rxend = 0;
+            // A nested DNSServiceProcessResult() may have delivered what we were about to
+            if (morebytes) morebytes = more_bytes(sdRef->sockfd);
         }
-        mdns_free(data);
     } while (morebytes);
 
     return kDNSServiceErr_NoError;
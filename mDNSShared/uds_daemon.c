@@ -24,6 +24,7 @@
 #include <sys/types.h>
 #include <sys/time.h>
 #include <sys/resource.h>
+#include <sys/uio.h>
 #endif
 
 #include <stdlib.h>
@@ -76,6 +77,14 @@
 #include "dns_sd_internal.h"
 #endif
 
+#if UDS_FRONTEND_THREADS
+#include <pthread.h>
+#include <signal.h>
+#include <stdatomic.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#endif
+
 #include "mdns_strict.h"
 
 // User IDs 0-500 are system-wide processes, not actual users in the usual sense
@@ -99,6 +108,14 @@ static char* boundPath = MDNS_UDS_SERVERPATH;
 #endif
 static dnssd_sock_t listenfd = dnssd_InvalidSocket;
 static request_state *all_requests = NULL;
+
+// Reply totals across all clients, including those that have since disconnected
+static mDNSu32 uds_reply_writes;
+static mDNSu32 uds_replies_sent;
+static unsigned long uds_reply_bytes_written;
+#if UDS_FRONTEND_THREADS
+mDNSlocal void frontend_detach(uds_frontend_conn *conn);
+#endif
 mDNSlocal void set_peer_pid(request_state *request);
 mDNSlocal void LogMcastClientInfo(request_state *req);
 mDNSlocal void GetMcastClients(request_state *req);
@@ -352,6 +369,15 @@ mDNSlocal void abort_request(request_state *req)
             LogRedact(MDNS_LOG_CATEGORY_DEFAULT, MDNS_LOG_DEBUG,
                       "[R%d] Removing FD %d", req->request_id, req->sd);
         }
+#if UDS_FRONTEND_THREADS
+        if (req->frontend)
+        {
+            frontend_detach(req->frontend);
+            req->frontend = mDNSNULL;
+            dnssd_close(req->sd);
+        }
+        else
+#endif
         udsSupportRemoveFDFromEventLoop(req->sd, req->platform_data);       // Note: This also closes file descriptor req->sd for us
         if (req->errsd != req->sd) { dnssd_close(req->errsd); req->errsd = req->sd; }
 
@@ -361,6 +387,8 @@ mDNSlocal void abort_request(request_state *req)
             req->replies = req->replies->next;
             freeL("reply_state (abort)", ptr);
         }
+        req->replies_queued = 0;
+        req->replies_queued_bytes = 0;
     }
 
     // Set req->sd to something invalid, so that udsserver_idle knows to unlink and free this structure
@@ -461,6 +489,9 @@ mDNSlocal void append_reply(request_state *req, reply_state *rep)
     while (*ptr) ptr = &(*ptr)->next;
     *ptr = rep;
     rep->next = NULL;
+    r->replies_queued++;
+    r->replies_queued_bytes += rep->totallen;
+    if (r->replies_queued_max < r->replies_queued) r->replies_queued_max = r->replies_queued;
 }
 
 // Generates a response message giving name, type, domain, plus interface index,
@@ -824,14 +855,13 @@ mDNSlocal dispatch_queue_t _get_trust_results_dispatch_queue(void)
 mDNSexport void FreeExtraRR(mDNS *const m, AuthRecord *const rr, mStatus result)
 {
     ExtraResourceRecord *extra = (ExtraResourceRecord *)rr->RecordContext;
-    (void)m;  // Unused
 
     if (result != mStatus_MemFree) { LogMsg("Error: FreeExtraRR invoked with unexpected error %d", result); return; }
 
     LogInfo("     FreeExtraRR %s", RRDisplayString(m, &rr->resrec));
 
     if (rr->resrec.rdata != &rr->rdatastorage)
-        freeL("Extra RData", rr->resrec.rdata);
+        mDNS_FreeRData(m, rr->resrec.rdata);
     freeL("ExtraResourceRecord/FreeExtraRR", extra);
 }
 
@@ -863,7 +893,7 @@ mDNSlocal void unlink_and_free_service_instance(service_instance *srv)
     }
 
     if (srv->srs.RR_TXT.resrec.rdata != &srv->srs.RR_TXT.rdatastorage)
-        freeL("TXT RData", srv->srs.RR_TXT.resrec.rdata);
+        mDNS_FreeRData(&mDNSStorage, srv->srs.RR_TXT.resrec.rdata);
 
     if (srv->subtypes)
     {
@@ -1069,7 +1099,7 @@ mDNSlocal void regrecord_callback(mDNS *const m, AuthRecord *rr, mStatus result)
             // If the record has been updated, we need to free the rdata. Every time we call mDNS_Update, it calls update_callback
             // with the old rdata (so that we can free it) and stores the new rdata in "rr->resrec.rdata". This means, we need
             // to free the latest rdata for which the update_callback was never called with.
-            if (rr->resrec.rdata != &rr->rdatastorage) freeL("RData/regrecord_callback", rr->resrec.rdata);
+            if (rr->resrec.rdata != &rr->rdatastorage) mDNS_FreeRData(m, rr->resrec.rdata);
             freeL("AuthRecord/regrecord_callback", rr);
         }
     }
@@ -1628,7 +1658,7 @@ mDNSlocal void update_callback(mDNS *const m, AuthRecord *const rr, RData *oldrd
 #endif
     }
 exit:
-    if (oldrd != &rr->rdatastorage) freeL("RData/update_callback", oldrd);
+    if (oldrd != &rr->rdatastorage) mDNS_FreeRData(m, oldrd);
 }
 
 mDNSlocal mStatus update_record(AuthRecord *ar, mDNSu16 rdlen, const mDNSu8 *const rdata, mDNSu32 ttl,
@@ -1637,21 +1667,27 @@ mDNSlocal mStatus update_record(AuthRecord *ar, mDNSu16 rdlen, const mDNSu8 *con
     ResourceRecord rr;
     mStatus result;
     const size_t rdcapacity = (rdlen > sizeof(RDataBody2)) ? rdlen : sizeof(RDataBody2);
-    RData *newrd = (RData *) callocL("RData/update_record", sizeof(*newrd) - sizeof(RDataBody) + rdcapacity);
+    RData *newrd;
+    if (rdcapacity > MaximumRDSize)
+    {
+        LogRedact(MDNS_LOG_CATEGORY_DEFAULT, MDNS_LOG_ERROR,
+            "[R%u] update_record: rdata length %u exceeds MaximumRDSize", request_id, rdlen);
+        return mStatus_BadParamErr;
+    }
+    newrd = mDNS_AllocateRData(&mDNSStorage, (mDNSu16)rdcapacity);
     if (!newrd) FatalError("ERROR: calloc");
     mDNSPlatformMemZero(&rr, (mDNSu32)sizeof(rr));
     rr.name     = ar->resrec.name;
     rr.rrtype   = ar->resrec.rrtype;
     rr.rrclass  = ar->resrec.rrclass;
     rr.rdata    = newrd;
-    rr.rdata->MaxRDLength = (mDNSu16)rdcapacity;
     rr.rdlength = rdlen;
     if (!SetRData(mDNSNULL, rdata, rdata + rdlen, &rr, rdlen))
     {
         LogRedact(MDNS_LOG_CATEGORY_DEFAULT, MDNS_LOG_ERROR,
             "[R%u] update_record: SetRData failed for " PRI_DM_NAME " (" PUB_S ")",
             request_id, DM_NAME_PARAM(rr.name), DNSTypeName(rr.rrtype));
-        freeL("RData/update_record", newrd);
+        mDNS_FreeRData(&mDNSStorage, newrd);
         return mStatus_BadParamErr;
     }
     rdlen = GetRDLength(&rr, mDNSfalse);
@@ -1663,7 +1699,7 @@ mDNSlocal mStatus update_record(AuthRecord *ar, mDNSu16 rdlen, const mDNSu8 *con
     if (external_advertise) ar->UpdateContext = (void *)external_advertise;
 
     result = mDNS_Update(&mDNSStorage, ar, ttl, rdlen, newrd, update_callback);
-    if (result) { LogMsg("update_record: Error %d for %s", (int)result, ARDisplayString(&mDNSStorage, ar)); freeL("RData/update_record", newrd); }
+    if (result) { LogMsg("update_record: Error %d for %s", (int)result, ARDisplayString(&mDNSStorage, ar)); mDNS_FreeRData(&mDNSStorage, newrd); }
     return result;
 }
 
@@ -4740,11 +4776,134 @@ mDNSlocal mStatus handle_client_request(request_state *req)
 // The lightweight operations are the ones that don't need a dedicated request_state structure allocated for them
 #define LightweightOp(X) (RecordOrientedOp(X) || (X) == cancel_request)
 
-mDNSlocal void request_callback(int fd, void *info)
+// Validate and dispatch the complete message that has been read into req, the primary request for its connection,
+// then reset req ready for the next message. Returns mDNSfalse if the connection was torn down.
+mDNSlocal mDNSBool process_msg(request_state *req)
 {
     mStatus err = 0;
-    request_state *req = info;
     mDNSs32 min_size = sizeof(DNSServiceFlags);
+
+    switch(req->hdr.op)            //          Interface       + other data
+    {
+        case connection_request:       min_size = 0;                                                                           break;
+        case connection_delegate_request: min_size = 4; /* pid */                                                              break;
+        case reg_service_request:      min_size += sizeof(mDNSu32) + 4 /* name, type, domain, host */ + 4 /* port, textlen */; break;
+        case add_record_request:       min_size +=                   4 /* type, rdlen */              + 4 /* ttl */;           break;
+        case update_record_request:    min_size +=                   2 /* rdlen */                    + 4 /* ttl */;           break;
+        case remove_record_request:                                                                                            break;
+        case browse_request:           min_size += sizeof(mDNSu32) + 2 /* type, domain */;                                     break;
+        case resolve_request:          min_size += sizeof(mDNSu32) + 3 /* type, type, domain */;                               break;
+        case query_request:            min_size += sizeof(mDNSu32) + 1 /* name */                     + 4 /* type, class*/;    break;
+        case enumeration_request:      min_size += sizeof(mDNSu32);                                                            break;
+        case reg_record_request:       min_size += sizeof(mDNSu32) + 1 /* name */ + 6 /* type, class, rdlen */ + 4 /* ttl */;  break;
+        case reconfirm_record_request: min_size += sizeof(mDNSu32) + 1 /* name */ + 6 /* type, class, rdlen */;                break;
+        case setdomain_request:        min_size +=                   1 /* domain */;                                           break;
+        case getproperty_request:      min_size = 2;                                                                           break;
+        case port_mapping_request:     min_size += sizeof(mDNSu32) + 4 /* udp/tcp */ + 4 /* int/ext port */    + 4 /* ttl */;  break;
+        case addrinfo_request:         min_size += sizeof(mDNSu32) + 4 /* v4/v6 */   + 1 /* hostname */;                       break;
+        case send_bpf:                 // Same as cancel_request below
+        case cancel_request:           min_size = 0;                                                                           break;
+        case release_request:          min_size += sizeof(mDNSu32) + 3 /* type, type, domain */;                               break;
+        default: LogMsg("request_callback: ERROR: validate_message - unsupported req type: %d PID[%d][%s]",
+                        req->hdr.op, req->process_id, req->pid_name);
+                 min_size = -1;                                                                                                break;
+    }
+
+    if ((mDNSs32)req->data_bytes < min_size)
+    {
+        LogMsg("request_callback: Invalid message %d bytes; min for %d is %d PID[%d][%s]",
+                req->data_bytes, req->hdr.op, min_size, req->process_id, req->pid_name);
+        AbortUnlinkAndFree(req);
+        return mDNSfalse;
+    }
+    if (LightweightOp(req->hdr.op) && !req->terminate)
+    {
+        LogMsg("request_callback: Reg/Add/Update/Remove %d require existing connection PID[%d][%s]",
+                req->hdr.op, req->process_id, req->pid_name);
+        AbortUnlinkAndFree(req);
+        return mDNSfalse;
+    }
+
+    // If req->terminate is already set, this means this operation is sharing an existing connection
+    if (req->terminate && !LightweightOp(req->hdr.op))
+    {
+        request_state *newreq = NewRequest();
+        newreq->primary = req;
+        newreq->sd      = req->sd;
+        newreq->errsd   = req->errsd;
+        newreq->uid     = req->uid;
+        newreq->hdr     = req->hdr;
+        newreq->msgbuf  = req->msgbuf;
+        newreq->msgptr  = req->msgptr;
+        newreq->msgend  = req->msgend;
+        newreq->request_id = GetNewRequestID();
+#if MDNSRESPONDER_SUPPORTS(APPLE, AUDIT_TOKEN)
+        newreq->audit_token = req->audit_token;
+#endif
+        // if the parent request is a delegate connection, copy the
+        // relevant bits
+        if (req->validUUID)
+        {
+            newreq->validUUID = mDNStrue;
+            mDNSPlatformMemCopy(newreq->uuid, req->uuid, UUID_SIZE);
+        }
+        else
+        {
+            if (req->process_id)
+            {
+                newreq->process_id = req->process_id;
+                mDNSPlatformStrLCopy(newreq->pid_name, req->pid_name, (mDNSu32)sizeof(newreq->pid_name));
+            }
+            else
+            {
+                set_peer_pid(newreq);
+            }
+        }
+        req = newreq;
+    }
+
+    // Check if the request wants no asynchronous replies.
+    if (req->hdr.ipc_flags & IPC_FLAGS_NOREPLY) req->no_reply = 1;
+
+    // If we're shutting down, don't allow new client requests
+    // We do allow "cancel" and "getproperty" during shutdown
+    if (mDNSStorage.ShutdownTime && req->hdr.op != cancel_request && req->hdr.op != getproperty_request)
+        err = mStatus_ServiceNotRunning;
+    else
+        err = handle_client_request(req);
+
+    // req->msgbuf may be NULL, e.g. for connection_request or remove_record_request
+    if (req->msgbuf) freeL("request_state msgbuf", req->msgbuf);
+
+    // There's no return data for a cancel request (DNSServiceRefDeallocate returns no result)
+    // For a DNSServiceGetProperty call, the handler already generated the response, so no need to do it again here
+    if (req->hdr.op != cancel_request && req->hdr.op != getproperty_request && req->hdr.op != send_bpf && req->hdr.op != getpid_request)
+    {
+        const mStatus err_netorder = (mStatus)dnssd_htonl((mDNSu32)err);
+        send_all(req->errsd, (const char *)&err_netorder, sizeof(err_netorder));
+        if (req->errsd != req->sd)
+        {
+            dnssd_close(req->errsd);
+            req->errsd = req->sd;
+            // Also need to reset the parent's errsd, if this is a subordinate operation
+            if (req->primary) req->primary->errsd = req->primary->sd;
+        }
+    }
+
+    // Reset ready to accept the next req on this pipe
+    if (req->primary) req = req->primary;
+    req->ts         = t_morecoming;
+    req->hdr_bytes  = 0;
+    req->data_bytes = 0;
+    req->msgbuf     = mDNSNULL;
+    req->msgptr     = mDNSNULL;
+    req->msgend     = 0;
+    return mDNStrue;
+}
+
+mDNSlocal void request_callback(int fd, void *info)
+{
+    request_state *req = info;
     (void)fd; // Unused
 
     for (;;)
@@ -4763,124 +4922,429 @@ mDNSlocal void request_callback(int fd, void *info)
             AbortUnlinkAndFree(req);
             return;
         }
+        if (!process_msg(req))
+            return;
+    }
+}
+
+#if UDS_FRONTEND_THREADS
+// ***************************************************************************
+// MARK: - Client I/O Worker Threads
+
+// When built with UDS_FRONTEND_THREADS set to a number of worker threads, client connections are not registered with
+// the main event loop. Each one is handed to a worker instead. The worker makes the recv()/recvmsg() calls, frames
+// the messages with read_msg() using a private request_state, and sets up the error return socket. It then pushes
+// each complete message onto a lock-free queue and pokes frontend_wakefd. The core thread takes the whole queue with
+// a single atomic exchange and runs each message through process_msg(), just as request_callback() would.
+// Everything that touches mDNSCore state, including building replies, stays on the core thread.
+// How read_msg() frames a message depends on whether an earlier one left the request with a terminate callback, and
+// only the core thread knows that. Until it does, the worker reads one message at a time and stops watching the socket
+// after each; the core thread records the outcome in conn->established and hands the socket back.
+
+#if !defined(__linux__)
+#error UDS_FRONTEND_THREADS requires epoll and eventfd
+#endif
+#if MDNS_MALLOC_DEBUGGING
+#error UDS_FRONTEND_THREADS cannot be combined with MDNS_MALLOC_DEBUGGING, whose allocation lists are not thread-safe
+#endif
+
+#define kFrontendMaxEvents      64
+#define kFrontendMaxMsgsPerRead 16      // Messages taken from one client before moving on to the next ready socket
+
+typedef struct frontend_worker frontend_worker;
+
+struct uds_frontend_conn
+{
+    uds_frontend_conn *next;            // Link on worker->dead, once detached
+    frontend_worker *worker;
+    dnssd_sock_t sd;
+    request_state *req;                 // Core thread only: the primary request for this connection
+    request_state *reader;              // Worker only: read_msg() state for the message currently being read
+    atomic_int refcount;                // One for the core, one for the worker, and one per queued message
+    atomic_bool established;            // Set by the core once req->terminate is set
+    mDNSBool detached;                  // Set under worker->lock once the core has started tearing the connection down
+};
+
+struct frontend_worker
+{
+    pthread_t thread;
+    pthread_mutex_t lock;               // Held by the worker while it reads, and by the core while it detaches
+    int epfd;
+    int wakefd;                         // eventfd that interrupts epoll_wait() for detach and shutdown
+    mDNSBool stop;
+    uds_frontend_conn *dead;            // Detached connections whose worker reference has yet to be dropped
+};
+
+typedef struct frontend_msg
+{
+    struct frontend_msg *next;
+    uds_frontend_conn *conn;
+    transfer_state ts;                  // t_complete, or t_terminated/t_error when the connection has gone away
+    ipc_msg_hdr hdr;
+    uint8_t *msgbuf;
+    size_t msgoffset;                   // How far read_msg() had already advanced msgptr
+    dnssd_sock_t errsd;
+    mDNSBool resume;                    // The worker stopped watching the socket until this message has been processed
+} frontend_msg;
+
+static frontend_worker frontend_workers[UDS_FRONTEND_THREADS];
+static int frontend_nworkers;
+static unsigned int frontend_next_worker;
+static int frontend_wakefd = -1;                // eventfd that wakes the core thread
+static _Atomic(frontend_msg *) frontend_queue;  // Pushed LIFO by the workers; reversed by the core thread
+
+// read_msg() expects a separate error return socket once the request has a terminate callback. A reader's terminate
+// is set to this once the core thread has reported that the real request has one, and is otherwise never called.
+mDNSlocal void frontend_reader_established(request_state *request)
+{
+    (void)request;
+}
+
+mDNSlocal void frontend_release(uds_frontend_conn *conn)
+{
+    if (atomic_fetch_sub(&conn->refcount, 1) != 1) return;
+    if (conn->reader->msgbuf) freeL("frontend reader msgbuf", conn->reader->msgbuf);
+    if (conn->reader->errsd != conn->reader->sd) dnssd_close(conn->reader->errsd);
+    freeL("frontend reader", conn->reader);
+    freeL("uds_frontend_conn", conn);
+}
+
+mDNSlocal void frontend_push(frontend_msg *msg)
+{
+    const uint64_t one = 1;
+    frontend_msg *head = atomic_load(&frontend_queue);
+
+    do msg->next = head;
+    while (!atomic_compare_exchange_weak(&frontend_queue, &head, msg));
 
-        switch(req->hdr.op)            //          Interface       + other data
+    // Only a push onto an empty queue needs to wake the core thread: anything pushed after that is picked up by the
+    // same exchange. This relies on frontend_queue_callback() draining the eventfd before it takes the queue.
+    if (!head && write(frontend_wakefd, &one, sizeof(one)) < 0)
+        LogMsg("frontend_push: write to wake fd failed: %s", strerror(errno));
+}
+
+// Called on a worker thread, with worker->lock held, when a client socket is readable.
+mDNSlocal void frontend_read(uds_frontend_conn *conn)
+{
+    request_state *const reader = conn->reader;
+    int count;
+
+    reader->terminate = atomic_load(&conn->established) ? frontend_reader_established : mDNSNULL;
+    for (count = 0; count < kFrontendMaxMsgsPerRead; count++)
+    {
+        frontend_msg *msg;
+        transfer_state ts;
+
+        read_msg(reader);
+        ts = reader->ts;
+        if (ts == t_morecoming) return;
+
+        msg = (frontend_msg *)callocL("frontend_msg", sizeof(*msg));
+        if (!msg) FatalError("ERROR: calloc");
+        msg->conn  = conn;
+        msg->ts    = ts;
+        msg->errsd = conn->sd;
+        if (ts == t_complete)
         {
-            case connection_request:       min_size = 0;                                                                           break;
-            case connection_delegate_request: min_size = 4; /* pid */                                                              break;
-            case reg_service_request:      min_size += sizeof(mDNSu32) + 4 /* name, type, domain, host */ + 4 /* port, textlen */; break;
-            case add_record_request:       min_size +=                   4 /* type, rdlen */              + 4 /* ttl */;           break;
-            case update_record_request:    min_size +=                   2 /* rdlen */                    + 4 /* ttl */;           break;
-            case remove_record_request:                                                                                            break;
-            case browse_request:           min_size += sizeof(mDNSu32) + 2 /* type, domain */;                                     break;
-            case resolve_request:          min_size += sizeof(mDNSu32) + 3 /* type, type, domain */;                               break;
-            case query_request:            min_size += sizeof(mDNSu32) + 1 /* name */                     + 4 /* type, class*/;    break;
-            case enumeration_request:      min_size += sizeof(mDNSu32);                                                            break;
-            case reg_record_request:       min_size += sizeof(mDNSu32) + 1 /* name */ + 6 /* type, class, rdlen */ + 4 /* ttl */;  break;
-            case reconfirm_record_request: min_size += sizeof(mDNSu32) + 1 /* name */ + 6 /* type, class, rdlen */;                break;
-            case setdomain_request:        min_size +=                   1 /* domain */;                                           break;
-            case getproperty_request:      min_size = 2;                                                                           break;
-            case port_mapping_request:     min_size += sizeof(mDNSu32) + 4 /* udp/tcp */ + 4 /* int/ext port */    + 4 /* ttl */;  break;
-            case addrinfo_request:         min_size += sizeof(mDNSu32) + 4 /* v4/v6 */   + 1 /* hostname */;                       break;
-            case send_bpf:                 // Same as cancel_request below
-            case cancel_request:           min_size = 0;                                                                           break;
-            case release_request:          min_size += sizeof(mDNSu32) + 3 /* type, type, domain */;                               break;
-            default: LogMsg("request_callback: ERROR: validate_message - unsupported req type: %d PID[%d][%s]",
-                            req->hdr.op, req->process_id, req->pid_name);
-                     min_size = -1;                                                                                                break;
-        }
-
-        if ((mDNSs32)req->data_bytes < min_size)
+            msg->hdr       = reader->hdr;
+            msg->msgbuf    = reader->msgbuf;
+            msg->msgoffset = (size_t)(reader->msgptr - reader->msgbuf);
+            msg->errsd     = reader->errsd;
+
+            reader->ts         = t_morecoming;
+            reader->hdr_bytes  = 0;
+            reader->data_bytes = 0;
+            reader->msgbuf     = mDNSNULL;
+            reader->msgptr     = mDNSNULL;
+            reader->msgend     = mDNSNULL;
+            reader->errsd      = reader->sd;
+        }
+        else
         {
-            LogMsg("request_callback: Invalid message %d bytes; min for %d is %d PID[%d][%s]",
-                    req->data_bytes, req->hdr.op, min_size, req->process_id, req->pid_name);
-            AbortUnlinkAndFree(req);
-            return;
+            // The client went away or sent something we can't parse. Stop watching the socket and leave the core
+            // thread to tear the connection down.
+            (void)epoll_ctl(conn->worker->epfd, EPOLL_CTL_DEL, conn->sd, NULL);
         }
-        if (LightweightOp(req->hdr.op) && !req->terminate)
+        atomic_fetch_add(&conn->refcount, 1);
+        if (ts == t_complete && !reader->terminate)
         {
-            LogMsg("request_callback: Reg/Add/Update/Remove %d require existing connection PID[%d][%s]",
-                    req->hdr.op, req->process_id, req->pid_name);
-            AbortUnlinkAndFree(req);
+            // We can't frame the next message until the core has processed this one; frontend_resume() gives the
+            // socket back. It has to be removed before the push, or the core could add it back first.
+            (void)epoll_ctl(conn->worker->epfd, EPOLL_CTL_DEL, conn->sd, NULL);
+            msg->resume = mDNStrue;
+            frontend_push(msg);
             return;
         }
+        frontend_push(msg);
+        if (ts != t_complete) return;
+    }
+}
+
+mDNSlocal void *frontend_worker_main(void *context)
+{
+    frontend_worker *const worker = (frontend_worker *)context;
+    struct epoll_event events[kFrontendMaxEvents];
+    mDNSBool stop = mDNSfalse;
 
-        // If req->terminate is already set, this means this operation is sharing an existing connection
-        if (req->terminate && !LightweightOp(req->hdr.op))
+    while (!stop)
+    {
+        int i;
+        const int n = epoll_wait(worker->epfd, events, kFrontendMaxEvents, -1);
+        if (n < 0 && errno != EINTR)
         {
-            request_state *newreq = NewRequest();
-            newreq->primary = req;
-            newreq->sd      = req->sd;
-            newreq->errsd   = req->errsd;
-            newreq->uid     = req->uid;
-            newreq->hdr     = req->hdr;
-            newreq->msgbuf  = req->msgbuf;
-            newreq->msgptr  = req->msgptr;
-            newreq->msgend  = req->msgend;
-            newreq->request_id = GetNewRequestID();
-#if MDNSRESPONDER_SUPPORTS(APPLE, AUDIT_TOKEN)
-            newreq->audit_token = req->audit_token;
-#endif
-            // if the parent request is a delegate connection, copy the
-            // relevant bits
-            if (req->validUUID)
+            LogMsg("frontend_worker_main: epoll_wait failed: %s", strerror(errno));
+            break;
+        }
+
+        pthread_mutex_lock(&worker->lock);
+        for (i = 0; i < n; i++)
+        {
+            uds_frontend_conn *const conn = (uds_frontend_conn *)events[i].data.ptr;
+            if (conn == mDNSNULL)
             {
-                newreq->validUUID = mDNStrue;
-                mDNSPlatformMemCopy(newreq->uuid, req->uuid, UUID_SIZE);
+                uint64_t value;
+                (void)read(worker->wakefd, &value, sizeof(value));
             }
-            else
+            else if (!conn->detached)
             {
-                if (req->process_id)
-                {
-                    newreq->process_id = req->process_id;
-                    mDNSPlatformStrLCopy(newreq->pid_name, req->pid_name, (mDNSu32)sizeof(newreq->pid_name));
-                }
-                else
-                {
-                    set_peer_pid(newreq);
-                }
+                frontend_read(conn);
             }
-            req = newreq;
         }
+        // Every event that might refer to a detached connection has now been seen, so our references can go.
+        while (worker->dead)
+        {
+            uds_frontend_conn *const conn = worker->dead;
+            worker->dead = conn->next;
+            frontend_release(conn);
+        }
+        stop = worker->stop;
+        pthread_mutex_unlock(&worker->lock);
+    }
+    return NULL;
+}
 
-        // Check if the request wants no asynchronous replies.
-        if (req->hdr.ipc_flags & IPC_FLAGS_NOREPLY) req->no_reply = 1;
+mDNSlocal void frontend_free_msg(frontend_msg *msg)
+{
+    if (msg->msgbuf) freeL("frontend msgbuf", msg->msgbuf);
+    if (msg->errsd != msg->conn->sd) dnssd_close(msg->errsd);
+    frontend_release(msg->conn);
+    freeL("frontend_msg", msg);
+}
 
-        // If we're shutting down, don't allow new client requests
-        // We do allow "cancel" and "getproperty" during shutdown
-        if (mDNSStorage.ShutdownTime && req->hdr.op != cancel_request && req->hdr.op != getproperty_request)
-            err = mStatus_ServiceNotRunning;
-        else
-            err = handle_client_request(req);
+// Runs on the core thread once it has processed a message after which the worker stopped watching the socket.
+mDNSlocal void frontend_resume(uds_frontend_conn *conn)
+{
+    struct epoll_event ev;
+
+    atomic_store(&conn->established, conn->req->terminate != mDNSNULL);
+    mDNSPlatformMemZero(&ev, sizeof(ev));
+    ev.events   = EPOLLIN;
+    ev.data.ptr = conn;
+    if (epoll_ctl(conn->worker->epfd, EPOLL_CTL_ADD, conn->sd, &ev) < 0)
+    {
+        LogMsg("frontend_resume: epoll_ctl failed: %s", strerror(errno));
+        AbortUnlinkAndFree(conn->req);
+    }
+}
+
+// Runs on the core thread when a worker has queued messages.
+mDNSlocal void frontend_queue_callback(int fd, void *context)
+{
+    uint64_t value;
+    frontend_msg *msgs, *fifo = mDNSNULL;
+    (void)context;
+
+    (void)read(fd, &value, sizeof(value));
+    msgs = atomic_exchange(&frontend_queue, mDNSNULL);
+    while (msgs)
+    {
+        frontend_msg *const next = msgs->next;
+        msgs->next = fifo;
+        fifo = msgs;
+        msgs = next;
+    }
 
-        // req->msgbuf may be NULL, e.g. for connection_request or remove_record_request
-        if (req->msgbuf) freeL("request_state msgbuf", req->msgbuf);
+    while (fifo)
+    {
+        frontend_msg *const msg = fifo;
+        uds_frontend_conn *const conn = msg->conn;
+        fifo = msg->next;
 
-        // There's no return data for a cancel request (DNSServiceRefDeallocate returns no result)
-        // For a DNSServiceGetProperty call, the handler already generated the response, so no need to do it again here
-        if (req->hdr.op != cancel_request && req->hdr.op != getproperty_request && req->hdr.op != send_bpf && req->hdr.op != getpid_request)
+        // Only the core thread sets detached, so it can be read here without the worker's lock.
+        if (!conn->detached)
         {
-            const mStatus err_netorder = (mStatus)dnssd_htonl((mDNSu32)err);
-            send_all(req->errsd, (const char *)&err_netorder, sizeof(err_netorder));
-            if (req->errsd != req->sd)
+            request_state *const req = conn->req;
+            if (msg->ts == t_complete)
+            {
+                req->ts         = t_complete;
+                req->hdr        = msg->hdr;
+                req->hdr_bytes  = sizeof(ipc_msg_hdr);
+                req->data_bytes = msg->hdr.datalen;
+                req->msgbuf     = msg->msgbuf;
+                req->msgptr     = msg->msgbuf + msg->msgoffset;
+                req->msgend     = msg->msgbuf + msg->hdr.datalen;
+                req->errsd      = msg->errsd;
+                msg->msgbuf     = mDNSNULL;     // Now owned by process_msg()
+                msg->errsd      = conn->sd;
+                process_msg(req);
+                // process_msg() may have torn the connection down
+                if (msg->resume && !conn->detached) frontend_resume(conn);
+            }
+            else
             {
-                dnssd_close(req->errsd);
-                req->errsd = req->sd;
-                // Also need to reset the parent's errsd, if this is a subordinate operation
-                if (req->primary) req->primary->errsd = req->primary->sd;
+                AbortUnlinkAndFree(req);
             }
         }
+        frontend_free_msg(msg);
+    }
+}
+
+// Hand a newly accepted client connection to a worker. Returns mDNSfalse if the caller should read it itself.
+mDNSlocal mDNSBool frontend_attach(request_state *req)
+{
+    frontend_worker *worker;
+    uds_frontend_conn *conn;
+    request_state *reader;
+    struct epoll_event ev;
+
+    if (frontend_nworkers == 0) return mDNSfalse;
+    worker = &frontend_workers[frontend_next_worker++ % (unsigned int)frontend_nworkers];
+
+    conn   = (uds_frontend_conn *)callocL("uds_frontend_conn", sizeof(*conn));
+    reader = (request_state *)callocL("frontend reader", sizeof(*reader));
+    if (!conn || !reader) FatalError("ERROR: calloc");
+    reader->ts         = t_morecoming;
+    reader->sd         = req->sd;
+    reader->errsd      = req->sd;
+    reader->uid        = req->uid;
+    reader->request_id = req->request_id;
+    reader->process_id = req->process_id;
+    mDNSPlatformStrLCopy(reader->pid_name, req->pid_name, (mDNSu32)sizeof(reader->pid_name));
+
+    conn->worker = worker;
+    conn->sd     = req->sd;
+    conn->req    = req;
+    conn->reader = reader;
+    atomic_init(&conn->refcount, 2);
+
+    mDNSPlatformMemZero(&ev, sizeof(ev));
+    ev.events   = EPOLLIN;
+    ev.data.ptr = conn;
+    if (epoll_ctl(worker->epfd, EPOLL_CTL_ADD, req->sd, &ev) < 0)
+    {
+        LogMsg("frontend_attach: epoll_ctl failed: %s", strerror(errno));
+        freeL("frontend reader", reader);
+        freeL("uds_frontend_conn", conn);
+        return mDNSfalse;
+    }
+    req->frontend = conn;
+    return mDNStrue;
+}
+
+// Take a connection away from its worker. When this returns the worker will not touch the socket again, so the
+// caller is free to close it. Any messages still queued for the connection are discarded.
+mDNSlocal void frontend_detach(uds_frontend_conn *conn)
+{
+    frontend_worker *const worker = conn->worker;
+    const uint64_t one = 1;
+
+    pthread_mutex_lock(&worker->lock);
+    conn->detached = mDNStrue;
+    conn->req = mDNSNULL;
+    (void)epoll_ctl(worker->epfd, EPOLL_CTL_DEL, conn->sd, NULL);
+    conn->next = worker->dead;
+    worker->dead = conn;
+    pthread_mutex_unlock(&worker->lock);
+    if (write(worker->wakefd, &one, sizeof(one)) < 0)
+        LogMsg("frontend_detach: write to wake fd failed: %s", strerror(errno));
+    frontend_release(conn);
+}
+
+mDNSlocal void frontend_start(void)
+{
+    struct epoll_event ev;
+    sigset_t all, saved;
+    int i;
+
+    frontend_wakefd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if (frontend_wakefd < 0 ||
+        udsSupportAddFDToEventLoop(frontend_wakefd, frontend_queue_callback, mDNSNULL, mDNSNULL) != mStatus_NoError)
+    {
+        LogMsg("frontend_start: unable to create wake fd; client I/O stays on the main thread");
+        if (frontend_wakefd >= 0) close(frontend_wakefd);
+        frontend_wakefd = -1;
+        return;
+    }
+
+    // Signals are handled by the main event loop, so the workers must never be the ones to receive them.
+    sigfillset(&all);
+    pthread_sigmask(SIG_BLOCK, &all, &saved);
+    for (i = 0; i < UDS_FRONTEND_THREADS; i++)
+    {
+        frontend_worker *const worker = &frontend_workers[frontend_nworkers];
+        mDNSPlatformMemZero(worker, sizeof(*worker));
+        worker->epfd   = epoll_create1(EPOLL_CLOEXEC);
+        worker->wakefd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+        mDNSPlatformMemZero(&ev, sizeof(ev));
+        ev.events   = EPOLLIN;
+        ev.data.ptr = mDNSNULL;
+        if (worker->epfd < 0 || worker->wakefd < 0 || epoll_ctl(worker->epfd, EPOLL_CTL_ADD, worker->wakefd, &ev) < 0 ||
+            pthread_mutex_init(&worker->lock, NULL) != 0)
+        {
+            LogMsg("frontend_start: unable to set up worker %d: %s", i, strerror(errno));
+            if (worker->epfd >= 0) close(worker->epfd);
+            if (worker->wakefd >= 0) close(worker->wakefd);
+            break;
+        }
+        if (pthread_create(&worker->thread, NULL, frontend_worker_main, worker) != 0)
+        {
+            LogMsg("frontend_start: unable to start worker %d", i);
+            pthread_mutex_destroy(&worker->lock);
+            close(worker->epfd);
+            close(worker->wakefd);
+            break;
+        }
+        frontend_nworkers++;
+    }
+    pthread_sigmask(SIG_SETMASK, &saved, NULL);
+    LogInfo("frontend_start: %d client I/O worker threads", frontend_nworkers);
+}
+
+// Called once every client request has been aborted, so every connection has already been detached.
+mDNSlocal void frontend_stop(void)
+{
+    const uint64_t one = 1;
+    frontend_msg *msgs;
+    int i;
 
-        // Reset ready to accept the next req on this pipe
-        if (req->primary) req = req->primary;
-        req->ts         = t_morecoming;
-        req->hdr_bytes  = 0;
-        req->data_bytes = 0;
-        req->msgbuf     = mDNSNULL;
-        req->msgptr     = mDNSNULL;
-        req->msgend     = 0;
+    for (i = 0; i < frontend_nworkers; i++)
+    {
+        frontend_worker *const worker = &frontend_workers[i];
+        pthread_mutex_lock(&worker->lock);
+        worker->stop = mDNStrue;
+        pthread_mutex_unlock(&worker->lock);
+        (void)write(worker->wakefd, &one, sizeof(one));
+        pthread_join(worker->thread, NULL);
+        pthread_mutex_destroy(&worker->lock);
+        close(worker->epfd);
+        close(worker->wakefd);
+    }
+    frontend_nworkers = 0;
+
+    msgs = atomic_exchange(&frontend_queue, mDNSNULL);
+    while (msgs)
+    {
+        frontend_msg *const next = msgs->next;
+        frontend_free_msg(msgs);
+        msgs = next;
+    }
+    if (frontend_wakefd >= 0)
+    {
+        udsSupportRemoveFDFromEventLoop(frontend_wakefd, mDNSNULL);  // Note: This also closes the file descriptor
+        frontend_wakefd = -1;
     }
 }
+#endif // UDS_FRONTEND_THREADS
 
 mDNSlocal void connect_callback(int fd, void *info)
 {
@@ -4929,6 +5393,9 @@ mDNSlocal void connect_callback(int fd, void *info)
         request->request_id = GetNewRequestID();
         set_peer_pid(request);
         LogRedact(MDNS_LOG_CATEGORY_DEFAULT, MDNS_LOG_DEBUG, "%3d: connect_callback: Adding FD for uid %u", request->sd, request->uid);
+#if UDS_FRONTEND_THREADS
+        if (frontend_attach(request)) return;
+#endif
         udsSupportAddFDToEventLoop(sd, request_callback, request, &request->platform_data);
     }
 }
@@ -5129,6 +5596,9 @@ mDNSexport int udsserver_init(dnssd_sock_t skts[], const size_t count)
     AddAutoBrowseDomain(0, &localdomain);
 
     udsserver_handle_configchange(&mDNSStorage);
+#if UDS_FRONTEND_THREADS
+    frontend_start();
+#endif
     return 0;
 
 error:
@@ -5141,6 +5611,9 @@ mDNSexport int udsserver_exit(void)
 {
     // Cancel all outstanding client requests
     while (all_requests) AbortUnlinkAndFree(all_requests);
+#if UDS_FRONTEND_THREADS
+    frontend_stop();
+#endif
 
     // Clean up any special mDNSInterface_LocalOnly records we created, both the entries for "local" we
     // created in udsserver_init, and others we created as a result of reading local configuration data
@@ -5642,6 +6115,9 @@ mDNSlocal void PrintCachedRecordsToFD(int fd, const CacheRecord *cr, mDNSu32 slo
 
 mDNSexport void LogMDNSStatisticsToFD(int fd, mDNS *const m)
 {
+    const request_state *req;
+    int i;
+
     LogToFD(fd, "--- MDNS Statistics ---");
 
     LogToFD(fd, "Name Conflicts                 %u", m->mDNSStats.NameConflicts);
@@ -5672,6 +6148,40 @@ mDNSexport void LogMDNSStatisticsToFD(int fd, mDNS *const m)
     LogToFD(fd, "Cache refresh queries          %u", m->mDNSStats.CacheRefreshQueries);
     LogToFD(fd, "Cache refreshed                %u", m->mDNSStats.CacheRefreshed);
     LogToFD(fd, "Wakeup on Resolves             %u", m->mDNSStats.WakeOnResolves);
+    LogToFD(fd, "Cache evictions                %u", m->mDNSStats.CacheEvictions);
+    LogToFD(fd, "Cache eviction failures        %u", m->mDNSStats.CacheEvictionFailures);
+    LogToFD(fd, "--------------------------------");
+
+    LogToFD(fd, "Query sockets open             %u", m->QuerySocketCount);
+    LogToFD(fd, "Query sockets high water       %u", m->mDNSStats.QuerySocketsHighWater);
+    LogToFD(fd, "Query sockets opened           %u", m->mDNSStats.QuerySocketsOpened);
+    LogToFD(fd, "Query sockets closed           %u", m->mDNSStats.QuerySocketsClosed);
+    LogToFD(fd, "Query socket acquisitions      %u", m->mDNSStats.QuerySocketAcquisitions);
+    LogToFD(fd, "Query socket shared            %u", m->mDNSStats.QuerySocketsShared);
+    LogToFD(fd, "Query socket overloaded        %u", m->mDNSStats.QuerySocketsOverloaded);
+    LogToFD(fd, "Query socket unpooled          %u", m->mDNSStats.QuerySocketsUnpooled);
+    LogToFD(fd, "--------------------------------");
+
+    LogToFD(fd, "RData class: in-use slabs slabs-allocated allocations");
+    for (i = 0; i < RDataSlabClassCount; i++)
+    {
+        const RDataSlabClass *const c = &m->rdataslab[i];
+        LogToFD(fd, "  %5u  %6u %5u %15u %11u", c->MaxRDLength, c->InUse, c->Slabs, c->SlabAllocations, c->Allocations);
+    }
+    LogToFD(fd, "--------------------------------");
+
+    LogToFD(fd, "Client reply writes            %u", uds_reply_writes);
+    LogToFD(fd, "Client replies sent            %u", uds_replies_sent);
+    LogToFD(fd, "Client reply bytes written     %lu", uds_reply_bytes_written);
+    LogToFD(fd, "--------------------------------");
+
+    LogToFD(fd, "Client replies: queued (bytes) max-queued writes bytes-written");
+    for (req = all_requests; req; req = req->next)
+    {
+        if (req->primary) continue;     // Only primary requests have reply lists
+        LogToFD(fd, "[R%u] %u (%u) %u %u %lu PID[%d](%s)", req->request_id, req->replies_queued, req->replies_queued_bytes,
+                req->replies_queued_max, req->reply_writes, req->reply_bytes_written, req->process_id, req->pid_name);
+    }
 }
 
 mDNSexport void udsserver_info_dump_to_fd(int fd)
@@ -5681,6 +6191,7 @@ mDNSexport void udsserver_info_dump_to_fd(int fd)
     mDNSu32 CacheUsed = 0, CacheActive = 0, slot;
     int ProxyA = 0, ProxyD = 0;
     mDNSu32 groupCount = 0;
+    mDNSu32 slotsUsed = 0, longestChain = 0;
     mDNSu32 mcastRecordCount = 0;
     mDNSu32 ucastRecordCount = 0;
     const CacheGroup *cg;
@@ -5691,11 +6202,13 @@ mDNSexport void udsserver_info_dump_to_fd(int fd)
 
     LogToFD(fd, "------------ Cache -------------");
     LogToFD(fd, "Slt Q     TTL if     U Type rdlen");
-    for (slot = 0; slot < CACHE_HASH_SLOTS; slot++)
+    for (slot = 0; slot < m->rrcache_hashslots; slot++)
     {
+        mDNSu32 chainLength = 0;
         for (cg = m->rrcache_hash[slot]; cg; cg=cg->next)
         {
             groupCount++;   // Count one cache entity for the CacheGroup object
+            chainLength++;
             for (cr = cg->members; cr; cr=cr->next)
             {
                 const mDNSu32 remain = cr->resrec.rroriginalttl - (mDNSu32)((now - cr->TimeRcvd) / mDNSPlatformOneSecond);
@@ -5718,6 +6231,8 @@ mDNSexport void udsserver_info_dump_to_fd(int fd)
                 PrintCachedRecordsToFD(fd, cr, slot, remain, ifname, countPtr);
             }
         }
+        if (chainLength) slotsUsed++;
+        if (longestChain < chainLength) longestChain = chainLength;
     }
 
     CacheUsed = groupCount + mcastRecordCount + ucastRecordCount;
@@ -5727,6 +6242,13 @@ mDNSexport void udsserver_info_dump_to_fd(int fd)
         LogToFD(fd, "Cache use mismatch: rrcache_active is %lu, true count %lu", m->rrcache_active, CacheActive);
     LogToFD(fd, "Cache size %u entities; %u in use (%u group, %u multicast, %u unicast); %u referenced by active questions",
               m->rrcache_size, CacheUsed, groupCount, mcastRecordCount, ucastRecordCount, CacheActive);
+    if (m->rrcache_budget)
+        LogToFD(fd, "Cache budget %u entities; %u records evicted", m->rrcache_budget, m->mDNSStats.CacheEvictions);
+    LogToFD(fd, "Cache hash %u slots (%u allocated); %u slots in use; average chain %u.%02u; longest chain %u",
+              m->rrcache_hashslots, m->rrcache_hashcapacity, slotsUsed,
+              slotsUsed ? groupCount / slotsUsed : 0, slotsUsed ? (groupCount * 100 / slotsUsed) % 100 : 0, longestChain);
+    if (m->rrcache_groups != groupCount)
+        LogToFD(fd, "Cache use mismatch: rrcache_groups is %u, true count %u", m->rrcache_groups, groupCount);
 
     LogToFD(fd, "--------- Auth Records ---------");
     LogAuthRecordsToFD(fd, now, m->ResourceRecords, mDNSNULL);
@@ -6026,15 +6548,47 @@ mDNSlocal void udsserver_validatelists(void *context)
 }
 #endif // MDNS_MALLOC_DEBUGGING
 
+// Replies queued for a client are written with a single writev(), up to these limits.
+// The byte budget stops one busy client from monopolizing the event loop.
+#define kMaxRepliesPerWrite     64
+#define kMaxReplyBytesPerWrite  (64 * 1024)
+
+// Write as many of the waiting replies as the socket will take.
+// Returns t_complete if every reply was sent, t_morecoming if the client's socket buffer filled up,
+// and t_terminated or t_error if the connection failed.
 mDNSlocal transfer_state send_msg(request_state *const req)
 {
-    reply_state *const rep = req->replies;      // Send the first waiting reply
+#if defined(_WIN32)
+    struct iovec { void *iov_base; size_t iov_len; } iov[1];
+    const int maxcount = 1;
+#else
+    struct iovec iov[kMaxRepliesPerWrite];
+    const int maxcount = kMaxRepliesPerWrite;
+#endif
+    reply_state *rep;
+    mDNSu32 len = 0;
     ssize_t nwritten;
-    const mDNSu32 len = rep->totallen - rep->nwritten;
+    int count, i;
 
-    ConvertHeaderBytes(rep->mhdr);
-    nwritten = send(req->sd, (char *)&rep->mhdr + rep->nwritten, len, 0);
-    ConvertHeaderBytes(rep->mhdr);
+    for (count = 0, rep = req->replies; rep && count < maxcount; count++, rep = rep->next)
+    {
+        const mDNSu32 remaining = rep->totallen - rep->nwritten;
+        if (count > 0 && len + remaining > kMaxReplyBytesPerWrite) break;
+        if (rep->next) rep->rhdr->flags |= dnssd_htonl(kDNSServiceFlagsMoreComing);
+        ConvertHeaderBytes(rep->mhdr);
+        iov[count].iov_base = (char *)&rep->mhdr + rep->nwritten;
+        iov[count].iov_len  = remaining;
+        len += remaining;
+    }
+
+#if defined(_WIN32)
+    nwritten = send(req->sd, iov[0].iov_base, (int)iov[0].iov_len, 0);
+#else
+    nwritten = writev(req->sd, iov, count);
+#endif
+
+    for (i = 0, rep = req->replies; i < count; i++, rep = rep->next)
+        ConvertHeaderBytes(rep->mhdr);
 
     if (nwritten < 0)
     {
@@ -6047,14 +6601,38 @@ mDNSlocal transfer_state send_msg(request_state *const req)
             else
 #endif
             {
-                LogMsg("send_msg ERROR: failed to write %u of %d bytes to fd %d errno %d (%s)",
-                       len, rep->totallen, req->sd, dnssd_errno, dnssd_strerror(dnssd_errno));
+                LogMsg("send_msg ERROR: failed to write %u bytes of %d repl%s to fd %d errno %d (%s)",
+                       len, count, count == 1 ? "y" : "ies", req->sd, dnssd_errno, dnssd_strerror(dnssd_errno));
                 return(t_error);
             }
         }
     }
-    rep->nwritten += (mDNSu32)nwritten;
-    return (rep->nwritten == rep->totallen) ? t_complete : t_morecoming;
+    else
+    {
+        req->reply_writes++;
+        req->reply_bytes_written += (unsigned long)nwritten;
+        uds_reply_writes++;
+        uds_reply_bytes_written += (unsigned long)nwritten;
+    }
+
+    // Free the replies that were written in full, and note how far we got into the one after them
+    while (nwritten > 0)
+    {
+        rep = req->replies;
+        if ((mDNSu32)nwritten < rep->totallen - rep->nwritten)
+        {
+            rep->nwritten += (mDNSu32)nwritten;
+            req->replies_queued_bytes -= (mDNSu32)nwritten;
+            break;
+        }
+        nwritten -= rep->totallen - rep->nwritten;
+        req->replies = rep->next;
+        req->replies_queued--;
+        req->replies_queued_bytes -= rep->totallen - rep->nwritten;
+        uds_replies_sent++;
+        freeL("reply_state/send_msg", rep);
+    }
+    return req->replies ? t_morecoming : t_complete;
 }
 
 mDNSexport mDNSs32 udsserver_idle(mDNSs32 nextevent)
@@ -6078,18 +6656,13 @@ mDNSexport mDNSs32 udsserver_idle(mDNSs32 nextevent)
         // Note: Only primary req's have reply lists, not subordinate req's.
         while (r->replies)      // Send queued replies
         {
-            transfer_state result;
-            if (r->replies->next)
-                r->replies->rhdr->flags |= dnssd_htonl(kDNSServiceFlagsMoreComing);
-            result = send_msg(r);   // Returns t_morecoming if buffer full because client is not reading
-            if (result == t_complete)
+            const mDNSu32 queued = r->replies_queued;
+            const transfer_state result = send_msg(r);  // Returns t_morecoming if buffer full because client is not reading
+            if (result == t_complete || r->replies_queued != queued)
             {
-                reply_state *fptr = r->replies;
-                r->replies = r->replies->next;
-                freeL("reply_state/udsserver_idle", fptr);
                 r->time_blocked = 0; // reset failure counter after successful send
                 r->unresponsiveness_reports = 0;
-                continue;
+                continue;            // we may have stopped at the byte budget rather than a full socket buffer
             }
             else if (result == t_terminated)
             {
@@ -6118,13 +6691,7 @@ mDNSexport mDNSs32 udsserver_idle(mDNSs32 nextevent)
                 r->time_blocked = NonZeroTime(now);
             else if (now - r->time_blocked >= 10 * mDNSPlatformOneSecond * (r->unresponsiveness_reports+1))
             {
-                int num = 0;
-                struct reply_state *x = r->replies;
-                while (x)
-                {
-                    num++;
-                    x=x->next;
-                }
+                const int num = (int)r->replies_queued;
                 LogMsg("%3d: Could not write data to client PID[%d](%s) after %ld seconds, %d repl%s waiting",
                        r->sd, r->process_id, r->pid_name, (now - r->time_blocked) / mDNSPlatformOneSecond, num, num == 1 ? "y" : "ies");
                 if (++r->unresponsiveness_reports >= 60)
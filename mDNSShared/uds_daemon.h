@@ -40,6 +40,9 @@ typedef enum
 } transfer_state;
 
 typedef struct request_state request_state;
+#if UDS_FRONTEND_THREADS
+typedef struct uds_frontend_conn uds_frontend_conn;
+#endif
 
 typedef void (*req_termination_fn)(request_state *request);
 
@@ -111,6 +114,9 @@ struct request_state
 	mDNSu32 uid;
     mDNSu32 request_id;
 	void * platform_data;
+#if UDS_FRONTEND_THREADS
+	uds_frontend_conn *frontend;    // The client I/O worker reading this connection, if any (primary requests only)
+#endif
 #if MDNSRESPONDER_SUPPORTS(APPLE, TRUST_ENFORCEMENT)
     mdns_trust_t trust;
 #endif
@@ -130,6 +136,11 @@ struct request_state
 	mDNSs32 time_blocked;           // record time of a blocked client
 	int unresponsiveness_reports;
 	struct reply_state *replies;    // corresponding (active) reply list
+	mDNSu32 replies_queued;         // number of replies on the list above
+	mDNSu32 replies_queued_bytes;   // bytes still to be written for the replies on the list above
+	mDNSu32 replies_queued_max;     // largest value replies_queued has reached
+	mDNSu32 reply_writes;           // number of writes used to send replies to this client
+	unsigned long reply_bytes_written; // total bytes of replies written to this client
 	req_termination_fn terminate;
 	DNSServiceFlags flags;
 	mDNSu32 interfaceIndex;
@@ -14,7 +14,7 @@ mDNSexport void LogCacheRecords_ut(mDNSs32 now, mDNSu32* retCacheUsed, mDNSu32*
 
 	LogMsgNoIdent("------------ Cache -------------");
 	LogMsgNoIdent("Slt Q     TTL if     U Type rdlen");
-	for (slot = 0; slot < CACHE_HASH_SLOTS; slot++)
+	for (slot = 0; slot < mDNSStorage.rrcache_hashslots; slot++)
 	{
 		for (cg = mDNSStorage.rrcache_hash[slot]; cg; cg=cg->next)
 		{